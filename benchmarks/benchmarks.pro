@@ -0,0 +1,22 @@
+# Throughput benchmarks of the model layer, driven by the simulated
+# backend so that they run without any Bluetooth adapter.
+#
+# The results are written as plain text to the console and as XML to
+# modelbenchmark.xml, unless an explicit -o option is passed, e.g.:
+#
+#   ./modelbenchmark -o results.csv,csv
+#   ./modelbenchmark -o -,txt -o results.xml,xml -callgrind
+
+QT += testlib
+QT -= gui
+CONFIG += c++11 testcase console
+CONFIG -= app_bundle
+
+TARGET = modelbenchmark
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+include(../scanner.pri)
+
+SOURCES += \
+    modelbenchmark.cpp
@@ -0,0 +1,392 @@
+#include "simulatedblebackend.h"
+#include "devicesmodel.h"
+#include "servicesmodel.h"
+#include "characteristicsmodel.h"
+#include "gatttreemodel.h"
+
+#include <QtTest>
+
+// Frames per second of the UI, the batchers flush once per frame.
+enum { FrameRate = 60 };
+
+// Rows a typical ListView has delegates for.
+enum { ViewportRows = 12 };
+
+static int rowCount(const QAbstractItemModel &model)
+{
+    return model.rowCount();
+}
+
+// Reads every role of the rows, as the delegates bound to them do.
+static void readRows(const QAbstractItemModel &model, int first, int last)
+{
+    const auto roles = model.roleNames().keys();
+    for (auto row = first; row <= last; ++row) {
+        const auto index = model.index(row, 0);
+        for (const auto role : roles)
+            model.data(index, role);
+    }
+}
+
+// Stands for a ListView showing the first rows of the model: the rows
+// inserted into or changed within the viewport are read again.
+static void attachViewport(QAbstractItemModel *model, QObject *context)
+{
+    const auto refresh = [model](int first, int last) {
+        last = qMin(last, ViewportRows - 1);
+        if (first <= last)
+            readRows(*model, first, last);
+    };
+
+    QObject::connect(model, &QAbstractItemModel::rowsInserted, context,
+                     [refresh](const QModelIndex &, int first, int last) {
+        refresh(first, last);
+    });
+    QObject::connect(model, &QAbstractItemModel::dataChanged, context,
+                     [refresh](const QModelIndex &topLeft, const QModelIndex &bottomRight) {
+        refresh(topLeft.row(), bottomRight.row());
+    });
+}
+
+static bool waitForState(PeripheralController *controller,
+                         QLowEnergyController::ControllerState state)
+{
+    return QTest::qWaitFor([controller, state]() {
+        return controller->state() == state;
+    });
+}
+
+// Connects to the first simulated device and returns its first service,
+// owned by the controller which is parented to the context.
+static GattService *connectService(SimulatedBleBackend *backend, QObject *context)
+{
+    const auto controller = backend->createController(
+                backend->advertisement(0).address(), context);
+    controller->connectToDevice();
+    if (!waitForState(controller, QLowEnergyController::ConnectedState))
+        return nullptr;
+    controller->discoverServices();
+    if (!waitForState(controller, QLowEnergyController::DiscoveredState))
+        return nullptr;
+
+    const auto serviceUuids = controller->services();
+    if (serviceUuids.isEmpty())
+        return nullptr;
+    return controller->createServiceObject(serviceUuids.constFirst(), controller);
+}
+
+class ModelBenchmark : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void advertisementGeneration_data();
+    void advertisementGeneration();
+
+    void devicesIngest_data();
+    void devicesIngest();
+
+    void characteristicsNotifications_data();
+    void characteristicsNotifications();
+
+    void servicesLookup_data();
+    void servicesLookup();
+
+    void devicesScrolling_data();
+    void devicesScrolling();
+
+    void characteristicsScrolling_data();
+    void characteristicsScrolling();
+
+    void gattTreeScrolling_data();
+    void gattTreeScrolling();
+
+private:
+    static SimulationConfig config(int deviceCount, int servicesPerDevice,
+                                   int characteristicsPerService);
+};
+
+SimulationConfig ModelBenchmark::config(int deviceCount, int servicesPerDevice,
+                                        int characteristicsPerService)
+{
+    SimulationConfig config;
+    config.deviceCount = deviceCount;
+    config.servicesPerDevice = servicesPerDevice;
+    config.characteristicsPerService = characteristicsPerService;
+    // Everything is advanced synchronously by the benchmarks, the timers
+    // of the simulated objects must not add anything on their own.
+    config.advertisementRate = 0;
+    config.notificationRate = 0;
+    config.connectLatency = 0;
+    config.discoveryLatency = 0;
+    return config;
+}
+
+void ModelBenchmark::advertisementGeneration_data()
+{
+    devicesIngest_data();
+}
+
+// The cost of the simulated scanner alone, to be subtracted from the
+// ingestion results.
+void ModelBenchmark::advertisementGeneration()
+{
+    QFETCH(int, deviceCount);
+    QFETCH(int, advertisements);
+
+    SimulatedBleBackend backend;
+    backend.setConfig(config(deviceCount, 3, 4));
+
+    QBENCHMARK {
+        SimulatedDeviceScanner scanner(&backend);
+        scanner.advance(advertisements);
+    }
+}
+
+void ModelBenchmark::devicesIngest_data()
+{
+    QTest::addColumn<int>("deviceCount");
+    QTest::addColumn<int>("advertisements");
+
+    QTest::newRow("1k devices, 10k advertisements") << 1000 << 10000;
+    QTest::newRow("1k devices, 100k advertisements") << 1000 << 100000;
+    QTest::newRow("10k devices, 100k advertisements") << 10000 << 100000;
+}
+
+void ModelBenchmark::devicesIngest()
+{
+    QFETCH(int, deviceCount);
+    QFETCH(int, advertisements);
+
+    SimulatedBleBackend backend;
+    backend.setConfig(config(deviceCount, 3, 4));
+
+    // One frame worth of advertisements is ingested between the flushes.
+    const auto advertisementsPerFrame = qMax(advertisements / FrameRate, 1);
+
+    QBENCHMARK {
+        QObject context;
+        DevicesModel model(&backend);
+        attachViewport(&model, &context);
+        const auto scanner = model.findChild<SimulatedDeviceScanner *>();
+        QVERIFY(scanner);
+
+        for (auto ingested = 0; ingested < advertisements;
+             ingested += advertisementsPerFrame) {
+            scanner->advance(qMin(advertisementsPerFrame, advertisements - ingested));
+            model.insertionBatcher()->flush();
+        }
+        QCOMPARE(rowCount(model), qMin(deviceCount, advertisements));
+    }
+}
+
+void ModelBenchmark::characteristicsNotifications_data()
+{
+    QTest::addColumn<int>("characteristicCount");
+    QTest::addColumn<int>("rate");
+
+    QTest::newRow("16 characteristics, 1 kHz") << 16 << 1000;
+    QTest::newRow("16 characteristics, 10 kHz") << 16 << 10000;
+    QTest::newRow("256 characteristics, 1 kHz") << 256 << 1000;
+    QTest::newRow("256 characteristics, 10 kHz") << 256 << 10000;
+}
+
+// One iteration is one second of the notification stream, with the
+// refresh batcher flushed once per frame.
+void ModelBenchmark::characteristicsNotifications()
+{
+    QFETCH(int, characteristicCount);
+    QFETCH(int, rate);
+
+    SimulatedBleBackend backend;
+    backend.setConfig(config(1, 1, characteristicCount));
+
+    QObject context;
+    const auto service = qobject_cast<SimulatedGattService *>(
+                connectService(&backend, &context));
+    QVERIFY(service);
+
+    CharacteriticsModel model;
+    model.update(service);
+    QVERIFY(QTest::qWaitFor([&model, characteristicCount]() {
+        return rowCount(model) == characteristicCount;
+    }));
+
+    const auto characteristicUuids = service->characteristicUuids();
+    for (const auto &characteristicUuid : characteristicUuids) {
+        const auto properties = service->characteristic(characteristicUuid).properties;
+        if (properties & QLowEnergyCharacteristic::Notify)
+            model.enableNotification(characteristicUuid.toString(), true);
+        else if (properties & QLowEnergyCharacteristic::Indicate)
+            model.enableIndication(characteristicUuid.toString(), true);
+    }
+    // The descriptor writes go through the operation queue.
+    const auto operationQueue = model.operationQueue();
+    QVERIFY(QTest::qWaitFor([operationQueue]() {
+        return operationQueue->pendingCount() == 0 && operationQueue->inFlightCount() == 0;
+    }));
+    model.refreshBatcher()->flush();
+
+    attachViewport(&model, &context);
+    const auto notificationsPerFrame = qMax(rate / FrameRate, 1);
+
+    QBENCHMARK {
+        for (auto frame = 0; frame < FrameRate; ++frame) {
+            service->advanceNotifications(notificationsPerFrame);
+            model.refreshBatcher()->flush();
+        }
+    }
+}
+
+void ModelBenchmark::servicesLookup_data()
+{
+    QTest::addColumn<int>("serviceCount");
+
+    QTest::newRow("8 services") << 8;
+    QTest::newRow("32 services") << 32;
+    QTest::newRow("128 services") << 128;
+}
+
+// Looks up every service once by its string UUID, as the pages do,
+// plus one miss.
+void ModelBenchmark::servicesLookup()
+{
+    QFETCH(int, serviceCount);
+
+    SimulatedBleBackend backend;
+    backend.setConfig(config(1, serviceCount, 1));
+
+    ServicesModel model(&backend);
+    model.update(backend.advertisement(0).address().toString());
+    QVERIFY(QTest::qWaitFor([&model, serviceCount]() {
+        return !model.isRunning() && rowCount(model) == serviceCount;
+    }));
+
+    const QAbstractItemModel &itemModel = model;
+    const auto uuidRole = itemModel.roleNames().key("uuid");
+    QStringList serviceUuids;
+    for (auto row = 0; row < serviceCount; ++row) {
+        const auto uuid = itemModel.data(itemModel.index(row, 0), uuidRole);
+        serviceUuids.append(uuid.value<QBluetoothUuid>().toString());
+    }
+    serviceUuids.append(QBluetoothUuid(quint32(0xffffffff)).toString());
+
+    QBENCHMARK {
+        for (const auto &serviceUuid : qAsConst(serviceUuids))
+            model.service(serviceUuid);
+    }
+}
+
+void ModelBenchmark::devicesScrolling_data()
+{
+    QTest::addColumn<int>("deviceCount");
+
+    QTest::newRow("1k devices") << 1000;
+    QTest::newRow("10k devices") << 10000;
+}
+
+// Flicks from the top to the bottom of the list: every row entering the
+// viewport gets a delegate which reads all the roles.
+void ModelBenchmark::devicesScrolling()
+{
+    QFETCH(int, deviceCount);
+
+    SimulatedBleBackend backend;
+    backend.setConfig(config(deviceCount, 3, 4));
+
+    DevicesModel model(&backend);
+    const auto scanner = model.findChild<SimulatedDeviceScanner *>();
+    QVERIFY(scanner);
+    // A few advertisements per device, so that the history is populated.
+    scanner->advance(deviceCount * 4);
+    model.insertionBatcher()->flush();
+    QCOMPARE(rowCount(model), deviceCount);
+
+    QBENCHMARK {
+        readRows(model, 0, deviceCount - 1);
+    }
+}
+
+void ModelBenchmark::characteristicsScrolling_data()
+{
+    QTest::addColumn<int>("characteristicCount");
+
+    QTest::newRow("64 characteristics") << 64;
+    QTest::newRow("1k characteristics") << 1024;
+}
+
+void ModelBenchmark::characteristicsScrolling()
+{
+    QFETCH(int, characteristicCount);
+
+    SimulatedBleBackend backend;
+    backend.setConfig(config(1, 1, characteristicCount));
+
+    QObject context;
+    const auto service = connectService(&backend, &context);
+    QVERIFY(service);
+
+    CharacteriticsModel model;
+    model.update(service);
+    QVERIFY(QTest::qWaitFor([&model, characteristicCount]() {
+        return rowCount(model) == characteristicCount;
+    }));
+
+    QBENCHMARK {
+        readRows(model, 0, characteristicCount - 1);
+    }
+}
+
+void ModelBenchmark::gattTreeScrolling_data()
+{
+    characteristicsScrolling_data();
+}
+
+// The characteristics page, which shows the subtree of the service.
+void ModelBenchmark::gattTreeScrolling()
+{
+    QFETCH(int, characteristicCount);
+
+    SimulatedBleBackend backend;
+    backend.setConfig(config(1, 1, characteristicCount));
+
+    QObject context;
+    const auto service = connectService(&backend, &context);
+    QVERIFY(service);
+    service->discoverDetails();
+    QVERIFY(QTest::qWaitFor([service]() {
+        return service->state() == QLowEnergyService::ServiceDiscovered;
+    }));
+
+    GattTreeModel tree;
+    tree.addService(service);
+    const auto serviceIndex = tree.childIndex(tree.deviceIndex(service->deviceAddress().toString()),
+                                              service->serviceUuid().toString());
+    QVERIFY(serviceIndex.isValid());
+
+    GattSubtreeModel model;
+    model.setTree(&tree);
+    model.setRootIndex(serviceIndex);
+    QCOMPARE(rowCount(model), characteristicCount);
+
+    QBENCHMARK {
+        readRows(model, 0, characteristicCount - 1);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    ModelBenchmark benchmark;
+
+    // Keeps machine readable results of every run by default, so that
+    // the throughput can be compared between releases.
+    auto arguments = app.arguments();
+    if (!arguments.contains(QStringLiteral("-o"))) {
+        arguments << QStringLiteral("-o") << QStringLiteral("-,txt")
+                  << QStringLiteral("-o") << QStringLiteral("modelbenchmark.xml,xml");
+    }
+    return QTest::qExec(&benchmark, arguments);
+}
+
+#include "modelbenchmark.moc"
@@ -0,0 +1,24 @@
+#include "blebackend.h"
+#include "qtblebackend.h"
+
+#include <QCoreApplication>
+#include <QPointer>
+
+static QPointer<BleBackend> &defaultBackendInstance()
+{
+    static QPointer<BleBackend> backend;
+    return backend;
+}
+
+BleBackend *BleBackend::defaultBackend()
+{
+    auto &backend = defaultBackendInstance();
+    if (!backend)
+        backend = new QtBleBackend(QCoreApplication::instance());
+    return backend;
+}
+
+void BleBackend::setDefaultBackend(BleBackend *backend)
+{
+    defaultBackendInstance() = backend;
+}
@@ -0,0 +1,183 @@
+#ifndef BLEBACKEND_H
+#define BLEBACKEND_H
+
+#include <QBluetoothAddress>
+#include <QBluetoothDeviceInfo>
+#include <QBluetoothUuid>
+#include <QLowEnergyCharacteristic>
+#include <QLowEnergyConnectionParameters>
+#include <QLowEnergyController>
+#include <QLowEnergyService>
+#include <QObject>
+#include <QVector>
+
+// Abstraction of the Bluetooth LE stack the models are built upon, so
+// that they can run either on top of Qt Bluetooth or on top of a
+// simulator. The interfaces mirror the Qt Bluetooth classes and reuse
+// their enumerations, but describe the GATT attributes by value and by
+// UUID, as the Qt attribute classes can not be created outside of it.
+
+// The ATT MTU of a link until a larger one is exchanged.
+enum { DefaultAttMtu = 23 };
+
+// Client Characteristic Configuration descriptor values.
+enum : quint16 {
+    ClientConfigurationDisabled = 0x0000,
+    ClientConfigurationNotification = 0x0001,
+    ClientConfigurationIndication = 0x0002
+};
+
+struct GattDescriptorInfo
+{
+    QBluetoothUuid uuid;
+    QString name;
+    QByteArray value;
+};
+
+struct GattCharacteristicInfo
+{
+    bool isValid() const { return !uuid.isNull(); }
+
+    QBluetoothUuid uuid;
+    QString name;
+    QLowEnergyCharacteristic::PropertyTypes properties;
+    QByteArray value;
+    QVector<GattDescriptorInfo> descriptors;
+};
+
+class DeviceScanner : public QObject
+{
+    Q_OBJECT
+
+public:
+    using QObject::QObject;
+
+    virtual int lowEnergyDiscoveryTimeout() const = 0;
+    virtual void setLowEnergyDiscoveryTimeout(int timeout) = 0;
+
+    virtual bool isActive() const = 0;
+    virtual QString errorString() const = 0;
+
+    virtual void start() = 0;
+    virtual void stop() = 0;
+
+signals:
+    void deviceDiscovered(const QBluetoothDeviceInfo &device);
+    void deviceUpdated(const QBluetoothDeviceInfo &device,
+                       QBluetoothDeviceInfo::Fields updatedFields);
+    void finished();
+    void canceled();
+    void errorOccurred();
+};
+
+class GattService : public QObject
+{
+    Q_OBJECT
+
+public:
+    using QObject::QObject;
+
+    virtual QBluetoothAddress deviceAddress() const = 0;
+    virtual QBluetoothUuid serviceUuid() const = 0;
+    virtual QString serviceName() const = 0;
+
+    virtual QLowEnergyService::ServiceState state() const = 0;
+    virtual void discoverDetails() = 0;
+
+    virtual QVector<QBluetoothUuid> characteristicUuids() const = 0;
+    virtual GattCharacteristicInfo characteristic(
+            const QBluetoothUuid &characteristicUuid) const = 0;
+    virtual QByteArray characteristicValue(
+            const QBluetoothUuid &characteristicUuid) const = 0;
+    virtual QByteArray descriptorValue(
+            const QBluetoothUuid &characteristicUuid,
+            const QBluetoothUuid &descriptorUuid) const = 0;
+
+    virtual void readCharacteristic(const QBluetoothUuid &characteristicUuid) = 0;
+    virtual void writeCharacteristic(
+            const QBluetoothUuid &characteristicUuid, const QByteArray &value,
+            QLowEnergyService::WriteMode mode = QLowEnergyService::WriteWithResponse) = 0;
+    virtual void readDescriptor(const QBluetoothUuid &characteristicUuid,
+                                const QBluetoothUuid &descriptorUuid) = 0;
+    virtual void writeDescriptor(const QBluetoothUuid &characteristicUuid,
+                                 const QBluetoothUuid &descriptorUuid,
+                                 const QByteArray &value) = 0;
+
+    // Whether requests are held back until the service is ready on its
+    // link rather than sent; their completion cannot be expected then.
+    virtual bool isHoldingRequests() const { return false; }
+
+signals:
+    void stateChanged(QLowEnergyService::ServiceState state);
+    void errorOccurred(QLowEnergyService::ServiceError error);
+
+    void characteristicChanged(const QBluetoothUuid &characteristicUuid,
+                               const QByteArray &value);
+    void characteristicRead(const QBluetoothUuid &characteristicUuid,
+                            const QByteArray &value);
+    void characteristicWritten(const QBluetoothUuid &characteristicUuid,
+                               const QByteArray &value);
+    void descriptorRead(const QBluetoothUuid &characteristicUuid,
+                        const QBluetoothUuid &descriptorUuid,
+                        const QByteArray &value);
+    void descriptorWritten(const QBluetoothUuid &characteristicUuid,
+                           const QBluetoothUuid &descriptorUuid,
+                           const QByteArray &value);
+};
+
+class PeripheralController : public QObject
+{
+    Q_OBJECT
+
+public:
+    using QObject::QObject;
+
+    virtual QBluetoothAddress remoteAddress() const = 0;
+    virtual QLowEnergyController::ControllerState state() const = 0;
+    virtual QLowEnergyController::Error error() const = 0;
+    virtual QString errorString() const = 0;
+
+    virtual void connectToDevice() = 0;
+    virtual void disconnectFromDevice() = 0;
+
+    virtual void discoverServices() = 0;
+    virtual QVector<QBluetoothUuid> services() const = 0;
+    virtual GattService *createServiceObject(const QBluetoothUuid &serviceUuid,
+                                             QObject *parent = nullptr) = 0;
+
+    // The ATT MTU, the default one of 23 bytes until a larger one is
+    // exchanged.
+    virtual int mtu() const = 0;
+    // The parameters in effect, as reported by the last update; the
+    // interval range is a single value then.
+    virtual QLowEnergyConnectionParameters connectionParameters() const = 0;
+    // The peer, or the stack, may grant other parameters, or none.
+    virtual void requestConnectionUpdate(const QLowEnergyConnectionParameters &parameters) = 0;
+
+signals:
+    void stateChanged(QLowEnergyController::ControllerState state);
+    void errorOccurred(QLowEnergyController::Error error);
+    void serviceDiscovered(const QBluetoothUuid &serviceUuid);
+    void discoveryFinished();
+    void mtuChanged(int mtu);
+    void connectionUpdated(const QLowEnergyConnectionParameters &parameters);
+};
+
+class BleBackend : public QObject
+{
+    Q_OBJECT
+
+public:
+    using QObject::QObject;
+
+    virtual DeviceScanner *createDeviceScanner(QObject *parent = nullptr) = 0;
+    virtual PeripheralController *createController(
+            const QBluetoothAddress &remoteAddress, QObject *parent = nullptr) = 0;
+
+    // The backend used by the models created without an explicit one,
+    // e.g. the ones instantiated from QML. Defaults to Qt Bluetooth.
+    static BleBackend *defaultBackend();
+    static void setDefaultBackend(BleBackend *backend);
+};
+
+#endif // BLEBACKEND_H
@@ -0,0 +1,116 @@
+#ifndef CAPTUREFORMAT_H
+#define CAPTUREFORMAT_H
+
+#include <QtEndian>
+
+#include <cstring>
+
+// Binary notification capture file layout, all integers little endian.
+//
+// The file starts with a CaptureFileHeader, followed by the records. Each
+// record is a CaptureRecordHeader followed by payloadSize bytes. UUIDs are
+// not repeated in every record: the first use of a UUID appends an
+// UuidDefinition record carrying the 16 RFC 4122 bytes and the index
+// which the later records refer to.
+
+namespace CaptureFormat {
+
+static const char Magic[8] = { 'B', 'L', 'E', 'C', 'A', 'P', 'T', '\0' };
+enum : quint16 { Version = 1 };
+
+enum RecordType : quint8 {
+    UuidDefinition = 0,
+    CharacteristicChanged = 1,
+    CharacteristicRead = 2,
+    CharacteristicWritten = 3
+};
+
+// Index value of a record which does not refer to any UUID.
+enum : quint16 { NoUuidIndex = 0xffff };
+
+struct FileHeader
+{
+    char magic[8];
+    quint16 version;
+    quint16 headerSize;
+    quint16 recordHeaderSize;
+    quint16 reserved;
+    // Wall clock of the capture start, in microseconds since the epoch.
+    qint64 startTime;
+};
+
+struct RecordHeader
+{
+    quint8 type;
+    quint8 reserved0;
+    quint16 serviceIndex;
+    // For UuidDefinition records, the index being defined.
+    quint16 characteristicIndex;
+    quint16 reserved1;
+    quint32 payloadSize;
+    quint32 reserved2;
+    // Microseconds since the epoch.
+    qint64 timestamp;
+    // 48-bit Bluetooth address in the low bits.
+    quint64 address;
+};
+
+static_assert(sizeof(FileHeader) == 24, "Unexpected capture file header size");
+static_assert(sizeof(RecordHeader) == 32, "Unexpected capture record header size");
+
+// The structures are serialized field by field, so that the files are
+// portable regardless of the host byte order.
+
+inline void writeFileHeader(char *dest, const FileHeader &header)
+{
+    std::memcpy(dest, header.magic, sizeof(header.magic));
+    qToLittleEndian(header.version, dest + 8);
+    qToLittleEndian(header.headerSize, dest + 10);
+    qToLittleEndian(header.recordHeaderSize, dest + 12);
+    qToLittleEndian(header.reserved, dest + 14);
+    qToLittleEndian(header.startTime, dest + 16);
+}
+
+inline FileHeader readFileHeader(const char *src)
+{
+    FileHeader header;
+    std::memcpy(header.magic, src, sizeof(header.magic));
+    header.version = qFromLittleEndian<quint16>(src + 8);
+    header.headerSize = qFromLittleEndian<quint16>(src + 10);
+    header.recordHeaderSize = qFromLittleEndian<quint16>(src + 12);
+    header.reserved = qFromLittleEndian<quint16>(src + 14);
+    header.startTime = qFromLittleEndian<qint64>(src + 16);
+    return header;
+}
+
+inline void writeRecordHeader(char *dest, const RecordHeader &header)
+{
+    dest[0] = char(header.type);
+    dest[1] = char(header.reserved0);
+    qToLittleEndian(header.serviceIndex, dest + 2);
+    qToLittleEndian(header.characteristicIndex, dest + 4);
+    qToLittleEndian(header.reserved1, dest + 6);
+    qToLittleEndian(header.payloadSize, dest + 8);
+    qToLittleEndian(header.reserved2, dest + 12);
+    qToLittleEndian(header.timestamp, dest + 16);
+    qToLittleEndian(header.address, dest + 24);
+}
+
+inline RecordHeader readRecordHeader(const char *src)
+{
+    RecordHeader header;
+    header.type = quint8(src[0]);
+    header.reserved0 = quint8(src[1]);
+    header.serviceIndex = qFromLittleEndian<quint16>(src + 2);
+    header.characteristicIndex = qFromLittleEndian<quint16>(src + 4);
+    header.reserved1 = qFromLittleEndian<quint16>(src + 6);
+    header.payloadSize = qFromLittleEndian<quint32>(src + 8);
+    header.reserved2 = qFromLittleEndian<quint32>(src + 12);
+    header.timestamp = qFromLittleEndian<qint64>(src + 16);
+    header.address = qFromLittleEndian<quint64>(src + 24);
+    return header;
+}
+
+} // namespace CaptureFormat
+
+#endif // CAPTUREFORMAT_H
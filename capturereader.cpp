@@ -0,0 +1,221 @@
+#include "capturereader.h"
+
+#include <QLoggingCategory>
+#include <QTimer>
+
+#include <algorithm>
+
+Q_DECLARE_LOGGING_CATEGORY(BLE_CAPTURE)
+
+CaptureReader::CaptureReader(QObject *parent)
+    : QObject(parent)
+    , m_playbackTimer(new QTimer(this))
+{
+    m_playbackTimer->setSingleShot(true);
+    m_playbackTimer->setTimerType(Qt::PreciseTimer);
+    connect(m_playbackTimer, &QTimer::timeout, this, &CaptureReader::replayDue);
+}
+
+CaptureReader::~CaptureReader()
+{
+    close();
+}
+
+bool CaptureReader::open(const QString &fileName)
+{
+    close();
+
+    m_file.setFileName(fileName);
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        m_errorString = m_file.errorString();
+        return false;
+    }
+
+    m_size = m_file.size();
+    if (m_size < qint64(sizeof(CaptureFormat::FileHeader))) {
+        m_errorString = tr("Capture file is too short");
+        close();
+        return false;
+    }
+
+    m_data = reinterpret_cast<const char *>(m_file.map(0, m_size));
+    if (!m_data) {
+        m_errorString = m_file.errorString();
+        close();
+        return false;
+    }
+
+    const auto header = CaptureFormat::readFileHeader(m_data);
+    if (std::memcmp(header.magic, CaptureFormat::Magic, sizeof(header.magic)) != 0
+            || header.version != CaptureFormat::Version
+            || header.headerSize != sizeof(CaptureFormat::FileHeader)
+            || header.recordHeaderSize != sizeof(CaptureFormat::RecordHeader)) {
+        m_errorString = tr("Unsupported capture file format");
+        close();
+        return false;
+    }
+    m_startTime = header.startTime;
+
+    if (!indexRecords()) {
+        close();
+        return false;
+    }
+
+    qCDebug(BLE_CAPTURE) << "Open capture:" << fileName
+                         << "records:" << m_recordOffsets.count();
+    return true;
+}
+
+void CaptureReader::close()
+{
+    pause();
+    m_recordOffsets.clear();
+    m_uuids.clear();
+    m_position = 0;
+    if (m_data) {
+        m_file.unmap(reinterpret_cast<uchar *>(const_cast<char *>(m_data)));
+        m_data = nullptr;
+    }
+    m_size = 0;
+    m_file.close();
+}
+
+bool CaptureReader::isOpen() const
+{
+    return m_data != nullptr;
+}
+
+QString CaptureReader::errorString() const
+{
+    return m_errorString;
+}
+
+qint64 CaptureReader::startTime() const
+{
+    return m_startTime;
+}
+
+int CaptureReader::count() const
+{
+    return m_recordOffsets.count();
+}
+
+CaptureReader::Record CaptureReader::record(int index) const
+{
+    const auto offset = m_recordOffsets.at(index);
+    const auto header = CaptureFormat::readRecordHeader(m_data + offset);
+    const auto uuidAt = [this](quint16 uuidIndex) {
+        return uuidIndex < m_uuids.count() ? m_uuids.at(uuidIndex)
+                                           : QBluetoothUuid();
+    };
+
+    Record record;
+    record.type = CaptureFormat::RecordType(header.type);
+    record.timestamp = header.timestamp;
+    record.address = QBluetoothAddress(header.address);
+    record.serviceUuid = uuidAt(header.serviceIndex);
+    record.characteristicUuid = uuidAt(header.characteristicIndex);
+    record.payload = QByteArray::fromRawData(
+                m_data + offset + sizeof(CaptureFormat::RecordHeader),
+                int(header.payloadSize));
+    return record;
+}
+
+int CaptureReader::indexOf(qint64 timestamp) const
+{
+    // The records are appended in the time order.
+    const auto offsetIt = std::lower_bound(
+                m_recordOffsets.cbegin(), m_recordOffsets.cend(), timestamp,
+                [this](qint64 offset, qint64 timestamp) {
+        return CaptureFormat::readRecordHeader(m_data + offset).timestamp < timestamp;
+    });
+    return int(std::distance(m_recordOffsets.cbegin(), offsetIt));
+}
+
+bool CaptureReader::isPlaying() const
+{
+    return m_playbackTimer->isActive();
+}
+
+int CaptureReader::position() const
+{
+    return m_position;
+}
+
+void CaptureReader::seek(int index)
+{
+    const auto playing = isPlaying();
+    pause();
+    m_position = qBound(0, index, count());
+    if (playing)
+        play(m_speed);
+}
+
+void CaptureReader::play(qreal speed)
+{
+    if (!isOpen() || speed <= 0)
+        return;
+
+    m_speed = speed;
+    m_playbackOrigin = (m_position < count()) ? timestampAt(m_position) : 0;
+    m_playbackClock.start();
+    replayDue();
+}
+
+void CaptureReader::pause()
+{
+    m_playbackTimer->stop();
+}
+
+bool CaptureReader::indexRecords()
+{
+    // Walks the whole file once, a truncated trailing record (e.g. the
+    // application was killed while capturing) ends the index.
+    auto offset = qint64(sizeof(CaptureFormat::FileHeader));
+    while (offset + qint64(sizeof(CaptureFormat::RecordHeader)) <= m_size) {
+        const auto header = CaptureFormat::readRecordHeader(m_data + offset);
+        const auto recordSize = qint64(sizeof(CaptureFormat::RecordHeader))
+                + header.payloadSize;
+        if (offset + recordSize > m_size) {
+            qCWarning(BLE_CAPTURE) << "Ignore truncated record at:" << offset;
+            break;
+        }
+
+        if (header.type == CaptureFormat::UuidDefinition) {
+            if (header.payloadSize != 16 || header.characteristicIndex != m_uuids.count()) {
+                m_errorString = tr("Corrupted UUID definition at %1").arg(offset);
+                return false;
+            }
+            const auto rfc4122 = QByteArray::fromRawData(
+                        m_data + offset + sizeof(CaptureFormat::RecordHeader), 16);
+            m_uuids.append(QBluetoothUuid(QUuid::fromRfc4122(rfc4122)));
+        } else {
+            m_recordOffsets.append(offset);
+        }
+
+        offset += recordSize;
+    }
+    return true;
+}
+
+qint64 CaptureReader::timestampAt(int index) const
+{
+    return CaptureFormat::readRecordHeader(m_data + m_recordOffsets.at(index)).timestamp;
+}
+
+void CaptureReader::replayDue()
+{
+    const auto now = m_playbackOrigin
+            + qint64(m_playbackClock.nsecsElapsed() / 1000 * m_speed);
+
+    while (m_position < count() && timestampAt(m_position) <= now)
+        emit recordReplayed(m_position++);
+
+    if (m_position >= count()) {
+        emit finished();
+        return;
+    }
+
+    const auto delay = qreal(timestampAt(m_position) - now) / 1000 / m_speed;
+    m_playbackTimer->start(int(qMax(qreal(0), delay)));
+}
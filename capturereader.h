@@ -0,0 +1,78 @@
+#ifndef CAPTUREREADER_H
+#define CAPTUREREADER_H
+
+#include "captureformat.h"
+
+#include <QBluetoothAddress>
+#include <QBluetoothUuid>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QVector>
+
+class QTimer;
+
+// Memory maps a capture file written by CaptureWriter, indexes its
+// records once when opening and gives random access to them as well
+// as a timed playback at the original or at an accelerated speed.
+class CaptureReader : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Record
+    {
+        CaptureFormat::RecordType type = CaptureFormat::CharacteristicChanged;
+        qint64 timestamp = 0;
+        QBluetoothAddress address;
+        QBluetoothUuid serviceUuid;
+        QBluetoothUuid characteristicUuid;
+        // Refers to the mapped file, valid until the reader is closed.
+        QByteArray payload;
+    };
+
+    explicit CaptureReader(QObject *parent = nullptr);
+    ~CaptureReader() override;
+
+    bool open(const QString &fileName);
+    void close();
+
+    bool isOpen() const;
+    QString errorString() const;
+
+    qint64 startTime() const;
+    int count() const;
+    Record record(int index) const;
+    int indexOf(qint64 timestamp) const;
+
+    bool isPlaying() const;
+    int position() const;
+    void seek(int index);
+    void play(qreal speed = 1.0);
+    void pause();
+
+signals:
+    void recordReplayed(int index);
+    void finished();
+
+private:
+    bool indexRecords();
+    qint64 timestampAt(int index) const;
+    void replayDue();
+
+    QFile m_file;
+    const char *m_data = nullptr;
+    qint64 m_size = 0;
+    qint64 m_startTime = 0;
+    QString m_errorString;
+
+    QVector<qint64> m_recordOffsets;
+    QVector<QBluetoothUuid> m_uuids;
+
+    QTimer *m_playbackTimer = nullptr;
+    QElapsedTimer m_playbackClock;
+    qreal m_speed = 1.0;
+    int m_position = 0;
+    qint64 m_playbackOrigin = 0;
+};
+
+#endif // CAPTUREREADER_H
@@ -0,0 +1,180 @@
+#include "capturewriter.h"
+
+#include <QBluetoothAddress>
+#include <QDateTime>
+#include <QLoggingCategory>
+#include <QTimer>
+
+Q_DECLARE_LOGGING_CATEGORY(BLE_CAPTURE)
+
+enum {
+    BufferCapacity = 256 * 1024,
+    FlushInterval = 1000
+};
+
+CaptureWriter::CaptureWriter(QObject *parent)
+    : QObject(parent)
+    , m_flushTimer(new QTimer(this))
+{
+    m_flushTimer->setInterval(FlushInterval);
+    connect(m_flushTimer, &QTimer::timeout, this, &CaptureWriter::flush);
+}
+
+CaptureWriter::~CaptureWriter()
+{
+    close();
+}
+
+bool CaptureWriter::open(const QString &fileName)
+{
+    close();
+
+    m_file.setFileName(fileName);
+    // The writer does its own buffering.
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate
+                     | QIODevice::Unbuffered)) {
+        qCWarning(BLE_CAPTURE) << "Unable to open capture file:"
+                               << fileName << m_file.errorString();
+        return false;
+    }
+
+    qCDebug(BLE_CAPTURE) << "Start capture:" << fileName;
+
+    m_clock.start();
+    m_startTime = QDateTime::currentMSecsSinceEpoch() * 1000;
+    m_recordCount = 0;
+    m_uuidIndexes.clear();
+    m_buffer.reserve(BufferCapacity);
+
+    CaptureFormat::FileHeader header;
+    std::memcpy(header.magic, CaptureFormat::Magic, sizeof(header.magic));
+    header.version = CaptureFormat::Version;
+    header.headerSize = sizeof(CaptureFormat::FileHeader);
+    header.recordHeaderSize = sizeof(CaptureFormat::RecordHeader);
+    header.reserved = 0;
+    header.startTime = m_startTime;
+
+    m_buffer.resize(sizeof(CaptureFormat::FileHeader));
+    CaptureFormat::writeFileHeader(m_buffer.data(), header);
+
+    m_flushTimer->start();
+    return true;
+}
+
+void CaptureWriter::close()
+{
+    if (!m_file.isOpen())
+        return;
+
+    flush();
+    m_flushTimer->stop();
+    m_file.close();
+    qCDebug(BLE_CAPTURE) << "Stop capture:" << m_file.fileName()
+                         << "records:" << m_recordCount;
+}
+
+bool CaptureWriter::isOpen() const
+{
+    return m_file.isOpen();
+}
+
+QString CaptureWriter::fileName() const
+{
+    return m_file.fileName();
+}
+
+QString CaptureWriter::errorString() const
+{
+    return m_file.errorString();
+}
+
+qint64 CaptureWriter::recordCount() const
+{
+    return m_recordCount;
+}
+
+void CaptureWriter::append(CaptureFormat::RecordType type,
+                           const QBluetoothAddress &address,
+                           const QBluetoothUuid &serviceUuid,
+                           const QBluetoothUuid &characteristicUuid,
+                           const QByteArray &payload)
+{
+    if (!m_file.isOpen())
+        return;
+
+    const auto timestamp = currentTimestamp();
+
+    CaptureFormat::RecordHeader header;
+    header.type = type;
+    header.reserved0 = 0;
+    header.serviceIndex = uuidIndex(serviceUuid, timestamp);
+    header.characteristicIndex = uuidIndex(characteristicUuid, timestamp);
+    header.reserved1 = 0;
+    header.payloadSize = quint32(payload.size());
+    header.reserved2 = 0;
+    header.timestamp = timestamp;
+    header.address = address.toUInt64();
+
+    appendRecord(header, payload.constData());
+    ++m_recordCount;
+}
+
+void CaptureWriter::flush()
+{
+    if (!m_file.isOpen() || m_buffer.isEmpty())
+        return;
+
+    if (m_file.write(m_buffer) != m_buffer.size()) {
+        qCWarning(BLE_CAPTURE) << "Unable to write capture file:"
+                               << m_file.errorString();
+    }
+    m_buffer.resize(0);
+}
+
+quint16 CaptureWriter::uuidIndex(const QBluetoothUuid &uuid, qint64 timestamp)
+{
+    if (uuid.isNull())
+        return CaptureFormat::NoUuidIndex;
+
+    const auto indexIt = m_uuidIndexes.constFind(uuid);
+    if (indexIt != m_uuidIndexes.cend())
+        return indexIt.value();
+
+    const auto index = quint16(m_uuidIndexes.count());
+    if (index == CaptureFormat::NoUuidIndex) {
+        qCWarning(BLE_CAPTURE) << "UUID table is full, unable to add:" << uuid;
+        return CaptureFormat::NoUuidIndex;
+    }
+    m_uuidIndexes.insert(uuid, index);
+
+    CaptureFormat::RecordHeader header;
+    header.type = CaptureFormat::UuidDefinition;
+    header.reserved0 = 0;
+    header.serviceIndex = CaptureFormat::NoUuidIndex;
+    header.characteristicIndex = index;
+    header.reserved1 = 0;
+    header.payloadSize = 16;
+    header.reserved2 = 0;
+    header.timestamp = timestamp;
+    header.address = 0;
+
+    appendRecord(header, uuid.toRfc4122().constData());
+    return index;
+}
+
+void CaptureWriter::appendRecord(const CaptureFormat::RecordHeader &header,
+                                 const char *payload)
+{
+    const auto offset = m_buffer.size();
+    m_buffer.resize(offset + int(sizeof(CaptureFormat::RecordHeader)));
+    CaptureFormat::writeRecordHeader(m_buffer.data() + offset, header);
+    m_buffer.append(payload, int(header.payloadSize));
+
+    if (m_buffer.size() >= BufferCapacity)
+        flush();
+}
+
+qint64 CaptureWriter::currentTimestamp() const
+{
+    return m_startTime + m_clock.nsecsElapsed() / 1000;
+}
@@ -0,0 +1,56 @@
+#ifndef CAPTUREWRITER_H
+#define CAPTUREWRITER_H
+
+#include "captureformat.h"
+
+#include <QBluetoothUuid>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+
+class QBluetoothAddress;
+class QTimer;
+
+// Appends notification records to a binary capture file (see
+// captureformat.h). Records are accumulated in memory and written out
+// in large chunks, when the buffer fills up and once per second.
+class CaptureWriter : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit CaptureWriter(QObject *parent = nullptr);
+    ~CaptureWriter() override;
+
+    bool open(const QString &fileName);
+    void close();
+
+    bool isOpen() const;
+    QString fileName() const;
+    QString errorString() const;
+    qint64 recordCount() const;
+
+    void append(CaptureFormat::RecordType type,
+                const QBluetoothAddress &address,
+                const QBluetoothUuid &serviceUuid,
+                const QBluetoothUuid &characteristicUuid,
+                const QByteArray &payload);
+
+    void flush();
+
+private:
+    quint16 uuidIndex(const QBluetoothUuid &uuid, qint64 timestamp);
+    void appendRecord(const CaptureFormat::RecordHeader &header,
+                      const char *payload);
+    qint64 currentTimestamp() const;
+
+    QFile m_file;
+    QByteArray m_buffer;
+    QTimer *m_flushTimer = nullptr;
+    QHash<QBluetoothUuid, quint16> m_uuidIndexes;
+    QElapsedTimer m_clock;
+    qint64 m_startTime = 0;
+    qint64 m_recordCount = 0;
+};
+
+#endif // CAPTUREWRITER_H
@@ -1,8 +1,9 @@
 #include "characteristicsmodel.h"
 
-#include <QLowEnergyService>
-#include <QLowEnergyCharacteristic>
 #include <QLoggingCategory>
+#include <QtEndian>
+
+#include <algorithm>
 
 Q_DECLARE_LOGGING_CATEGORY(BLE_CHARACTERISTICS_MODEL)
 
@@ -19,28 +20,42 @@ enum {
     CharacteristicValueRole
 };
 
-static QString decodeProperties(QLowEnergyCharacteristic::PropertyTypes pt)
+quint16 CharacteriticsModel::decodeClientConfiguration(const QByteArray &value)
+{
+    if (value.size() < int(sizeof(quint16)))
+        return ClientConfigurationDisabled;
+    return qFromLittleEndian<quint16>(value.constData());
+}
+
+static QByteArray encodeClientConfiguration(quint16 configuration)
+{
+    QByteArray value(sizeof(quint16), Qt::Uninitialized);
+    qToLittleEndian(configuration, value.data());
+    return value;
+}
+
+QString CharacteriticsModel::decodeProperties(QLowEnergyCharacteristic::PropertyTypes pt)
 {
     QStringList properties;
     if (pt == QLowEnergyCharacteristic::Unknown) {
-        properties << CharacteriticsModel::tr("Unknown");
+        properties << tr("Unknown");
     } else {
         if (pt & QLowEnergyCharacteristic::Broadcasting)
-            properties << CharacteriticsModel::tr("Broadcasting");
+            properties << tr("Broadcasting");
         if (pt & QLowEnergyCharacteristic::Read)
-            properties << CharacteriticsModel::tr("Read");
+            properties << tr("Read");
         if (pt & QLowEnergyCharacteristic::WriteNoResponse)
-            properties << CharacteriticsModel::tr("WriteNoResponse");
+            properties << tr("WriteNoResponse");
         if (pt & QLowEnergyCharacteristic::Write)
-            properties << CharacteriticsModel::tr("Write");
+            properties << tr("Write");
         if (pt & QLowEnergyCharacteristic::Notify)
-            properties << CharacteriticsModel::tr("Notify");
+            properties << tr("Notify");
         if (pt & QLowEnergyCharacteristic::Indicate)
-            properties << CharacteriticsModel::tr("Indicate");
+            properties << tr("Indicate");
         if (pt & QLowEnergyCharacteristic::WriteSigned)
-            properties << CharacteriticsModel::tr("WriteSigned");
+            properties << tr("WriteSigned");
         if (pt & QLowEnergyCharacteristic::ExtendedProperty)
-            properties << CharacteriticsModel::tr("ExtendedProperty");
+            properties << tr("ExtendedProperty");
     }
 
     return properties.join(",");
@@ -48,7 +63,16 @@ static QString decodeProperties(QLowEnergyCharacteristic::PropertyTypes pt)
 
 CharacteriticsModel::CharacteriticsModel(QObject *parent)
     : QAbstractListModel(parent)
+    , m_refreshBatcher(new UpdateBatcher(this))
+    , m_operationQueue(new GattOperationQueue(this))
+    , m_streamWriter(new StreamWriter(m_operationQueue, this))
+    , m_captureWriter(new CaptureWriter(this))
 {
+    // The values are read from the service when the rows are refreshed,
+    // so coalescing the notifications never loses the latest value.
+    m_refreshBatcher->setFlushHandler([this]() {
+        flushDirtyRows();
+    });
 }
 
 bool CharacteriticsModel::isRunning() const
@@ -70,6 +94,26 @@ QString CharacteriticsModel::errorString() const
     return m_service ? tr("Service I/O error") : tr("No service object set");
 }
 
+UpdateBatcher *CharacteriticsModel::refreshBatcher() const
+{
+    return m_refreshBatcher;
+}
+
+GattOperationQueue *CharacteriticsModel::operationQueue() const
+{
+    return m_operationQueue;
+}
+
+StreamWriter *CharacteriticsModel::streamWriter() const
+{
+    return m_streamWriter;
+}
+
+bool CharacteriticsModel::isCapturing() const
+{
+    return m_captureWriter->isOpen();
+}
+
 void CharacteriticsModel::update(QObject *service)
 {
     if (m_running)
@@ -81,19 +125,27 @@ void CharacteriticsModel::update(QObject *service)
     qCDebug(BLE_CHARACTERISTICS_MODEL) << "Start characteristics discovery";
 
     if (m_service) {
-        disconnect(m_service);
+        m_service->disconnect(this);
     }
 
     beginResetModel();
-    m_service = qobject_cast<QLowEnergyService *>(service);
+    m_service = qobject_cast<GattService *>(service);
     m_characteristicUuids.clear();
+    m_deviceAddress = m_service ? m_service->deviceAddress()
+                                : QBluetoothAddress();
+    m_characteristicRows.clear();
+    m_refreshBatcher->cancel();
+    m_dirtyRows.clear();
+    m_snapshots.clear();
+    m_streamWriter->cancel();
+    m_operationQueue->setService(m_service);
     endResetModel();
 
     setRunning(false);
 
     if (m_service) {
-        connect(m_service, &QLowEnergyService::stateChanged,
-                [this](QLowEnergyService::ServiceState state) {
+        connect(m_service, &GattService::stateChanged,
+                this, [this](QLowEnergyService::ServiceState state) {
             switch (state) {
             case QLowEnergyService::DiscoveringServices:
                 setRunning(true);
@@ -108,71 +160,56 @@ void CharacteriticsModel::update(QObject *service)
 
         });
 
-        connect(m_service, QOverload<QLowEnergyService::ServiceError>::of(&QLowEnergyService::error),
-                [this](QLowEnergyService::ServiceError error) {
+        connect(m_service, &GattService::errorOccurred,
+                this, [this](QLowEnergyService::ServiceError error) {
             Q_UNUSED(error);
             setRunning(false);
             if (error != QLowEnergyService::DescriptorReadError)
                 emit errorOccurred();
 
             // Update whole model data.
+            for (auto &snapshot : m_snapshots)
+                snapshot.stale = true;
             const auto topLeftModelIndex = index(0, 0);
             const auto bottomRightModelIndex = index(m_characteristicUuids.count() - 1, 0);
             emit dataChanged(topLeftModelIndex, bottomRightModelIndex);
         });
 
-        connect(m_service, &QLowEnergyService::characteristicRead,
-                [this](const QLowEnergyCharacteristic &characteristic, const QByteArray &value) {
-            Q_UNUSED(value);
-            const auto characteristicUuid = characteristic.uuid();
+        connect(m_service, &GattService::characteristicRead,
+                this, [this](const QBluetoothUuid &characteristicUuid, const QByteArray &value) {
             qCDebug(BLE_CHARACTERISTICS_MODEL) << "Characteristic read completed:"
                                                << characteristicUuid
                                                << value.toHex();
-            const auto row = m_characteristicUuids.indexOf(characteristicUuid);
-            const auto modelIndex = index(row, 0);
-            emit dataChanged(modelIndex, modelIndex);
+            capture(CaptureFormat::CharacteristicRead, characteristicUuid, value);
+            markDirty(characteristicUuid);
         });
 
-        connect(m_service, &QLowEnergyService::characteristicWritten,
-                [this](const QLowEnergyCharacteristic &characteristic, const QByteArray &value) {
-            Q_UNUSED(value);
-            const auto characteristicUuid = characteristic.uuid();
+        connect(m_service, &GattService::characteristicWritten,
+                this, [this](const QBluetoothUuid &characteristicUuid, const QByteArray &value) {
             qCDebug(BLE_CHARACTERISTICS_MODEL) << "Characteristic write completed:"
                                                << characteristicUuid
                                                << value.toHex();
-            const auto row = m_characteristicUuids.indexOf(characteristicUuid);
-            const auto modelIndex = index(row, 0);
-            emit dataChanged(modelIndex, modelIndex);
+            capture(CaptureFormat::CharacteristicWritten, characteristicUuid, value);
+            markDirty(characteristicUuid);
         });
 
-        connect(m_service, &QLowEnergyService::characteristicChanged,
-                [this](const QLowEnergyCharacteristic &characteristic, const QByteArray &value) {
-            Q_UNUSED(value);
-            const auto characteristicUuid = characteristic.uuid();
+        connect(m_service, &GattService::characteristicChanged,
+                this, [this](const QBluetoothUuid &characteristicUuid, const QByteArray &value) {
             qCDebug(BLE_CHARACTERISTICS_MODEL) << "Characteristic change completed:"
                                                << characteristicUuid
                                                << value.toHex();
-            const auto row = m_characteristicUuids.indexOf(characteristicUuid);
-            const auto modelIndex = index(row, 0);
-            emit dataChanged(modelIndex, modelIndex);
+            capture(CaptureFormat::CharacteristicChanged, characteristicUuid, value);
+            markDirty(characteristicUuid);
         });
 
-        connect(m_service, &QLowEnergyService::descriptorWritten,
-                [this](const QLowEnergyDescriptor &descriptor, const QByteArray &value) {
-            Q_UNUSED(value);
+        connect(m_service, &GattService::descriptorWritten,
+                this, [this](const QBluetoothUuid &characteristicUuid,
+                             const QBluetoothUuid &descriptorUuid,
+                             const QByteArray &value) {
             qCDebug(BLE_CHARACTERISTICS_MODEL) << "Write descriptor completed:"
-                                               << descriptor.uuid()
+                                               << descriptorUuid
                                                << value.toHex();
-            for (auto characteristicUuidIt = m_characteristicUuids.cbegin();
-                 characteristicUuidIt < m_characteristicUuids.cend(); ++characteristicUuidIt) {
-                const auto &characteristic = m_service->characteristic(*characteristicUuidIt);
-                const auto &descriptors = characteristic.descriptors();
-                if (!descriptors.contains(descriptor))
-                    continue;
-                const auto row = std::distance(m_characteristicUuids.cbegin(), characteristicUuidIt);
-                const auto modelIndex = index(row, 0);
-                emit dataChanged(modelIndex, modelIndex);
-            }
+            markDirty(characteristicUuid);
         });
 
         if (m_service->state() == QLowEnergyService::ServiceDiscovered) {
@@ -180,106 +217,239 @@ void CharacteriticsModel::update(QObject *service)
             setRunning(false);
         } else if (m_service->state() == QLowEnergyService::DiscoveryRequired) {
             m_service->discoverDetails();
+        } else if (m_service->state() == QLowEnergyService::DiscoveringServices) {
+            // Already being prefetched.
+            setRunning(true);
         }
     }
 }
 
 void CharacteriticsModel::read(const QString &characteristicUuid)
 {
-    const auto &characteristic = m_service->characteristic(
-                QBluetoothUuid(characteristicUuid));
-    if (!characteristic.isValid())
+    const QBluetoothUuid uuid(characteristicUuid);
+    if (!m_service || !m_characteristicRows.contains(uuid))
         return;
 
     qCDebug(BLE_CHARACTERISTICS_MODEL) << "Start read characteristic:"
                                        << characteristicUuid;
 
-    m_service->readCharacteristic(characteristic);
+    m_operationQueue->readCharacteristic(uuid);
 }
 
 void CharacteriticsModel::write(const QString &characteristicUuid,
                                 const QByteArray &hexValue)
 {
-    const auto &characteristic = m_service->characteristic(
-                QBluetoothUuid(characteristicUuid));
-    if (!characteristic.isValid())
+    const QBluetoothUuid uuid(characteristicUuid);
+    if (!m_service || !m_characteristicRows.contains(uuid))
         return;
 
     qCDebug(BLE_CHARACTERISTICS_MODEL) << "Start write characteristic:"
                                        << characteristicUuid
                                        << hexValue;
 
-    m_service->writeCharacteristic(characteristic, QByteArray::fromHex(hexValue));
+    m_operationQueue->writeCharacteristic(uuid, QByteArray::fromHex(hexValue));
+}
+
+bool CharacteriticsModel::writeFile(const QString &characteristicUuid,
+                                    const QString &fileName)
+{
+    const QBluetoothUuid uuid(characteristicUuid);
+    if (!m_service || !m_characteristicRows.contains(uuid))
+        return false;
+
+    qCDebug(BLE_CHARACTERISTICS_MODEL) << "Start write file:" << characteristicUuid
+                                       << fileName;
+
+    return m_streamWriter->start(uuid, fileName);
 }
 
 void CharacteriticsModel::enableNotification(const QString &characteristicUuid,
                                              bool enable)
 {
-    const auto &characteristic = m_service->characteristic(
-                QBluetoothUuid(characteristicUuid));
+    writeClientConfiguration(QBluetoothUuid(characteristicUuid),
+                             enable ? ClientConfigurationNotification
+                                    : ClientConfigurationDisabled);
+}
+
+void CharacteriticsModel::enableIndication(const QString &characteristicUuid,
+                                           bool enable)
+{
+    writeClientConfiguration(QBluetoothUuid(characteristicUuid),
+                             enable ? ClientConfigurationIndication
+                                    : ClientConfigurationDisabled);
+}
+
+QObject *CharacteriticsModel::service() const
+{
+    return m_service;
+}
+
+void CharacteriticsModel::writeClientConfiguration(const QBluetoothUuid &characteristicUuid,
+                                                   quint16 configuration)
+{
+    if (!m_service)
+        return;
+
+    const auto characteristic = m_service->characteristic(characteristicUuid);
     if (!characteristic.isValid())
         return;
 
-    const auto &configDescriptor = characteristic.descriptor(
+    const QBluetoothUuid configDescriptorUuid(
                 QBluetoothUuid::ClientCharacteristicConfiguration);
-    if (!configDescriptor.isValid())
+    const auto &descriptors = characteristic.descriptors;
+    const auto hasConfigDescriptor = std::any_of(
+                descriptors.cbegin(), descriptors.cend(),
+                [configDescriptorUuid](const GattDescriptorInfo &descriptor) {
+        return descriptor.uuid == configDescriptorUuid;
+    });
+    if (!hasConfigDescriptor)
         return;
 
-    const auto value = enable ? QByteArray::fromHex("0100")
-                              : QByteArray::fromHex("0000");
+    const auto value = encodeClientConfiguration(configuration);
 
     qCDebug(BLE_CHARACTERISTICS_MODEL) << "Start write descriptor:"
-                                       << configDescriptor.uuid()
+                                       << configDescriptorUuid
                                        << value.toHex();
 
-    m_service->writeDescriptor(configDescriptor, value);
+    m_operationQueue->writeDescriptor(characteristicUuid, configDescriptorUuid, value);
 }
 
-void CharacteriticsModel::enableIndication(const QString &characteristicUuid,
-                                           bool enable)
+bool CharacteriticsModel::startCapture(const QString &fileName)
 {
-    const auto &characteristic = m_service->characteristic(
-                QBluetoothUuid(characteristicUuid));
-    if (!characteristic.isValid())
+    const auto wasCapturing = m_captureWriter->isOpen();
+    const auto opened = m_captureWriter->open(fileName);
+    if (!opened)
+        emit errorOccurred();
+    if (wasCapturing != opened)
+        emit capturingChanged(opened);
+    return opened;
+}
+
+void CharacteriticsModel::stopCapture()
+{
+    if (!m_captureWriter->isOpen())
         return;
+    m_captureWriter->close();
+    emit capturingChanged(false);
+}
 
-    const auto &configDescriptor = characteristic.descriptor(
-                QBluetoothUuid::ClientCharacteristicConfiguration);
-    if (!configDescriptor.isValid())
+void CharacteriticsModel::capture(CaptureFormat::RecordType type,
+                                  const QBluetoothUuid &characteristicUuid,
+                                  const QByteArray &value)
+{
+    if (!m_captureWriter->isOpen())
         return;
+    m_captureWriter->append(type, m_deviceAddress, m_service->serviceUuid(),
+                            characteristicUuid, value);
+}
 
-    const auto value = enable ? QByteArray::fromHex("0200")
-                              : QByteArray::fromHex("0000");
+void CharacteriticsModel::updateCharacteristics()
+{
+    const auto characteristicUuids = m_service->characteristicUuids();
+
+    // A service answering from the GATT cache reports its discovered
+    // state once more when the real layout is known. The rows are then
+    // rebuilt if characteristics have gone, or refreshed otherwise.
+    const auto hasRemovedRows = std::any_of(
+                m_characteristicUuids.cbegin(), m_characteristicUuids.cend(),
+                [&characteristicUuids](const QBluetoothUuid &characteristicUuid) {
+        return !characteristicUuids.contains(characteristicUuid);
+    });
+    if (hasRemovedRows) {
+        qCDebug(BLE_CHARACTERISTICS_MODEL) << "Rebuild characteristics";
+        beginResetModel();
+        m_characteristicUuids.clear();
+        m_characteristicRows.clear();
+        m_refreshBatcher->cancel();
+        m_dirtyRows.clear();
+        m_snapshots.clear();
+        endResetModel();
+    }
 
-    qCDebug(BLE_CHARACTERISTICS_MODEL) << "Start write descriptor:"
-                                       << configDescriptor.uuid()
-                                       << value.toHex();
+    QVector<QBluetoothUuid> addedUuids;
+    for (const auto &characteristicUuid : characteristicUuids) {
+        const auto row = m_characteristicRows.value(characteristicUuid, -1);
+        if (row >= 0) {
+            m_snapshots[row].built = false;
+            markRowDirty(row);
+            continue;
+        }
+        qCDebug(BLE_CHARACTERISTICS_MODEL) << "Add characteristic:" << characteristicUuid;
+        addedUuids.append(characteristicUuid);
+    }
+    if (addedUuids.isEmpty())
+        return;
 
-    m_service->writeDescriptor(configDescriptor, value);
+    // The snapshots and dirty bits cover the new rows before they are
+    // announced, since the views read them on insertion.
+    const auto first = m_characteristicUuids.count();
+    beginInsertRows(QModelIndex(), first, first + addedUuids.count() - 1);
+    for (const auto &characteristicUuid : qAsConst(addedUuids)) {
+        m_characteristicRows.insert(characteristicUuid, m_characteristicUuids.count());
+        m_characteristicUuids.append(characteristicUuid);
+    }
+    m_dirtyRows.resize(m_characteristicUuids.count());
+    m_snapshots.resize(m_characteristicUuids.count());
+    endInsertRows();
 }
 
-QObject *CharacteriticsModel::service() const
+void CharacteriticsModel::markDirty(const QBluetoothUuid &characteristicUuid)
 {
-    return m_service;
+    const auto row = m_characteristicRows.value(characteristicUuid, -1);
+    if (row < 0)
+        return;
+    markRowDirty(row);
 }
 
-void CharacteriticsModel::updateCharacteristics()
+void CharacteriticsModel::markRowDirty(int row)
 {
-    const auto characteristics = m_service->characteristics();
-    for (const auto &characteristic : characteristics) {
-        const auto characteristicUuid = characteristic.uuid();
-        if (m_characteristicUuids.contains(characteristicUuid)) {
-            qCWarning(BLE_CHARACTERISTICS_MODEL) << "Nothing to add, characteristic already is in model:"
-                                                 << characteristicUuid;
+    m_snapshots[row].stale = true;
+    m_dirtyRows.setBit(row);
+    m_refreshBatcher->schedule();
+}
+
+void CharacteriticsModel::flushDirtyRows()
+{
+    // Emit one change per contiguous range of dirty rows.
+    const auto rowsCount = m_dirtyRows.size();
+    auto row = 0;
+    while (row < rowsCount) {
+        if (!m_dirtyRows.testBit(row)) {
+            ++row;
             continue;
         }
+        const auto first = row;
+        while (row < rowsCount && m_dirtyRows.testBit(row))
+            ++row;
+        emit dataChanged(index(first, 0), index(row - 1, 0));
+    }
+    m_dirtyRows.fill(false);
+}
 
-        qCDebug(BLE_CHARACTERISTICS_MODEL) << "Add characteristic:" << characteristicUuid;
-        const auto rowsCount = m_characteristicUuids.count();
-        beginInsertRows(QModelIndex(), rowsCount, rowsCount);
-        m_characteristicUuids.append(characteristicUuid);
-        endInsertRows();
+const CharacteriticsModel::RowSnapshot &CharacteriticsModel::snapshot(int row) const
+{
+    auto &snapshot = m_snapshots[row];
+    if (!snapshot.stale)
+        return snapshot;
+
+    const auto &characteristicUuid = m_characteristicUuids.at(row);
+    if (!snapshot.built) {
+        const auto characteristic = m_service->characteristic(characteristicUuid);
+        snapshot.name = characteristic.name;
+        snapshot.properties = characteristic.properties;
+        snapshot.decodedProperties = decodeProperties(snapshot.properties);
+        // Not known yet, e.g. while the details are rediscovered: tried
+        // again with the next refresh of the row.
+        snapshot.built = characteristic.isValid();
     }
+
+    snapshot.hexValue = m_service->characteristicValue(characteristicUuid).toHex();
+    snapshot.clientConfiguration = decodeClientConfiguration(
+                m_service->descriptorValue(
+                    characteristicUuid,
+                    QBluetoothUuid(QBluetoothUuid::ClientCharacteristicConfiguration)));
+    snapshot.stale = false;
+    return snapshot;
 }
 
 int CharacteriticsModel::rowCount(const QModelIndex &parent) const
@@ -295,23 +465,20 @@ QVariant CharacteriticsModel::data(const QModelIndex &index, int role) const
     if (index.row() >= m_characteristicUuids.count())
         return QVariant();
 
-    const auto row = index.row();
-    const auto characteristicUuid = m_characteristicUuids.at(row);
-    const auto characteristic = m_service->characteristic(characteristicUuid);
-    if (!characteristic.isValid())
+    if (!m_service)
         return QVariant();
 
-    const auto properties = characteristic.properties();
-    const auto configDescriptor = characteristic.descriptor(
-                QBluetoothUuid::ClientCharacteristicConfiguration);
+    const auto row = index.row();
+    const auto &snapshot = this->snapshot(row);
+    const auto properties = snapshot.properties;
 
     switch (role) {
     case CharacteristicNameRole:
-        return characteristic.name();
+        return snapshot.name;
     case CharacteristicUuidRole:
-        return characteristic.uuid();
+        return m_characteristicUuids.at(row);
     case CharacteristicPropertiesRole:
-        return decodeProperties(properties);
+        return snapshot.decodedProperties;
     case CharacteristicWritableRole:
         return bool(properties & (QLowEnergyCharacteristic::Write
                                   | QLowEnergyCharacteristic::WriteNoResponse
@@ -323,13 +490,11 @@ QVariant CharacteriticsModel::data(const QModelIndex &index, int role) const
     case CharacteristicIndicatableRole:
         return bool(properties & (QLowEnergyCharacteristic::Indicate));
     case CharacteristicNotificationEnabledRole:
-        return configDescriptor.isValid()
-                && configDescriptor.value() == QByteArray::fromHex("0100");
+        return bool(snapshot.clientConfiguration & ClientConfigurationNotification);
     case CharacteristicIndicationEnabledRole:
-        return configDescriptor.isValid()
-                && configDescriptor.value() == QByteArray::fromHex("0200");
+        return bool(snapshot.clientConfiguration & ClientConfigurationIndication);
     case CharacteristicValueRole:
-        return characteristic.value().toHex();
+        return snapshot.hexValue;
     default:
         break;
     }
@@ -1,31 +1,47 @@
 #ifndef CHARACTERISTICSMODEL_H
 #define CHARACTERISTICSMODEL_H
 
+#include "blebackend.h"
+#include "capturewriter.h"
+#include "gattoperationqueue.h"
+#include "streamwriter.h"
+#include "updatebatcher.h"
+
+#include <QBluetoothAddress>
 #include <QBluetoothUuid>
 #include <QAbstractListModel>
+#include <QBitArray>
 #include <QPointer>
 
-class QLowEnergyService;
-class QLowEnergyCharacteristic;
-
 class CharacteriticsModel : public QAbstractListModel
 {
     Q_OBJECT
 
     Q_PROPERTY(bool running READ isRunning NOTIFY runningChanged)
     Q_PROPERTY(QString errorString READ errorString NOTIFY errorOccurred)
+    Q_PROPERTY(UpdateBatcher *refreshBatcher READ refreshBatcher CONSTANT)
+    Q_PROPERTY(GattOperationQueue *operationQueue READ operationQueue CONSTANT)
+    Q_PROPERTY(StreamWriter *streamWriter READ streamWriter CONSTANT)
+    Q_PROPERTY(bool capturing READ isCapturing NOTIFY capturingChanged)
 
 public:
     explicit CharacteriticsModel(QObject *parent = nullptr);
 
     bool isRunning() const;
     QString errorString() const;
+    UpdateBatcher *refreshBatcher() const;
+    GattOperationQueue *operationQueue() const;
+    StreamWriter *streamWriter() const;
+    bool isCapturing() const;
 
     Q_INVOKABLE void update(QObject *service);
 
     Q_INVOKABLE void read(const QString &characteristicUuid);
     Q_INVOKABLE void write(const QString &characteristicUuid,
                            const QByteArray &hexValue);
+    // Streams the content of the file, see StreamWriter.
+    Q_INVOKABLE bool writeFile(const QString &characteristicUuid,
+                               const QString &fileName);
 
     Q_INVOKABLE void enableNotification(const QString &characteristicUuid,
                                         bool enable);
@@ -34,22 +50,64 @@ public:
 
     Q_INVOKABLE QObject *service() const;
 
+    Q_INVOKABLE bool startCapture(const QString &fileName);
+    Q_INVOKABLE void stopCapture();
+
+    // Also used by the GATT tree, which the characteristics page shows.
+    static QString decodeProperties(QLowEnergyCharacteristic::PropertyTypes pt);
+    static quint16 decodeClientConfiguration(const QByteArray &value);
+
 signals:
     void runningChanged(bool running);
+    void capturingChanged(bool capturing);
     void errorOccurred();
 
 private:
+    // Everything the delegate binds, so that data() does not need to
+    // query the service. The static part is built once per row, the
+    // value and the CCCD state are refreshed when the row gets dirty.
+    struct RowSnapshot
+    {
+        QString name;
+        QString decodedProperties;
+        QLowEnergyCharacteristic::PropertyTypes properties;
+        QByteArray hexValue;
+        quint16 clientConfiguration = 0;
+        bool built = false;
+        bool stale = true;
+    };
+
     void setRunning(bool running);
 
     void updateCharacteristics();
+    void writeClientConfiguration(const QBluetoothUuid &characteristicUuid,
+                                  quint16 configuration);
+
+    void capture(CaptureFormat::RecordType type,
+                 const QBluetoothUuid &characteristicUuid,
+                 const QByteArray &value);
+
+    void markDirty(const QBluetoothUuid &characteristicUuid);
+    void markRowDirty(int row);
+    void flushDirtyRows();
+
+    const RowSnapshot &snapshot(int row) const;
 
     int rowCount(const QModelIndex &parent) const final;
     QVariant data(const QModelIndex &index, int role) const final;
     QHash<int, QByteArray> roleNames() const final;
 
     bool m_running = false;
-    QPointer<QLowEnergyService> m_service;
+    QPointer<GattService> m_service;
+    QBluetoothAddress m_deviceAddress;
     QVector<QBluetoothUuid> m_characteristicUuids;
+    QHash<QBluetoothUuid, int> m_characteristicRows;
+    QBitArray m_dirtyRows;
+    mutable QVector<RowSnapshot> m_snapshots;
+    UpdateBatcher *m_refreshBatcher = nullptr;
+    GattOperationQueue *m_operationQueue = nullptr;
+    StreamWriter *m_streamWriter = nullptr;
+    CaptureWriter *m_captureWriter = nullptr;
 };
 
 #endif // CHARACTERISTICSMODEL_H
@@ -0,0 +1,391 @@
+#include "connectionpool.h"
+#include "tracer.h"
+
+#include <QLoggingCategory>
+#include <QRandomGenerator>
+#include <QTimer>
+
+Q_DECLARE_LOGGING_CATEGORY(BLE_CONNECTION_POOL)
+
+ConnectionPool::ConnectionPool(QObject *parent)
+    : ConnectionPool(BleBackend::defaultBackend(), parent)
+{
+}
+
+ConnectionPool::ConnectionPool(BleBackend *backend, QObject *parent)
+    : QObject(parent)
+    , m_backend(backend)
+    , m_metrics(LatencyMetrics::defaultMetrics())
+{
+}
+
+int ConnectionPool::capacity() const
+{
+    return m_capacity;
+}
+
+void ConnectionPool::setCapacity(int capacity)
+{
+    capacity = qMax(capacity, 1);
+    if (m_capacity == capacity)
+        return;
+    m_capacity = capacity;
+    qCDebug(BLE_CONNECTION_POOL) << "Set capacity:" << m_capacity;
+    evictIdle();
+    emit capacityChanged(m_capacity);
+}
+
+int ConnectionPool::concurrentConnects() const
+{
+    return m_concurrentConnects;
+}
+
+void ConnectionPool::setConcurrentConnects(int concurrentConnects)
+{
+    concurrentConnects = qMax(concurrentConnects, 1);
+    if (m_concurrentConnects == concurrentConnects)
+        return;
+    m_concurrentConnects = concurrentConnects;
+    qCDebug(BLE_CONNECTION_POOL) << "Set concurrent connects:" << m_concurrentConnects;
+    startConnects();
+    emit concurrentConnectsChanged(m_concurrentConnects);
+}
+
+bool ConnectionPool::autoReconnect() const
+{
+    return m_autoReconnect;
+}
+
+void ConnectionPool::setAutoReconnect(bool autoReconnect)
+{
+    if (m_autoReconnect == autoReconnect)
+        return;
+    m_autoReconnect = autoReconnect;
+    qCDebug(BLE_CONNECTION_POOL) << "Set auto reconnect:" << m_autoReconnect;
+    if (!m_autoReconnect) {
+        for (auto &entry : m_entries)
+            stopReconnect(entry);
+    }
+    emit autoReconnectChanged(m_autoReconnect);
+}
+
+int ConnectionPool::reconnectDelay() const
+{
+    return m_reconnectDelay;
+}
+
+void ConnectionPool::setReconnectDelay(int reconnectDelay)
+{
+    reconnectDelay = qMax(reconnectDelay, 1);
+    if (m_reconnectDelay == reconnectDelay)
+        return;
+    m_reconnectDelay = reconnectDelay;
+    qCDebug(BLE_CONNECTION_POOL) << "Set reconnect delay:" << m_reconnectDelay;
+    emit reconnectDelayChanged(m_reconnectDelay);
+}
+
+int ConnectionPool::maxReconnectDelay() const
+{
+    return m_maxReconnectDelay;
+}
+
+void ConnectionPool::setMaxReconnectDelay(int maxReconnectDelay)
+{
+    maxReconnectDelay = qMax(maxReconnectDelay, 1);
+    if (m_maxReconnectDelay == maxReconnectDelay)
+        return;
+    m_maxReconnectDelay = maxReconnectDelay;
+    qCDebug(BLE_CONNECTION_POOL) << "Set max reconnect delay:" << m_maxReconnectDelay;
+    emit maxReconnectDelayChanged(m_maxReconnectDelay);
+}
+
+int ConnectionPool::occupancy() const
+{
+    return m_entries.count();
+}
+
+int ConnectionPool::connectedCount() const
+{
+    return m_connectedCount;
+}
+
+int ConnectionPool::queueDepth() const
+{
+    return m_connectQueue.count();
+}
+
+PeripheralController *ConnectionPool::acquire(const QBluetoothAddress &address)
+{
+    const auto key = address.toUInt64();
+    auto entryIt = m_entries.find(key);
+    if (entryIt != m_entries.end()) {
+        ++entryIt->users;
+        entryIt->lastUsed = ++m_useCounter;
+        entryIt->disconnectRequested = false;
+        // The link may have dropped while it was idle, or be waiting for
+        // its next reconnect attempt, which is not waited for then.
+        if (entryIt->controller->state() == QLowEnergyController::UnconnectedState) {
+            stopReconnect(*entryIt);
+            enqueueConnect(key);
+        }
+        return entryIt->controller;
+    }
+
+    qCDebug(BLE_CONNECTION_POOL) << "Add controller:" << address;
+    const auto controller = m_backend->createController(address, this);
+
+    connect(controller, &PeripheralController::stateChanged,
+            this, [this, key, controller](QLowEnergyController::ControllerState state) {
+        if (Tracer::isEnabled()) {
+            Tracer::instant("controller", "state changed",
+                            controller->remoteAddress().toString() + QLatin1Char(' ')
+                            + QString::number(state));
+        }
+        if (state != QLowEnergyController::ConnectingState)
+            finishConnect(key);
+        updateConnectedCount();
+
+        if (state == QLowEnergyController::ConnectedState) {
+            const auto entryIt = m_entries.find(key);
+            if (entryIt != m_entries.end()) {
+                entryIt->wasConnected = true;
+                stopReconnect(*entryIt);
+            }
+        } else if (state == QLowEnergyController::UnconnectedState) {
+            scheduleReconnect(key);
+        }
+    });
+
+    // Some failures are reported without leaving the unconnected state.
+    connect(controller, &PeripheralController::errorOccurred,
+            this, [this, key, controller](QLowEnergyController::Error error) {
+        qCWarning(BLE_CONNECTION_POOL) << "Controller error:"
+                                       << controller->remoteAddress() << error;
+        if (controller->state() != QLowEnergyController::ConnectingState)
+            finishConnect(key);
+        if (controller->state() == QLowEnergyController::UnconnectedState)
+            scheduleReconnect(key);
+    });
+
+    Entry entry;
+    entry.controller = controller;
+    entry.users = 1;
+    entry.lastUsed = ++m_useCounter;
+    m_entries.insert(key, entry);
+    emit occupancyChanged(m_entries.count());
+
+    enqueueConnect(key);
+    evictIdle();
+    return controller;
+}
+
+void ConnectionPool::release(const QBluetoothAddress &address)
+{
+    const auto entryIt = m_entries.find(address.toUInt64());
+    if (entryIt == m_entries.end() || entryIt->users == 0)
+        return;
+    --entryIt->users;
+    entryIt->lastUsed = ++m_useCounter;
+    // Idle links are reconnected by the next acquire().
+    if (entryIt->users == 0)
+        stopReconnect(*entryIt);
+    evictIdle();
+}
+
+PeripheralController *ConnectionPool::controller(const QBluetoothAddress &address) const
+{
+    const auto entryIt = m_entries.constFind(address.toUInt64());
+    return (entryIt != m_entries.cend()) ? entryIt->controller : nullptr;
+}
+
+bool ConnectionPool::isReconnecting(const QBluetoothAddress &address) const
+{
+    const auto entryIt = m_entries.constFind(address.toUInt64());
+    return (entryIt != m_entries.cend()) && entryIt->reconnectAttempts > 0;
+}
+
+bool ConnectionPool::contains(const QString &address) const
+{
+    return m_entries.contains(QBluetoothAddress(address).toUInt64());
+}
+
+void ConnectionPool::connectDevice(const QString &address)
+{
+    const auto key = QBluetoothAddress(address).toUInt64();
+    const auto entryIt = m_entries.find(key);
+    if (entryIt == m_entries.end()
+            || entryIt->controller->state() != QLowEnergyController::UnconnectedState) {
+        return;
+    }
+    qCDebug(BLE_CONNECTION_POOL) << "Connect device:" << address;
+    entryIt->disconnectRequested = false;
+    stopReconnect(*entryIt);
+    enqueueConnect(key);
+}
+
+void ConnectionPool::disconnectDevice(const QString &address)
+{
+    const auto key = QBluetoothAddress(address).toUInt64();
+    const auto entryIt = m_entries.find(key);
+    if (entryIt == m_entries.end())
+        return;
+    qCDebug(BLE_CONNECTION_POOL) << "Disconnect device:" << address;
+    entryIt->disconnectRequested = true;
+    stopReconnect(*entryIt);
+    m_connectQueue.removeAll(key);
+    emit queueDepthChanged(m_connectQueue.count());
+    entryIt->controller->disconnectFromDevice();
+}
+
+void ConnectionPool::enqueueConnect(quint64 key)
+{
+    if (m_connecting.contains(key) || m_connectQueue.contains(key))
+        return;
+    m_connectQueue.enqueue(key);
+    emit queueDepthChanged(m_connectQueue.count());
+    startConnects();
+}
+
+void ConnectionPool::startConnects()
+{
+    const auto queueDepth = m_connectQueue.count();
+    while (m_connecting.count() < m_concurrentConnects && !m_connectQueue.isEmpty()) {
+        const auto key = m_connectQueue.dequeue();
+        const auto controller = m_entries.value(key).controller;
+        if (!controller || controller->state() != QLowEnergyController::UnconnectedState)
+            continue;
+        qCDebug(BLE_CONNECTION_POOL) << "Connect device:" << controller->remoteAddress();
+        m_connecting.insert(key);
+        if (m_metrics)
+            m_metrics->begin(LatencyMetrics::Connect, controller->remoteAddress());
+        if (Tracer::isEnabled())
+            Tracer::begin("controller", "connect", key, controller->remoteAddress().toString());
+        controller->connectToDevice();
+    }
+    if (queueDepth != m_connectQueue.count())
+        emit queueDepthChanged(m_connectQueue.count());
+}
+
+void ConnectionPool::finishConnect(quint64 key)
+{
+    if (!m_connecting.remove(key))
+        return;
+    Tracer::end("controller", "connect", key);
+
+    const auto controller = m_entries.value(key).controller;
+    if (m_metrics && controller) {
+        const auto state = controller->state();
+        const auto connected = state != QLowEnergyController::UnconnectedState
+                && state != QLowEnergyController::ClosingState;
+        m_metrics->end(LatencyMetrics::Connect, controller->remoteAddress(),
+                       QString(), connected);
+    }
+    startConnects();
+}
+
+void ConnectionPool::scheduleReconnect(quint64 key)
+{
+    const auto entryIt = m_entries.find(key);
+    if (entryIt == m_entries.end())
+        return;
+    auto &entry = *entryIt;
+    if (!m_autoReconnect || !entry.wasConnected || entry.disconnectRequested || entry.users == 0)
+        return;
+    if (m_connecting.contains(key) || m_connectQueue.contains(key)
+            || (entry.reconnectTimer && entry.reconnectTimer->isActive())) {
+        return;
+    }
+
+    if (!entry.reconnectTimer) {
+        entry.reconnectTimer = new QTimer(this);
+        entry.reconnectTimer->setSingleShot(true);
+        connect(entry.reconnectTimer, &QTimer::timeout,
+                this, [this, key]() {
+            enqueueConnect(key);
+        });
+    }
+
+    // Between half and all of the delay, so that the links dropped at
+    // once, e.g. by an adapter reset, are not all retried at once.
+    const auto delay = int(qMin(qint64(m_reconnectDelay) << qMin(entry.reconnectAttempts, 16),
+                                qint64(m_maxReconnectDelay)));
+    const auto jitteredDelay = delay / 2 + int(QRandomGenerator::global()->bounded(delay / 2 + 1));
+    ++entry.reconnectAttempts;
+    qCDebug(BLE_CONNECTION_POOL) << "Reconnect device:" << entry.controller->remoteAddress()
+                                 << "attempt:" << entry.reconnectAttempts
+                                 << "delay:" << jitteredDelay;
+    entry.reconnectTimer->start(jitteredDelay);
+    emit reconnectScheduled(entry.controller->remoteAddress(), entry.reconnectAttempts,
+                            jitteredDelay);
+}
+
+void ConnectionPool::stopReconnect(Entry &entry)
+{
+    entry.reconnectAttempts = 0;
+    if (entry.reconnectTimer)
+        entry.reconnectTimer->stop();
+}
+
+void ConnectionPool::updateConnectedCount()
+{
+    auto connectedCount = 0;
+    for (const auto &entry : qAsConst(m_entries)) {
+        switch (entry.controller->state()) {
+        case QLowEnergyController::ConnectedState:
+        case QLowEnergyController::DiscoveringState:
+        case QLowEnergyController::DiscoveredState:
+            ++connectedCount;
+            break;
+        default:
+            break;
+        }
+    }
+
+    if (m_connectedCount == connectedCount)
+        return;
+    m_connectedCount = connectedCount;
+    emit connectedCountChanged(m_connectedCount);
+}
+
+void ConnectionPool::evictIdle()
+{
+    while (m_entries.count() > m_capacity) {
+        auto victim = m_entries.cend();
+        for (auto entryIt = m_entries.cbegin(); entryIt != m_entries.cend(); ++entryIt) {
+            if (entryIt->users > 0)
+                continue;
+            if (victim == m_entries.cend() || entryIt->lastUsed < victim->lastUsed)
+                victim = entryIt;
+        }
+        // Everything is in use, the pool stays over capacity until
+        // something is released.
+        if (victim == m_entries.cend())
+            return;
+        remove(victim.key());
+    }
+}
+
+void ConnectionPool::remove(quint64 key)
+{
+    const auto entry = m_entries.take(key);
+    const auto controller = entry.controller;
+    qCDebug(BLE_CONNECTION_POOL) << "Remove controller:" << controller->remoteAddress();
+    delete entry.reconnectTimer;
+
+    m_connectQueue.removeAll(key);
+    // A connection in flight is abandoned, so it counts as failed.
+    if (m_connecting.remove(key)) {
+        Tracer::end("controller", "connect", key);
+        if (m_metrics)
+            m_metrics->fail(LatencyMetrics::Connect, controller->remoteAddress());
+    }
+    controller->disconnect(this);
+    controller->disconnectFromDevice();
+    // The removal may be triggered by one of its own signals.
+    controller->deleteLater();
+
+    emit occupancyChanged(m_entries.count());
+    emit queueDepthChanged(m_connectQueue.count());
+    updateConnectedCount();
+    startConnects();
+}
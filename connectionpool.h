@@ -0,0 +1,135 @@
+#ifndef CONNECTIONPOOL_H
+#define CONNECTIONPOOL_H
+
+#include "blebackend.h"
+#include "latencymetrics.h"
+
+#include <QBluetoothAddress>
+#include <QHash>
+#include <QPointer>
+#include <QQueue>
+#include <QSet>
+
+class QTimer;
+
+// Owns the peripheral controllers, keyed by the device address, so that
+// the links outlive the pages using them. The adapter serializes the
+// connection attempts, so only a bounded number of them is started at
+// once and the others wait in a FIFO queue. Idle links (acquired by
+// nobody) are kept until the capacity is exceeded, then the least
+// recently used ones are closed first.
+//
+// A link in use which drops is reconnected with a jittered exponential
+// backoff, unless it was disconnected on purpose. The controller, and
+// so the service objects created from it, is kept across reconnects.
+class ConnectionPool : public QObject
+{
+    Q_OBJECT
+
+    Q_PROPERTY(int capacity READ capacity WRITE setCapacity NOTIFY capacityChanged)
+    Q_PROPERTY(int concurrentConnects READ concurrentConnects
+               WRITE setConcurrentConnects NOTIFY concurrentConnectsChanged)
+
+    Q_PROPERTY(bool autoReconnect READ autoReconnect
+               WRITE setAutoReconnect NOTIFY autoReconnectChanged)
+    Q_PROPERTY(int reconnectDelay READ reconnectDelay
+               WRITE setReconnectDelay NOTIFY reconnectDelayChanged)
+    Q_PROPERTY(int maxReconnectDelay READ maxReconnectDelay
+               WRITE setMaxReconnectDelay NOTIFY maxReconnectDelayChanged)
+
+    Q_PROPERTY(int occupancy READ occupancy NOTIFY occupancyChanged)
+    Q_PROPERTY(int connectedCount READ connectedCount NOTIFY connectedCountChanged)
+    Q_PROPERTY(int queueDepth READ queueDepth NOTIFY queueDepthChanged)
+
+public:
+    explicit ConnectionPool(QObject *parent = nullptr);
+    explicit ConnectionPool(BleBackend *backend, QObject *parent = nullptr);
+
+    int capacity() const;
+    void setCapacity(int capacity);
+
+    int concurrentConnects() const;
+    void setConcurrentConnects(int concurrentConnects);
+
+    bool autoReconnect() const;
+    void setAutoReconnect(bool autoReconnect);
+
+    // Milliseconds, of the first attempt. Each failed attempt doubles
+    // the delay of the next one, up to the maximum.
+    int reconnectDelay() const;
+    void setReconnectDelay(int reconnectDelay);
+
+    int maxReconnectDelay() const;
+    void setMaxReconnectDelay(int maxReconnectDelay);
+
+    int occupancy() const;
+    int connectedCount() const;
+    int queueDepth() const;
+
+    // Returns the pooled controller of the device, creating it and
+    // queueing its connection when needed. Every acquire() has to be
+    // balanced by a release(), the controller is owned by the pool.
+    PeripheralController *acquire(const QBluetoothAddress &address);
+    void release(const QBluetoothAddress &address);
+
+    PeripheralController *controller(const QBluetoothAddress &address) const;
+    // Whether the link dropped and is being reconnected.
+    bool isReconnecting(const QBluetoothAddress &address) const;
+
+    Q_INVOKABLE bool contains(const QString &address) const;
+    // Queues the connection of a pooled link which is down, e.g. of one
+    // whose first connection failed, which is not reconnected.
+    Q_INVOKABLE void connectDevice(const QString &address);
+    Q_INVOKABLE void disconnectDevice(const QString &address);
+
+signals:
+    void capacityChanged(int capacity);
+    void concurrentConnectsChanged(int concurrentConnects);
+    void autoReconnectChanged(bool autoReconnect);
+    void reconnectDelayChanged(int reconnectDelay);
+    void maxReconnectDelayChanged(int maxReconnectDelay);
+
+    void occupancyChanged(int occupancy);
+    void connectedCountChanged(int connectedCount);
+    void queueDepthChanged(int queueDepth);
+
+    void reconnectScheduled(const QBluetoothAddress &address, int attempt, int delay);
+
+private:
+    struct Entry
+    {
+        PeripheralController *controller = nullptr;
+        int users = 0;
+        quint64 lastUsed = 0;
+        // Reconnects only the links which were up.
+        bool wasConnected = false;
+        bool disconnectRequested = false;
+        int reconnectAttempts = 0;
+        QTimer *reconnectTimer = nullptr;
+    };
+
+    void enqueueConnect(quint64 key);
+    void startConnects();
+    void finishConnect(quint64 key);
+    void scheduleReconnect(quint64 key);
+    void stopReconnect(Entry &entry);
+    void updateConnectedCount();
+    void evictIdle();
+    void remove(quint64 key);
+
+    BleBackend *m_backend = nullptr;
+    QPointer<LatencyMetrics> m_metrics;
+    int m_capacity = 8;
+    int m_concurrentConnects = 1;
+    bool m_autoReconnect = true;
+    int m_reconnectDelay = 1000;
+    int m_maxReconnectDelay = 30000;
+    int m_connectedCount = 0;
+    // Monotonic use counter, orders the idle entries for the eviction.
+    quint64 m_useCounter = 0;
+    QHash<quint64, Entry> m_entries;
+    QQueue<quint64> m_connectQueue;
+    QSet<quint64> m_connecting;
+};
+
+#endif // CONNECTIONPOOL_H
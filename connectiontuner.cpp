@@ -0,0 +1,172 @@
+#include "connectiontuner.h"
+
+#include <QLoggingCategory>
+#include <QMetaEnum>
+
+Q_DECLARE_LOGGING_CATEGORY(BLE_CONNECTION_TUNER)
+
+namespace {
+
+// The ATT header of a write command: the opcode and the handle.
+const int WriteHeaderSize = 3;
+
+} // namespace
+
+ConnectionTuner::ConnectionTuner(QObject *parent)
+    : QObject(parent)
+{
+}
+
+QLowEnergyConnectionParameters ConnectionTuner::parameters(Profile profile)
+{
+    QLowEnergyConnectionParameters parameters;
+    switch (profile) {
+    case HighThroughput:
+        // Several packets per connection event, so a little longer
+        // intervals than for the latency cost nothing.
+        parameters.setIntervalRange(15, 30);
+        parameters.setLatency(0);
+        parameters.setSupervisionTimeout(4000);
+        break;
+    case LowLatency:
+        parameters.setIntervalRange(7.5, 15);
+        parameters.setLatency(0);
+        parameters.setSupervisionTimeout(2000);
+        break;
+    case LowPower:
+        parameters.setIntervalRange(100, 125);
+        parameters.setLatency(4);
+        parameters.setSupervisionTimeout(6000);
+        break;
+    case DefaultProfile:
+        break;
+    }
+    return parameters;
+}
+
+ConnectionTuner::Profile ConnectionTuner::profileFromName(const QString &name, bool *ok)
+{
+    const auto metaEnum = QMetaEnum::fromType<Profile>();
+    const auto key = name.isEmpty() ? QByteArray() : name.left(1).toUpper().toLatin1()
+                                                     + name.mid(1).toLatin1();
+    bool found = false;
+    const auto value = metaEnum.keyToValue(key.constData(), &found);
+    if (ok)
+        *ok = found || name.isEmpty();
+    return found ? Profile(value) : DefaultProfile;
+}
+
+ConnectionTuner::Profile ConnectionTuner::profile() const
+{
+    if (!m_controller)
+        return DefaultProfile;
+    return m_profiles.value(m_controller->remoteAddress().toUInt64(), DefaultProfile);
+}
+
+void ConnectionTuner::setProfile(Profile profile)
+{
+    if (!m_controller || this->profile() == profile)
+        return;
+    m_profiles.insert(m_controller->remoteAddress().toUInt64(), profile);
+    qCDebug(BLE_CONNECTION_TUNER) << "Set profile:" << profile
+                                  << "for" << m_controller->remoteAddress();
+    emit profileChanged(profile);
+    requestProfile();
+}
+
+int ConnectionTuner::mtu() const
+{
+    return m_mtu;
+}
+
+int ConnectionTuner::writeChunkSize() const
+{
+    return m_mtu - WriteHeaderSize;
+}
+
+qreal ConnectionTuner::connectionInterval() const
+{
+    return m_parameters.minimumInterval();
+}
+
+int ConnectionTuner::latency() const
+{
+    return m_parameters.latency();
+}
+
+int ConnectionTuner::supervisionTimeout() const
+{
+    return m_parameters.supervisionTimeout();
+}
+
+void ConnectionTuner::setController(PeripheralController *controller)
+{
+    if (m_controller == controller)
+        return;
+
+    const auto previousProfile = profile();
+    if (m_controller)
+        m_controller->disconnect(this);
+    m_controller = controller;
+
+    if (m_controller) {
+        connect(m_controller, &PeripheralController::stateChanged,
+                this, [this](QLowEnergyController::ControllerState state) {
+            if (state == QLowEnergyController::ConnectedState)
+                requestProfile();
+        });
+        connect(m_controller, &PeripheralController::mtuChanged,
+                this, &ConnectionTuner::updateMtu);
+        connect(m_controller, &PeripheralController::connectionUpdated,
+                this, &ConnectionTuner::updateParameters);
+    }
+
+    if (profile() != previousProfile)
+        emit profileChanged(profile());
+    updateMtu(m_controller ? m_controller->mtu() : int(DefaultAttMtu));
+    updateParameters(m_controller ? m_controller->connectionParameters()
+                                  : QLowEnergyConnectionParameters());
+
+    // A pooled link may be up already.
+    requestProfile();
+}
+
+void ConnectionTuner::requestProfile()
+{
+    const auto profile = this->profile();
+    if (!m_controller || profile == DefaultProfile)
+        return;
+    // Requested again once connected.
+    switch (m_controller->state()) {
+    case QLowEnergyController::UnconnectedState:
+    case QLowEnergyController::ConnectingState:
+    case QLowEnergyController::ClosingState:
+        return;
+    default:
+        break;
+    }
+    qCDebug(BLE_CONNECTION_TUNER) << "Requesting" << profile
+                                  << "for" << m_controller->remoteAddress();
+    m_controller->requestConnectionUpdate(parameters(profile));
+}
+
+void ConnectionTuner::updateMtu(int mtu)
+{
+    if (m_mtu == mtu)
+        return;
+    m_mtu = mtu;
+    qCDebug(BLE_CONNECTION_TUNER) << "MTU:" << m_mtu;
+    emit mtuChanged(m_mtu);
+}
+
+void ConnectionTuner::updateParameters(const QLowEnergyConnectionParameters &parameters)
+{
+    if (m_parameters == parameters)
+        return;
+    m_parameters = parameters;
+    qCDebug(BLE_CONNECTION_TUNER) << "Connection updated: interval"
+                                  << m_parameters.minimumInterval() << "ms, latency"
+                                  << m_parameters.latency() << ", timeout"
+                                  << m_parameters.supervisionTimeout() << "ms";
+    emit connectionUpdated();
+}
@@ -0,0 +1,71 @@
+#ifndef CONNECTIONTUNER_H
+#define CONNECTIONTUNER_H
+
+#include "blebackend.h"
+
+#include <QHash>
+#include <QPointer>
+
+// Requests the connection parameters of a profile on the link of the
+// services model and reports what was negotiated. Throughput wants short
+// intervals and a large MTU, the battery of the peripheral long ones and
+// some slave latency. The profile is remembered per device and requested
+// again whenever its link comes up, including after a reconnect; the
+// default profile leaves the parameters to the peripheral.
+class ConnectionTuner : public QObject
+{
+    Q_OBJECT
+
+    Q_PROPERTY(Profile profile READ profile WRITE setProfile NOTIFY profileChanged)
+
+    Q_PROPERTY(int mtu READ mtu NOTIFY mtuChanged)
+    Q_PROPERTY(int writeChunkSize READ writeChunkSize NOTIFY mtuChanged)
+    Q_PROPERTY(qreal connectionInterval READ connectionInterval NOTIFY connectionUpdated)
+    Q_PROPERTY(int latency READ latency NOTIFY connectionUpdated)
+    Q_PROPERTY(int supervisionTimeout READ supervisionTimeout NOTIFY connectionUpdated)
+
+public:
+    enum Profile {
+        DefaultProfile,
+        HighThroughput,
+        LowLatency,
+        LowPower
+    };
+    Q_ENUM(Profile)
+
+    explicit ConnectionTuner(QObject *parent = nullptr);
+
+    static QLowEnergyConnectionParameters parameters(Profile profile);
+    static Profile profileFromName(const QString &name, bool *ok = nullptr);
+
+    // Of the current device.
+    Profile profile() const;
+    void setProfile(Profile profile);
+
+    int mtu() const;
+    // The ATT payload of a write without response at the current MTU.
+    int writeChunkSize() const;
+    // Milliseconds, as is the supervision timeout.
+    qreal connectionInterval() const;
+    int latency() const;
+    int supervisionTimeout() const;
+
+    void setController(PeripheralController *controller);
+
+signals:
+    void profileChanged(Profile profile);
+    void mtuChanged(int mtu);
+    void connectionUpdated();
+
+private:
+    void requestProfile();
+    void updateMtu(int mtu);
+    void updateParameters(const QLowEnergyConnectionParameters &parameters);
+
+    QPointer<PeripheralController> m_controller;
+    QHash<quint64, Profile> m_profiles;
+    int m_mtu = DefaultAttMtu;
+    QLowEnergyConnectionParameters m_parameters;
+};
+
+#endif // CONNECTIONTUNER_H
@@ -0,0 +1,226 @@
+#include "devicefilter.h"
+
+#include <QBluetoothDeviceInfo>
+#include <QLoggingCategory>
+
+#include <algorithm>
+
+Q_DECLARE_LOGGING_CATEGORY(BLE_DEVICES_MODEL)
+
+namespace {
+
+// Accepts the 16 and 32 bit forms of the assigned numbers, e.g. "180D"
+// or "0x180D", besides the full 128 bit form.
+QBluetoothUuid parseUuid(const QString &text)
+{
+    auto digits = text.trimmed();
+    if (digits.startsWith(QLatin1String("0x"), Qt::CaseInsensitive))
+        digits.remove(0, 2);
+    bool ok = false;
+    if (digits.length() == 4) {
+        const auto value = digits.toUShort(&ok, 16);
+        return ok ? QBluetoothUuid(value) : QBluetoothUuid();
+    }
+    if (digits.length() == 8) {
+        const auto value = digits.toUInt(&ok, 16);
+        return ok ? QBluetoothUuid(value) : QBluetoothUuid();
+    }
+    return QBluetoothUuid(text.trimmed());
+}
+
+} // namespace
+
+DeviceFilter::DeviceFilter(QObject *parent)
+    : QObject(parent)
+    , m_rejectedCountBatcher(new UpdateBatcher(this))
+{
+    // Rejections may come at the advertising rate, so the counter is
+    // published at most once per batch interval.
+    m_rejectedCountBatcher->setFlushHandler([this]() {
+        emit rejectedCountChanged(m_rejectedCount);
+    });
+}
+
+QStringList DeviceFilter::serviceUuids() const
+{
+    return m_serviceUuids;
+}
+
+void DeviceFilter::setServiceUuids(const QStringList &serviceUuids)
+{
+    if (m_serviceUuids == serviceUuids)
+        return;
+    m_serviceUuids = serviceUuids;
+    qCDebug(BLE_DEVICES_MODEL) << "Set filter service UUIDs:" << m_serviceUuids;
+
+    m_serviceUuidSet.clear();
+    for (const auto &serviceUuid : m_serviceUuids) {
+        const auto uuid = parseUuid(serviceUuid);
+        if (uuid.isNull()) {
+            qCWarning(BLE_DEVICES_MODEL) << "Ignore invalid filter service UUID:"
+                                         << serviceUuid;
+            continue;
+        }
+        m_serviceUuidSet.insert(uuid);
+    }
+    updateEmpty();
+
+    emit serviceUuidsChanged(m_serviceUuids);
+}
+
+QStringList DeviceFilter::namePrefixes() const
+{
+    return m_namePrefixes;
+}
+
+void DeviceFilter::setNamePrefixes(const QStringList &namePrefixes)
+{
+    if (m_namePrefixes == namePrefixes)
+        return;
+    m_namePrefixes = namePrefixes;
+    qCDebug(BLE_DEVICES_MODEL) << "Set filter name prefixes:" << m_namePrefixes;
+    compileNamePrefixes();
+    updateEmpty();
+    emit namePrefixesChanged(m_namePrefixes);
+}
+
+QList<int> DeviceFilter::manufacturerIds() const
+{
+    return m_manufacturerIds;
+}
+
+void DeviceFilter::setManufacturerIds(const QList<int> &manufacturerIds)
+{
+    if (m_manufacturerIds == manufacturerIds)
+        return;
+    m_manufacturerIds = manufacturerIds;
+    qCDebug(BLE_DEVICES_MODEL) << "Set filter manufacturer IDs:" << m_manufacturerIds;
+
+    m_manufacturerIdSet.clear();
+    for (const auto manufacturerId : m_manufacturerIds)
+        m_manufacturerIdSet.insert(quint16(manufacturerId));
+    updateEmpty();
+
+    emit manufacturerIdsChanged(m_manufacturerIds);
+}
+
+int DeviceFilter::rssiFloor() const
+{
+    return m_rssiFloor;
+}
+
+void DeviceFilter::setRssiFloor(int rssiFloor)
+{
+    if (m_rssiFloor == rssiFloor)
+        return;
+    m_rssiFloor = rssiFloor;
+    qCDebug(BLE_DEVICES_MODEL) << "Set filter RSSI floor:" << m_rssiFloor;
+    updateEmpty();
+    emit rssiFloorChanged(m_rssiFloor);
+}
+
+int DeviceFilter::rejectedCount() const
+{
+    return m_rejectedCount;
+}
+
+void DeviceFilter::resetRejectedCount()
+{
+    if (m_rejectedCount == 0)
+        return;
+    m_rejectedCount = 0;
+    m_rejectedCountBatcher->cancel();
+    emit rejectedCountChanged(m_rejectedCount);
+}
+
+bool DeviceFilter::accepts(const QBluetoothDeviceInfo &device)
+{
+    if (m_empty || matches(device))
+        return true;
+
+    ++m_rejectedCount;
+    m_rejectedCountBatcher->schedule();
+    return false;
+}
+
+bool DeviceFilter::matches(const QBluetoothDeviceInfo &device) const
+{
+    // Cheapest checks first. An unknown RSSI is reported as zero and
+    // is not rejected.
+    const auto rssi = device.rssi();
+    if (rssi != 0 && rssi < m_rssiFloor)
+        return false;
+
+    if (!m_manufacturerIdSet.isEmpty()) {
+        const auto manufacturerIds = device.manufacturerIds();
+        const auto matched = std::any_of(manufacturerIds.cbegin(), manufacturerIds.cend(),
+                                         [this](quint16 manufacturerId) {
+            return m_manufacturerIdSet.contains(manufacturerId);
+        });
+        if (!matched)
+            return false;
+    }
+
+    // A list without any valid entry rejects everything rather than
+    // turning the rule off.
+    if (!m_serviceUuids.isEmpty()) {
+        const auto serviceUuids = device.serviceUuids();
+        const auto matched = std::any_of(serviceUuids.cbegin(), serviceUuids.cend(),
+                                         [this](const QBluetoothUuid &serviceUuid) {
+            return m_serviceUuidSet.contains(serviceUuid);
+        });
+        if (!matched)
+            return false;
+    }
+
+    if (!m_prefixNodes.isEmpty() && !matchesNamePrefix(device.name()))
+        return false;
+
+    return true;
+}
+
+bool DeviceFilter::matchesNamePrefix(const QString &name) const
+{
+    auto node = 0;
+    for (const auto character : name) {
+        if (m_prefixNodes.at(node).terminal)
+            return true;
+        const auto &children = m_prefixNodes.at(node).children;
+        const auto childIt = children.constFind(character.unicode());
+        if (childIt == children.cend())
+            return false;
+        node = childIt.value();
+    }
+    return m_prefixNodes.at(node).terminal;
+}
+
+void DeviceFilter::compileNamePrefixes()
+{
+    m_prefixNodes.clear();
+    if (m_namePrefixes.isEmpty())
+        return;
+
+    m_prefixNodes.append(PrefixNode());
+    for (const auto &namePrefix : m_namePrefixes) {
+        auto node = 0;
+        for (const auto character : namePrefix) {
+            const auto key = character.unicode();
+            auto child = m_prefixNodes.at(node).children.value(key, -1);
+            if (child < 0) {
+                child = m_prefixNodes.count();
+                m_prefixNodes.append(PrefixNode());
+                m_prefixNodes[node].children.insert(key, child);
+            }
+            node = child;
+        }
+        m_prefixNodes[node].terminal = true;
+    }
+}
+
+void DeviceFilter::updateEmpty()
+{
+    m_empty = m_serviceUuids.isEmpty()
+            && m_manufacturerIdSet.isEmpty()
+            && m_prefixNodes.isEmpty()
+            && m_rssiFloor <= NoRssiFloor;
+}
@@ -0,0 +1,90 @@
+#ifndef DEVICEFILTER_H
+#define DEVICEFILTER_H
+
+#include "updatebatcher.h"
+
+#include <QBluetoothUuid>
+#include <QObject>
+#include <QSet>
+#include <QStringList>
+#include <QVector>
+
+class QBluetoothDeviceInfo;
+
+// Scan-time filter applied to the advertisements before they reach the
+// devices model. Every non-empty rule class has to match (any of its
+// entries), the rules are compiled into hash sets and a name prefix trie
+// whenever they change, so that a check costs constant time per class.
+class DeviceFilter : public QObject
+{
+    Q_OBJECT
+
+    Q_PROPERTY(QStringList serviceUuids READ serviceUuids
+               WRITE setServiceUuids NOTIFY serviceUuidsChanged)
+    Q_PROPERTY(QStringList namePrefixes READ namePrefixes
+               WRITE setNamePrefixes NOTIFY namePrefixesChanged)
+    Q_PROPERTY(QList<int> manufacturerIds READ manufacturerIds
+               WRITE setManufacturerIds NOTIFY manufacturerIdsChanged)
+    Q_PROPERTY(int rssiFloor READ rssiFloor
+               WRITE setRssiFloor NOTIFY rssiFloorChanged)
+
+    Q_PROPERTY(int rejectedCount READ rejectedCount NOTIFY rejectedCountChanged)
+
+public:
+    // Below any RSSI which can be reported by the controller.
+    enum { NoRssiFloor = -128 };
+
+    explicit DeviceFilter(QObject *parent = nullptr);
+
+    QStringList serviceUuids() const;
+    void setServiceUuids(const QStringList &serviceUuids);
+
+    QStringList namePrefixes() const;
+    void setNamePrefixes(const QStringList &namePrefixes);
+
+    QList<int> manufacturerIds() const;
+    void setManufacturerIds(const QList<int> &manufacturerIds);
+
+    int rssiFloor() const;
+    void setRssiFloor(int rssiFloor);
+
+    int rejectedCount() const;
+    Q_INVOKABLE void resetRejectedCount();
+
+    bool accepts(const QBluetoothDeviceInfo &device);
+
+signals:
+    void serviceUuidsChanged(const QStringList &serviceUuids);
+    void namePrefixesChanged(const QStringList &namePrefixes);
+    void manufacturerIdsChanged(const QList<int> &manufacturerIds);
+    void rssiFloorChanged(int rssiFloor);
+    void rejectedCountChanged(int rejectedCount);
+
+private:
+    struct PrefixNode
+    {
+        QHash<ushort, int> children;
+        bool terminal = false;
+    };
+
+    bool matches(const QBluetoothDeviceInfo &device) const;
+    bool matchesNamePrefix(const QString &name) const;
+    void compileNamePrefixes();
+    void updateEmpty();
+
+    QStringList m_serviceUuids;
+    QStringList m_namePrefixes;
+    QList<int> m_manufacturerIds;
+    int m_rssiFloor = NoRssiFloor;
+
+    QSet<QBluetoothUuid> m_serviceUuidSet;
+    QSet<quint16> m_manufacturerIdSet;
+    // Node zero is the root, it is absent while there are no prefixes.
+    QVector<PrefixNode> m_prefixNodes;
+    bool m_empty = true;
+
+    int m_rejectedCount = 0;
+    UpdateBatcher *m_rejectedCountBatcher = nullptr;
+};
+
+#endif // DEVICEFILTER_H
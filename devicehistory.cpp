@@ -0,0 +1,106 @@
+#include "devicehistory.h"
+
+#include <QByteArray>
+
+#include <cstring>
+
+int DeviceHistory::count() const
+{
+    return m_heads.count();
+}
+
+void DeviceHistory::appendSlot()
+{
+    m_timestamps.insert(m_timestamps.count(), Depth, 0);
+    m_rssi.insert(m_rssi.count(), Depth, 0);
+    m_payloadSizes.insert(m_payloadSizes.count(), Depth, 0);
+    m_payloads.insert(m_payloads.count(), Depth * PayloadCapacity, 0);
+
+    m_heads.append(0);
+    m_counts.append(0);
+    m_rssiSums.append(0);
+}
+
+void DeviceHistory::removeSlots(int first, int count)
+{
+    m_timestamps.remove(first * Depth, count * Depth);
+    m_rssi.remove(first * Depth, count * Depth);
+    m_payloadSizes.remove(first * Depth, count * Depth);
+    m_payloads.remove(first * Depth * PayloadCapacity,
+                      count * Depth * PayloadCapacity);
+
+    m_heads.remove(first, count);
+    m_counts.remove(first, count);
+    m_rssiSums.remove(first, count);
+}
+
+void DeviceHistory::record(int slot, qint64 timestamp, qint16 rssi,
+                           const QByteArray &payload)
+{
+    const auto head = m_heads.at(slot);
+    const auto index = slot * Depth + head;
+
+    // The running sum keeps the moving average O(1), the evicted sample
+    // is subtracted once the ring is full.
+    if (m_counts.at(slot) == Depth)
+        m_rssiSums[slot] -= m_rssi.at(index);
+    else
+        ++m_counts[slot];
+    m_rssiSums[slot] += rssi;
+
+    m_timestamps[index] = timestamp;
+    m_rssi[index] = rssi;
+
+    const auto payloadSize = qMin(payload.size(), int(PayloadCapacity));
+    m_payloadSizes[index] = quint8(payloadSize);
+    std::memcpy(m_payloads.data() + index * PayloadCapacity,
+                payload.constData(), size_t(payloadSize));
+
+    m_heads[slot] = quint8((head + 1) % Depth);
+}
+
+int DeviceHistory::sampleCount(int slot) const
+{
+    return m_counts.at(slot);
+}
+
+qint16 DeviceHistory::currentRssi(int slot) const
+{
+    if (m_counts.at(slot) == 0)
+        return 0;
+    return m_rssi.at(sampleIndex(slot, 0));
+}
+
+qreal DeviceHistory::averageRssi(int slot) const
+{
+    const auto samples = m_counts.at(slot);
+    if (samples == 0)
+        return 0;
+    return qreal(m_rssiSums.at(slot)) / samples;
+}
+
+qint64 DeviceHistory::advertisementInterval(int slot) const
+{
+    const auto samples = m_counts.at(slot);
+    if (samples < 2)
+        return 0;
+    const auto newest = m_timestamps.at(sampleIndex(slot, 0));
+    const auto oldest = m_timestamps.at(sampleIndex(slot, samples - 1));
+    return (newest - oldest) / (samples - 1);
+}
+
+QByteArray DeviceHistory::payload(int slot, int age) const
+{
+    if (age >= m_counts.at(slot))
+        return QByteArray();
+    const auto index = sampleIndex(slot, age);
+    return QByteArray(m_payloads.constData() + index * PayloadCapacity,
+                      m_payloadSizes.at(index));
+}
+
+int DeviceHistory::sampleIndex(int slot, int age) const
+{
+    // The head points past the newest sample.
+    const auto position = (m_heads.at(slot) + Depth - 1 - age) % Depth;
+    return slot * Depth + position;
+}
@@ -0,0 +1,48 @@
+#ifndef DEVICEHISTORY_H
+#define DEVICEHISTORY_H
+
+#include <QVector>
+
+class QByteArray;
+
+// Fixed-depth ring buffers of the RSSI samples and advertisement payloads
+// of every device, kept as a structure of arrays indexed by slot. Each
+// slot takes a constant amount of memory, so the store only grows with
+// the number of devices and never with the scan duration.
+class DeviceHistory
+{
+public:
+    enum {
+        Depth = 16,
+        // Maximum payload of a legacy advertising PDU.
+        PayloadCapacity = 31
+    };
+
+    int count() const;
+
+    void appendSlot();
+    void removeSlots(int first, int count);
+
+    void record(int slot, qint64 timestamp, qint16 rssi,
+                const QByteArray &payload);
+
+    int sampleCount(int slot) const;
+    qint16 currentRssi(int slot) const;
+    qreal averageRssi(int slot) const;
+    qint64 advertisementInterval(int slot) const;
+    QByteArray payload(int slot, int age = 0) const;
+
+private:
+    int sampleIndex(int slot, int age) const;
+
+    QVector<qint64> m_timestamps;
+    QVector<qint16> m_rssi;
+    QVector<quint8> m_payloadSizes;
+    QVector<char> m_payloads;
+
+    QVector<quint8> m_heads;
+    QVector<quint8> m_counts;
+    QVector<qint32> m_rssiSums;
+};
+
+#endif // DEVICEHISTORY_H
@@ -1,61 +1,172 @@
 #include "devicesmodel.h"
+#include "tracer.h"
 
-#include <QBluetoothDeviceDiscoveryAgent>
 #include <QLoggingCategory>
+#include <QTimer>
 
 Q_DECLARE_LOGGING_CATEGORY(BLE_DEVICES_MODEL)
 
 enum {
     DeviceNameRole = Qt::UserRole + 1,
-    DeviceAddressRole
+    DeviceAddressRole,
+    DeviceRssiRole,
+    DeviceRssiAverageRole,
+    DeviceAdvertisementIntervalRole
 };
 
+// Lower bound for the eviction check period, so that very short TTLs
+// do not turn the check into a busy loop.
+enum { MinimumEvictionInterval = 250 };
+
+// Devices are indexed by the 48-bit Bluetooth address. Platforms which
+// hide the address (e.g. CoreBluetooth) report a null one, in which case
+// the hash of the device UUID is used instead, tagged by the high bit so
+// that it can never clash with a real address.
+static quint64 deviceKey(const QBluetoothDeviceInfo &device)
+{
+    const auto address = device.address();
+    if (!address.isNull())
+        return address.toUInt64();
+    return (quint64(1) << 63) | qHash(device.deviceUuid());
+}
+
 DevicesModel::DevicesModel(QObject *parent)
+    : DevicesModel(BleBackend::defaultBackend(), parent)
+{
+}
+
+DevicesModel::DevicesModel(BleBackend *backend, QObject *parent)
     : QAbstractListModel(parent)
-    , m_discoveryAgent(new QBluetoothDeviceDiscoveryAgent(this))
+    , m_scanner(backend->createDeviceScanner(this))
+    , m_insertionBatcher(new UpdateBatcher(this))
+    , m_filter(new DeviceFilter(this))
+    , m_scheduler(new ScanScheduler(this))
+    , m_evictionTimer(new QTimer(this))
+    , m_discoveryTimeout(m_scanner->lowEnergyDiscoveryTimeout())
 {
-    connect(m_discoveryAgent, &QBluetoothDeviceDiscoveryAgent::canceled,
+    m_clock.start();
+
+    m_insertionBatcher->setFlushHandler([this]() {
+        flushPendingDevices();
+    });
+
+    connect(m_scanner, &DeviceScanner::canceled,
             [this]() {
+        Tracer::end("scan", "scan window", m_scanTraceId);
+        finishScanTime();
+        // Paused, e.g. while connecting.
+        if (m_scheduler->isActive()) {
+            m_scheduler->finishWindow();
+            return;
+        }
         setRunning(false);
     });
 
-    connect(m_discoveryAgent, &QBluetoothDeviceDiscoveryAgent::finished,
+    connect(m_scanner, &DeviceScanner::finished,
             [this]() {
+        Tracer::end("scan", "scan window", m_scanTraceId);
+        finishScanTime();
+        m_insertionBatcher->flush();
+        if (m_scheduler->isActive()) {
+            m_scheduler->finishWindow();
+            return;
+        }
+        if (m_continuous) {
+            qCDebug(BLE_DEVICES_MODEL) << "Restart devices discovery";
+            startScanner();
+            return;
+        }
         setRunning(false);
     });
 
-    connect(m_discoveryAgent, &QBluetoothDeviceDiscoveryAgent::deviceDiscovered,
+    connect(m_scheduler, &ScanScheduler::scanRequested,
+            this, &DevicesModel::startScanner);
+    connect(m_scheduler, &ScanScheduler::stopRequested,
+            this, [this]() {
+        m_scanner->stop();
+    });
+
+    connect(m_evictionTimer, &QTimer::timeout,
+            [this]() {
+        evictStaleDevices();
+    });
+
+    connect(m_scanner, &DeviceScanner::deviceDiscovered,
             [this](const QBluetoothDeviceInfo &device) {
-        if (m_devices.contains(device)) {
-            qCWarning(BLE_DEVICES_MODEL) << "Nothing to add, device already is in model:"
-                                         << device.name();
+        if (!m_filter->accepts(device))
             return;
-        }
+        addDevice(device);
+    });
 
-        qCDebug(BLE_DEVICES_MODEL) << "Add device:" << device.name();
-        const auto rowsCount = m_devices.count();
-        beginInsertRows(QModelIndex(), rowsCount, rowsCount);
-        m_devices.append(device);
-        endInsertRows();
+    connect(m_scanner, &DeviceScanner::deviceUpdated,
+            [this](const QBluetoothDeviceInfo &device,
+                   QBluetoothDeviceInfo::Fields updatedFields) {
+        if (!m_filter->accepts(device))
+            return;
+        updateDevice(device, updatedFields);
     });
 
-    connect(m_discoveryAgent, QOverload<QBluetoothDeviceDiscoveryAgent::Error>::of(
-                &QBluetoothDeviceDiscoveryAgent::error),
+    connect(m_scanner, &DeviceScanner::errorOccurred,
+            this, [this]() {
+        Tracer::end("scan", "scan window", m_scanTraceId);
+        finishScanTime();
+        // Retrying every window would only repeat the error.
+        if (m_scheduler->isActive()) {
+            m_scheduler->stop();
+            setRunning(false);
+        }
+    });
+    connect(m_scanner, &DeviceScanner::errorOccurred,
             this, &DevicesModel::errorOccurred);
 }
 
 int DevicesModel::discoveryTimeout() const
 {
-    return m_discoveryAgent->lowEnergyDiscoveryTimeout();
+    return m_discoveryTimeout;
 }
 
 void DevicesModel::setDiscoveryTimeout(int discoveryTimeout)
 {
-    if (m_discoveryAgent->lowEnergyDiscoveryTimeout() == discoveryTimeout)
+    if (m_discoveryTimeout == discoveryTimeout)
+        return;
+    m_discoveryTimeout = discoveryTimeout;
+    qCDebug(BLE_DEVICES_MODEL) << "Set discovery timeout:" << m_discoveryTimeout;
+    emit discoveryTimeoutChanged(m_discoveryTimeout);
+}
+
+bool DevicesModel::isContinuous() const
+{
+    return m_continuous;
+}
+
+void DevicesModel::setContinuous(bool continuous)
+{
+    if (m_continuous == continuous)
         return;
-    m_discoveryAgent->setLowEnergyDiscoveryTimeout(discoveryTimeout);
-    qCDebug(BLE_DEVICES_MODEL) << "Set discovery timeout:" << discoveryTimeout;
-    emit discoveryTimeoutChanged(discoveryTimeout);
+    m_continuous = continuous;
+    qCDebug(BLE_DEVICES_MODEL) << "Set continuous:" << m_continuous;
+    emit continuousChanged(m_continuous);
+}
+
+int DevicesModel::deviceTtl() const
+{
+    return m_deviceTtl;
+}
+
+void DevicesModel::setDeviceTtl(int deviceTtl)
+{
+    if (m_deviceTtl == deviceTtl)
+        return;
+    m_deviceTtl = deviceTtl;
+    qCDebug(BLE_DEVICES_MODEL) << "Set device TTL:" << m_deviceTtl;
+
+    if (m_deviceTtl > 0) {
+        m_evictionTimer->start(qMax(m_deviceTtl / 2, int(MinimumEvictionInterval)));
+    } else {
+        m_evictionTimer->stop();
+    }
+
+    emit deviceTtlChanged(m_deviceTtl);
 }
 
 bool DevicesModel::isRunning() const
@@ -74,7 +185,22 @@ void DevicesModel::setRunning(bool running)
 
 QString DevicesModel::errorString() const
 {
-    return m_discoveryAgent->errorString();
+    return m_scanner->errorString();
+}
+
+UpdateBatcher *DevicesModel::insertionBatcher() const
+{
+    return m_insertionBatcher;
+}
+
+DeviceFilter *DevicesModel::filter() const
+{
+    return m_filter;
+}
+
+ScanScheduler *DevicesModel::scheduler() const
+{
+    return m_scheduler;
 }
 
 void DevicesModel::update()
@@ -83,7 +209,188 @@ void DevicesModel::update()
         return;
     qCDebug(BLE_DEVICES_MODEL) << "Start devices discovery";
     setRunning(true);
-    m_discoveryAgent->start(QBluetoothDeviceDiscoveryAgent::LowEnergyMethod);
+    if (m_scheduler->isEnabled()) {
+        m_scheduler->start();
+        return;
+    }
+    startScanner();
+}
+
+void DevicesModel::stop()
+{
+    if (!m_running)
+        return;
+    qCDebug(BLE_DEVICES_MODEL) << "Stop devices discovery";
+    if (m_scheduler->isActive()) {
+        const auto scanning = m_scheduler->isScanning();
+        m_scheduler->stop();
+        // Between two windows, there is no scan to cancel.
+        if (!scanning) {
+            setRunning(false);
+            return;
+        }
+    }
+    m_scanner->stop();
+}
+
+void DevicesModel::startScanner()
+{
+    m_scanner->setLowEnergyDiscoveryTimeout(m_scheduler->isActive() ? m_scheduler->scanWindow()
+                                                                    : m_discoveryTimeout);
+    if (Tracer::isEnabled()) {
+        m_scanTraceId = Tracer::nextId();
+        Tracer::begin("scan", "scan window", m_scanTraceId);
+    }
+    m_scanClock.start();
+    m_scanner->start();
+}
+
+qint64 DevicesModel::scanTime() const
+{
+    return m_scanTime + (m_scanClock.isValid() ? m_scanClock.elapsed() : 0);
+}
+
+void DevicesModel::finishScanTime()
+{
+    if (!m_scanClock.isValid())
+        return;
+    m_scanTime += m_scanClock.elapsed();
+    m_scanClock.invalidate();
+}
+
+void DevicesModel::addDevice(const QBluetoothDeviceInfo &device)
+{
+    const auto key = deviceKey(device);
+    m_scheduler->recordDevice(key, !m_deviceRows.contains(key));
+    if (m_deviceRows.contains(key)) {
+        // The agent reports a known device again when it is re-advertised,
+        // so treat it as an update of the existing row.
+        updateDevice(device, QBluetoothDeviceInfo::Field::All);
+        return;
+    }
+
+    qCDebug(BLE_DEVICES_MODEL) << "Add device:" << device.name();
+    const auto row = m_devices.count() + m_pendingDevices.count();
+    m_pendingDevices.append(device);
+    m_deviceRows.insert(key, row);
+    m_lastSeen.append(scanTime());
+    m_history.appendSlot();
+    recordSample(row, device);
+    m_insertionBatcher->schedule();
+}
+
+void DevicesModel::updateDevice(const QBluetoothDeviceInfo &device,
+                                QBluetoothDeviceInfo::Fields updatedFields)
+{
+    const auto key = deviceKey(device);
+    const auto rowIt = m_deviceRows.constFind(key);
+    if (rowIt == m_deviceRows.cend()) {
+        addDevice(device);
+        return;
+    }
+    m_scheduler->recordDevice(key, false);
+
+    qCDebug(BLE_DEVICES_MODEL) << "Update device:" << device.name()
+                               << "fields:" << updatedFields;
+    const auto row = rowIt.value();
+    m_lastSeen[row] = scanTime();
+    if (updatedFields & (QBluetoothDeviceInfo::Field::RSSI
+                         | QBluetoothDeviceInfo::Field::ManufacturerData)) {
+        recordSample(row, device);
+    }
+
+    const auto rowsCount = m_devices.count();
+    if (row >= rowsCount) {
+        // Not yet visible, the insertion will carry the latest data.
+        m_pendingDevices[row - rowsCount] = device;
+        return;
+    }
+
+    m_devices[row] = device;
+    const auto modelIndex = index(row, 0);
+    emit dataChanged(modelIndex, modelIndex);
+}
+
+void DevicesModel::recordSample(int row, const QBluetoothDeviceInfo &device)
+{
+    // The raw advertising PDU is not exposed by Qt, so the manufacturer
+    // specific data (company identifier first, as on air) stands for it.
+    QByteArray payload;
+    const auto manufacturerIds = device.manufacturerIds();
+    if (!manufacturerIds.isEmpty()) {
+        const auto manufacturerId = manufacturerIds.constFirst();
+        payload.append(char(manufacturerId & 0xff));
+        payload.append(char(manufacturerId >> 8));
+        payload.append(device.manufacturerData(manufacturerId));
+    }
+
+    m_history.record(row, m_clock.elapsed(), device.rssi(), payload);
+}
+
+void DevicesModel::flushPendingDevices()
+{
+    if (m_pendingDevices.isEmpty())
+        return;
+
+    const auto rowsCount = m_devices.count();
+    beginInsertRows(QModelIndex(), rowsCount,
+                    rowsCount + m_pendingDevices.count() - 1);
+    m_devices.append(m_pendingDevices);
+    m_pendingDevices.clear();
+    endInsertRows();
+}
+
+void DevicesModel::evictStaleDevices()
+{
+    // Nothing is heard from anybody while the scanner is off, whether the
+    // scan is stopped, paused for a connection or between two windows of
+    // the scheduler, so the devices age by the time spent scanning.
+    if (!m_running || m_deviceTtl <= 0)
+        return;
+
+    // Pending rows are inserted first, so that all the stale rows can be
+    // removed from the visible range only.
+    m_insertionBatcher->flush();
+
+    const auto deadline = scanTime() - m_deviceTtl;
+    bool evicted = false;
+
+    // Walk backwards removing each contiguous run of stale rows at once,
+    // so that the lower rows stay valid while the upper ones are removed.
+    auto row = m_devices.count() - 1;
+    while (row >= 0) {
+        if (m_lastSeen.at(row) > deadline) {
+            --row;
+            continue;
+        }
+
+        const auto last = row;
+        while (row > 0 && m_lastSeen.at(row - 1) <= deadline)
+            --row;
+        const auto first = row;
+        const auto count = last - first + 1;
+
+        qCDebug(BLE_DEVICES_MODEL) << "Evict devices:" << count;
+        beginRemoveRows(QModelIndex(), first, last);
+        m_devices.remove(first, count);
+        m_lastSeen.remove(first, count);
+        m_history.removeSlots(first, count);
+        endRemoveRows();
+
+        evicted = true;
+        --row;
+    }
+
+    if (evicted)
+        rebuildDeviceRows();
+}
+
+void DevicesModel::rebuildDeviceRows()
+{
+    m_deviceRows.clear();
+    m_deviceRows.reserve(m_devices.count());
+    for (auto row = 0; row < m_devices.count(); ++row)
+        m_deviceRows.insert(deviceKey(m_devices.at(row)), row);
 }
 
 int DevicesModel::rowCount(const QModelIndex &parent) const
@@ -106,6 +413,12 @@ QVariant DevicesModel::data(const QModelIndex &index, int role) const
         return device.name();
     case DeviceAddressRole:
         return device.address().toString();
+    case DeviceRssiRole:
+        return m_history.currentRssi(row);
+    case DeviceRssiAverageRole:
+        return m_history.averageRssi(row);
+    case DeviceAdvertisementIntervalRole:
+        return m_history.advertisementInterval(row);
     default:
         return QVariant();
     }
@@ -115,6 +428,9 @@ QHash<int, QByteArray> DevicesModel::roleNames() const
 {
     return {
         { DeviceNameRole, "name" },
-        { DeviceAddressRole, "address" }
+        { DeviceAddressRole, "address" },
+        { DeviceRssiRole, "rssi" },
+        { DeviceRssiAverageRole, "rssiAverage" },
+        { DeviceAdvertisementIntervalRole, "advertisementInterval" }
     };
 }
@@ -1,10 +1,17 @@
 #ifndef DEVICESMODEL_H
 #define DEVICESMODEL_H
 
+#include "blebackend.h"
+#include "devicefilter.h"
+#include "devicehistory.h"
+#include "scanscheduler.h"
+#include "updatebatcher.h"
+
 #include <QBluetoothDeviceInfo>
 #include <QAbstractListModel>
+#include <QElapsedTimer>
 
-class QBluetoothDeviceDiscoveryAgent;
+class QTimer;
 
 class DevicesModel : public QAbstractListModel
 {
@@ -13,36 +20,89 @@ class DevicesModel : public QAbstractListModel
     Q_PROPERTY(int discoveryTimeout READ discoveryTimeout
                WRITE setDiscoveryTimeout NOTIFY discoveryTimeoutChanged)
 
+    Q_PROPERTY(bool continuous READ isContinuous
+               WRITE setContinuous NOTIFY continuousChanged)
+    Q_PROPERTY(int deviceTtl READ deviceTtl
+               WRITE setDeviceTtl NOTIFY deviceTtlChanged)
+
     Q_PROPERTY(bool running READ isRunning NOTIFY runningChanged)
     Q_PROPERTY(QString errorString READ errorString NOTIFY errorOccurred)
+    Q_PROPERTY(UpdateBatcher *insertionBatcher READ insertionBatcher CONSTANT)
+    Q_PROPERTY(DeviceFilter *filter READ filter CONSTANT)
+    Q_PROPERTY(ScanScheduler *scheduler READ scheduler CONSTANT)
 
 public:
     explicit DevicesModel(QObject *parent = nullptr);
+    explicit DevicesModel(BleBackend *backend, QObject *parent = nullptr);
 
     int discoveryTimeout() const;
     void setDiscoveryTimeout(int discoveryTimeout);
 
+    bool isContinuous() const;
+    void setContinuous(bool continuous);
+
+    int deviceTtl() const;
+    void setDeviceTtl(int deviceTtl);
+
     bool isRunning() const;
     QString errorString() const;
+    UpdateBatcher *insertionBatcher() const;
+    DeviceFilter *filter() const;
+    // When enabled, update() starts duty cycled scan windows instead of
+    // a single (or continuous) scan, until stop().
+    ScanScheduler *scheduler() const;
 
     Q_INVOKABLE void update();
+    Q_INVOKABLE void stop();
 
 signals:
     void discoveryTimeoutChanged(int discoveryTimeout);
+    void continuousChanged(bool continuous);
+    void deviceTtlChanged(int deviceTtl);
 
     void runningChanged(bool running);
     void errorOccurred();
 
 private:
     void setRunning(bool running);
+    void startScanner();
+    qint64 scanTime() const;
+    void finishScanTime();
+
+    void addDevice(const QBluetoothDeviceInfo &device);
+    void updateDevice(const QBluetoothDeviceInfo &device,
+                      QBluetoothDeviceInfo::Fields updatedFields);
+    void recordSample(int row, const QBluetoothDeviceInfo &device);
+    void flushPendingDevices();
+    void evictStaleDevices();
+    void rebuildDeviceRows();
 
     int rowCount(const QModelIndex &parent) const final;
     QVariant data(const QModelIndex &index, int role) const final;
     QHash<int, QByteArray> roleNames() const final;
 
-    QBluetoothDeviceDiscoveryAgent *m_discoveryAgent = nullptr;
+    DeviceScanner *m_scanner = nullptr;
+    UpdateBatcher *m_insertionBatcher = nullptr;
+    DeviceFilter *m_filter = nullptr;
+    ScanScheduler *m_scheduler = nullptr;
+    QTimer *m_evictionTimer = nullptr;
+    QElapsedTimer m_clock;
+    // Runs while the scanner does, m_scanTime sums the previous runs.
+    QElapsedTimer m_scanClock;
+    qint64 m_scanTime = 0;
+    quint64 m_scanTraceId = 0;
+    int m_discoveryTimeout = 0;
     bool m_running = false;
+    bool m_continuous = false;
+    int m_deviceTtl = 0;
     QVector<QBluetoothDeviceInfo> m_devices;
+    QVector<QBluetoothDeviceInfo> m_pendingDevices;
+    // Rows at or past m_devices.count() refer to m_pendingDevices.
+    QHash<quint64, int> m_deviceRows;
+    // Milliseconds of scanTime(), indexed by row (pending rows included).
+    QVector<qint64> m_lastSeen;
+    // Slots are indexed by row too.
+    DeviceHistory m_history;
 };
 
 #endif // DEVICESMODEL_H
@@ -0,0 +1,664 @@
+#include "gattcache.h"
+
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QLoggingCategory>
+#include <QSaveFile>
+#include <QTimer>
+
+#include <algorithm>
+
+Q_DECLARE_LOGGING_CATEGORY(BLE_GATT_CACHE)
+
+static const quint32 CacheMagic = 0x47415443; // "GATC"
+static const quint16 CacheVersion = 1;
+
+enum : quint8 {
+    AddressKey = 0,
+    DeviceModelKey = 1
+};
+
+// Changes are written out after a quiet period, a discovery stores
+// many services in a row.
+enum { SaveDelay = 1000 };
+
+static QString &defaultFileNameInstance()
+{
+    static QString fileName;
+    return fileName;
+}
+
+static QDataStream &operator<<(QDataStream &stream, const GattDescriptorInfo &descriptor)
+{
+    return stream << static_cast<const QUuid &>(descriptor.uuid)
+                  << descriptor.name << descriptor.value;
+}
+
+static QDataStream &operator>>(QDataStream &stream, GattDescriptorInfo &descriptor)
+{
+    QUuid uuid;
+    stream >> uuid >> descriptor.name >> descriptor.value;
+    descriptor.uuid = QBluetoothUuid(uuid);
+    return stream;
+}
+
+static QDataStream &operator<<(QDataStream &stream, const GattCharacteristicInfo &characteristic)
+{
+    return stream << static_cast<const QUuid &>(characteristic.uuid)
+                  << characteristic.name
+                  << quint8(characteristic.properties)
+                  << characteristic.descriptors;
+}
+
+static QDataStream &operator>>(QDataStream &stream, GattCharacteristicInfo &characteristic)
+{
+    QUuid uuid;
+    quint8 properties = 0;
+    stream >> uuid >> characteristic.name >> properties >> characteristic.descriptors;
+    characteristic.uuid = QBluetoothUuid(uuid);
+    characteristic.properties = QLowEnergyCharacteristic::PropertyTypes(properties);
+    return stream;
+}
+
+static QDataStream &operator<<(QDataStream &stream, const GattCache::Service &service)
+{
+    return stream << static_cast<const QUuid &>(service.uuid) << service.name
+                  << service.detailed << service.characteristics;
+}
+
+static QDataStream &operator>>(QDataStream &stream, GattCache::Service &service)
+{
+    QUuid uuid;
+    stream >> uuid >> service.name >> service.detailed >> service.characteristics;
+    service.uuid = QBluetoothUuid(uuid);
+    return stream;
+}
+
+static bool sameServices(const GattCache::Layout &left, const GattCache::Layout &right)
+{
+    return left.count() == right.count()
+            && std::equal(left.cbegin(), left.cend(), right.cbegin(),
+                          [](const GattCache::Service &l, const GattCache::Service &r) {
+        return l.uuid == r.uuid;
+    });
+}
+
+static bool sameCharacteristics(const GattCache::Service &left, const GattCache::Service &right)
+{
+    const auto sameDescriptor = [](const GattDescriptorInfo &l, const GattDescriptorInfo &r) {
+        return l.uuid == r.uuid;
+    };
+    const auto sameCharacteristic = [sameDescriptor](const GattCharacteristicInfo &l,
+                                                     const GattCharacteristicInfo &r) {
+        return l.uuid == r.uuid && l.properties == r.properties
+                && l.descriptors.count() == r.descriptors.count()
+                && std::equal(l.descriptors.cbegin(), l.descriptors.cend(),
+                              r.descriptors.cbegin(), sameDescriptor);
+    };
+    return left.characteristics.count() == right.characteristics.count()
+            && std::equal(left.characteristics.cbegin(), left.characteristics.cend(),
+                          right.characteristics.cbegin(), sameCharacteristic);
+}
+
+// GattCache
+
+GattCache::GattCache(QObject *parent)
+    : QObject(parent)
+    , m_saveTimer(new QTimer(this))
+{
+    m_saveTimer->setSingleShot(true);
+    m_saveTimer->setInterval(SaveDelay);
+    connect(m_saveTimer, &QTimer::timeout, this, &GattCache::save);
+
+    setFileName(defaultFileName());
+}
+
+GattCache::~GattCache()
+{
+    if (m_saveTimer->isActive())
+        save();
+}
+
+QString GattCache::fileName() const
+{
+    return m_fileName;
+}
+
+void GattCache::setFileName(const QString &fileName)
+{
+    if (m_fileName == fileName)
+        return;
+    if (m_saveTimer->isActive())
+        save();
+    m_fileName = fileName;
+    qCDebug(BLE_GATT_CACHE) << "Set file name:" << m_fileName;
+    load();
+    emit fileNameChanged(m_fileName);
+}
+
+bool GattCache::shareByDeviceModel() const
+{
+    return m_shareByDeviceModel;
+}
+
+void GattCache::setShareByDeviceModel(bool shareByDeviceModel)
+{
+    if (m_shareByDeviceModel == shareByDeviceModel)
+        return;
+    m_shareByDeviceModel = shareByDeviceModel;
+    qCDebug(BLE_GATT_CACHE) << "Set share by device model:" << m_shareByDeviceModel;
+    emit shareByDeviceModelChanged(m_shareByDeviceModel);
+}
+
+int GattCache::entryCount() const
+{
+    return m_addressLayouts.count() + m_modelLayouts.count();
+}
+
+int GattCache::hits() const
+{
+    return m_hits;
+}
+
+int GattCache::misses() const
+{
+    return m_misses;
+}
+
+int GattCache::invalidations() const
+{
+    return m_invalidations;
+}
+
+GattCache::Layout GattCache::lookup(const QBluetoothAddress &address,
+                                    const QString &deviceModel)
+{
+    Layout layout;
+    auto found = false;
+    const auto addressLayoutIt = m_addressLayouts.constFind(address.toUInt64());
+    if (addressLayoutIt != m_addressLayouts.cend()) {
+        layout = addressLayoutIt.value();
+        found = true;
+    } else if (m_shareByDeviceModel && !deviceModel.isEmpty()) {
+        const auto modelLayoutIt = m_modelLayouts.constFind(deviceModel);
+        if (modelLayoutIt != m_modelLayouts.cend()) {
+            layout = modelLayoutIt.value();
+            found = true;
+        }
+    }
+
+    if (found)
+        ++m_hits;
+    else
+        ++m_misses;
+    qCDebug(BLE_GATT_CACHE) << (found ? "Hit:" : "Miss:") << address << deviceModel;
+    emit statisticsChanged();
+    return layout;
+}
+
+void GattCache::storeServices(const QBluetoothAddress &address,
+                              const QString &deviceModel, const Layout &services)
+{
+    store(address, deviceModel, [&services](Layout &layout) -> bool {
+        Layout merged;
+        merged.reserve(services.count());
+        for (const auto &service : services) {
+            const auto cachedIt = std::find_if(layout.cbegin(), layout.cend(),
+                                               [&service](const Service &cached) {
+                return cached.uuid == service.uuid;
+            });
+            merged.append((cachedIt != layout.cend()) ? *cachedIt : service);
+        }
+        const auto invalidated = !layout.isEmpty() && !sameServices(layout, merged);
+        layout = merged;
+        return invalidated;
+    });
+}
+
+void GattCache::storeService(const QBluetoothAddress &address,
+                             const QString &deviceModel, const Service &service)
+{
+    // Only the layout is kept, the values are those of the moment.
+    auto stored = service;
+    stored.detailed = true;
+    const QBluetoothUuid configDescriptorUuid(
+                QBluetoothUuid::ClientCharacteristicConfiguration);
+    for (auto &characteristic : stored.characteristics) {
+        characteristic.value.clear();
+        for (auto &descriptor : characteristic.descriptors) {
+            if (descriptor.uuid == configDescriptorUuid)
+                descriptor.value.clear();
+        }
+    }
+
+    store(address, deviceModel, [&stored](Layout &layout) -> bool {
+        const auto cachedIt = std::find_if(layout.begin(), layout.end(),
+                                           [&stored](const Service &cached) {
+            return cached.uuid == stored.uuid;
+        });
+        if (cachedIt == layout.end()) {
+            layout.append(stored);
+            return false;
+        }
+        const auto invalidated = cachedIt->detailed
+                && !sameCharacteristics(*cachedIt, stored);
+        *cachedIt = stored;
+        return invalidated;
+    });
+}
+
+void GattCache::store(const QBluetoothAddress &address, const QString &deviceModel,
+                      const std::function<bool(Layout &)> &update)
+{
+    auto invalidated = update(m_addressLayouts[address.toUInt64()]);
+    if (m_shareByDeviceModel && !deviceModel.isEmpty())
+        invalidated |= update(m_modelLayouts[deviceModel]);
+
+    if (invalidated) {
+        qCDebug(BLE_GATT_CACHE) << "Invalidate:" << address << deviceModel;
+        ++m_invalidations;
+    }
+    emit statisticsChanged();
+    scheduleSave();
+}
+
+void GattCache::clear()
+{
+    qCDebug(BLE_GATT_CACHE) << "Clear";
+    m_addressLayouts.clear();
+    m_modelLayouts.clear();
+    emit statisticsChanged();
+    scheduleSave();
+}
+
+void GattCache::resetStatistics()
+{
+    m_hits = 0;
+    m_misses = 0;
+    m_invalidations = 0;
+    emit statisticsChanged();
+}
+
+bool GattCache::save()
+{
+    m_saveTimer->stop();
+    if (m_fileName.isEmpty())
+        return true;
+
+    QDir().mkpath(QFileInfo(m_fileName).absolutePath());
+    QSaveFile file(m_fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qCWarning(BLE_GATT_CACHE) << "Unable to save:" << m_fileName
+                                  << file.errorString();
+        return false;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_12);
+    stream << CacheMagic << CacheVersion << quint32(entryCount());
+    for (auto layoutIt = m_addressLayouts.cbegin(); layoutIt != m_addressLayouts.cend(); ++layoutIt)
+        stream << quint8(AddressKey) << quint64(layoutIt.key()) << layoutIt.value();
+    for (auto layoutIt = m_modelLayouts.cbegin(); layoutIt != m_modelLayouts.cend(); ++layoutIt)
+        stream << quint8(DeviceModelKey) << layoutIt.key() << layoutIt.value();
+
+    if (!file.commit()) {
+        qCWarning(BLE_GATT_CACHE) << "Unable to save:" << m_fileName
+                                  << file.errorString();
+        return false;
+    }
+    qCDebug(BLE_GATT_CACHE) << "Saved entries:" << entryCount();
+    return true;
+}
+
+void GattCache::load()
+{
+    m_addressLayouts.clear();
+    m_modelLayouts.clear();
+
+    QFile file(m_fileName);
+    if (m_fileName.isEmpty() || !file.open(QIODevice::ReadOnly)) {
+        emit statisticsChanged();
+        return;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_12);
+    quint32 magic = 0;
+    quint16 version = 0;
+    quint32 count = 0;
+    stream >> magic >> version >> count;
+    if (magic != CacheMagic || version != CacheVersion) {
+        qCWarning(BLE_GATT_CACHE) << "Ignore incompatible cache:" << m_fileName;
+        emit statisticsChanged();
+        return;
+    }
+
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i) {
+        quint8 keyType = 0;
+        stream >> keyType;
+        if (keyType == AddressKey) {
+            quint64 address = 0;
+            Layout layout;
+            stream >> address >> layout;
+            m_addressLayouts.insert(address, layout);
+        } else if (keyType == DeviceModelKey) {
+            QString deviceModel;
+            Layout layout;
+            stream >> deviceModel >> layout;
+            m_modelLayouts.insert(deviceModel, layout);
+        } else {
+            stream.setStatus(QDataStream::ReadCorruptData);
+        }
+    }
+
+    if (stream.status() != QDataStream::Ok) {
+        qCWarning(BLE_GATT_CACHE) << "Ignore corrupted cache:" << m_fileName;
+        m_addressLayouts.clear();
+        m_modelLayouts.clear();
+    }
+    qCDebug(BLE_GATT_CACHE) << "Loaded entries:" << entryCount();
+    emit statisticsChanged();
+}
+
+void GattCache::scheduleSave()
+{
+    if (!m_fileName.isEmpty())
+        m_saveTimer->start();
+}
+
+QString GattCache::defaultFileName()
+{
+    return defaultFileNameInstance();
+}
+
+void GattCache::setDefaultFileName(const QString &fileName)
+{
+    defaultFileNameInstance() = fileName;
+}
+
+// CachedGattService
+
+CachedGattService::CachedGattService(const QBluetoothAddress &deviceAddress,
+                                     const GattCache::Service &cached,
+                                     QObject *parent)
+    : GattService(parent)
+    , m_deviceAddress(deviceAddress)
+    , m_cached(cached)
+    , m_state(cached.detailed ? QLowEnergyService::ServiceDiscovered
+                              : QLowEnergyService::DiscoveryRequired)
+{
+}
+
+GattService *CachedGattService::source() const
+{
+    return m_source;
+}
+
+void CachedGattService::setSource(GattService *source)
+{
+    if (m_source == source)
+        return;
+    if (m_source) {
+        snapshotSource();
+        m_source->disconnect(this);
+        delete m_source.data();
+    }
+
+    m_source = source;
+    if (!m_source)
+        return;
+
+    m_source->setParent(this);
+    connect(m_source, &GattService::stateChanged,
+            this, &CachedGattService::sourceStateChanged);
+    connect(m_source, &GattService::errorOccurred,
+            this, &GattService::errorOccurred);
+    connect(m_source, &GattService::characteristicChanged,
+            this, &GattService::characteristicChanged);
+    connect(m_source, &GattService::characteristicRead,
+            this, &GattService::characteristicRead);
+    connect(m_source, &GattService::characteristicWritten,
+            this, &GattService::characteristicWritten);
+    connect(m_source, &GattService::descriptorRead,
+            this, &GattService::descriptorRead);
+    connect(m_source, &GattService::descriptorWritten,
+            this, &GattService::descriptorWritten);
+    connect(m_source, &GattService::descriptorWritten,
+            this, [this](const QBluetoothUuid &characteristicUuid,
+                         const QBluetoothUuid &descriptorUuid, const QByteArray &value) {
+        if (descriptorUuid == QBluetoothUuid(QBluetoothUuid::ClientCharacteristicConfiguration))
+            m_clientConfigurations.insert(characteristicUuid, value);
+    });
+
+    if (m_source->state() == QLowEnergyService::ServiceDiscovered) {
+        sourceStateChanged(m_source->state());
+    } else if (m_cached.detailed || m_detailsRequested
+               || !m_pendingOperations.isEmpty()) {
+        // Confirms the cached details in the background.
+        m_source->discoverDetails();
+    } else {
+        // E.g. invalid since the previous link dropped.
+        setState(m_source->state());
+    }
+}
+
+QBluetoothAddress CachedGattService::deviceAddress() const
+{
+    return m_deviceAddress;
+}
+
+QBluetoothUuid CachedGattService::serviceUuid() const
+{
+    return m_cached.uuid;
+}
+
+QString CachedGattService::serviceName() const
+{
+    if (m_cached.name.isEmpty() && m_source)
+        return m_source->serviceName();
+    return m_cached.name;
+}
+
+QLowEnergyService::ServiceState CachedGattService::state() const
+{
+    return m_state;
+}
+
+void CachedGattService::discoverDetails()
+{
+    if (isForwarding())
+        return;
+    m_detailsRequested = true;
+    if (m_source && m_source->state() == QLowEnergyService::DiscoveryRequired)
+        m_source->discoverDetails();
+    if (!m_cached.detailed)
+        setState(QLowEnergyService::DiscoveringServices);
+}
+
+QVector<QBluetoothUuid> CachedGattService::characteristicUuids() const
+{
+    if (isForwarding())
+        return m_source->characteristicUuids();
+
+    QVector<QBluetoothUuid> characteristicUuids;
+    characteristicUuids.reserve(m_cached.characteristics.count());
+    for (const auto &characteristic : m_cached.characteristics)
+        characteristicUuids.append(characteristic.uuid);
+    return characteristicUuids;
+}
+
+GattCharacteristicInfo CachedGattService::characteristic(
+        const QBluetoothUuid &characteristicUuid) const
+{
+    if (isForwarding())
+        return m_source->characteristic(characteristicUuid);
+
+    const auto characteristicIt = std::find_if(
+                m_cached.characteristics.cbegin(), m_cached.characteristics.cend(),
+                [&characteristicUuid](const GattCharacteristicInfo &characteristic) {
+        return characteristic.uuid == characteristicUuid;
+    });
+    return (characteristicIt != m_cached.characteristics.cend())
+            ? *characteristicIt : GattCharacteristicInfo();
+}
+
+QByteArray CachedGattService::characteristicValue(
+        const QBluetoothUuid &characteristicUuid) const
+{
+    if (isForwarding())
+        return m_source->characteristicValue(characteristicUuid);
+    return characteristic(characteristicUuid).value;
+}
+
+QByteArray CachedGattService::descriptorValue(const QBluetoothUuid &characteristicUuid,
+                                              const QBluetoothUuid &descriptorUuid) const
+{
+    if (isForwarding())
+        return m_source->descriptorValue(characteristicUuid, descriptorUuid);
+
+    const auto descriptors = characteristic(characteristicUuid).descriptors;
+    for (const auto &descriptor : descriptors) {
+        if (descriptor.uuid == descriptorUuid)
+            return descriptor.value;
+    }
+    return QByteArray();
+}
+
+void CachedGattService::readCharacteristic(const QBluetoothUuid &characteristicUuid)
+{
+    runWhenDiscovered([this, characteristicUuid]() {
+        m_source->readCharacteristic(characteristicUuid);
+    });
+}
+
+void CachedGattService::writeCharacteristic(const QBluetoothUuid &characteristicUuid,
+                                            const QByteArray &value,
+                                            QLowEnergyService::WriteMode mode)
+{
+    runWhenDiscovered([this, characteristicUuid, value, mode]() {
+        m_source->writeCharacteristic(characteristicUuid, value, mode);
+    });
+}
+
+void CachedGattService::readDescriptor(const QBluetoothUuid &characteristicUuid,
+                                       const QBluetoothUuid &descriptorUuid)
+{
+    runWhenDiscovered([this, characteristicUuid, descriptorUuid]() {
+        m_source->readDescriptor(characteristicUuid, descriptorUuid);
+    });
+}
+
+void CachedGattService::writeDescriptor(const QBluetoothUuid &characteristicUuid,
+                                        const QBluetoothUuid &descriptorUuid,
+                                        const QByteArray &value)
+{
+    runWhenDiscovered([this, characteristicUuid, descriptorUuid, value]() {
+        m_source->writeDescriptor(characteristicUuid, descriptorUuid, value);
+    });
+}
+
+bool CachedGattService::isHoldingRequests() const
+{
+    return !m_pendingOperations.isEmpty();
+}
+
+bool CachedGattService::isForwarding() const
+{
+    return m_source && m_source->state() == QLowEnergyService::ServiceDiscovered;
+}
+
+void CachedGattService::setState(QLowEnergyService::ServiceState state)
+{
+    if (m_state == state)
+        return;
+    m_state = state;
+    emit stateChanged(m_state);
+}
+
+void CachedGattService::runWhenDiscovered(const std::function<void()> &operation)
+{
+    // An invalid source fails the operation right away.
+    if (isForwarding()
+            || (m_source && m_source->state() == QLowEnergyService::InvalidService)) {
+        operation();
+        return;
+    }
+    m_pendingOperations.append(operation);
+    if (m_source && m_source->state() == QLowEnergyService::DiscoveryRequired)
+        m_source->discoverDetails();
+}
+
+void CachedGattService::sourceStateChanged(QLowEnergyService::ServiceState state)
+{
+    switch (state) {
+    case QLowEnergyService::ServiceDiscovered: {
+        qCDebug(BLE_GATT_CACHE) << "Confirm service:" << m_cached.uuid;
+        snapshotSource();
+        restoreClientConfigurations();
+        // Reported even when the state does not change, so that the
+        // users pick up the real layout and values.
+        m_state = state;
+        emit stateChanged(m_state);
+        runPendingOperations();
+        break;
+    }
+    case QLowEnergyService::DiscoveryRequired:
+    case QLowEnergyService::DiscoveringServices:
+        // The cached details stand for them meanwhile.
+        if (!m_cached.detailed)
+            setState(state);
+        break;
+    case QLowEnergyService::InvalidService:
+        // The link dropped, what was known of the service stands for it
+        // until the next one. The operations waiting for it fail on the
+        // invalid source, the callers may retry them on the next link.
+        snapshotSource();
+        if (!m_cached.detailed)
+            setState(state);
+        runPendingOperations();
+        break;
+    default:
+        setState(state);
+        break;
+    }
+}
+
+void CachedGattService::snapshotSource()
+{
+    if (!m_source)
+        return;
+    const auto characteristicUuids = m_source->characteristicUuids();
+    if (characteristicUuids.isEmpty())
+        return;
+
+    m_cached.name = m_source->serviceName();
+    m_cached.detailed = true;
+    m_cached.characteristics.clear();
+    for (const auto &characteristicUuid : characteristicUuids)
+        m_cached.characteristics.append(m_source->characteristic(characteristicUuid));
+}
+
+void CachedGattService::runPendingOperations()
+{
+    const auto pendingOperations = m_pendingOperations;
+    m_pendingOperations.clear();
+    for (const auto &operation : pendingOperations)
+        operation();
+}
+
+void CachedGattService::restoreClientConfigurations()
+{
+    // The peer forgets them with the link, unless it is bonded.
+    const QBluetoothUuid configDescriptorUuid(
+                QBluetoothUuid::ClientCharacteristicConfiguration);
+    for (auto configIt = m_clientConfigurations.cbegin();
+         configIt != m_clientConfigurations.cend(); ++configIt) {
+        if (m_source->descriptorValue(configIt.key(), configDescriptorUuid) == configIt.value())
+            continue;
+        qCDebug(BLE_GATT_CACHE) << "Restore client configuration:" << configIt.key()
+                                << configIt.value().toHex();
+        m_source->writeDescriptor(configIt.key(), configDescriptorUuid, configIt.value());
+    }
+}
@@ -0,0 +1,171 @@
+#ifndef GATTCACHE_H
+#define GATTCACHE_H
+
+#include "blebackend.h"
+
+#include <QBluetoothAddress>
+#include <QHash>
+#include <QPointer>
+
+#include <functional>
+
+class QTimer;
+
+// Persistent store of the discovered GATT layouts (services,
+// characteristics and descriptors, without the characteristic values),
+// keyed by the device address and optionally by the device model, so
+// that a fleet of identical devices shares one layout. The models show
+// the cached layout right away and confirm it with the discovery
+// running in the background; a discovered layout which differs from
+// the cached one replaces it and counts as an invalidation.
+class GattCache : public QObject
+{
+    Q_OBJECT
+
+    Q_PROPERTY(QString fileName READ fileName WRITE setFileName NOTIFY fileNameChanged)
+    Q_PROPERTY(bool shareByDeviceModel READ shareByDeviceModel
+               WRITE setShareByDeviceModel NOTIFY shareByDeviceModelChanged)
+
+    Q_PROPERTY(int entryCount READ entryCount NOTIFY statisticsChanged)
+    Q_PROPERTY(int hits READ hits NOTIFY statisticsChanged)
+    Q_PROPERTY(int misses READ misses NOTIFY statisticsChanged)
+    Q_PROPERTY(int invalidations READ invalidations NOTIFY statisticsChanged)
+
+public:
+    struct Service
+    {
+        QBluetoothUuid uuid;
+        QString name;
+        // Only set once the details of the service have been discovered.
+        bool detailed = false;
+        QVector<GattCharacteristicInfo> characteristics;
+    };
+    using Layout = QVector<Service>;
+
+    explicit GattCache(QObject *parent = nullptr);
+    ~GattCache() override;
+
+    // An empty file name keeps the cache in memory only.
+    QString fileName() const;
+    void setFileName(const QString &fileName);
+
+    bool shareByDeviceModel() const;
+    void setShareByDeviceModel(bool shareByDeviceModel);
+
+    int entryCount() const;
+    int hits() const;
+    int misses() const;
+    int invalidations() const;
+
+    // Counts a hit or a miss.
+    Layout lookup(const QBluetoothAddress &address, const QString &deviceModel);
+
+    // Records the services found by a discovery, keeping the cached
+    // details of the services which are still there.
+    void storeServices(const QBluetoothAddress &address, const QString &deviceModel,
+                       const Layout &services);
+    // Records the details of one discovered service.
+    void storeService(const QBluetoothAddress &address, const QString &deviceModel,
+                      const Service &service);
+
+    Q_INVOKABLE void clear();
+    Q_INVOKABLE void resetStatistics();
+    bool save();
+
+    // The file used by the caches created by the models, set up once
+    // by the application. Empty by default.
+    static QString defaultFileName();
+    static void setDefaultFileName(const QString &fileName);
+
+signals:
+    void fileNameChanged(const QString &fileName);
+    void shareByDeviceModelChanged(bool shareByDeviceModel);
+    void statisticsChanged();
+
+private:
+    void store(const QBluetoothAddress &address, const QString &deviceModel,
+               const std::function<bool(Layout &layout)> &update);
+    void load();
+    void scheduleSave();
+
+    QString m_fileName;
+    bool m_shareByDeviceModel = false;
+    QHash<quint64, Layout> m_addressLayouts;
+    QHash<QString, Layout> m_modelLayouts;
+    QTimer *m_saveTimer = nullptr;
+    int m_hits = 0;
+    int m_misses = 0;
+    int m_invalidations = 0;
+};
+
+// Stands for a service of the cache until the real one, discovered on
+// the link, is attached to it. It answers from the cached layout until
+// the details of the real service are discovered, then forwards to it.
+// The operations requested meanwhile are queued and run then, unless the
+// link drops first: they fail then, as do the operations requested until
+// the next link, so that nothing is sent twice by a retrying caller.
+//
+// The services model wraps the discovered services too, so that they
+// outlive their link: the layout and the values of a source are kept
+// when it goes away, and the client configurations written through it
+// are written again to the next source, once its details are known.
+class CachedGattService final : public GattService
+{
+    Q_OBJECT
+
+public:
+    explicit CachedGattService(const QBluetoothAddress &deviceAddress,
+                               const GattCache::Service &cached,
+                               QObject *parent = nullptr);
+
+    // The source is owned by this object, the previous one is deleted.
+    GattService *source() const;
+    void setSource(GattService *source);
+
+    QBluetoothAddress deviceAddress() const final;
+    QBluetoothUuid serviceUuid() const final;
+    QString serviceName() const final;
+
+    QLowEnergyService::ServiceState state() const final;
+    void discoverDetails() final;
+
+    QVector<QBluetoothUuid> characteristicUuids() const final;
+    GattCharacteristicInfo characteristic(
+            const QBluetoothUuid &characteristicUuid) const final;
+    QByteArray characteristicValue(
+            const QBluetoothUuid &characteristicUuid) const final;
+    QByteArray descriptorValue(const QBluetoothUuid &characteristicUuid,
+                               const QBluetoothUuid &descriptorUuid) const final;
+
+    void readCharacteristic(const QBluetoothUuid &characteristicUuid) final;
+    void writeCharacteristic(const QBluetoothUuid &characteristicUuid,
+                             const QByteArray &value,
+                             QLowEnergyService::WriteMode mode) final;
+    void readDescriptor(const QBluetoothUuid &characteristicUuid,
+                        const QBluetoothUuid &descriptorUuid) final;
+    void writeDescriptor(const QBluetoothUuid &characteristicUuid,
+                         const QBluetoothUuid &descriptorUuid,
+                         const QByteArray &value) final;
+
+    bool isHoldingRequests() const final;
+
+private:
+    bool isForwarding() const;
+    void setState(QLowEnergyService::ServiceState state);
+    void runWhenDiscovered(const std::function<void()> &operation);
+    void sourceStateChanged(QLowEnergyService::ServiceState state);
+    void snapshotSource();
+    void restoreClientConfigurations();
+    void runPendingOperations();
+
+    QBluetoothAddress m_deviceAddress;
+    GattCache::Service m_cached;
+    QPointer<GattService> m_source;
+    QLowEnergyService::ServiceState m_state = QLowEnergyService::DiscoveryRequired;
+    bool m_detailsRequested = false;
+    QVector<std::function<void()>> m_pendingOperations;
+    // By characteristic, as last written.
+    QHash<QBluetoothUuid, QByteArray> m_clientConfigurations;
+};
+
+#endif // GATTCACHE_H
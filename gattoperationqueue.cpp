@@ -0,0 +1,534 @@
+#include "gattoperationqueue.h"
+#include "tracer.h"
+
+#include <QLoggingCategory>
+#include <QTimer>
+#include <QtEndian>
+
+#include <algorithm>
+
+Q_DECLARE_LOGGING_CATEGORY(BLE_OPERATIONS)
+
+enum { PriorityCount = GattOperationQueue::Background + 1 };
+
+GattOperationQueue::GattOperationQueue(QObject *parent)
+    : QObject(parent)
+    , m_metrics(LatencyMetrics::defaultMetrics())
+    , m_queues(PriorityCount)
+    , m_timeoutTimer(new QTimer(this))
+{
+    m_clock.start();
+    m_timeoutTimer->setSingleShot(true);
+    connect(m_timeoutTimer, &QTimer::timeout,
+            this, &GattOperationQueue::expireOperations);
+}
+
+GattService *GattOperationQueue::service() const
+{
+    return m_service;
+}
+
+void GattOperationQueue::setService(GattService *service)
+{
+    if (m_service == service)
+        return;
+
+    if (m_service)
+        m_service->disconnect(this);
+    failAll();
+    m_service = service;
+    if (!m_service)
+        return;
+
+    connect(m_service, &GattService::characteristicRead,
+            this, [this](const QBluetoothUuid &characteristicUuid) {
+        completeOperation(ReadCharacteristic, characteristicUuid, QBluetoothUuid());
+    });
+    connect(m_service, &GattService::characteristicWritten,
+            this, [this](const QBluetoothUuid &characteristicUuid) {
+        completeOperation(WriteCharacteristic, characteristicUuid, QBluetoothUuid());
+    });
+    connect(m_service, &GattService::descriptorRead,
+            this, [this](const QBluetoothUuid &characteristicUuid,
+                         const QBluetoothUuid &descriptorUuid) {
+        completeOperation(ReadDescriptor, characteristicUuid, descriptorUuid);
+    });
+    connect(m_service, &GattService::descriptorWritten,
+            this, [this](const QBluetoothUuid &characteristicUuid,
+                         const QBluetoothUuid &descriptorUuid) {
+        completeOperation(WriteDescriptor, characteristicUuid, descriptorUuid);
+    });
+    connect(m_service, &GattService::errorOccurred,
+            this, &GattOperationQueue::failOperation);
+}
+
+int GattOperationQueue::maxInFlight() const
+{
+    return m_maxInFlight;
+}
+
+void GattOperationQueue::setMaxInFlight(int maxInFlight)
+{
+    maxInFlight = qMax(maxInFlight, 1);
+    if (m_maxInFlight == maxInFlight)
+        return;
+    m_maxInFlight = maxInFlight;
+    qCDebug(BLE_OPERATIONS) << "Set max in flight:" << m_maxInFlight;
+    issueOperations();
+    emit maxInFlightChanged(m_maxInFlight);
+}
+
+int GattOperationQueue::timeout() const
+{
+    return m_timeout;
+}
+
+void GattOperationQueue::setTimeout(int timeout)
+{
+    if (m_timeout == timeout)
+        return;
+    m_timeout = timeout;
+    qCDebug(BLE_OPERATIONS) << "Set timeout:" << m_timeout;
+    emit timeoutChanged(m_timeout);
+}
+
+int GattOperationQueue::maxRetries() const
+{
+    return m_maxRetries;
+}
+
+void GattOperationQueue::setMaxRetries(int maxRetries)
+{
+    if (m_maxRetries == maxRetries)
+        return;
+    m_maxRetries = maxRetries;
+    qCDebug(BLE_OPERATIONS) << "Set max retries:" << m_maxRetries;
+    emit maxRetriesChanged(m_maxRetries);
+}
+
+int GattOperationQueue::pendingCount() const
+{
+    auto count = 0;
+    for (const auto &queue : m_queues)
+        count += queue.count();
+    return count;
+}
+
+int GattOperationQueue::inFlightCount() const
+{
+    return m_inFlight.count();
+}
+
+int GattOperationQueue::readCharacteristic(const QBluetoothUuid &characteristicUuid,
+                                           Priority priority)
+{
+    Operation operation;
+    operation.type = ReadCharacteristic;
+    operation.characteristicUuid = characteristicUuid;
+    return submit({ operation }, priority);
+}
+
+int GattOperationQueue::writeCharacteristic(const QBluetoothUuid &characteristicUuid,
+                                            const QByteArray &value,
+                                            QLowEnergyService::WriteMode mode,
+                                            Priority priority)
+{
+    Operation operation;
+    operation.type = WriteCharacteristic;
+    operation.characteristicUuid = characteristicUuid;
+    operation.value = value;
+    operation.writeMode = mode;
+    return submit({ operation }, priority);
+}
+
+int GattOperationQueue::readDescriptor(const QBluetoothUuid &characteristicUuid,
+                                       const QBluetoothUuid &descriptorUuid,
+                                       Priority priority)
+{
+    Operation operation;
+    operation.type = ReadDescriptor;
+    operation.characteristicUuid = characteristicUuid;
+    operation.descriptorUuid = descriptorUuid;
+    return submit({ operation }, priority);
+}
+
+int GattOperationQueue::writeDescriptor(const QBluetoothUuid &characteristicUuid,
+                                        const QBluetoothUuid &descriptorUuid,
+                                        const QByteArray &value,
+                                        Priority priority)
+{
+    Operation operation;
+    operation.type = WriteDescriptor;
+    operation.characteristicUuid = characteristicUuid;
+    operation.descriptorUuid = descriptorUuid;
+    operation.value = value;
+    return submit({ operation }, priority);
+}
+
+int GattOperationQueue::readAll(Priority priority)
+{
+    if (!m_service)
+        return -1;
+
+    QVector<Operation> operations;
+    const auto characteristicUuids = m_service->characteristicUuids();
+    for (const auto &characteristicUuid : characteristicUuids) {
+        const auto characteristic = m_service->characteristic(characteristicUuid);
+        if (!(characteristic.properties & QLowEnergyCharacteristic::Read))
+            continue;
+        Operation operation;
+        operation.type = ReadCharacteristic;
+        operation.characteristicUuid = characteristicUuid;
+        operations.append(operation);
+    }
+    return submit(operations, priority);
+}
+
+int GattOperationQueue::subscribeAll(bool enable, Priority priority)
+{
+    if (!m_service)
+        return -1;
+
+    const QBluetoothUuid configDescriptorUuid(
+                QBluetoothUuid::ClientCharacteristicConfiguration);
+
+    QVector<Operation> operations;
+    const auto characteristicUuids = m_service->characteristicUuids();
+    for (const auto &characteristicUuid : characteristicUuids) {
+        const auto characteristic = m_service->characteristic(characteristicUuid);
+        const auto &descriptors = characteristic.descriptors;
+        const auto hasConfigDescriptor = std::any_of(
+                    descriptors.cbegin(), descriptors.cend(),
+                    [configDescriptorUuid](const GattDescriptorInfo &descriptor) {
+            return descriptor.uuid == configDescriptorUuid;
+        });
+        if (!hasConfigDescriptor)
+            continue;
+
+        auto configuration = quint16(ClientConfigurationDisabled);
+        if (enable) {
+            if (characteristic.properties & QLowEnergyCharacteristic::Notify)
+                configuration = ClientConfigurationNotification;
+            else if (characteristic.properties & QLowEnergyCharacteristic::Indicate)
+                configuration = ClientConfigurationIndication;
+            else
+                continue;
+        }
+
+        Operation operation;
+        operation.type = WriteDescriptor;
+        operation.characteristicUuid = characteristicUuid;
+        operation.descriptorUuid = configDescriptorUuid;
+        operation.value.resize(sizeof(quint16));
+        qToLittleEndian(configuration, operation.value.data());
+        operations.append(operation);
+    }
+    return submit(operations, priority);
+}
+
+int GattOperationQueue::writeAll(const QVariantList &writes, Priority priority)
+{
+    QVector<Operation> operations;
+    operations.reserve(writes.count());
+    for (const auto &write : writes) {
+        const auto map = write.toMap();
+        Operation operation;
+        operation.type = WriteCharacteristic;
+        operation.characteristicUuid = QBluetoothUuid(map.value(QStringLiteral("uuid")).toString());
+        operation.value = QByteArray::fromHex(map.value(QStringLiteral("value")).toByteArray());
+        if (operation.characteristicUuid.isNull()) {
+            qCWarning(BLE_OPERATIONS) << "Skip write without characteristic:" << map;
+            continue;
+        }
+        operations.append(operation);
+    }
+    return submit(operations, priority);
+}
+
+void GattOperationQueue::clear()
+{
+    QVector<Operation> operations;
+    for (auto &queue : m_queues) {
+        operations += queue;
+        queue.clear();
+    }
+    qCDebug(BLE_OPERATIONS) << "Clear pending operations:" << operations.count();
+    for (const auto &operation : qAsConst(operations))
+        finishOperation(operation, false);
+    issueOperations();
+}
+
+// A string literal, as the tracer keeps the names by address.
+const char *GattOperationQueue::traceName(OperationType type)
+{
+    switch (type) {
+    case ReadCharacteristic:
+        return "read characteristic";
+    case WriteCharacteristic:
+        return "write characteristic";
+    case ReadDescriptor:
+        return "read descriptor";
+    case WriteDescriptor:
+        return "write descriptor";
+    }
+    return "operation";
+}
+
+int GattOperationQueue::submit(const QVector<Operation> &operations, Priority priority)
+{
+    if (operations.isEmpty())
+        return -1;
+
+    const auto jobId = m_nextJobId++;
+    Job job;
+    job.remaining = operations.count();
+    job.submitted = m_clock.elapsed();
+    m_jobs.insert(jobId, job);
+
+    qCDebug(BLE_OPERATIONS) << "Submit job:" << jobId << "operations:"
+                            << operations.count() << "priority:" << priority;
+
+    auto &queue = m_queues[priority];
+    for (auto operation : operations) {
+        operation.priority = priority;
+        operation.jobId = jobId;
+        queue.append(operation);
+    }
+    issueOperations();
+    return jobId;
+}
+
+void GattOperationQueue::issueOperations()
+{
+    while (m_service && m_inFlight.count() < m_maxInFlight) {
+        // The first non empty queue is the one of the highest priority.
+        auto queueIt = std::find_if(m_queues.begin(), m_queues.end(),
+                                    [](const QVector<Operation> &queue) {
+            return !queue.isEmpty();
+        });
+        if (queueIt == m_queues.end())
+            break;
+
+        auto operation = queueIt->takeFirst();
+        ++operation.attempts;
+        operation.deadline = m_clock.elapsed() + m_timeout;
+        operation.issued = m_clock.nsecsElapsed();
+        // Each attempt is a span of its own, on a track of its own.
+        if (Tracer::isEnabled()) {
+            operation.traceId = Tracer::nextId();
+            Tracer::begin("gatt", traceName(operation.type), operation.traceId,
+                          operation.characteristicUuid.toString());
+        }
+
+        // Unacknowledged writes never complete, they are done once sent.
+        const auto acknowledged = operation.type != WriteCharacteristic
+                || operation.writeMode == QLowEnergyService::WriteWithResponse;
+        // Added before the request, which may fail synchronously.
+        if (acknowledged)
+            m_inFlight.append(operation);
+
+        switch (operation.type) {
+        case ReadCharacteristic:
+            m_service->readCharacteristic(operation.characteristicUuid);
+            break;
+        case WriteCharacteristic:
+            m_service->writeCharacteristic(operation.characteristicUuid,
+                                           operation.value, operation.writeMode);
+            break;
+        case ReadDescriptor:
+            m_service->readDescriptor(operation.characteristicUuid,
+                                      operation.descriptorUuid);
+            break;
+        case WriteDescriptor:
+            m_service->writeDescriptor(operation.characteristicUuid,
+                                       operation.descriptorUuid, operation.value);
+            break;
+        }
+
+        if (!acknowledged) {
+            Tracer::end("gatt", traceName(operation.type), operation.traceId);
+            finishOperation(operation, true);
+        }
+    }
+
+    armTimeoutTimer();
+    emit countsChanged();
+}
+
+void GattOperationQueue::completeOperation(OperationType type,
+                                           const QBluetoothUuid &characteristicUuid,
+                                           const QBluetoothUuid &descriptorUuid)
+{
+    const auto operationIt = std::find_if(
+                m_inFlight.cbegin(), m_inFlight.cend(),
+                [type, &characteristicUuid, &descriptorUuid](const Operation &operation) {
+        return operation.type == type
+                && operation.characteristicUuid == characteristicUuid
+                && operation.descriptorUuid == descriptorUuid;
+    });
+    // Not one of ours, e.g. requested around the queue.
+    if (operationIt == m_inFlight.cend())
+        return;
+
+    const auto operation = *operationIt;
+    m_inFlight.erase(operationIt);
+    recordLatency(operation, true);
+    finishOperation(operation, true);
+    issueOperations();
+}
+
+void GattOperationQueue::failOperation(QLowEnergyService::ServiceError error)
+{
+    // The other errors, e.g. an operation on an invalid service, fail
+    // whatever is in flight first.
+    auto typed = true;
+    auto type = ReadCharacteristic;
+    switch (error) {
+    case QLowEnergyService::CharacteristicReadError:
+        type = ReadCharacteristic;
+        break;
+    case QLowEnergyService::CharacteristicWriteError:
+        type = WriteCharacteristic;
+        break;
+    case QLowEnergyService::DescriptorReadError:
+        type = ReadDescriptor;
+        break;
+    case QLowEnergyService::DescriptorWriteError:
+        type = WriteDescriptor;
+        break;
+    default:
+        typed = false;
+        break;
+    }
+
+    const auto operationIt = std::find_if(m_inFlight.cbegin(), m_inFlight.cend(),
+                                          [typed, type](const Operation &operation) {
+        return !typed || operation.type == type;
+    });
+    if (operationIt == m_inFlight.cend())
+        return;
+
+    const auto operation = *operationIt;
+    qCWarning(BLE_OPERATIONS) << "Operation failed:" << operation.characteristicUuid
+                              << error;
+    m_inFlight.erase(operationIt);
+    recordLatency(operation, false);
+    finishOperation(operation, false);
+    issueOperations();
+}
+
+void GattOperationQueue::finishOperation(const Operation &operation, bool succeeded)
+{
+    const auto jobIt = m_jobs.find(operation.jobId);
+    if (jobIt == m_jobs.end())
+        return;
+
+    if (succeeded)
+        ++jobIt->succeeded;
+    else
+        ++jobIt->failed;
+    if (--jobIt->remaining > 0)
+        return;
+
+    const auto job = jobIt.value();
+    m_jobs.erase(jobIt);
+    const auto latency = m_clock.elapsed() - job.submitted;
+    qCDebug(BLE_OPERATIONS) << "Job finished:" << operation.jobId
+                            << "succeeded:" << job.succeeded
+                            << "failed:" << job.failed
+                            << "latency:" << latency;
+    emit jobFinished(operation.jobId, job.succeeded, job.failed, latency);
+}
+
+void GattOperationQueue::recordLatency(const Operation &operation, bool succeeded)
+{
+    Tracer::end("gatt", traceName(operation.type), operation.traceId);
+    if (!m_metrics || !m_service)
+        return;
+
+    // The latency of the attempt on the link, not counting the time
+    // spent in the queue.
+    auto phase = LatencyMetrics::Read;
+    switch (operation.type) {
+    case ReadCharacteristic:
+    case ReadDescriptor:
+        phase = LatencyMetrics::Read;
+        break;
+    case WriteCharacteristic:
+        phase = LatencyMetrics::Write;
+        break;
+    case WriteDescriptor:
+        phase = (operation.descriptorUuid
+                 == QBluetoothUuid(QBluetoothUuid::ClientCharacteristicConfiguration))
+                ? LatencyMetrics::ClientConfigurationWrite : LatencyMetrics::Write;
+        break;
+    }
+    m_metrics->record(phase, m_service->deviceAddress(),
+                      m_clock.nsecsElapsed() - operation.issued, succeeded);
+}
+
+void GattOperationQueue::expireOperations()
+{
+    const auto now = m_clock.elapsed();
+    // Requests held by the service have not been sent yet, retrying them
+    // would only send them once more when they are.
+    const auto holding = m_service && m_service->isHoldingRequests();
+    QVector<Operation> retried;
+    for (auto operationIt = m_inFlight.begin(); operationIt != m_inFlight.end();) {
+        if (operationIt->deadline > now) {
+            ++operationIt;
+            continue;
+        }
+        if (holding) {
+            operationIt->deadline = now + m_timeout;
+            ++operationIt;
+            continue;
+        }
+        const auto operation = *operationIt;
+        operationIt = m_inFlight.erase(operationIt);
+        recordLatency(operation, false);
+
+        if (operation.attempts <= m_maxRetries) {
+            qCDebug(BLE_OPERATIONS) << "Retry operation:" << operation.characteristicUuid
+                                    << "attempt:" << operation.attempts + 1;
+            retried.append(operation);
+        } else {
+            qCWarning(BLE_OPERATIONS) << "Operation timed out:" << operation.characteristicUuid;
+            finishOperation(operation, false);
+        }
+    }
+
+    // The retries go first within their priority, in their order.
+    for (auto operationIt = retried.crbegin(); operationIt != retried.crend(); ++operationIt)
+        m_queues[operationIt->priority].prepend(*operationIt);
+    issueOperations();
+}
+
+void GattOperationQueue::armTimeoutTimer()
+{
+    if (m_inFlight.isEmpty()) {
+        m_timeoutTimer->stop();
+        return;
+    }
+
+    auto deadline = m_inFlight.constFirst().deadline;
+    for (const auto &operation : qAsConst(m_inFlight))
+        deadline = qMin(deadline, operation.deadline);
+    m_timeoutTimer->start(int(qMax(deadline - m_clock.elapsed(), qint64(0))));
+}
+
+void GattOperationQueue::failAll()
+{
+    auto operations = m_inFlight;
+    m_inFlight.clear();
+    for (const auto &operation : qAsConst(operations))
+        Tracer::end("gatt", traceName(operation.type), operation.traceId);
+    for (auto &queue : m_queues) {
+        operations += queue;
+        queue.clear();
+    }
+    for (const auto &operation : qAsConst(operations))
+        finishOperation(operation, false);
+    armTimeoutTimer();
+    emit countsChanged();
+}
@@ -0,0 +1,159 @@
+#ifndef GATTOPERATIONQUEUE_H
+#define GATTOPERATIONQUEUE_H
+
+#include "blebackend.h"
+#include "latencymetrics.h"
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QPointer>
+#include <QVariantList>
+#include <QVector>
+
+class QTimer;
+
+// Queues the GATT requests of one service. Interactive requests go
+// before the background ones, a few requests are kept in flight so that
+// the stack always has the next one at hand, and the requests which do
+// not complete in time are retried. Requests are grouped into jobs, a
+// single request or a batch, which complete as a whole.
+//
+// The completions do not carry any request identifier: they are matched
+// to the oldest request in flight of the same kind and attribute, and
+// the errors to the oldest request in flight of the same kind, since
+// the stack processes the requests in order.
+class GattOperationQueue : public QObject
+{
+    Q_OBJECT
+
+    Q_PROPERTY(int maxInFlight READ maxInFlight WRITE setMaxInFlight NOTIFY maxInFlightChanged)
+    Q_PROPERTY(int timeout READ timeout WRITE setTimeout NOTIFY timeoutChanged)
+    Q_PROPERTY(int maxRetries READ maxRetries WRITE setMaxRetries NOTIFY maxRetriesChanged)
+
+    Q_PROPERTY(int pendingCount READ pendingCount NOTIFY countsChanged)
+    Q_PROPERTY(int inFlightCount READ inFlightCount NOTIFY countsChanged)
+
+public:
+    enum Priority {
+        Interactive,
+        Background
+    };
+    Q_ENUM(Priority)
+
+    explicit GattOperationQueue(QObject *parent = nullptr);
+
+    GattService *service() const;
+    // Pending jobs of the previous service fail.
+    void setService(GattService *service);
+
+    int maxInFlight() const;
+    void setMaxInFlight(int maxInFlight);
+
+    // Milliseconds per attempt.
+    int timeout() const;
+    void setTimeout(int timeout);
+
+    int maxRetries() const;
+    void setMaxRetries(int maxRetries);
+
+    int pendingCount() const;
+    int inFlightCount() const;
+
+    // Each returns the identifier of the job, or -1 when there is
+    // nothing to do.
+    int readCharacteristic(const QBluetoothUuid &characteristicUuid,
+                           Priority priority = Interactive);
+    int writeCharacteristic(const QBluetoothUuid &characteristicUuid,
+                            const QByteArray &value,
+                            QLowEnergyService::WriteMode mode = QLowEnergyService::WriteWithResponse,
+                            Priority priority = Interactive);
+    int readDescriptor(const QBluetoothUuid &characteristicUuid,
+                       const QBluetoothUuid &descriptorUuid,
+                       Priority priority = Interactive);
+    int writeDescriptor(const QBluetoothUuid &characteristicUuid,
+                        const QBluetoothUuid &descriptorUuid,
+                        const QByteArray &value,
+                        Priority priority = Interactive);
+
+    // Batches.
+    Q_INVOKABLE int readAll(Priority priority = Background);
+    // Notifications, or indications for the characteristics which only
+    // support those; disabled when enable is false.
+    Q_INVOKABLE int subscribeAll(bool enable, Priority priority = Background);
+    // A list of { "uuid": ..., "value": <hex> } maps.
+    Q_INVOKABLE int writeAll(const QVariantList &writes,
+                             Priority priority = Background);
+
+    Q_INVOKABLE void clear();
+
+signals:
+    void maxInFlightChanged(int maxInFlight);
+    void timeoutChanged(int timeout);
+    void maxRetriesChanged(int maxRetries);
+    void countsChanged();
+
+    // Latency in milliseconds, from the submission of the job to the
+    // completion of its last request.
+    void jobFinished(int jobId, int succeeded, int failed, qint64 latency);
+
+private:
+    enum OperationType {
+        ReadCharacteristic,
+        WriteCharacteristic,
+        ReadDescriptor,
+        WriteDescriptor
+    };
+
+    struct Operation
+    {
+        OperationType type = ReadCharacteristic;
+        QBluetoothUuid characteristicUuid;
+        QBluetoothUuid descriptorUuid;
+        QByteArray value;
+        QLowEnergyService::WriteMode writeMode = QLowEnergyService::WriteWithResponse;
+        Priority priority = Interactive;
+        int jobId = -1;
+        int attempts = 0;
+        qint64 deadline = 0;
+        // Nanoseconds, of the last attempt.
+        qint64 issued = 0;
+        // Of the trace span of the last attempt, 0 when not traced.
+        quint64 traceId = 0;
+    };
+
+    struct Job
+    {
+        int remaining = 0;
+        int succeeded = 0;
+        int failed = 0;
+        qint64 submitted = 0;
+    };
+
+    static const char *traceName(OperationType type);
+
+    int submit(const QVector<Operation> &operations, Priority priority);
+    void issueOperations();
+    void completeOperation(OperationType type, const QBluetoothUuid &characteristicUuid,
+                           const QBluetoothUuid &descriptorUuid);
+    void failOperation(QLowEnergyService::ServiceError error);
+    void finishOperation(const Operation &operation, bool succeeded);
+    void recordLatency(const Operation &operation, bool succeeded);
+    void expireOperations();
+    void armTimeoutTimer();
+    void failAll();
+
+    QPointer<GattService> m_service;
+    QPointer<LatencyMetrics> m_metrics;
+    // Indexed by priority.
+    QVector<QVector<Operation>> m_queues;
+    QVector<Operation> m_inFlight;
+    QHash<int, Job> m_jobs;
+    QTimer *m_timeoutTimer = nullptr;
+    QElapsedTimer m_clock;
+    int m_maxInFlight = 4;
+    int m_timeout = 5000;
+    int m_maxRetries = 2;
+    int m_nextJobId = 0;
+};
+
+#endif // GATTOPERATIONQUEUE_H
@@ -0,0 +1,735 @@
+#include "gatttreemodel.h"
+#include "characteristicsmodel.h"
+#include "servicesmodel.h"
+
+#include <QLoggingCategory>
+
+#include <algorithm>
+
+Q_DECLARE_LOGGING_CATEGORY(BLE_GATT_TREE)
+
+enum {
+    NodeTypeRole = Qt::UserRole + 1,
+    NodeNameRole,
+    NodeUuidRole,
+    NodeAddressRole,
+    NodeValueRole,
+    NodePropertiesRole,
+    NodeServiceRole,
+    NodeDetailsDiscoveredRole,
+    NodeDecodedPropertiesRole,
+    NodeWritableRole,
+    NodeReadableRole,
+    NodeNotifyableRole,
+    NodeIndicatableRole,
+    NodeNotificationEnabledRole,
+    NodeIndicationEnabledRole
+};
+
+GattTreeModel::GattTreeModel(QObject *parent)
+    : QAbstractItemModel(parent)
+    , m_refreshBatcher(new UpdateBatcher(this))
+    , m_readBatcher(new UpdateBatcher(this))
+{
+    m_refreshBatcher->setFlushHandler([this]() {
+        flushDirtyNodes();
+    });
+    // The values are asked for from data(), the reads are issued once
+    // the view is laid out.
+    m_readBatcher->setFlushHandler([this]() {
+        readRequestedValues();
+    });
+}
+
+GattTreeModel::~GattTreeModel()
+{
+    // The services outlive the tree, e.g. when their link is pooled.
+    for (auto serviceIt = m_serviceNodes.cbegin(); serviceIt != m_serviceNodes.cend(); ++serviceIt)
+        serviceIt.key()->disconnect(this);
+}
+
+ServicesModel *GattTreeModel::servicesModel() const
+{
+    return m_servicesModel;
+}
+
+void GattTreeModel::setServicesModel(ServicesModel *servicesModel)
+{
+    if (m_servicesModel == servicesModel)
+        return;
+    if (m_servicesModel)
+        m_servicesModel->disconnect(this);
+    m_servicesModel = servicesModel;
+    qCDebug(BLE_GATT_TREE) << "Set services model:" << m_servicesModel;
+
+    if (m_servicesModel) {
+        // The rows of the services model come and go as the user
+        // navigates, the tree keeps the services as long as they live.
+        connect(m_servicesModel, &QAbstractItemModel::rowsInserted,
+                this, [this](const QModelIndex &parent, int first, int last) {
+            Q_UNUSED(parent);
+            addServiceRows(first, last);
+        });
+        connect(m_servicesModel, &QAbstractItemModel::modelReset,
+                this, [this]() {
+            const QAbstractItemModel &model = *m_servicesModel;
+            addServiceRows(0, model.rowCount() - 1);
+        });
+        const QAbstractItemModel &model = *m_servicesModel;
+        addServiceRows(0, model.rowCount() - 1);
+    }
+
+    emit servicesModelChanged(m_servicesModel);
+}
+
+UpdateBatcher *GattTreeModel::refreshBatcher() const
+{
+    return m_refreshBatcher;
+}
+
+GattOperationQueue *GattTreeModel::operationQueue() const
+{
+    return m_operationQueue;
+}
+
+void GattTreeModel::setOperationQueue(GattOperationQueue *operationQueue)
+{
+    if (m_operationQueue == operationQueue)
+        return;
+    m_operationQueue = operationQueue;
+    qCDebug(BLE_GATT_TREE) << "Set operation queue:" << m_operationQueue;
+    emit operationQueueChanged(m_operationQueue);
+}
+
+QModelIndex GattTreeModel::addDevice(const QString &address, const QString &name)
+{
+    const QBluetoothAddress deviceAddress(address);
+    const auto rowIt = m_deviceRows.constFind(deviceAddress.toUInt64());
+    if (rowIt != m_deviceRows.cend()) {
+        const auto node = m_root.children.at(rowIt.value());
+        if (!name.isEmpty() && node->name != name) {
+            node->name = name;
+            markDirty(node);
+        }
+        return indexOf(node);
+    }
+
+    qCDebug(BLE_GATT_TREE) << "Add device:" << deviceAddress;
+    const auto node = new Node;
+    node->type = DeviceNode;
+    node->address = deviceAddress;
+    node->name = name;
+    return indexOf(appendNode(&m_root, node));
+}
+
+QModelIndex GattTreeModel::deviceIndex(const QString &address) const
+{
+    const auto rowIt = m_deviceRows.constFind(QBluetoothAddress(address).toUInt64());
+    if (rowIt == m_deviceRows.cend())
+        return QModelIndex();
+    return indexOf(m_root.children.at(rowIt.value()));
+}
+
+QModelIndex GattTreeModel::childIndex(const QModelIndex &parent, const QString &uuid) const
+{
+    const auto node = nodeOf(parent);
+    if (node == &m_root)
+        return QModelIndex();
+    const auto rowIt = node->childRows.constFind(QBluetoothUuid(uuid));
+    if (rowIt == node->childRows.cend())
+        return QModelIndex();
+    return indexOf(node->children.at(rowIt.value()));
+}
+
+void GattTreeModel::addService(GattService *service)
+{
+    if (!service || m_serviceNodes.contains(service))
+        return;
+
+    const auto deviceNode = nodeOf(addDevice(service->deviceAddress().toString()));
+    // Another object for the same service, e.g. after a reconnect, takes
+    // the node over, so that the pages showing its subtree keep it.
+    const auto row = deviceNode->childRows.value(service->serviceUuid(), -1);
+    Node *node = nullptr;
+    if (row >= 0) {
+        node = deviceNode->children.at(row);
+        if (node->service) {
+            m_serviceNodes.remove(node->service);
+            node->service->disconnect(this);
+        }
+        qCDebug(BLE_GATT_TREE) << "Rebind service:" << service->serviceUuid();
+        node->name = service->serviceName();
+        node->service = service;
+        markDirty(node);
+    } else {
+        qCDebug(BLE_GATT_TREE) << "Add service:" << service->serviceUuid();
+        node = new Node;
+        node->type = ServiceNode;
+        node->uuid = service->serviceUuid();
+        node->name = service->serviceName();
+        node->service = service;
+        appendNode(deviceNode, node);
+    }
+    m_serviceNodes.insert(service, node);
+    watchService(service);
+
+    if (service->state() == QLowEnergyService::ServiceDiscovered)
+        updateCharacteristics(node);
+}
+
+void GattTreeModel::watchService(GattService *service)
+{
+    connect(service, &QObject::destroyed,
+            this, [this, service]() {
+        removeService(service);
+    });
+
+    connect(service, &GattService::stateChanged,
+            this, [this, service](QLowEnergyService::ServiceState state) {
+        const auto node = m_serviceNodes.value(service);
+        if (!node)
+            return;
+        if (state == QLowEnergyService::ServiceDiscovered)
+            updateCharacteristics(node);
+        markDirty(node);
+    });
+
+    const auto markCharacteristic = [this, service](const QBluetoothUuid &characteristicUuid) {
+        const auto node = m_serviceNodes.value(service);
+        const auto row = node ? node->childRows.value(characteristicUuid, -1) : -1;
+        if (row >= 0)
+            markDirty(node->children.at(row));
+    };
+    connect(service, &GattService::characteristicChanged,
+            this, [markCharacteristic](const QBluetoothUuid &characteristicUuid) {
+        markCharacteristic(characteristicUuid);
+    });
+    connect(service, &GattService::characteristicRead,
+            this, [markCharacteristic](const QBluetoothUuid &characteristicUuid) {
+        markCharacteristic(characteristicUuid);
+    });
+    connect(service, &GattService::characteristicWritten,
+            this, [markCharacteristic](const QBluetoothUuid &characteristicUuid) {
+        markCharacteristic(characteristicUuid);
+    });
+
+    const auto markDescriptor = [this, service](const QBluetoothUuid &characteristicUuid,
+                                                const QBluetoothUuid &descriptorUuid) {
+        const auto node = m_serviceNodes.value(service);
+        const auto row = node ? node->childRows.value(characteristicUuid, -1) : -1;
+        if (row < 0)
+            return;
+        const auto characteristicNode = node->children.at(row);
+        const auto descriptorRow = characteristicNode->childRows.value(descriptorUuid, -1);
+        if (descriptorRow >= 0) {
+            const auto descriptorNode = characteristicNode->children.at(descriptorRow);
+            // Known now, whether it was read by the tree or not.
+            descriptorNode->valueRequested = true;
+            markDirty(descriptorNode);
+        }
+        // The notification and indication states of the characteristic.
+        if (descriptorUuid == QBluetoothUuid(QBluetoothUuid::ClientCharacteristicConfiguration))
+            markDirty(characteristicNode);
+    };
+    connect(service, &GattService::descriptorRead,
+            this, [markDescriptor](const QBluetoothUuid &characteristicUuid,
+                                   const QBluetoothUuid &descriptorUuid) {
+        markDescriptor(characteristicUuid, descriptorUuid);
+    });
+    connect(service, &GattService::descriptorWritten,
+            this, [markDescriptor](const QBluetoothUuid &characteristicUuid,
+                                   const QBluetoothUuid &descriptorUuid) {
+        markDescriptor(characteristicUuid, descriptorUuid);
+    });
+}
+
+void GattTreeModel::addServiceRows(int first, int last)
+{
+    for (auto row = first; row <= last; ++row)
+        addService(m_servicesModel->serviceAt(row));
+}
+
+void GattTreeModel::removeService(GattService *service)
+{
+    const auto node = m_serviceNodes.take(service);
+    if (!node)
+        return;
+    qCDebug(BLE_GATT_TREE) << "Remove service:" << node->uuid;
+    service->disconnect(this);
+    removeNode(node);
+}
+
+void GattTreeModel::updateCharacteristics(Node *serviceNode)
+{
+    const auto service = serviceNode->service;
+    if (!service)
+        return;
+    const auto characteristicUuids = service->characteristicUuids();
+
+    // A service answering from the GATT cache reports its discovered
+    // state once more when the real layout is known, only the
+    // differences are applied.
+    for (auto row = serviceNode->children.count() - 1; row >= 0; --row) {
+        const auto node = serviceNode->children.at(row);
+        if (!characteristicUuids.contains(node->uuid))
+            removeNode(node);
+    }
+
+    for (const auto &characteristicUuid : characteristicUuids) {
+        const auto characteristic = service->characteristic(characteristicUuid);
+        const auto row = serviceNode->childRows.value(characteristicUuid, -1);
+        if (row < 0) {
+            const auto node = new Node;
+            node->type = CharacteristicNode;
+            node->uuid = characteristicUuid;
+            node->name = characteristic.name;
+            node->properties = characteristic.properties;
+            node->decodedProperties = CharacteriticsModel::decodeProperties(node->properties);
+            appendNode(serviceNode, node);
+            updateDescriptors(node, characteristic.descriptors);
+            continue;
+        }
+
+        const auto node = serviceNode->children.at(row);
+        node->name = characteristic.name;
+        node->properties = characteristic.properties;
+        node->decodedProperties = CharacteriticsModel::decodeProperties(node->properties);
+        updateDescriptors(node, characteristic.descriptors);
+        markDirty(node);
+    }
+}
+
+void GattTreeModel::updateDescriptors(Node *characteristicNode,
+                                      const QVector<GattDescriptorInfo> &descriptors)
+{
+    for (auto row = characteristicNode->children.count() - 1; row >= 0; --row) {
+        const auto node = characteristicNode->children.at(row);
+        const auto found = std::any_of(descriptors.cbegin(), descriptors.cend(),
+                                       [node](const GattDescriptorInfo &descriptor) {
+            return descriptor.uuid == node->uuid;
+        });
+        if (!found)
+            removeNode(node);
+    }
+
+    for (const auto &descriptor : descriptors) {
+        // Some stacks report a descriptor twice.
+        const auto row = characteristicNode->childRows.value(descriptor.uuid, -1);
+        if (row >= 0) {
+            markDirty(characteristicNode->children.at(row));
+            continue;
+        }
+        const auto node = new Node;
+        node->type = DescriptorNode;
+        node->uuid = descriptor.uuid;
+        node->name = descriptor.name;
+        // A value which came with the layout is not read again.
+        node->valueRequested = !descriptor.value.isEmpty();
+        appendNode(characteristicNode, node);
+    }
+}
+
+GattTreeModel::Node *GattTreeModel::nodeOf(const QModelIndex &index) const
+{
+    if (!index.isValid())
+        return const_cast<Node *>(&m_root);
+    return static_cast<Node *>(index.internalPointer());
+}
+
+QModelIndex GattTreeModel::indexOf(Node *node) const
+{
+    if (node == &m_root)
+        return QModelIndex();
+    return createIndex(node->row, 0, node);
+}
+
+GattTreeModel::Node *GattTreeModel::serviceOf(Node *node) const
+{
+    while (node && node->type != ServiceNode)
+        node = node->parent;
+    return node;
+}
+
+const GattTreeModel::Node &GattTreeModel::snapshot(Node *node) const
+{
+    if (node->built)
+        return *node;
+    node->built = true;
+
+    const auto serviceNode = serviceOf(node);
+    const auto service = serviceNode ? serviceNode->service.data() : nullptr;
+    if (!service) {
+        node->hexValue.clear();
+        node->clientConfiguration = 0;
+    } else if (node->type == CharacteristicNode) {
+        node->hexValue = service->characteristicValue(node->uuid).toHex();
+        node->clientConfiguration = CharacteriticsModel::decodeClientConfiguration(
+                    service->descriptorValue(node->uuid,
+                                             QBluetoothUuid(QBluetoothUuid::ClientCharacteristicConfiguration)));
+    } else if (node->type == DescriptorNode) {
+        node->hexValue = service->descriptorValue(node->parent->uuid, node->uuid).toHex();
+    }
+    return *node;
+}
+
+GattTreeModel::Node *GattTreeModel::appendNode(Node *parent, Node *node)
+{
+    const auto row = parent->children.count();
+    node->parent = parent;
+    node->row = row;
+
+    beginInsertRows(indexOf(parent), row, row);
+    parent->children.append(node);
+    if (parent == &m_root)
+        m_deviceRows.insert(node->address.toUInt64(), row);
+    else
+        parent->childRows.insert(node->uuid, row);
+    endInsertRows();
+    return node;
+}
+
+void GattTreeModel::removeNode(Node *node)
+{
+    const auto parent = node->parent;
+    const auto row = node->row;
+
+    beginRemoveRows(indexOf(parent), row, row);
+    parent->children.remove(row);
+    if (parent == &m_root)
+        m_deviceRows.remove(node->address.toUInt64());
+    else
+        parent->childRows.remove(node->uuid);
+    for (auto sibling = row; sibling < parent->children.count(); ++sibling) {
+        const auto siblingNode = parent->children.at(sibling);
+        siblingNode->row = sibling;
+        if (parent == &m_root)
+            m_deviceRows.insert(siblingNode->address.toUInt64(), sibling);
+        else
+            parent->childRows.insert(siblingNode->uuid, sibling);
+    }
+    endRemoveRows();
+
+    forgetNode(node);
+    delete node;
+}
+
+void GattTreeModel::forgetNode(Node *node)
+{
+    m_dirtyNodes.remove(node);
+    m_pendingReads.removeAll(node);
+    if (node->type == ServiceNode && node->service) {
+        const auto service = node->service.data();
+        if (m_serviceNodes.value(service) == node) {
+            m_serviceNodes.remove(service);
+            service->disconnect(this);
+        }
+    }
+    for (const auto child : qAsConst(node->children))
+        forgetNode(child);
+}
+
+void GattTreeModel::markDirty(Node *node)
+{
+    if (!node)
+        return;
+    // Rebuilt by the delegates reading it again.
+    node->built = false;
+    m_dirtyNodes.insert(node);
+    m_refreshBatcher->schedule();
+}
+
+void GattTreeModel::flushDirtyNodes()
+{
+    const auto nodes = m_dirtyNodes;
+    m_dirtyNodes.clear();
+    for (const auto node : nodes) {
+        const auto modelIndex = indexOf(node);
+        emit dataChanged(modelIndex, modelIndex);
+    }
+}
+
+void GattTreeModel::requestValue(Node *node) const
+{
+    if (node->valueRequested)
+        return;
+    node->valueRequested = true;
+    m_pendingReads.append(node);
+    m_readBatcher->schedule();
+}
+
+void GattTreeModel::readRequestedValues()
+{
+    const auto nodes = m_pendingReads;
+    m_pendingReads.clear();
+    for (const auto node : nodes) {
+        const auto serviceNode = serviceOf(node);
+        const auto service = serviceNode ? serviceNode->service.data() : nullptr;
+        if (!service)
+            continue;
+
+        const auto characteristicUuid = node->parent->uuid;
+        qCDebug(BLE_GATT_TREE) << "Read descriptor:" << node->uuid;
+        if (m_operationQueue && m_operationQueue->service() == service)
+            m_operationQueue->readDescriptor(characteristicUuid, node->uuid);
+        else
+            service->readDescriptor(characteristicUuid, node->uuid);
+    }
+}
+
+QModelIndex GattTreeModel::index(int row, int column, const QModelIndex &parent) const
+{
+    const auto parentNode = nodeOf(parent);
+    if (column != 0 || row < 0 || row >= parentNode->children.count())
+        return QModelIndex();
+    return createIndex(row, column, parentNode->children.at(row));
+}
+
+QModelIndex GattTreeModel::parent(const QModelIndex &child) const
+{
+    if (!child.isValid())
+        return QModelIndex();
+    return indexOf(nodeOf(child)->parent);
+}
+
+int GattTreeModel::rowCount(const QModelIndex &parent) const
+{
+    if (parent.column() > 0)
+        return 0;
+    return nodeOf(parent)->children.count();
+}
+
+int GattTreeModel::columnCount(const QModelIndex &parent) const
+{
+    Q_UNUSED(parent);
+    return 1;
+}
+
+QVariant GattTreeModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid())
+        return QVariant();
+
+    const auto node = nodeOf(index);
+
+    switch (role) {
+    case NodeTypeRole:
+        return node->type;
+    case NodeNameRole:
+        return node->name;
+    case NodeUuidRole:
+        return (node->type == DeviceNode) ? QVariant() : QVariant(node->uuid.toString());
+    case NodeAddressRole: {
+        if (node->type == DeviceNode)
+            return node->address.toString();
+        const auto serviceNode = serviceOf(node);
+        return (serviceNode && serviceNode->service)
+                ? serviceNode->service->deviceAddress().toString() : QString();
+    }
+    case NodeValueRole:
+        if (node->type == CharacteristicNode)
+            return snapshot(node).hexValue;
+        if (node->type == DescriptorNode) {
+            // Only the delegates of the visible rows ask for the value.
+            requestValue(node);
+            return snapshot(node).hexValue;
+        }
+        return QVariant();
+    case NodePropertiesRole:
+        return (node->type == CharacteristicNode) ? QVariant(int(node->properties)) : QVariant();
+    case NodeDecodedPropertiesRole:
+        return (node->type == CharacteristicNode) ? QVariant(node->decodedProperties) : QVariant();
+    case NodeWritableRole:
+        return bool(node->properties & (QLowEnergyCharacteristic::Write
+                                        | QLowEnergyCharacteristic::WriteNoResponse
+                                        | QLowEnergyCharacteristic::WriteSigned));
+    case NodeReadableRole:
+        return bool(node->properties & QLowEnergyCharacteristic::Read);
+    case NodeNotifyableRole:
+        return bool(node->properties & QLowEnergyCharacteristic::Notify);
+    case NodeIndicatableRole:
+        return bool(node->properties & QLowEnergyCharacteristic::Indicate);
+    case NodeNotificationEnabledRole:
+        return node->type == CharacteristicNode
+                && (snapshot(node).clientConfiguration & ClientConfigurationNotification);
+    case NodeIndicationEnabledRole:
+        return node->type == CharacteristicNode
+                && (snapshot(node).clientConfiguration & ClientConfigurationIndication);
+    case NodeServiceRole:
+        return (node->type == ServiceNode) ? QVariant::fromValue<QObject *>(node->service.data()) : QVariant();
+    case NodeDetailsDiscoveredRole:
+        return (node->type == ServiceNode && node->service)
+                ? node->service->state() == QLowEnergyService::ServiceDiscovered : false;
+    default:
+        return QVariant();
+    }
+}
+
+QHash<int, QByteArray> GattTreeModel::roleNames() const
+{
+    return {
+        { NodeTypeRole, "nodeType" },
+        { NodeNameRole, "name" },
+        { NodeUuidRole, "uuid" },
+        { NodeAddressRole, "address" },
+        { NodeValueRole, "value" },
+        { NodePropertiesRole, "properties" },
+        { NodeServiceRole, "service" },
+        { NodeDetailsDiscoveredRole, "detailsDiscovered" },
+        { NodeDecodedPropertiesRole, "props" },
+        { NodeWritableRole, "writable" },
+        { NodeReadableRole, "readable" },
+        { NodeNotifyableRole, "notifyable" },
+        { NodeIndicatableRole, "indicatable" },
+        { NodeNotificationEnabledRole, "notificationEnabled" },
+        { NodeIndicationEnabledRole, "indicationEnabled" }
+    };
+}
+
+// GattSubtreeModel
+
+GattSubtreeModel::GattSubtreeModel(QObject *parent)
+    : QAbstractProxyModel(parent)
+{
+}
+
+GattTreeModel *GattSubtreeModel::tree() const
+{
+    return m_tree;
+}
+
+void GattSubtreeModel::setTree(GattTreeModel *tree)
+{
+    if (m_tree == tree)
+        return;
+
+    beginResetModel();
+    if (m_tree)
+        m_tree->disconnect(this);
+    m_tree = tree;
+    m_rootIndex = QModelIndex();
+    m_rootRemoved = false;
+    QAbstractProxyModel::setSourceModel(tree);
+
+    if (m_tree) {
+        connect(m_tree, &QAbstractItemModel::rowsAboutToBeInserted,
+                this, [this](const QModelIndex &parent, int first, int last) {
+            if (!m_rootRemoved && parent == m_rootIndex)
+                beginInsertRows(QModelIndex(), first, last);
+        });
+        connect(m_tree, &QAbstractItemModel::rowsInserted,
+                this, [this](const QModelIndex &parent) {
+            if (!m_rootRemoved && parent == m_rootIndex)
+                endInsertRows();
+        });
+        connect(m_tree, &QAbstractItemModel::rowsAboutToBeRemoved,
+                this, [this](const QModelIndex &parent, int first, int last) {
+            if (m_rootRemoved)
+                return;
+            if (parent == m_rootIndex) {
+                m_removingRows = true;
+                beginRemoveRows(QModelIndex(), first, last);
+            } else if (isRootRemoved(parent, first, last)) {
+                m_resetting = true;
+                beginResetModel();
+            }
+        });
+        connect(m_tree, &QAbstractItemModel::rowsRemoved,
+                this, [this]() {
+            if (m_removingRows) {
+                m_removingRows = false;
+                endRemoveRows();
+            } else if (m_resetting) {
+                m_resetting = false;
+                m_rootRemoved = true;
+                endResetModel();
+            }
+        });
+        connect(m_tree, &QAbstractItemModel::dataChanged,
+                this, [this](const QModelIndex &topLeft, const QModelIndex &bottomRight,
+                             const QVector<int> &roles) {
+            if (!m_rootRemoved && topLeft.parent() == m_rootIndex)
+                emit dataChanged(mapFromSource(topLeft), mapFromSource(bottomRight), roles);
+        });
+        connect(m_tree, &QAbstractItemModel::modelAboutToBeReset,
+                this, &GattSubtreeModel::beginResetModel);
+        connect(m_tree, &QAbstractItemModel::modelReset,
+                this, &GattSubtreeModel::endResetModel);
+    }
+    endResetModel();
+
+    emit treeChanged(m_tree);
+}
+
+QModelIndex GattSubtreeModel::rootIndex() const
+{
+    return m_rootIndex;
+}
+
+void GattSubtreeModel::setRootIndex(const QModelIndex &rootIndex)
+{
+    if (!m_rootRemoved && m_rootIndex == rootIndex)
+        return;
+    beginResetModel();
+    m_rootIndex = rootIndex;
+    m_rootRemoved = false;
+    endResetModel();
+    emit rootIndexChanged(m_rootIndex);
+}
+
+bool GattSubtreeModel::isRootRemoved(const QModelIndex &parent, int first, int last) const
+{
+    // Whether the root is within, or below, the removed rows.
+    for (QModelIndex index = m_rootIndex; index.isValid(); index = index.parent()) {
+        if (index.parent() == parent && index.row() >= first && index.row() <= last)
+            return true;
+    }
+    return false;
+}
+
+QModelIndex GattSubtreeModel::mapToSource(const QModelIndex &proxyIndex) const
+{
+    if (!m_tree || m_rootRemoved || !proxyIndex.isValid())
+        return QModelIndex();
+    return m_tree->index(proxyIndex.row(), proxyIndex.column(), m_rootIndex);
+}
+
+QModelIndex GattSubtreeModel::mapFromSource(const QModelIndex &sourceIndex) const
+{
+    if (m_rootRemoved || !sourceIndex.isValid() || sourceIndex.parent() != m_rootIndex)
+        return QModelIndex();
+    return createIndex(sourceIndex.row(), sourceIndex.column());
+}
+
+QModelIndex GattSubtreeModel::index(int row, int column, const QModelIndex &parent) const
+{
+    if (parent.isValid() || column != 0 || row < 0 || row >= rowCount(parent))
+        return QModelIndex();
+    return createIndex(row, column);
+}
+
+QModelIndex GattSubtreeModel::parent(const QModelIndex &child) const
+{
+    Q_UNUSED(child);
+    return QModelIndex();
+}
+
+int GattSubtreeModel::rowCount(const QModelIndex &parent) const
+{
+    if (!m_tree || m_rootRemoved || parent.isValid())
+        return 0;
+    const QAbstractItemModel &tree = *m_tree;
+    return tree.rowCount(m_rootIndex);
+}
+
+int GattSubtreeModel::columnCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : 1;
+}
+
+QHash<int, QByteArray> GattSubtreeModel::roleNames() const
+{
+    if (!m_tree)
+        return QHash<int, QByteArray>();
+    const QAbstractItemModel &tree = *m_tree;
+    return tree.roleNames();
+}
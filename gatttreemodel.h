@@ -0,0 +1,194 @@
+#ifndef GATTTREEMODEL_H
+#define GATTTREEMODEL_H
+
+#include "blebackend.h"
+#include "gattoperationqueue.h"
+#include "updatebatcher.h"
+
+#include <QAbstractItemModel>
+#include <QAbstractProxyModel>
+#include <QPointer>
+#include <QSet>
+
+class ServicesModel;
+
+// The GATT trees of the devices browsed so far, as a single tree:
+// device, service, characteristic and descriptor. The services come from
+// the services model as it resolves them and stay in the tree as long as
+// their objects live, i.e. while their link is pooled, so that browsing
+// back to a device finds its subtree as it was left.
+//
+// Rows are only ever appended or removed, never reset, so that the
+// persistent indexes of the pages stay valid. The children of a node
+// are looked up by a hash of their UUID. What the delegates show of a
+// node is read from its service when first asked for and kept until the
+// node changes, the changes being coalesced per frame. A new object for
+// a service in the tree, e.g. after a reconnect, takes its node over.
+// The descriptor values which did not come with the layout are read
+// once, when their rows are first shown, through the operation queue
+// when it is the one of their service.
+class GattTreeModel : public QAbstractItemModel
+{
+    Q_OBJECT
+
+    Q_PROPERTY(ServicesModel *servicesModel READ servicesModel
+               WRITE setServicesModel NOTIFY servicesModelChanged)
+    Q_PROPERTY(UpdateBatcher *refreshBatcher READ refreshBatcher CONSTANT)
+    Q_PROPERTY(GattOperationQueue *operationQueue READ operationQueue
+               WRITE setOperationQueue NOTIFY operationQueueChanged)
+
+public:
+    enum NodeType {
+        DeviceNode,
+        ServiceNode,
+        CharacteristicNode,
+        DescriptorNode
+    };
+    Q_ENUM(NodeType)
+
+    explicit GattTreeModel(QObject *parent = nullptr);
+    ~GattTreeModel() override;
+
+    ServicesModel *servicesModel() const;
+    void setServicesModel(ServicesModel *servicesModel);
+
+    UpdateBatcher *refreshBatcher() const;
+
+    GattOperationQueue *operationQueue() const;
+    void setOperationQueue(GattOperationQueue *operationQueue);
+
+    // Adds the device if it is not in the tree yet, renaming it
+    // otherwise.
+    Q_INVOKABLE QModelIndex addDevice(const QString &address,
+                                      const QString &name = QString());
+    Q_INVOKABLE QModelIndex deviceIndex(const QString &address) const;
+    // The child of a service or of a characteristic.
+    Q_INVOKABLE QModelIndex childIndex(const QModelIndex &parent, const QString &uuid) const;
+
+    void addService(GattService *service);
+
+    QModelIndex index(int row, int column, const QModelIndex &parent) const final;
+    QModelIndex parent(const QModelIndex &child) const final;
+    using QObject::parent;
+
+signals:
+    void servicesModelChanged(ServicesModel *servicesModel);
+    void operationQueueChanged(GattOperationQueue *operationQueue);
+
+private:
+    struct Node
+    {
+        ~Node() { qDeleteAll(children); }
+
+        NodeType type = DeviceNode;
+        Node *parent = nullptr;
+        int row = 0;
+        QVector<Node *> children;
+        QHash<QBluetoothUuid, int> childRows;
+
+        // Devices.
+        QBluetoothAddress address;
+        QString name;
+        // Services, characteristics and descriptors.
+        QBluetoothUuid uuid;
+        // Services, the characteristics and descriptors read from theirs.
+        QPointer<GattService> service;
+        // Characteristics, set with the layout.
+        QLowEnergyCharacteristic::PropertyTypes properties;
+        QString decodedProperties;
+        // Descriptors, whose value is known or being read.
+        bool valueRequested = false;
+
+        // Characteristics and descriptors, what the delegates show of
+        // the service, built when first asked for after a change.
+        bool built = false;
+        QByteArray hexValue;
+        quint16 clientConfiguration = 0;
+    };
+
+    Node *nodeOf(const QModelIndex &index) const;
+    QModelIndex indexOf(Node *node) const;
+    Node *serviceOf(Node *node) const;
+    const Node &snapshot(Node *node) const;
+
+    // Takes the ownership of the node.
+    Node *appendNode(Node *parent, Node *node);
+    void removeNode(Node *node);
+    void forgetNode(Node *node);
+
+    void watchService(GattService *service);
+    void addServiceRows(int first, int last);
+    void removeService(GattService *service);
+    void updateCharacteristics(Node *serviceNode);
+    void updateDescriptors(Node *characteristicNode,
+                           const QVector<GattDescriptorInfo> &descriptors);
+
+    void markDirty(Node *node);
+    void flushDirtyNodes();
+
+    void requestValue(Node *node) const;
+    void readRequestedValues();
+
+    int rowCount(const QModelIndex &parent) const final;
+    int columnCount(const QModelIndex &parent) const final;
+    QVariant data(const QModelIndex &index, int role) const final;
+    QHash<int, QByteArray> roleNames() const final;
+
+    Node m_root;
+    QHash<quint64, int> m_deviceRows;
+    QHash<GattService *, Node *> m_serviceNodes;
+    QSet<Node *> m_dirtyNodes;
+    mutable QVector<Node *> m_pendingReads;
+    QPointer<ServicesModel> m_servicesModel;
+    QPointer<GattOperationQueue> m_operationQueue;
+    UpdateBatcher *m_refreshBatcher = nullptr;
+    UpdateBatcher *m_readBatcher = nullptr;
+};
+
+// The children of one node of the tree as a flat list, which the pages
+// bind to. Moving to another node only resets this proxy, the tree is
+// neither reset nor walked again. The list empties when its node is
+// removed from the tree.
+class GattSubtreeModel : public QAbstractProxyModel
+{
+    Q_OBJECT
+
+    Q_PROPERTY(GattTreeModel *tree READ tree WRITE setTree NOTIFY treeChanged)
+    Q_PROPERTY(QModelIndex rootIndex READ rootIndex WRITE setRootIndex NOTIFY rootIndexChanged)
+
+public:
+    explicit GattSubtreeModel(QObject *parent = nullptr);
+
+    GattTreeModel *tree() const;
+    void setTree(GattTreeModel *tree);
+
+    // The invalid index stands for the devices.
+    QModelIndex rootIndex() const;
+    void setRootIndex(const QModelIndex &rootIndex);
+
+    QModelIndex mapToSource(const QModelIndex &proxyIndex) const final;
+    QModelIndex mapFromSource(const QModelIndex &sourceIndex) const final;
+
+    QModelIndex index(int row, int column, const QModelIndex &parent) const final;
+    QModelIndex parent(const QModelIndex &child) const final;
+    using QObject::parent;
+
+signals:
+    void treeChanged(GattTreeModel *tree);
+    void rootIndexChanged(const QModelIndex &rootIndex);
+
+private:
+    bool isRootRemoved(const QModelIndex &parent, int first, int last) const;
+
+    int rowCount(const QModelIndex &parent) const final;
+    int columnCount(const QModelIndex &parent) const final;
+    QHash<int, QByteArray> roleNames() const final;
+
+    QPointer<GattTreeModel> m_tree;
+    QPersistentModelIndex m_rootIndex;
+    bool m_rootRemoved = false;
+    bool m_removingRows = false;
+    bool m_resetting = false;
+};
+
+#endif // GATTTREEMODEL_H
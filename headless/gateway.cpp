@@ -0,0 +1,512 @@
+#include "gateway.h"
+#include "characteristicsmodel.h"
+#include "connectionpool.h"
+#include "devicesmodel.h"
+#include "gattcache.h"
+#include "latencymetrics.h"
+#include "scanscheduler.h"
+#include "servicesmodel.h"
+#include "streamserver.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QLoggingCategory>
+
+#include <algorithm>
+
+Q_DECLARE_LOGGING_CATEGORY(BLE_GATEWAY)
+
+// The models are driven through their roles, as the views do.
+static int roleOf(const QAbstractItemModel &model, const QByteArray &name)
+{
+    return model.roleNames().key(name, -1);
+}
+
+static QVariant dataOf(const QAbstractItemModel &model, int row, const QByteArray &name)
+{
+    return model.data(model.index(row, 0), roleOf(model, name));
+}
+
+// Resident set size in KiB, -1 where it is not known.
+static qint64 residentSetSize()
+{
+    QFile status(QStringLiteral("/proc/self/status"));
+    if (!status.open(QIODevice::ReadOnly | QIODevice::Text))
+        return -1;
+    for (auto line = status.readLine(); !line.isEmpty(); line = status.readLine()) {
+        if (line.startsWith("VmRSS:"))
+            return line.mid(6).trimmed().split(' ').value(0).toLongLong();
+    }
+    return -1;
+}
+
+static QStringList toStringList(const QJsonValue &value)
+{
+    QStringList strings;
+    for (const auto item : value.toArray())
+        strings.append(item.toString());
+    return strings;
+}
+
+Gateway::Gateway(QObject *parent)
+    : Gateway(BleBackend::defaultBackend(), parent)
+{
+}
+
+Gateway::Gateway(BleBackend *backend, QObject *parent)
+    : QObject(parent)
+    , m_backend(backend)
+    , m_devicesModel(new DevicesModel(backend, this))
+    , m_connectionPool(new ConnectionPool(backend, this))
+    , m_gattCache(new GattCache(this))
+{
+    m_clock.start();
+    setOutput(QStringLiteral("-"));
+
+    connect(m_devicesModel, &QAbstractItemModel::rowsInserted,
+            this, [this](const QModelIndex &, int first, int last) {
+        addDevices(first, last);
+    });
+    connect(m_devicesModel, &QAbstractItemModel::dataChanged,
+            this, [this](const QModelIndex &topLeft, const QModelIndex &bottomRight) {
+        updateDevices(topLeft.row(), bottomRight.row());
+    });
+    connect(m_devicesModel, &DevicesModel::runningChanged,
+            this, [this](bool running) {
+        writeStatus(running ? QStringLiteral("scanStarted") : QStringLiteral("scanStopped"));
+        checkFinished();
+    });
+    connect(m_devicesModel->scheduler(), &ScanScheduler::windowFinished,
+            this, [this](int window, int newDevices, int seenDevices, qint64 duration) {
+        const auto scheduler = m_devicesModel->scheduler();
+        writeStatus(QStringLiteral("scanWindow"),
+                    { { QStringLiteral("window"), window },
+                      { QStringLiteral("newDevices"), newDevices },
+                      { QStringLiteral("seenDevices"), seenDevices },
+                      { QStringLiteral("durationMs"), duration },
+                      { QStringLiteral("nextIdleMs"), scheduler->idleWindow() } });
+    });
+    connect(m_connectionPool, &ConnectionPool::reconnectScheduled,
+            this, [this](const QBluetoothAddress &address, int attempt, int delay) {
+        writeStatus(QStringLiteral("reconnecting"),
+                    { { QStringLiteral("address"), address.toString() },
+                      { QStringLiteral("attempt"), attempt },
+                      { QStringLiteral("delayMs"), delay } });
+    });
+    connect(m_devicesModel, &DevicesModel::errorOccurred, this, [this]() {
+        writeStatus(QStringLiteral("scanError"),
+                    { { QStringLiteral("error"), m_devicesModel->errorString() } });
+    });
+}
+
+Gateway::~Gateway()
+{
+    writeStatus(QStringLiteral("stopped"),
+                { { QStringLiteral("uptimeMs"), m_clock.elapsed() },
+                  { QStringLiteral("rssKb"), residentSetSize() } });
+}
+
+bool Gateway::configure(const QJsonObject &config)
+{
+    if (config.contains(QStringLiteral("output"))
+            && !setOutput(config.value(QStringLiteral("output")).toString())) {
+        return false;
+    }
+
+    const auto scan = config.value(QStringLiteral("scan")).toObject();
+    if (scan.contains(QStringLiteral("timeout")))
+        m_devicesModel->setDiscoveryTimeout(scan.value(QStringLiteral("timeout")).toInt());
+    if (scan.contains(QStringLiteral("continuous")))
+        m_devicesModel->setContinuous(scan.value(QStringLiteral("continuous")).toBool());
+    if (scan.contains(QStringLiteral("deviceTtl")))
+        m_devicesModel->setDeviceTtl(scan.value(QStringLiteral("deviceTtl")).toInt());
+    m_reportUpdates = scan.value(QStringLiteral("reportUpdates")).toBool();
+
+    const auto schedule = scan.value(QStringLiteral("schedule")).toObject();
+    if (!schedule.isEmpty()) {
+        const auto scheduler = m_devicesModel->scheduler();
+        scheduler->setEnabled(schedule.value(QStringLiteral("enabled")).toBool(true));
+        scheduler->setScanWindow(schedule.value(QStringLiteral("scanWindow"))
+                                 .toInt(scheduler->scanWindow()));
+        scheduler->setMinIdleWindow(schedule.value(QStringLiteral("minIdleWindow"))
+                                    .toInt(scheduler->minIdleWindow()));
+        scheduler->setMaxIdleWindow(schedule.value(QStringLiteral("maxIdleWindow"))
+                                    .toInt(scheduler->maxIdleWindow()));
+    }
+
+    const auto filter = m_devicesModel->filter();
+    filter->setServiceUuids(toStringList(scan.value(QStringLiteral("serviceUuids"))));
+    filter->setNamePrefixes(toStringList(scan.value(QStringLiteral("namePrefixes"))));
+    QList<int> manufacturerIds;
+    for (const auto id : scan.value(QStringLiteral("manufacturerIds")).toArray())
+        manufacturerIds.append(id.toInt());
+    filter->setManufacturerIds(manufacturerIds);
+    filter->setRssiFloor(scan.value(QStringLiteral("rssiFloor"))
+                         .toInt(DeviceFilter::NoRssiFloor));
+
+    if (config.contains(QStringLiteral("metrics"))) {
+        LatencyMetrics::defaultMetrics()->setExportFileName(
+                    config.value(QStringLiteral("metrics")).toString());
+    }
+
+    const auto server = config.value(QStringLiteral("server")).toObject();
+    if (!server.isEmpty()) {
+        m_streamServer = new StreamServer(this, this);
+        m_streamServer->setBufferSize(server.value(QStringLiteral("bufferSize"))
+                                      .toInt(m_streamServer->bufferSize()));
+        const auto dropPolicy = server.value(QStringLiteral("dropPolicy")).toString();
+        if (dropPolicy == QLatin1String("dropNewest"))
+            m_streamServer->setDropPolicy(StreamServer::DropNewest);
+        else if (dropPolicy == QLatin1String("disconnect"))
+            m_streamServer->setDropPolicy(StreamServer::Disconnect);
+        if (!m_streamServer->listen(quint16(server.value(QStringLiteral("port")).toInt()))) {
+            m_errorString = m_streamServer->errorString();
+            return false;
+        }
+    }
+
+    // One cache file in the cache directory, shared by all the devices.
+    const auto cacheDirectory = config.value(QStringLiteral("gattCache")).toString();
+    m_gattCache->setFileName(cacheDirectory.isEmpty()
+                             ? QString()
+                             : QDir(cacheDirectory).filePath(QStringLiteral("gatt.cache")));
+    // Identical devices, told by their advertised name, share their layout.
+    m_gattCache->setShareByDeviceModel(
+                config.value(QStringLiteral("shareGattByDeviceModel")).toBool());
+    if (config.contains(QStringLiteral("concurrentConnects"))) {
+        m_connectionPool->setConcurrentConnects(
+                    config.value(QStringLiteral("concurrentConnects")).toInt());
+    }
+
+    for (const auto value : config.value(QStringLiteral("connect")).toArray()) {
+        const auto device = value.toObject();
+        Target target;
+        target.address = QBluetoothAddress(device.value(QStringLiteral("address")).toString())
+                .toString();
+        if (target.address == QBluetoothAddress().toString()) {
+            m_errorString = tr("Invalid device address: %1")
+                    .arg(device.value(QStringLiteral("address")).toString());
+            return false;
+        }
+
+        const auto subscribe = device.value(QStringLiteral("subscribe"));
+        target.subscribe = subscribe.isArray() || subscribe.toBool();
+        for (const auto &uuid : toStringList(subscribe))
+            target.subscriptions.insert(QBluetoothUuid(uuid));
+        target.read = device.value(QStringLiteral("read")).toBool();
+        bool validProfile = false;
+        target.profile = ConnectionTuner::profileFromName(
+                    device.value(QStringLiteral("profile")).toString(), &validProfile);
+        if (!validProfile) {
+            m_errorString = tr("Invalid connection profile: %1")
+                    .arg(device.value(QStringLiteral("profile")).toString());
+            return false;
+        }
+
+        target.servicesModel = new ServicesModel(m_connectionPool, m_gattCache, this);
+        target.servicesModel->setPrefetch(true);
+        m_targets.append(target);
+    }
+    // Every configured link is kept.
+    m_connectionPool->setCapacity(qMax(m_connectionPool->capacity(), m_targets.count()));
+
+    for (auto index = 0; index < m_targets.count(); ++index) {
+        const auto servicesModel = m_targets.at(index).servicesModel;
+        // The tree is complete once the details of every service are.
+        // Cancelling a prefetch, or starting one with nothing left to
+        // discover, reports no pending service either: the tree is built
+        // once, then rebuilt only when a prefetch which ran completes.
+        connect(servicesModel, &ServicesModel::prefetchProgressChanged,
+                this, [this, index]() {
+            auto &target = m_targets[index];
+            if (target.servicesModel->prefetchPending() > 0) {
+                target.prefetching = true;
+                return;
+            }
+            const auto prefetched = target.prefetching
+                    && target.servicesModel->prefetchCompleted() > 0;
+            if ((prefetched || target.characteristicsModels.isEmpty())
+                    && target.servicesModel->isConnected()
+                    && !target.servicesModel->isRunning()) {
+                target.prefetching = false;
+                buildTree(target);
+            }
+        });
+        // No scan window while any of the devices is being connected.
+        connect(servicesModel, &ServicesModel::runningChanged,
+                this, [this]() {
+            const auto connecting = std::any_of(m_targets.cbegin(), m_targets.cend(),
+                                                [](const Target &target) {
+                return target.servicesModel->isRunning();
+            });
+            m_devicesModel->scheduler()->setPaused(connecting);
+        });
+        connect(servicesModel, &ServicesModel::connectedChanged,
+                this, [this, index](bool connected) {
+            writeStatus(connected ? QStringLiteral("connected") : QStringLiteral("disconnected"),
+                        { { QStringLiteral("address"), m_targets.at(index).address } });
+        });
+        const auto tuner = servicesModel->connectionTuner();
+        connect(tuner, &ConnectionTuner::connectionUpdated,
+                this, [this, index, tuner]() {
+            writeStatus(QStringLiteral("connectionUpdated"),
+                        { { QStringLiteral("address"), m_targets.at(index).address },
+                          { QStringLiteral("intervalMs"), tuner->connectionInterval() },
+                          { QStringLiteral("latency"), tuner->latency() },
+                          { QStringLiteral("supervisionTimeoutMs"),
+                            tuner->supervisionTimeout() } });
+        });
+        connect(tuner, &ConnectionTuner::mtuChanged,
+                this, [this, index](int mtu) {
+            writeStatus(QStringLiteral("mtuChanged"),
+                        { { QStringLiteral("address"), m_targets.at(index).address },
+                          { QStringLiteral("mtu"), mtu } });
+        });
+        connect(servicesModel, &ServicesModel::errorOccurred,
+                this, [this, index]() {
+            const auto &target = m_targets.at(index);
+            writeStatus(QStringLiteral("connectError"),
+                        { { QStringLiteral("address"), target.address },
+                          { QStringLiteral("error"), target.servicesModel->errorString() } });
+        });
+    }
+    return true;
+}
+
+bool Gateway::loadConfig(const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        m_errorString = file.errorString();
+        return false;
+    }
+
+    QJsonParseError error;
+    const auto document = QJsonDocument::fromJson(file.readAll(), &error);
+    if (!document.isObject()) {
+        m_errorString = tr("Invalid configuration: %1").arg(error.errorString());
+        return false;
+    }
+    return configure(document.object());
+}
+
+bool Gateway::setOutput(const QString &fileName)
+{
+    if (m_output.isOpen())
+        m_output.close();
+
+    auto opened = false;
+    if (fileName == QLatin1String("-")) {
+        opened = m_output.open(stdout, QIODevice::WriteOnly | QIODevice::Text);
+    } else {
+        m_output.setFileName(fileName);
+        opened = m_output.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text);
+    }
+    if (!opened)
+        m_errorString = m_output.errorString();
+    return opened;
+}
+
+QString Gateway::errorString() const
+{
+    return m_errorString;
+}
+
+CharacteriticsModel *Gateway::characteristicsModel(const QString &address,
+                                                   const QString &serviceUuid) const
+{
+    const auto normalizedAddress = QBluetoothAddress(address).toString();
+    const QBluetoothUuid uuid(serviceUuid);
+    for (const auto &target : m_targets) {
+        if (target.address != normalizedAddress)
+            continue;
+        for (const auto characteristicsModel : target.characteristicsModels) {
+            const auto service = qobject_cast<GattService *>(characteristicsModel->service());
+            if (service && service->serviceUuid() == uuid)
+                return characteristicsModel;
+        }
+    }
+    return nullptr;
+}
+
+void Gateway::start()
+{
+    writeStatus(QStringLiteral("started"),
+                { { QStringLiteral("startupMs"), m_clock.elapsed() },
+                  { QStringLiteral("rssKb"), residentSetSize() },
+                  { QStringLiteral("devices"), int(m_targets.count()) } });
+    m_devicesModel->update();
+}
+
+void Gateway::addDevices(int first, int last)
+{
+    for (auto row = first; row <= last; ++row) {
+        writeDevice("device", row);
+
+        const auto address = dataOf(*m_devicesModel, row, "address").toString();
+        for (auto &target : m_targets) {
+            if (target.address == address)
+                connectTarget(target, dataOf(*m_devicesModel, row, "name").toString());
+        }
+    }
+}
+
+void Gateway::updateDevices(int first, int last)
+{
+    if (!m_reportUpdates)
+        return;
+    for (auto row = first; row <= last; ++row)
+        writeDevice("advertisement", row);
+}
+
+void Gateway::connectTarget(Target &target, const QString &name)
+{
+    const auto connectionPool = target.servicesModel->connectionPool();
+    if (!connectionPool->contains(target.address)) {
+        qCDebug(BLE_GATEWAY) << "Connect device:" << target.address;
+        target.servicesModel->update(target.address, name);
+        target.servicesModel->connectionTuner()->setProfile(target.profile);
+        return;
+    }
+    // The pooled controller reconnects on its own once it was up, but a
+    // first connection which failed is only retried when the device is
+    // heard again.
+    if (!connectionPool->isReconnecting(QBluetoothAddress(target.address)))
+        connectionPool->connectDevice(target.address);
+}
+
+void Gateway::buildTree(Target &target)
+{
+    const QAbstractItemModel &servicesModel = *target.servicesModel;
+    const auto serviceCount = servicesModel.rowCount();
+    if (serviceCount == 0)
+        return;
+
+    qDeleteAll(target.characteristicsModels);
+    target.characteristicsModels.clear();
+    target.reported = false;
+
+    for (auto row = 0; row < serviceCount; ++row) {
+        const auto service = target.servicesModel->serviceAt(row);
+        if (!service)
+            continue;
+
+        // The details are prefetched, the model is ready right away.
+        const auto characteristicsModel = new CharacteriticsModel(this);
+        characteristicsModel->update(service);
+        target.characteristicsModels.append(characteristicsModel);
+        // The services outlive a rebuild after a reconnection.
+        service->disconnect(this);
+        watchValues(target, service);
+    }
+
+    reportTree(target);
+}
+
+void Gateway::reportTree(Target &target)
+{
+    QJsonArray services;
+    for (const auto characteristicsModel : target.characteristicsModels) {
+        const auto service = qobject_cast<GattService *>(characteristicsModel->service());
+        const QAbstractItemModel &model = *characteristicsModel;
+
+        QJsonArray characteristics;
+        for (auto row = 0; row < model.rowCount(); ++row) {
+            const auto uuid = dataOf(model, row, "uuid").value<QBluetoothUuid>().toString();
+            characteristics.append(QJsonObject {
+                { QStringLiteral("uuid"), uuid },
+                { QStringLiteral("name"), dataOf(model, row, "name").toString() },
+                { QStringLiteral("properties"), dataOf(model, row, "props").toString() },
+                { QStringLiteral("value"), dataOf(model, row, "value").toString() }
+            });
+
+            // The services restore their subscriptions after a reconnect.
+            const auto subscribed = target.subscribe && !target.subscribed
+                    && (target.subscriptions.isEmpty()
+                        || target.subscriptions.contains(QBluetoothUuid(uuid)));
+            if (subscribed && dataOf(model, row, "notifyable").toBool())
+                characteristicsModel->enableNotification(uuid, true);
+            else if (subscribed && dataOf(model, row, "indicatable").toBool())
+                characteristicsModel->enableIndication(uuid, true);
+            if (target.read && dataOf(model, row, "readable").toBool())
+                characteristicsModel->read(uuid);
+        }
+
+        services.append(QJsonObject {
+            { QStringLiteral("uuid"), service->serviceUuid().toString() },
+            { QStringLiteral("name"), service->serviceName() },
+            { QStringLiteral("characteristics"), characteristics }
+        });
+    }
+
+    writeRecord(QStringLiteral("gatt"), {
+        { QStringLiteral("address"), target.address },
+        { QStringLiteral("services"), services }
+    });
+    target.reported = true;
+    target.subscribed = target.subscribe;
+    checkFinished();
+}
+
+void Gateway::watchValues(const Target &target, GattService *service)
+{
+    const auto address = target.address;
+    const auto serviceUuid = service->serviceUuid().toString();
+    const auto writeValue = [this, address, serviceUuid](const QBluetoothUuid &characteristicUuid,
+                                                        const QByteArray &value) {
+        writeRecord(QStringLiteral("value"), {
+            { QStringLiteral("address"), address },
+            { QStringLiteral("service"), serviceUuid },
+            { QStringLiteral("characteristic"), characteristicUuid.toString() },
+            { QStringLiteral("value"), QString::fromLatin1(value.toHex()) }
+        });
+    };
+    connect(service, &GattService::characteristicChanged, this, writeValue);
+    connect(service, &GattService::characteristicRead, this, writeValue);
+}
+
+void Gateway::checkFinished()
+{
+    if (m_devicesModel->isRunning() || m_devicesModel->isContinuous())
+        return;
+    for (const auto &target : m_targets) {
+        // Subscribed devices are streamed until the gateway is stopped.
+        if (!target.reported || target.subscribe)
+            return;
+    }
+    emit finished();
+}
+
+void Gateway::writeDevice(const char *type, int row)
+{
+    const QAbstractItemModel &model = *m_devicesModel;
+    writeRecord(QString::fromLatin1(type), {
+        { QStringLiteral("address"), dataOf(model, row, "address").toString() },
+        { QStringLiteral("name"), dataOf(model, row, "name").toString() },
+        { QStringLiteral("rssi"), dataOf(model, row, "rssi").toInt() }
+    });
+}
+
+void Gateway::writeStatus(const QString &event, const QJsonObject &details)
+{
+    auto record = details;
+    record.insert(QStringLiteral("event"), event);
+    writeRecord(QStringLiteral("status"), record);
+}
+
+void Gateway::writeRecord(const QString &type, QJsonObject record)
+{
+    record.insert(QStringLiteral("type"), type);
+    record.insert(QStringLiteral("time"),
+                  QDateTime::currentDateTimeUtc().toString(Qt::ISODateWithMs));
+    emit recordWritten(record);
+
+    if (!m_output.isOpen())
+        return;
+    m_output.write(QJsonDocument(record).toJson(QJsonDocument::Compact));
+    m_output.write("\n");
+    // Records are consumed as they come, e.g. through a pipe.
+    m_output.flush();
+}
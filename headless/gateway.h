@@ -0,0 +1,109 @@
+#ifndef GATEWAY_H
+#define GATEWAY_H
+
+#include "blebackend.h"
+#include "connectiontuner.h"
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonObject>
+#include <QPointer>
+#include <QSet>
+#include <QStringList>
+#include <QVector>
+
+class CharacteriticsModel;
+class ConnectionPool;
+class DevicesModel;
+class GattCache;
+class ServicesModel;
+class StreamServer;
+
+// Drives the models without any view: scans with the devices model,
+// connects to the configured devices with a services model each, and
+// resolves their GATT tree with a characteristics model per service.
+// The services models share one connection pool, which bounds the
+// connection attempts of all the devices, and one GATT cache.
+// Everything is written as newline-delimited JSON records:
+//
+//   {"type":"device","time":...,"address":...,"name":...,"rssi":...}
+//   {"type":"gatt","time":...,"address":...,"services":[...]}
+//   {"type":"value","time":...,"address":...,"service":...,"characteristic":...,"value":<hex>}
+//   {"type":"status","time":...,"event":...}
+//
+// The values are taken from the services rather than from the models,
+// which coalesce them per frame. The records also go to the clients of
+// the stream server, when one is configured.
+class Gateway : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit Gateway(QObject *parent = nullptr);
+    explicit Gateway(BleBackend *backend, QObject *parent = nullptr);
+    ~Gateway() override;
+
+    // See headless/gateway.json for the keys.
+    bool configure(const QJsonObject &config);
+    bool loadConfig(const QString &fileName);
+
+    // "-" for the standard output.
+    bool setOutput(const QString &fileName);
+
+    QString errorString() const;
+
+    // The model of a service of a configured device, once its GATT tree
+    // has been resolved.
+    CharacteriticsModel *characteristicsModel(const QString &address,
+                                              const QString &serviceUuid) const;
+
+    void start();
+
+signals:
+    // Once a single shot scan is over and every configured device has
+    // been reported.
+    void finished();
+
+    void recordWritten(const QJsonObject &record);
+
+private:
+    struct Target
+    {
+        QString address;
+        // Empty for all of the notifyable characteristics.
+        QSet<QBluetoothUuid> subscriptions;
+        bool subscribe = false;
+        bool read = false;
+        ConnectionTuner::Profile profile = ConnectionTuner::DefaultProfile;
+        ServicesModel *servicesModel = nullptr;
+        QVector<CharacteriticsModel *> characteristicsModels;
+        bool prefetching = false;
+        bool reported = false;
+        bool subscribed = false;
+    };
+
+    void addDevices(int first, int last);
+    void updateDevices(int first, int last);
+    void connectTarget(Target &target, const QString &name);
+    void buildTree(Target &target);
+    void reportTree(Target &target);
+    void watchValues(const Target &target, GattService *service);
+    void checkFinished();
+
+    void writeDevice(const char *type, int row);
+    void writeStatus(const QString &event, const QJsonObject &details = QJsonObject());
+    void writeRecord(const QString &type, QJsonObject record);
+
+    BleBackend *m_backend = nullptr;
+    DevicesModel *m_devicesModel = nullptr;
+    ConnectionPool *m_connectionPool = nullptr;
+    GattCache *m_gattCache = nullptr;
+    QVector<Target> m_targets;
+    StreamServer *m_streamServer = nullptr;
+    QFile m_output;
+    QElapsedTimer m_clock;
+    QString m_errorString;
+    bool m_reportUpdates = false;
+};
+
+#endif // GATEWAY_H
@@ -0,0 +1,75 @@
+#include "gateway.h"
+#include "simulatedblebackend.h"
+#include "tracer.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    const QCommandLineOption configOption(
+                QStringLiteral("config"),
+                QStringLiteral("Read the gateway configuration from <file>."),
+                QStringLiteral("file"));
+    const QCommandLineOption outputOption(
+                QStringLiteral("output"),
+                QStringLiteral("Write the records to <file>, - for the standard output."),
+                QStringLiteral("file"));
+    const QCommandLineOption simulateOption(
+                QStringLiteral("simulate"),
+                QStringLiteral("Use a simulated backend with <count> devices."),
+                QStringLiteral("count"));
+    const QCommandLineOption notificationRateOption(
+                QStringLiteral("notification-rate"),
+                QStringLiteral("Simulated notifications per second and characteristic."),
+                QStringLiteral("rate"));
+    const QCommandLineOption seedOption(
+                QStringLiteral("seed"),
+                QStringLiteral("Seed of the simulated backend."),
+                QStringLiteral("seed"));
+    const QCommandLineOption traceOption(
+                QStringLiteral("trace"),
+                QStringLiteral("Record a trace, written to <file> on exit, in the Chrome trace event format."),
+                QStringLiteral("file"));
+    parser.addOptions({ configOption, outputOption, simulateOption,
+                        notificationRateOption, seedOption, traceOption });
+    parser.process(app);
+
+    if (parser.isSet(simulateOption)) {
+        const auto backend = new SimulatedBleBackend(&app);
+        auto config = backend->config();
+        config.deviceCount = parser.value(simulateOption).toInt();
+        if (parser.isSet(notificationRateOption))
+            config.notificationRate = parser.value(notificationRateOption).toInt();
+        if (parser.isSet(seedOption))
+            config.seed = parser.value(seedOption).toUInt();
+        backend->setConfig(config);
+        BleBackend::setDefaultBackend(backend);
+    }
+
+    if (parser.isSet(traceOption)) {
+        const auto traceFileName = parser.value(traceOption);
+        Tracer::start();
+        QObject::connect(&app, &QCoreApplication::aboutToQuit,
+                         &app, [traceFileName]() {
+            Tracer::stop();
+            Tracer::save(traceFileName);
+        });
+    }
+
+    Gateway gateway;
+    if ((parser.isSet(configOption) && !gateway.loadConfig(parser.value(configOption)))
+            || (parser.isSet(outputOption) && !gateway.setOutput(parser.value(outputOption)))) {
+        qCritical("%s", qPrintable(gateway.errorString()));
+        return -1;
+    }
+
+    QObject::connect(&gateway, &Gateway::finished, &app, &QCoreApplication::quit);
+    gateway.start();
+
+    return app.exec();
+}
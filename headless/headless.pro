@@ -0,0 +1,37 @@
+# Gateway mode: the model layer driven by a configuration file, without
+# QML nor Qt GUI, writing newline-delimited JSON records.
+#
+# The footprint can be compared with the GUI build, e.g.:
+#
+#   /usr/bin/time -v ./lowenergyscanner-ng-headless --simulate 100 --config gateway.json
+#   /usr/bin/time -v ../lowenergyscanner-ng --simulate 100
+#
+# the "started" and "stopped" status records also report the startup
+# time and the resident set size.
+
+QT += bluetooth websockets
+QT -= gui
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+TARGET = lowenergyscanner-ng-headless
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+include(../scanner.pri)
+
+HEADERS += \
+    gateway.h \
+    streamserver.h
+
+SOURCES += \
+    gateway.cpp \
+    headless.cpp \
+    streamserver.cpp
+
+DISTFILES += \
+    gateway.json
+
+qnx: target.path = /tmp/$${TARGET}/bin
+else: unix:!android: target.path = /opt/$${TARGET}/bin
+!isEmpty(target.path): INSTALLS += target
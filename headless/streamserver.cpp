@@ -0,0 +1,301 @@
+#include "streamserver.h"
+#include "characteristicsmodel.h"
+#include "gateway.h"
+
+#include <QBluetoothAddress>
+#include <QBluetoothUuid>
+#include <QJsonDocument>
+#include <QLoggingCategory>
+#include <QWebSocket>
+#include <QWebSocketServer>
+
+#include <algorithm>
+
+Q_DECLARE_LOGGING_CATEGORY(BLE_SERVER)
+
+// The records carry the addresses and UUIDs as the Qt classes print
+// them, the clients may use any form the Qt classes parse.
+static QString normalizedAddress(const QJsonValue &value)
+{
+    const auto address = value.toString();
+    return address.isEmpty() ? address : QBluetoothAddress(address).toString();
+}
+
+static QString normalizedUuid(const QJsonValue &value)
+{
+    const auto uuid = value.toString();
+    return uuid.isEmpty() ? uuid : QBluetoothUuid(uuid).toString();
+}
+
+bool StreamServer::Subscription::matches(const QJsonObject &record) const
+{
+    return (address.isEmpty()
+            || record.value(QStringLiteral("address")).toString() == address)
+            && (service.isEmpty()
+                || record.value(QStringLiteral("service")).toString() == service)
+            && (characteristic.isEmpty()
+                || record.value(QStringLiteral("characteristic")).toString() == characteristic);
+}
+
+StreamServer::StreamServer(Gateway *gateway, QObject *parent)
+    : QObject(parent)
+    , m_gateway(gateway)
+    , m_server(new QWebSocketServer(QStringLiteral("lowenergyscanner-ng"),
+                                    QWebSocketServer::NonSecureMode, this))
+{
+    connect(m_server, &QWebSocketServer::newConnection,
+            this, &StreamServer::addClient);
+    connect(m_gateway, &Gateway::recordWritten,
+            this, &StreamServer::publish);
+}
+
+StreamServer::~StreamServer()
+{
+    m_server->close();
+    for (auto clientIt = m_clients.cbegin(); clientIt != m_clients.cend(); ++clientIt)
+        clientIt.key()->disconnect(this);
+    qDeleteAll(m_clients.keys());
+}
+
+bool StreamServer::listen(quint16 port)
+{
+    // Meant for the other processes of the gateway only.
+    if (!m_server->listen(QHostAddress::LocalHost, port)) {
+        qCWarning(BLE_SERVER) << "Unable to listen:" << port << m_server->errorString();
+        return false;
+    }
+    qCDebug(BLE_SERVER) << "Listen:" << m_server->serverPort();
+    return true;
+}
+
+quint16 StreamServer::serverPort() const
+{
+    return m_server->serverPort();
+}
+
+QString StreamServer::errorString() const
+{
+    return m_server->errorString();
+}
+
+int StreamServer::bufferSize() const
+{
+    return m_bufferSize;
+}
+
+void StreamServer::setBufferSize(int bufferSize)
+{
+    m_bufferSize = qMax(bufferSize, 1);
+}
+
+StreamServer::DropPolicy StreamServer::dropPolicy() const
+{
+    return m_dropPolicy;
+}
+
+void StreamServer::setDropPolicy(DropPolicy dropPolicy)
+{
+    m_dropPolicy = dropPolicy;
+}
+
+qint64 StreamServer::highWatermark() const
+{
+    return m_highWatermark;
+}
+
+void StreamServer::setHighWatermark(qint64 highWatermark)
+{
+    m_highWatermark = qMax(highWatermark, qint64(1));
+}
+
+int StreamServer::clientCount() const
+{
+    return m_clients.count();
+}
+
+void StreamServer::publish(const QJsonObject &record)
+{
+    if (m_clients.isEmpty())
+        return;
+
+    QByteArray message;
+    // Sending may drop a client, iterate over a copy of the sockets.
+    const auto sockets = m_clients.keys();
+    for (const auto socket : sockets) {
+        const auto clientIt = m_clients.find(socket);
+        if (clientIt == m_clients.end())
+            continue;
+        const auto &subscriptions = clientIt->subscriptions;
+        const auto subscribed = std::any_of(subscriptions.cbegin(), subscriptions.cend(),
+                                            [&record](const Subscription &subscription) {
+            return subscription.matches(record);
+        });
+        if (!subscribed)
+            continue;
+        // Serialized once, for the first subscribed client.
+        if (message.isEmpty())
+            message = QJsonDocument(record).toJson(QJsonDocument::Compact);
+        send(socket, *clientIt, message);
+    }
+}
+
+StreamServer::Subscription StreamServer::subscriptionOf(const QJsonObject &command)
+{
+    Subscription subscription;
+    subscription.address = normalizedAddress(command.value(QStringLiteral("address")));
+    subscription.service = normalizedUuid(command.value(QStringLiteral("service")));
+    subscription.characteristic = normalizedUuid(command.value(QStringLiteral("characteristic")));
+    return subscription;
+}
+
+void StreamServer::addClient()
+{
+    while (const auto socket = m_server->nextPendingConnection()) {
+        qCDebug(BLE_SERVER) << "Add client:" << socket->peerAddress() << socket->peerPort();
+        m_clients.insert(socket, Client());
+
+        connect(socket, &QWebSocket::textMessageReceived,
+                this, [this, socket](const QString &message) {
+            processCommand(socket, message);
+        });
+        connect(socket, &QWebSocket::bytesWritten,
+                this, [this, socket](qint64 bytes) {
+            const auto clientIt = m_clients.find(socket);
+            if (clientIt == m_clients.end())
+                return;
+            // The written bytes include the framing, which is not
+            // accounted for when sending.
+            clientIt->bytesInFlight = qMax(clientIt->bytesInFlight - bytes, qint64(0));
+            drain(socket, *clientIt);
+        });
+        connect(socket, &QWebSocket::disconnected,
+                this, [this, socket]() {
+            removeClient(socket);
+        });
+    }
+}
+
+void StreamServer::removeClient(QWebSocket *socket)
+{
+    const auto clientIt = m_clients.find(socket);
+    if (clientIt == m_clients.end())
+        return;
+    qCDebug(BLE_SERVER) << "Remove client:" << socket->peerAddress() << socket->peerPort()
+                        << "dropped:" << clientIt->dropped;
+    m_clients.erase(clientIt);
+    socket->disconnect(this);
+    socket->deleteLater();
+}
+
+void StreamServer::processCommand(QWebSocket *socket, const QString &message)
+{
+    const auto command = QJsonDocument::fromJson(message.toUtf8()).object();
+    const auto name = command.value(QStringLiteral("command")).toString();
+    const auto clientIt = m_clients.find(socket);
+    if (clientIt == m_clients.end())
+        return;
+
+    if (name == QLatin1String("subscribe")) {
+        clientIt->subscriptions.append(subscriptionOf(command));
+        reply(socket, command, true);
+        return;
+    }
+
+    if (name == QLatin1String("unsubscribe")) {
+        const auto subscription = subscriptionOf(command);
+        auto &subscriptions = clientIt->subscriptions;
+        subscriptions.erase(std::remove_if(subscriptions.begin(), subscriptions.end(),
+                                           [&subscription](const Subscription &other) {
+            return other.address == subscription.address
+                    && other.service == subscription.service
+                    && other.characteristic == subscription.characteristic;
+        }), subscriptions.end());
+        reply(socket, command, true);
+        return;
+    }
+
+    const auto address = command.value(QStringLiteral("address")).toString();
+    const auto service = command.value(QStringLiteral("service")).toString();
+    const auto characteristic = command.value(QStringLiteral("characteristic")).toString();
+    const auto model = m_gateway->characteristicsModel(address, service);
+
+    if (name != QLatin1String("read") && name != QLatin1String("write")
+            && name != QLatin1String("notify")) {
+        reply(socket, command, false, tr("Unknown command"));
+        return;
+    }
+    if (!model) {
+        reply(socket, command, false, tr("Service not resolved"));
+        return;
+    }
+
+    // Queued by the operation queue of the model, the outcome comes as
+    // a value record, or not at all for a failed write.
+    if (name == QLatin1String("read")) {
+        model->read(characteristic);
+    } else if (name == QLatin1String("write")) {
+        model->write(characteristic, command.value(QStringLiteral("value")).toString().toLatin1());
+    } else {
+        model->enableNotification(characteristic,
+                                  command.value(QStringLiteral("enable")).toBool(true));
+    }
+    reply(socket, command, true);
+}
+
+void StreamServer::send(QWebSocket *socket, Client &client, const QByteArray &message)
+{
+    if (client.pending.isEmpty() && client.bytesInFlight < m_highWatermark) {
+        client.bytesInFlight += message.size();
+        socket->sendTextMessage(QString::fromUtf8(message));
+        return;
+    }
+
+    if (client.pending.count() < m_bufferSize) {
+        client.pending.enqueue(message);
+        return;
+    }
+
+    ++client.dropped;
+    switch (m_dropPolicy) {
+    case DropOldest:
+        client.pending.dequeue();
+        client.pending.enqueue(message);
+        break;
+    case DropNewest:
+        break;
+    case Disconnect:
+        qCWarning(BLE_SERVER) << "Disconnect slow client:" << socket->peerAddress()
+                              << socket->peerPort();
+        socket->close(QWebSocketProtocol::CloseCodeTooMuchData,
+                      QStringLiteral("Buffer overflow"));
+        removeClient(socket);
+        break;
+    }
+}
+
+void StreamServer::drain(QWebSocket *socket, Client &client)
+{
+    while (!client.pending.isEmpty() && client.bytesInFlight < m_highWatermark) {
+        const auto message = client.pending.dequeue();
+        client.bytesInFlight += message.size();
+        socket->sendTextMessage(QString::fromUtf8(message));
+    }
+}
+
+void StreamServer::reply(QWebSocket *socket, const QJsonObject &command, bool ok,
+                         const QString &errorString)
+{
+    QJsonObject record {
+        { QStringLiteral("type"), QStringLiteral("reply") },
+        { QStringLiteral("command"), command.value(QStringLiteral("command")) },
+        { QStringLiteral("ok"), ok }
+    };
+    if (!errorString.isEmpty())
+        record.insert(QStringLiteral("error"), errorString);
+
+    // Replies go through the buffer as well, but are not subject to the
+    // subscriptions.
+    const auto clientIt = m_clients.find(socket);
+    if (clientIt != m_clients.end())
+        send(socket, *clientIt, QJsonDocument(record).toJson(QJsonDocument::Compact));
+}
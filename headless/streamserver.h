@@ -0,0 +1,104 @@
+#ifndef STREAMSERVER_H
+#define STREAMSERVER_H
+
+#include <QHash>
+#include <QJsonObject>
+#include <QQueue>
+#include <QVector>
+
+class QWebSocket;
+class QWebSocketServer;
+
+class Gateway;
+
+// WebSocket endpoint on the loopback interface streaming the records of
+// the gateway to its clients, one JSON record per text message.
+//
+// A client receives the records matching any of its subscriptions, a
+// subscription being an address, a service and a characteristic, each
+// of them optional:
+//
+//   {"command":"subscribe","address":...,"service":...,"characteristic":...}
+//   {"command":"unsubscribe", ...}
+//
+// and sends GATT requests, mapped onto the characteristics models:
+//
+//   {"command":"read","address":...,"service":...,"characteristic":...}
+//   {"command":"write", ..., "value":<hex>}
+//   {"command":"notify", ..., "enable":true}
+//
+// each answered by a {"type":"reply","command":...,"ok":...} record.
+//
+// The records are never queued in the event loop on behalf of a slow
+// client: up to highWatermark bytes are handed to its socket, then up
+// to bufferSize records wait in the client buffer, beyond which the
+// drop policy applies.
+class StreamServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum DropPolicy {
+        DropOldest,
+        DropNewest,
+        Disconnect
+    };
+    Q_ENUM(DropPolicy)
+
+    explicit StreamServer(Gateway *gateway, QObject *parent = nullptr);
+    ~StreamServer() override;
+
+    bool listen(quint16 port);
+    quint16 serverPort() const;
+    QString errorString() const;
+
+    int bufferSize() const;
+    void setBufferSize(int bufferSize);
+
+    DropPolicy dropPolicy() const;
+    void setDropPolicy(DropPolicy dropPolicy);
+
+    qint64 highWatermark() const;
+    void setHighWatermark(qint64 highWatermark);
+
+    int clientCount() const;
+
+    void publish(const QJsonObject &record);
+
+private:
+    struct Subscription
+    {
+        bool matches(const QJsonObject &record) const;
+
+        QString address;
+        QString service;
+        QString characteristic;
+    };
+
+    struct Client
+    {
+        QVector<Subscription> subscriptions;
+        QQueue<QByteArray> pending;
+        qint64 bytesInFlight = 0;
+        quint64 dropped = 0;
+    };
+
+    static Subscription subscriptionOf(const QJsonObject &command);
+
+    void addClient();
+    void removeClient(QWebSocket *socket);
+    void processCommand(QWebSocket *socket, const QString &message);
+    void send(QWebSocket *socket, Client &client, const QByteArray &message);
+    void drain(QWebSocket *socket, Client &client);
+    void reply(QWebSocket *socket, const QJsonObject &command, bool ok,
+               const QString &errorString = QString());
+
+    Gateway *m_gateway = nullptr;
+    QWebSocketServer *m_server = nullptr;
+    QHash<QWebSocket *, Client> m_clients;
+    int m_bufferSize = 256;
+    DropPolicy m_dropPolicy = DropOldest;
+    qint64 m_highWatermark = 64 * 1024;
+};
+
+#endif // STREAMSERVER_H
@@ -0,0 +1,360 @@
+#include "latencymetrics.h"
+#include "updatebatcher.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFileInfo>
+#include <QLoggingCategory>
+#include <QPointer>
+#include <QSaveFile>
+#include <QTimer>
+
+#include <algorithm>
+#include <iterator>
+
+Q_DECLARE_LOGGING_CATEGORY(BLE_METRICS)
+
+// Upper bounds of the buckets, in milliseconds; the last bucket holds
+// everything above.
+static const qreal BucketBounds[] = {
+    1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000, 20000, 60000
+};
+enum { BucketCount = sizeof(BucketBounds) / sizeof(BucketBounds[0]) + 1 };
+
+static const char *const PhaseNames[] = {
+    "connect",
+    "service_discovery",
+    "detail_discovery",
+    "read",
+    "write",
+    "cccd_write"
+};
+
+static QPointer<LatencyMetrics> &defaultMetricsInstance()
+{
+    static QPointer<LatencyMetrics> metrics;
+    return metrics;
+}
+
+void LatencyMetrics::Histogram::add(qint64 nanoseconds)
+{
+    if (buckets.isEmpty())
+        buckets.fill(0, BucketCount);
+    const auto milliseconds = nanoseconds / 1e6;
+    const auto bound = std::lower_bound(std::begin(BucketBounds), std::end(BucketBounds),
+                                        milliseconds);
+    ++buckets[int(bound - std::begin(BucketBounds))];
+    ++count;
+    sum += nanoseconds;
+    max = qMax(max, nanoseconds);
+}
+
+qreal LatencyMetrics::Histogram::percentile(qreal quantile) const
+{
+    if (count == 0)
+        return 0;
+
+    const auto maxMilliseconds = max / 1e6;
+    const auto target = quantile * count;
+    quint64 cumulative = 0;
+    for (int i = 0; i < buckets.count(); ++i) {
+        if (buckets.at(i) == 0)
+            continue;
+        const auto previous = cumulative;
+        cumulative += buckets.at(i);
+        if (cumulative < target)
+            continue;
+        const auto lower = (i == 0) ? 0.0 : BucketBounds[i - 1];
+        const auto upper = (i < BucketCount - 1) ? qMin(BucketBounds[i], maxMilliseconds)
+                                                 : maxMilliseconds;
+        const auto fraction = (target - previous) / buckets.at(i);
+        return lower + (qMax(upper, lower) - lower) * fraction;
+    }
+    return maxMilliseconds;
+}
+
+LatencyMetrics::LatencyMetrics(QObject *parent)
+    : QObject(parent)
+    , m_global(PhaseCount)
+    , m_updateBatcher(new UpdateBatcher(this))
+    , m_exportTimer(new QTimer(this))
+{
+    m_clock.start();
+
+    // Operations complete in bursts, the views are updated once per
+    // frame at most.
+    m_updateBatcher->setFlushHandler([this]() {
+        emit updated();
+    });
+
+    m_exportTimer->setInterval(10000);
+    connect(m_exportTimer, &QTimer::timeout, this, [this]() {
+        if (m_exportPending)
+            exportToFile();
+    });
+}
+
+LatencyMetrics::~LatencyMetrics()
+{
+    if (m_exportPending)
+        exportToFile();
+}
+
+LatencyMetrics *LatencyMetrics::defaultMetrics()
+{
+    auto &metrics = defaultMetricsInstance();
+    if (!metrics)
+        metrics = new LatencyMetrics(QCoreApplication::instance());
+    return metrics;
+}
+
+void LatencyMetrics::setDefaultMetrics(LatencyMetrics *metrics)
+{
+    defaultMetricsInstance() = metrics;
+}
+
+QString LatencyMetrics::exportFileName() const
+{
+    return m_exportFileName;
+}
+
+void LatencyMetrics::setExportFileName(const QString &exportFileName)
+{
+    if (m_exportFileName == exportFileName)
+        return;
+    m_exportFileName = exportFileName;
+    qCDebug(BLE_METRICS) << "Set export file name:" << m_exportFileName;
+    m_exportPending = true;
+    updateExportTimer();
+    emit exportFileNameChanged(m_exportFileName);
+}
+
+int LatencyMetrics::exportInterval() const
+{
+    return m_exportTimer->interval();
+}
+
+void LatencyMetrics::setExportInterval(int exportInterval)
+{
+    exportInterval = qMax(exportInterval, 100);
+    if (m_exportTimer->interval() == exportInterval)
+        return;
+    m_exportTimer->setInterval(exportInterval);
+    qCDebug(BLE_METRICS) << "Set export interval:" << exportInterval;
+    emit exportIntervalChanged(exportInterval);
+}
+
+QStringList LatencyMetrics::devices() const
+{
+    QStringList devices;
+    devices.reserve(m_devices.count());
+    for (auto deviceIt = m_devices.cbegin(); deviceIt != m_devices.cend(); ++deviceIt)
+        devices.append(QBluetoothAddress(deviceIt.key()).toString());
+    devices.sort();
+    return devices;
+}
+
+int LatencyMetrics::sampleCount() const
+{
+    quint64 count = 0;
+    for (const auto &histogram : m_global)
+        count += histogram.count;
+    return int(count);
+}
+
+void LatencyMetrics::begin(Phase phase, const QBluetoothAddress &address,
+                           const QString &key)
+{
+    m_spans.insert(spanKey(phase, address, key), m_clock.nsecsElapsed());
+}
+
+void LatencyMetrics::end(Phase phase, const QBluetoothAddress &address,
+                         const QString &key, bool succeeded)
+{
+    const auto spanIt = m_spans.find(spanKey(phase, address, key));
+    if (spanIt == m_spans.end())
+        return;
+    const auto nanoseconds = m_clock.nsecsElapsed() - spanIt.value();
+    m_spans.erase(spanIt);
+    record(phase, address, nanoseconds, succeeded);
+}
+
+void LatencyMetrics::fail(Phase phase, const QBluetoothAddress &address,
+                          const QString &key)
+{
+    end(phase, address, key, false);
+}
+
+void LatencyMetrics::record(Phase phase, const QBluetoothAddress &address,
+                            qint64 nanoseconds, bool succeeded)
+{
+    if (phase < 0 || phase >= PhaseCount)
+        return;
+
+    // A failure often is a timeout, its latency says little about the
+    // link: it is only counted.
+    auto &deviceHistogram = deviceHistograms(address)[phase];
+    if (succeeded) {
+        m_global[phase].add(nanoseconds);
+        deviceHistogram.add(nanoseconds);
+    } else {
+        ++m_global[phase].failures;
+        ++deviceHistogram.failures;
+    }
+
+    m_exportPending = true;
+    m_updateBatcher->schedule();
+}
+
+QVariantMap LatencyMetrics::summary(Phase phase, const QString &address) const
+{
+    if (phase < 0 || phase >= PhaseCount)
+        return QVariantMap();
+    if (address.isEmpty())
+        return summary(m_global.at(phase));
+
+    const auto deviceIt = m_devices.constFind(QBluetoothAddress(address).toUInt64());
+    return summary(deviceIt != m_devices.cend() ? deviceIt->at(phase) : Histogram());
+}
+
+void LatencyMetrics::reset()
+{
+    qCDebug(BLE_METRICS) << "Reset";
+    m_global = Histograms(PhaseCount);
+    m_devices.clear();
+    m_exportPending = true;
+    m_updateBatcher->cancel();
+    emit updated();
+}
+
+QString LatencyMetrics::toPrometheusText() const
+{
+    QString text;
+    text += QStringLiteral("# HELP ble_latency_seconds Latency of the Bluetooth LE operations.\n"
+                           "# TYPE ble_latency_seconds histogram\n");
+    for (int phase = 0; phase < PhaseCount; ++phase) {
+        appendHistogram(text, QStringLiteral("ble_latency_seconds"),
+                        QStringLiteral("phase=\"%1\"").arg(QLatin1String(PhaseNames[phase])),
+                        m_global.at(phase));
+    }
+
+    text += QStringLiteral("# HELP ble_latency_quantile_seconds Interpolated latency percentiles.\n"
+                           "# TYPE ble_latency_quantile_seconds gauge\n");
+    for (int phase = 0; phase < PhaseCount; ++phase) {
+        for (const auto quantile : { 0.5, 0.95, 0.99 }) {
+            text += QStringLiteral("ble_latency_quantile_seconds{phase=\"%1\",quantile=\"%2\"} %3\n")
+                    .arg(QLatin1String(PhaseNames[phase])).arg(quantile)
+                    .arg(m_global.at(phase).percentile(quantile) / 1000);
+        }
+    }
+
+    text += QStringLiteral("# HELP ble_failures_total Failed Bluetooth LE operations.\n"
+                           "# TYPE ble_failures_total counter\n");
+    for (int phase = 0; phase < PhaseCount; ++phase) {
+        text += QStringLiteral("ble_failures_total{phase=\"%1\"} %2\n")
+                .arg(QLatin1String(PhaseNames[phase])).arg(m_global.at(phase).failures);
+    }
+
+    text += QStringLiteral("# HELP ble_device_latency_seconds Latency of the Bluetooth LE operations per device.\n"
+                           "# TYPE ble_device_latency_seconds histogram\n");
+    for (const auto &device : devices()) {
+        const auto &histograms = m_devices.value(QBluetoothAddress(device).toUInt64());
+        for (int phase = 0; phase < PhaseCount; ++phase) {
+            if (histograms.at(phase).count == 0)
+                continue;
+            appendHistogram(text, QStringLiteral("ble_device_latency_seconds"),
+                            QStringLiteral("device=\"%1\",phase=\"%2\"")
+                            .arg(device, QLatin1String(PhaseNames[phase])),
+                            histograms.at(phase));
+        }
+    }
+
+    text += QStringLiteral("# HELP ble_device_failures_total Failed Bluetooth LE operations per device.\n"
+                           "# TYPE ble_device_failures_total counter\n");
+    for (const auto &device : devices()) {
+        const auto &histograms = m_devices.value(QBluetoothAddress(device).toUInt64());
+        for (int phase = 0; phase < PhaseCount; ++phase) {
+            if (histograms.at(phase).failures == 0)
+                continue;
+            text += QStringLiteral("ble_device_failures_total{device=\"%1\",phase=\"%2\"} %3\n")
+                    .arg(device, QLatin1String(PhaseNames[phase]))
+                    .arg(histograms.at(phase).failures);
+        }
+    }
+    return text;
+}
+
+bool LatencyMetrics::exportToFile()
+{
+    m_exportPending = false;
+    if (m_exportFileName.isEmpty())
+        return false;
+
+    QDir().mkpath(QFileInfo(m_exportFileName).absolutePath());
+    QSaveFile file(m_exportFileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        qCWarning(BLE_METRICS) << "Unable to export:" << m_exportFileName
+                               << file.errorString();
+        return false;
+    }
+
+    file.write(toPrometheusText().toUtf8());
+    if (!file.commit()) {
+        qCWarning(BLE_METRICS) << "Unable to export:" << m_exportFileName
+                               << file.errorString();
+        return false;
+    }
+    return true;
+}
+
+QString LatencyMetrics::spanKey(Phase phase, const QBluetoothAddress &address,
+                                const QString &key)
+{
+    return QString::number(phase) + QLatin1Char('/') + address.toString()
+            + QLatin1Char('/') + key;
+}
+
+QVariantMap LatencyMetrics::summary(const Histogram &histogram)
+{
+    const auto mean = histogram.count ? histogram.sum / 1e6 / histogram.count : 0.0;
+    return {
+        { QStringLiteral("count"), histogram.count },
+        { QStringLiteral("failures"), histogram.failures },
+        { QStringLiteral("mean"), mean },
+        { QStringLiteral("max"), histogram.max / 1e6 },
+        { QStringLiteral("p50"), histogram.percentile(0.5) },
+        { QStringLiteral("p95"), histogram.percentile(0.95) },
+        { QStringLiteral("p99"), histogram.percentile(0.99) }
+    };
+}
+
+void LatencyMetrics::appendHistogram(QString &text, const QString &name,
+                                     const QString &labels, const Histogram &histogram)
+{
+    quint64 cumulative = 0;
+    for (int i = 0; i < BucketCount; ++i) {
+        cumulative += histogram.buckets.value(i);
+        const auto bound = (i < BucketCount - 1) ? QString::number(BucketBounds[i] / 1000)
+                                                 : QStringLiteral("+Inf");
+        text += QStringLiteral("%1_bucket{%2,le=\"%3\"} %4\n")
+                .arg(name, labels, bound).arg(cumulative);
+    }
+    text += QStringLiteral("%1_sum{%2} %3\n").arg(name, labels).arg(histogram.sum / 1e9);
+    text += QStringLiteral("%1_count{%2} %3\n").arg(name, labels).arg(histogram.count);
+}
+
+LatencyMetrics::Histograms &LatencyMetrics::deviceHistograms(const QBluetoothAddress &address)
+{
+    auto deviceIt = m_devices.find(address.toUInt64());
+    if (deviceIt == m_devices.end())
+        deviceIt = m_devices.insert(address.toUInt64(), Histograms(PhaseCount));
+    return *deviceIt;
+}
+
+void LatencyMetrics::updateExportTimer()
+{
+    if (m_exportFileName.isEmpty())
+        m_exportTimer->stop();
+    else
+        m_exportTimer->start();
+}
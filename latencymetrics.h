@@ -0,0 +1,122 @@
+#ifndef LATENCYMETRICS_H
+#define LATENCYMETRICS_H
+
+#include <QBluetoothAddress>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QStringList>
+#include <QVariantMap>
+#include <QVector>
+
+class QTimer;
+class UpdateBatcher;
+
+// Latency histograms of the phases of a peripheral session, globally
+// and per device, from the request to the answer of the stack. The
+// buckets are fixed, from 1 ms to 60 s, and the percentiles are
+// interpolated within them. The histograms are exported periodically
+// to a file in the Prometheus text format, when a file name is set.
+class LatencyMetrics : public QObject
+{
+    Q_OBJECT
+
+    Q_PROPERTY(QString exportFileName READ exportFileName
+               WRITE setExportFileName NOTIFY exportFileNameChanged)
+    Q_PROPERTY(int exportInterval READ exportInterval
+               WRITE setExportInterval NOTIFY exportIntervalChanged)
+
+    Q_PROPERTY(QStringList devices READ devices NOTIFY updated)
+    Q_PROPERTY(int sampleCount READ sampleCount NOTIFY updated)
+
+public:
+    enum Phase {
+        Connect,
+        ServiceDiscovery,
+        DetailDiscovery,
+        Read,
+        Write,
+        ClientConfigurationWrite,
+        PhaseCount
+    };
+    Q_ENUM(Phase)
+
+    explicit LatencyMetrics(QObject *parent = nullptr);
+    ~LatencyMetrics() override;
+
+    // The instance the models and their helpers report to.
+    static LatencyMetrics *defaultMetrics();
+    static void setDefaultMetrics(LatencyMetrics *metrics);
+
+    QString exportFileName() const;
+    void setExportFileName(const QString &exportFileName);
+
+    // Milliseconds.
+    int exportInterval() const;
+    void setExportInterval(int exportInterval);
+
+    QStringList devices() const;
+    int sampleCount() const;
+
+    // A span is identified by its phase, its device and a key, such as
+    // a service UUID, for the phases which run concurrently on a device.
+    // Beginning a span again restarts it, ending a span which was not
+    // begun does nothing.
+    void begin(Phase phase, const QBluetoothAddress &address,
+               const QString &key = QString());
+    void end(Phase phase, const QBluetoothAddress &address,
+             const QString &key = QString(), bool succeeded = true);
+    void fail(Phase phase, const QBluetoothAddress &address,
+              const QString &key = QString());
+    // For the callers which time the phase themselves.
+    void record(Phase phase, const QBluetoothAddress &address,
+                qint64 nanoseconds, bool succeeded = true);
+
+    // count, failures, mean, max, p50, p95 and p99, in milliseconds;
+    // for all the devices when address is empty.
+    Q_INVOKABLE QVariantMap summary(Phase phase, const QString &address = QString()) const;
+    Q_INVOKABLE void reset();
+
+    QString toPrometheusText() const;
+    Q_INVOKABLE bool exportToFile();
+
+signals:
+    void exportFileNameChanged(const QString &exportFileName);
+    void exportIntervalChanged(int exportInterval);
+    void updated();
+
+private:
+    struct Histogram
+    {
+        void add(qint64 nanoseconds);
+        // Milliseconds.
+        qreal percentile(qreal quantile) const;
+
+        QVector<quint64> buckets;
+        quint64 count = 0;
+        quint64 failures = 0;
+        qint64 sum = 0;
+        qint64 max = 0;
+    };
+
+    using Histograms = QVector<Histogram>;
+
+    static QString spanKey(Phase phase, const QBluetoothAddress &address,
+                           const QString &key);
+    static QVariantMap summary(const Histogram &histogram);
+    static void appendHistogram(QString &text, const QString &name,
+                                const QString &labels, const Histogram &histogram);
+
+    Histograms &deviceHistograms(const QBluetoothAddress &address);
+    void updateExportTimer();
+
+    Histograms m_global;
+    QHash<quint64, Histograms> m_devices;
+    QHash<QString, qint64> m_spans;
+    QElapsedTimer m_clock;
+    UpdateBatcher *m_updateBatcher = nullptr;
+    QTimer *m_exportTimer = nullptr;
+    QString m_exportFileName;
+    bool m_exportPending = false;
+};
+
+#endif // LATENCYMETRICS_H
@@ -0,0 +1,17 @@
+#include <QLoggingCategory>
+
+Q_LOGGING_CATEGORY(BLE_DEVICES_MODEL, "scanner.devicesmodel")
+Q_LOGGING_CATEGORY(BLE_SCAN_SCHEDULER, "scanner.scanscheduler")
+Q_LOGGING_CATEGORY(BLE_SERVICES_MODEL, "scanner.servicesmodel")
+Q_LOGGING_CATEGORY(BLE_CHARACTERISTICS_MODEL, "scanner.characteristicsmodel")
+Q_LOGGING_CATEGORY(BLE_GATT_TREE, "scanner.gatttree")
+Q_LOGGING_CATEGORY(BLE_CAPTURE, "scanner.capture")
+Q_LOGGING_CATEGORY(BLE_BACKEND, "scanner.backend")
+Q_LOGGING_CATEGORY(BLE_CONNECTION_POOL, "scanner.connectionpool")
+Q_LOGGING_CATEGORY(BLE_CONNECTION_TUNER, "scanner.connectiontuner")
+Q_LOGGING_CATEGORY(BLE_GATT_CACHE, "scanner.gattcache")
+Q_LOGGING_CATEGORY(BLE_OPERATIONS, "scanner.operations")
+Q_LOGGING_CATEGORY(BLE_METRICS, "scanner.metrics")
+Q_LOGGING_CATEGORY(BLE_TRACE, "scanner.trace")
+Q_LOGGING_CATEGORY(BLE_GATEWAY, "scanner.gateway")
+Q_LOGGING_CATEGORY(BLE_SERVER, "scanner.server")
@@ -1,17 +1,25 @@
+#include "simulatedblebackend.h"
 #include "devicesmodel.h"
 #include "servicesmodel.h"
 #include "characteristicsmodel.h"
-#include "descriptorsmodel.h"
+#include "devicefilter.h"
+#include "connectionpool.h"
+#include "connectiontuner.h"
+#include "gattcache.h"
+#include "gattoperationqueue.h"
+#include "gatttreemodel.h"
+#include "latencymetrics.h"
+#include "scanscheduler.h"
+#include "streamwriter.h"
+#include "threadedblebackend.h"
+#include "tracer.h"
+#include "updatebatcher.h"
 
+#include <QCommandLineParser>
 #include <QGuiApplication>
 #include <QQmlApplicationEngine>
 #include <QQuickStyle>
-#include <QLoggingCategory>
-
-Q_LOGGING_CATEGORY(BLE_DEVICES_MODEL, "scanner.devicesmodel")
-Q_LOGGING_CATEGORY(BLE_SERVICES_MODEL, "scanner.servicesmodel")
-Q_LOGGING_CATEGORY(BLE_CHARACTERISTICS_MODEL, "scanner.characteristicsmodel")
-Q_LOGGING_CATEGORY(BLE_DESCRIPTORS_MODEL, "scanner.descriptorsmodel")
+#include <QStandardPaths>
 
 int main(int argc, char *argv[])
 {
@@ -19,10 +27,103 @@ int main(int argc, char *argv[])
     QGuiApplication app(argc, argv);
     QQuickStyle::setStyle(QStringLiteral("Material"));
 
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    const QCommandLineOption simulateOption(
+                QStringLiteral("simulate"),
+                QStringLiteral("Use a simulated backend with <count> devices."),
+                QStringLiteral("count"));
+    const QCommandLineOption notificationRateOption(
+                QStringLiteral("notification-rate"),
+                QStringLiteral("Simulated notifications per second and characteristic."),
+                QStringLiteral("rate"));
+    const QCommandLineOption seedOption(
+                QStringLiteral("seed"),
+                QStringLiteral("Seed of the simulated backend."),
+                QStringLiteral("seed"));
+    const QCommandLineOption replayOption(
+                QStringLiteral("replay"),
+                QStringLiteral("Replay the notifications of a capture <file>."),
+                QStringLiteral("file"));
+    const QCommandLineOption replaySpeedOption(
+                QStringLiteral("replay-speed"),
+                QStringLiteral("Replay speed factor."),
+                QStringLiteral("factor"), QStringLiteral("1"));
+    const QCommandLineOption metricsOption(
+                QStringLiteral("metrics"),
+                QStringLiteral("Export the latency metrics to <file>, in the Prometheus text format."),
+                QStringLiteral("file"));
+    const QCommandLineOption traceOption(
+                QStringLiteral("trace"),
+                QStringLiteral("Record a trace, written to <file> on exit, in the Chrome trace event format."),
+                QStringLiteral("file"));
+    const QCommandLineOption guiThreadOption(
+                QStringLiteral("gui-thread-io"),
+                QStringLiteral("Run the Bluetooth stack on the GUI thread instead of a dedicated one."));
+    parser.addOptions({ simulateOption, notificationRateOption, seedOption,
+                        replayOption, replaySpeedOption, metricsOption, traceOption,
+                        guiThreadOption });
+    parser.process(app);
+
+    if (parser.isSet(simulateOption) || parser.isSet(replayOption)) {
+        const auto backend = new SimulatedBleBackend(&app);
+        auto config = backend->config();
+        if (parser.isSet(simulateOption))
+            config.deviceCount = parser.value(simulateOption).toInt();
+        if (parser.isSet(notificationRateOption))
+            config.notificationRate = parser.value(notificationRateOption).toInt();
+        if (parser.isSet(seedOption))
+            config.seed = parser.value(seedOption).toUInt();
+        backend->setConfig(config);
+        if (parser.isSet(replayOption)
+                && !backend->loadReplay(parser.value(replayOption),
+                                        parser.value(replaySpeedOption).toDouble())) {
+            return -1;
+        }
+        BleBackend::setDefaultBackend(backend);
+    }
+    // Keeps the notification bursts away from the rendering.
+    if (!parser.isSet(guiThreadOption))
+        BleBackend::setDefaultBackend(new ThreadedBleBackend(BleBackend::defaultBackend(), &app));
+
+    GattCache::setDefaultFileName(
+                QStandardPaths::writableLocation(QStandardPaths::CacheLocation)
+                + QStringLiteral("/gatt.cache"));
+    if (parser.isSet(metricsOption))
+        LatencyMetrics::defaultMetrics()->setExportFileName(parser.value(metricsOption));
+    if (parser.isSet(traceOption)) {
+        const auto traceFileName = parser.value(traceOption);
+        Tracer::start();
+        QObject::connect(&app, &QCoreApplication::aboutToQuit,
+                         &app, [traceFileName]() {
+            Tracer::stop();
+            Tracer::save(traceFileName);
+        });
+    }
+
     qmlRegisterType<DevicesModel>("qt.example.com", 1, 0, "DevicesModel");
     qmlRegisterType<ServicesModel>("qt.example.com", 1, 0, "ServicesModel");
     qmlRegisterType<CharacteriticsModel>("qt.example.com", 1, 0, "CharacteriticsModel");
-    qmlRegisterType<DescriptorsModel>("qt.example.com", 1, 0, "DescriptorsModel");
+    qmlRegisterType<GattTreeModel>("qt.example.com", 1, 0, "GattTreeModel");
+    qmlRegisterType<GattSubtreeModel>("qt.example.com", 1, 0, "GattSubtreeModel");
+    qmlRegisterUncreatableType<UpdateBatcher>("qt.example.com", 1, 0, "UpdateBatcher",
+                                              QStringLiteral("Owned by the models"));
+    qmlRegisterUncreatableType<DeviceFilter>("qt.example.com", 1, 0, "DeviceFilter",
+                                             QStringLiteral("Owned by the devices model"));
+    qmlRegisterUncreatableType<ScanScheduler>("qt.example.com", 1, 0, "ScanScheduler",
+                                              QStringLiteral("Owned by the devices model"));
+    qmlRegisterUncreatableType<ConnectionPool>("qt.example.com", 1, 0, "ConnectionPool",
+                                               QStringLiteral("Owned by the services model"));
+    qmlRegisterUncreatableType<ConnectionTuner>("qt.example.com", 1, 0, "ConnectionTuner",
+                                                QStringLiteral("Owned by the services model"));
+    qmlRegisterUncreatableType<GattCache>("qt.example.com", 1, 0, "GattCache",
+                                          QStringLiteral("Owned by the services model"));
+    qmlRegisterUncreatableType<GattOperationQueue>("qt.example.com", 1, 0, "GattOperationQueue",
+                                                   QStringLiteral("Owned by the characteristics model"));
+    qmlRegisterUncreatableType<LatencyMetrics>("qt.example.com", 1, 0, "LatencyMetrics",
+                                               QStringLiteral("Shared by the models"));
+    qmlRegisterUncreatableType<StreamWriter>("qt.example.com", 1, 0, "StreamWriter",
+                                             QStringLiteral("Owned by the characteristics model"));
 
     QQmlApplicationEngine engine;
     engine.load(QUrl(QStringLiteral("qrc:/qml/lowenergyscanner-ng.qml")));
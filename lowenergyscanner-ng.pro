@@ -12,17 +12,9 @@ DEFINES += QT_DEPRECATED_WARNINGS
 # You can also select to disable deprecated APIs only up to a certain version of Qt.
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
-HEADERS += \
-    devicesmodel.h \
-    servicesmodel.h \
-    characteristicsmodel.h \
-    descriptorsmodel.h
+include(scanner.pri)
 
 SOURCES += \
-    devicesmodel.cpp \
-    servicesmodel.cpp \
-    characteristicsmodel.cpp \
-    descriptorsmodel.cpp \
     lowenergyscanner-ng.cpp
 
 RESOURCES += \
@@ -6,7 +6,14 @@ import QtQuick.Controls.Material 2.2
 import qt.example.com 1.0
 
 ListView {
-    model: characteristicsModel
+    property var serviceIndex
+
+    // The characteristics of the service within the tree; the
+    // operations go through the characteristics model.
+    model: GattSubtreeModel {
+        tree: gattTreeModel
+        rootIndex: serviceIndex
+    }
     delegate: Button {
         width: parent.width
         contentItem: ColumnLayout {
@@ -57,9 +64,8 @@ ListView {
         }
         onClicked: {
             errorPopup.close();
-            var service = characteristicsModel.service();
-            descriptorsModel.update(service, uuid);
-            stackView.push("qrc:/qml/DescriptorsPage.qml");
+            stackView.push("qrc:/qml/DescriptorsPage.qml",
+                           { characteristicIndex: gattTreeModel.childIndex(serviceIndex, uuid) });
         }
     }
 
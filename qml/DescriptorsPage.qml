@@ -6,7 +6,12 @@ import QtQuick.Controls.Material 2.2
 import qt.example.com 1.0
 
 ListView {
-    model: descriptorsModel
+    property var characteristicIndex
+
+    model: GattSubtreeModel {
+        tree: gattTreeModel
+        rootIndex: characteristicIndex
+    }
     delegate: Button {
         width: parent.width
         text: qsTr("%1\n%2\n%3").arg(name).arg(uuid).arg(value)
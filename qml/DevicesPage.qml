@@ -9,11 +9,12 @@ ListView {
     model: devicesModel
     delegate: Button {
         width: parent.width
-        text: qsTr("%1\n%2").arg(name).arg(address)
+        text: qsTr("%1\n%2\n%3 dBm").arg(name).arg(address).arg(rssi)
         onClicked: {
             errorPopup.close();
-            servicesModel.update(address);
-            stackView.push("qrc:/qml/ServicesPage.qml");
+            servicesModel.update(address, name);
+            stackView.push("qrc:/qml/ServicesPage.qml",
+                           { deviceIndex: gattTreeModel.addDevice(address, name) });
         }
     }
 }
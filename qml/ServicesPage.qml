@@ -6,15 +6,23 @@ import QtQuick.Controls.Material 2.2
 import qt.example.com 1.0
 
 ListView {
-    model: servicesModel
+    property var deviceIndex
+
+    // The services of the device within the tree, which keeps them
+    // while the page is left and come back to.
+    model: GattSubtreeModel {
+        tree: gattTreeModel
+        rootIndex: deviceIndex
+    }
     delegate: Button {
         width: parent.width
         text: qsTr("%1\n%2").arg(name).arg(uuid)
         onClicked: {
             errorPopup.close();
-            var service = servicesModel.service(uuid);
+            // Still the target of the characteristic operations.
             characteristicsModel.update(service);
-            stackView.push("qrc:/qml/CharacteristicsPage.qml");
+            stackView.push("qrc:/qml/CharacteristicsPage.qml",
+                           { serviceIndex: gattTreeModel.childIndex(deviceIndex, uuid) });
         }
     }
 }
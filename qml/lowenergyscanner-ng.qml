@@ -53,7 +53,7 @@ ApplicationWindow {
                 id: searchTimeoutsBox
                 enabled: !devicesModel.running
                 visible: stackView.depth === 1
-                model: [ 1000, 2000, 5000 ]
+                model: [ "1000", "2000", "5000", qsTr("Adaptive") ]
             }
 
             Label {
@@ -145,7 +145,10 @@ ApplicationWindow {
 
     DevicesModel {
         id: devicesModel
-        discoveryTimeout: searchTimeoutsBox.currentText
+        discoveryTimeout: scheduler.enabled ? scheduler.scanWindow : searchTimeoutsBox.currentText
+        scheduler.enabled: searchTimeoutsBox.currentIndex === searchTimeoutsBox.count - 1
+        // The scan and the connection compete for the adapter.
+        scheduler.paused: servicesModel.running
         onErrorOccurred: errorPopup.showError(errorString);
     }
 
@@ -154,12 +157,16 @@ ApplicationWindow {
         onErrorOccurred: errorPopup.showError(errorString);
     }
 
+    GattTreeModel {
+        id: gattTreeModel
+        servicesModel: servicesModel
+        operationQueue: characteristicsModel.operationQueue
+    }
+
     CharacteriticsModel {
         id: characteristicsModel
+        // One chunk per packet at the negotiated MTU.
+        streamWriter.chunkSize: servicesModel.connectionTuner.writeChunkSize
         onErrorOccurred: errorPopup.showError(errorString);
     }
-
-    DescriptorsModel {
-        id: descriptorsModel
-    }
 }
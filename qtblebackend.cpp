@@ -0,0 +1,318 @@
+#include "qtblebackend.h"
+
+#include <QBluetoothDeviceDiscoveryAgent>
+#include <QLowEnergyDescriptor>
+
+static GattDescriptorInfo toDescriptorInfo(const QLowEnergyDescriptor &descriptor)
+{
+    GattDescriptorInfo info;
+    info.uuid = descriptor.uuid();
+    info.name = descriptor.name();
+    info.value = descriptor.value();
+    return info;
+}
+
+// QtDeviceScanner
+
+QtDeviceScanner::QtDeviceScanner(QObject *parent)
+    : DeviceScanner(parent)
+    , m_discoveryAgent(new QBluetoothDeviceDiscoveryAgent(this))
+{
+    connect(m_discoveryAgent, &QBluetoothDeviceDiscoveryAgent::deviceDiscovered,
+            this, &DeviceScanner::deviceDiscovered);
+    connect(m_discoveryAgent, &QBluetoothDeviceDiscoveryAgent::deviceUpdated,
+            this, &DeviceScanner::deviceUpdated);
+    connect(m_discoveryAgent, &QBluetoothDeviceDiscoveryAgent::finished,
+            this, &DeviceScanner::finished);
+    connect(m_discoveryAgent, &QBluetoothDeviceDiscoveryAgent::canceled,
+            this, &DeviceScanner::canceled);
+    connect(m_discoveryAgent, QOverload<QBluetoothDeviceDiscoveryAgent::Error>::of(
+                &QBluetoothDeviceDiscoveryAgent::error),
+            this, &DeviceScanner::errorOccurred);
+}
+
+int QtDeviceScanner::lowEnergyDiscoveryTimeout() const
+{
+    return m_discoveryAgent->lowEnergyDiscoveryTimeout();
+}
+
+void QtDeviceScanner::setLowEnergyDiscoveryTimeout(int timeout)
+{
+    m_discoveryAgent->setLowEnergyDiscoveryTimeout(timeout);
+}
+
+bool QtDeviceScanner::isActive() const
+{
+    return m_discoveryAgent->isActive();
+}
+
+QString QtDeviceScanner::errorString() const
+{
+    return m_discoveryAgent->errorString();
+}
+
+void QtDeviceScanner::start()
+{
+    m_discoveryAgent->start(QBluetoothDeviceDiscoveryAgent::LowEnergyMethod);
+}
+
+void QtDeviceScanner::stop()
+{
+    m_discoveryAgent->stop();
+}
+
+// QtGattService
+
+QtGattService::QtGattService(QLowEnergyService *service,
+                             const QBluetoothAddress &deviceAddress,
+                             QObject *parent)
+    : GattService(parent)
+    , m_service(service)
+    , m_deviceAddress(deviceAddress)
+{
+    m_service->setParent(this);
+
+    connect(m_service, &QLowEnergyService::stateChanged,
+            this, &GattService::stateChanged);
+    connect(m_service, QOverload<QLowEnergyService::ServiceError>::of(&QLowEnergyService::error),
+            this, &GattService::errorOccurred);
+
+    connect(m_service, &QLowEnergyService::characteristicChanged,
+            [this](const QLowEnergyCharacteristic &characteristic, const QByteArray &value) {
+        emit characteristicChanged(characteristic.uuid(), value);
+    });
+    connect(m_service, &QLowEnergyService::characteristicRead,
+            [this](const QLowEnergyCharacteristic &characteristic, const QByteArray &value) {
+        emit characteristicRead(characteristic.uuid(), value);
+    });
+    connect(m_service, &QLowEnergyService::characteristicWritten,
+            [this](const QLowEnergyCharacteristic &characteristic, const QByteArray &value) {
+        emit characteristicWritten(characteristic.uuid(), value);
+    });
+
+    // The descriptors only know the handle of their characteristic.
+    const auto characteristicUuid = [this](const QLowEnergyDescriptor &descriptor)
+            -> QBluetoothUuid {
+        const auto characteristics = m_service->characteristics();
+        for (const auto &characteristic : characteristics) {
+            if (characteristic.handle() == descriptor.characteristicHandle())
+                return characteristic.uuid();
+        }
+        return QBluetoothUuid();
+    };
+    connect(m_service, &QLowEnergyService::descriptorRead,
+            [this, characteristicUuid](const QLowEnergyDescriptor &descriptor,
+                                       const QByteArray &value) {
+        emit descriptorRead(characteristicUuid(descriptor), descriptor.uuid(), value);
+    });
+    connect(m_service, &QLowEnergyService::descriptorWritten,
+            [this, characteristicUuid](const QLowEnergyDescriptor &descriptor,
+                                       const QByteArray &value) {
+        emit descriptorWritten(characteristicUuid(descriptor), descriptor.uuid(), value);
+    });
+}
+
+QBluetoothAddress QtGattService::deviceAddress() const
+{
+    return m_deviceAddress;
+}
+
+QBluetoothUuid QtGattService::serviceUuid() const
+{
+    return m_service->serviceUuid();
+}
+
+QString QtGattService::serviceName() const
+{
+    return m_service->serviceName();
+}
+
+QLowEnergyService::ServiceState QtGattService::state() const
+{
+    return m_service->state();
+}
+
+void QtGattService::discoverDetails()
+{
+    m_service->discoverDetails();
+}
+
+QVector<QBluetoothUuid> QtGattService::characteristicUuids() const
+{
+    const auto characteristics = m_service->characteristics();
+    QVector<QBluetoothUuid> characteristicUuids;
+    characteristicUuids.reserve(characteristics.count());
+    for (const auto &characteristic : characteristics)
+        characteristicUuids.append(characteristic.uuid());
+    return characteristicUuids;
+}
+
+GattCharacteristicInfo QtGattService::characteristic(
+        const QBluetoothUuid &characteristicUuid) const
+{
+    const auto characteristic = m_service->characteristic(characteristicUuid);
+    if (!characteristic.isValid())
+        return GattCharacteristicInfo();
+
+    GattCharacteristicInfo info;
+    info.uuid = characteristic.uuid();
+    info.name = characteristic.name();
+    info.properties = characteristic.properties();
+    info.value = characteristic.value();
+    const auto descriptors = characteristic.descriptors();
+    info.descriptors.reserve(descriptors.count());
+    for (const auto &descriptor : descriptors)
+        info.descriptors.append(toDescriptorInfo(descriptor));
+    return info;
+}
+
+QByteArray QtGattService::characteristicValue(
+        const QBluetoothUuid &characteristicUuid) const
+{
+    return m_service->characteristic(characteristicUuid).value();
+}
+
+QByteArray QtGattService::descriptorValue(const QBluetoothUuid &characteristicUuid,
+                                          const QBluetoothUuid &descriptorUuid) const
+{
+    return m_service->characteristic(characteristicUuid)
+            .descriptor(descriptorUuid).value();
+}
+
+void QtGattService::readCharacteristic(const QBluetoothUuid &characteristicUuid)
+{
+    m_service->readCharacteristic(m_service->characteristic(characteristicUuid));
+}
+
+void QtGattService::writeCharacteristic(const QBluetoothUuid &characteristicUuid,
+                                        const QByteArray &value,
+                                        QLowEnergyService::WriteMode mode)
+{
+    m_service->writeCharacteristic(m_service->characteristic(characteristicUuid),
+                                   value, mode);
+}
+
+void QtGattService::readDescriptor(const QBluetoothUuid &characteristicUuid,
+                                   const QBluetoothUuid &descriptorUuid)
+{
+    m_service->readDescriptor(m_service->characteristic(characteristicUuid)
+                              .descriptor(descriptorUuid));
+}
+
+void QtGattService::writeDescriptor(const QBluetoothUuid &characteristicUuid,
+                                    const QBluetoothUuid &descriptorUuid,
+                                    const QByteArray &value)
+{
+    m_service->writeDescriptor(m_service->characteristic(characteristicUuid)
+                               .descriptor(descriptorUuid), value);
+}
+
+// QtPeripheralController
+
+QtPeripheralController::QtPeripheralController(const QBluetoothAddress &remoteAddress,
+                                               QObject *parent)
+    : PeripheralController(parent)
+    , m_controller(new QLowEnergyController(remoteAddress, this))
+{
+    connect(m_controller, &QLowEnergyController::stateChanged,
+            this, &PeripheralController::stateChanged);
+    connect(m_controller, QOverload<QLowEnergyController::Error>::of(
+                &QLowEnergyController::error),
+            this, &PeripheralController::errorOccurred);
+    connect(m_controller, &QLowEnergyController::serviceDiscovered,
+            this, &PeripheralController::serviceDiscovered);
+    connect(m_controller, &QLowEnergyController::discoveryFinished,
+            this, &PeripheralController::discoveryFinished);
+    connect(m_controller, &QLowEnergyController::connectionUpdated,
+            this, [this](const QLowEnergyConnectionParameters &parameters) {
+        m_connectionParameters = parameters;
+        emit connectionUpdated(m_connectionParameters);
+    });
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+    connect(m_controller, &QLowEnergyController::mtuChanged,
+            this, &PeripheralController::mtuChanged);
+#endif
+}
+
+QBluetoothAddress QtPeripheralController::remoteAddress() const
+{
+    return m_controller->remoteAddress();
+}
+
+QLowEnergyController::ControllerState QtPeripheralController::state() const
+{
+    return m_controller->state();
+}
+
+QLowEnergyController::Error QtPeripheralController::error() const
+{
+    return m_controller->error();
+}
+
+QString QtPeripheralController::errorString() const
+{
+    return m_controller->errorString();
+}
+
+void QtPeripheralController::connectToDevice()
+{
+    m_controller->connectToDevice();
+}
+
+void QtPeripheralController::disconnectFromDevice()
+{
+    m_controller->disconnectFromDevice();
+}
+
+void QtPeripheralController::discoverServices()
+{
+    m_controller->discoverServices();
+}
+
+QVector<QBluetoothUuid> QtPeripheralController::services() const
+{
+    return m_controller->services().toVector();
+}
+
+GattService *QtPeripheralController::createServiceObject(
+        const QBluetoothUuid &serviceUuid, QObject *parent)
+{
+    const auto service = m_controller->createServiceObject(serviceUuid);
+    if (!service)
+        return nullptr;
+    return new QtGattService(service, m_controller->remoteAddress(), parent);
+}
+
+int QtPeripheralController::mtu() const
+{
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+    return m_controller->mtu();
+#else
+    // Not reported before Qt 5.14.
+    return DefaultAttMtu;
+#endif
+}
+
+QLowEnergyConnectionParameters QtPeripheralController::connectionParameters() const
+{
+    return m_connectionParameters;
+}
+
+void QtPeripheralController::requestConnectionUpdate(
+        const QLowEnergyConnectionParameters &parameters)
+{
+    m_controller->requestConnectionUpdate(parameters);
+}
+
+// QtBleBackend
+
+DeviceScanner *QtBleBackend::createDeviceScanner(QObject *parent)
+{
+    return new QtDeviceScanner(parent);
+}
+
+PeripheralController *QtBleBackend::createController(
+        const QBluetoothAddress &remoteAddress, QObject *parent)
+{
+    return new QtPeripheralController(remoteAddress, parent);
+}
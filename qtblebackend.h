@@ -0,0 +1,112 @@
+#ifndef QTBLEBACKEND_H
+#define QTBLEBACKEND_H
+
+#include "blebackend.h"
+
+class QBluetoothDeviceDiscoveryAgent;
+
+// Backend running on top of the Qt Bluetooth module, i.e. on real radios.
+
+class QtDeviceScanner final : public DeviceScanner
+{
+    Q_OBJECT
+
+public:
+    explicit QtDeviceScanner(QObject *parent = nullptr);
+
+    int lowEnergyDiscoveryTimeout() const final;
+    void setLowEnergyDiscoveryTimeout(int timeout) final;
+
+    bool isActive() const final;
+    QString errorString() const final;
+
+    void start() final;
+    void stop() final;
+
+private:
+    QBluetoothDeviceDiscoveryAgent *m_discoveryAgent = nullptr;
+};
+
+class QtGattService final : public GattService
+{
+    Q_OBJECT
+
+public:
+    explicit QtGattService(QLowEnergyService *service,
+                           const QBluetoothAddress &deviceAddress,
+                           QObject *parent = nullptr);
+
+    QBluetoothAddress deviceAddress() const final;
+    QBluetoothUuid serviceUuid() const final;
+    QString serviceName() const final;
+
+    QLowEnergyService::ServiceState state() const final;
+    void discoverDetails() final;
+
+    QVector<QBluetoothUuid> characteristicUuids() const final;
+    GattCharacteristicInfo characteristic(
+            const QBluetoothUuid &characteristicUuid) const final;
+    QByteArray characteristicValue(
+            const QBluetoothUuid &characteristicUuid) const final;
+    QByteArray descriptorValue(const QBluetoothUuid &characteristicUuid,
+                               const QBluetoothUuid &descriptorUuid) const final;
+
+    void readCharacteristic(const QBluetoothUuid &characteristicUuid) final;
+    void writeCharacteristic(const QBluetoothUuid &characteristicUuid,
+                             const QByteArray &value,
+                             QLowEnergyService::WriteMode mode) final;
+    void readDescriptor(const QBluetoothUuid &characteristicUuid,
+                        const QBluetoothUuid &descriptorUuid) final;
+    void writeDescriptor(const QBluetoothUuid &characteristicUuid,
+                         const QBluetoothUuid &descriptorUuid,
+                         const QByteArray &value) final;
+
+private:
+    QLowEnergyService *m_service = nullptr;
+    QBluetoothAddress m_deviceAddress;
+};
+
+class QtPeripheralController final : public PeripheralController
+{
+    Q_OBJECT
+
+public:
+    explicit QtPeripheralController(const QBluetoothAddress &remoteAddress,
+                                    QObject *parent = nullptr);
+
+    QBluetoothAddress remoteAddress() const final;
+    QLowEnergyController::ControllerState state() const final;
+    QLowEnergyController::Error error() const final;
+    QString errorString() const final;
+
+    void connectToDevice() final;
+    void disconnectFromDevice() final;
+
+    void discoverServices() final;
+    QVector<QBluetoothUuid> services() const final;
+    GattService *createServiceObject(const QBluetoothUuid &serviceUuid,
+                                     QObject *parent) final;
+
+    int mtu() const final;
+    QLowEnergyConnectionParameters connectionParameters() const final;
+    void requestConnectionUpdate(const QLowEnergyConnectionParameters &parameters) final;
+
+private:
+    QLowEnergyController *m_controller = nullptr;
+    // Qt only reports the updates.
+    QLowEnergyConnectionParameters m_connectionParameters;
+};
+
+class QtBleBackend final : public BleBackend
+{
+    Q_OBJECT
+
+public:
+    using BleBackend::BleBackend;
+
+    DeviceScanner *createDeviceScanner(QObject *parent) final;
+    PeripheralController *createController(const QBluetoothAddress &remoteAddress,
+                                           QObject *parent) final;
+};
+
+#endif // QTBLEBACKEND_H
@@ -0,0 +1,55 @@
+# Scanner core: the BLE backends and the models, shared by the
+# application and the benchmarks.
+
+QT += bluetooth
+
+INCLUDEPATH += $$PWD
+
+HEADERS += \
+    $$PWD/blebackend.h \
+    $$PWD/qtblebackend.h \
+    $$PWD/simulatedblebackend.h \
+    $$PWD/captureformat.h \
+    $$PWD/capturereader.h \
+    $$PWD/capturewriter.h \
+    $$PWD/devicefilter.h \
+    $$PWD/devicehistory.h \
+    $$PWD/devicesmodel.h \
+    $$PWD/servicesmodel.h \
+    $$PWD/characteristicsmodel.h \
+    $$PWD/updatebatcher.h \
+    $$PWD/connectionpool.h \
+    $$PWD/gattcache.h \
+    $$PWD/gattoperationqueue.h \
+    $$PWD/streamwriter.h \
+    $$PWD/latencymetrics.h \
+    $$PWD/tracer.h \
+    $$PWD/spscqueue.h \
+    $$PWD/threadedblebackend.h \
+    $$PWD/gatttreemodel.h \
+    $$PWD/scanscheduler.h \
+    $$PWD/connectiontuner.h
+
+SOURCES += \
+    $$PWD/blebackend.cpp \
+    $$PWD/qtblebackend.cpp \
+    $$PWD/simulatedblebackend.cpp \
+    $$PWD/capturereader.cpp \
+    $$PWD/capturewriter.cpp \
+    $$PWD/devicefilter.cpp \
+    $$PWD/devicehistory.cpp \
+    $$PWD/devicesmodel.cpp \
+    $$PWD/servicesmodel.cpp \
+    $$PWD/characteristicsmodel.cpp \
+    $$PWD/updatebatcher.cpp \
+    $$PWD/loggingcategories.cpp \
+    $$PWD/connectionpool.cpp \
+    $$PWD/gattcache.cpp \
+    $$PWD/gattoperationqueue.cpp \
+    $$PWD/streamwriter.cpp \
+    $$PWD/latencymetrics.cpp \
+    $$PWD/tracer.cpp \
+    $$PWD/threadedblebackend.cpp \
+    $$PWD/gatttreemodel.cpp \
+    $$PWD/scanscheduler.cpp \
+    $$PWD/connectiontuner.cpp
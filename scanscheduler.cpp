@@ -0,0 +1,210 @@
+#include "scanscheduler.h"
+
+#include <QLoggingCategory>
+#include <QTimer>
+
+Q_DECLARE_LOGGING_CATEGORY(BLE_SCAN_SCHEDULER)
+
+ScanScheduler::ScanScheduler(QObject *parent)
+    : QObject(parent)
+    , m_idleTimer(new QTimer(this))
+{
+    m_idleTimer->setSingleShot(true);
+    connect(m_idleTimer, &QTimer::timeout, this, &ScanScheduler::startWindow);
+}
+
+bool ScanScheduler::isEnabled() const
+{
+    return m_enabled;
+}
+
+void ScanScheduler::setEnabled(bool enabled)
+{
+    if (m_enabled == enabled)
+        return;
+    m_enabled = enabled;
+    qCDebug(BLE_SCAN_SCHEDULER) << "Set enabled:" << m_enabled;
+    emit enabledChanged(m_enabled);
+}
+
+int ScanScheduler::scanWindow() const
+{
+    return m_scanWindow;
+}
+
+void ScanScheduler::setScanWindow(int scanWindow)
+{
+    scanWindow = qMax(scanWindow, 1);
+    if (m_scanWindow == scanWindow)
+        return;
+    m_scanWindow = scanWindow;
+    qCDebug(BLE_SCAN_SCHEDULER) << "Set scan window:" << m_scanWindow;
+    emit scanWindowChanged(m_scanWindow);
+    emit statisticsChanged();
+}
+
+int ScanScheduler::minIdleWindow() const
+{
+    return m_minIdleWindow;
+}
+
+void ScanScheduler::setMinIdleWindow(int minIdleWindow)
+{
+    minIdleWindow = qMax(minIdleWindow, 0);
+    if (m_minIdleWindow == minIdleWindow)
+        return;
+    m_minIdleWindow = minIdleWindow;
+    qCDebug(BLE_SCAN_SCHEDULER) << "Set min idle window:" << m_minIdleWindow;
+    m_idleWindow = qBound(m_minIdleWindow, m_idleWindow, qMax(m_minIdleWindow, m_maxIdleWindow));
+    emit minIdleWindowChanged(m_minIdleWindow);
+    emit statisticsChanged();
+}
+
+int ScanScheduler::maxIdleWindow() const
+{
+    return m_maxIdleWindow;
+}
+
+void ScanScheduler::setMaxIdleWindow(int maxIdleWindow)
+{
+    maxIdleWindow = qMax(maxIdleWindow, 0);
+    if (m_maxIdleWindow == maxIdleWindow)
+        return;
+    m_maxIdleWindow = maxIdleWindow;
+    qCDebug(BLE_SCAN_SCHEDULER) << "Set max idle window:" << m_maxIdleWindow;
+    m_idleWindow = qBound(m_minIdleWindow, m_idleWindow, qMax(m_minIdleWindow, m_maxIdleWindow));
+    emit maxIdleWindowChanged(m_maxIdleWindow);
+    emit statisticsChanged();
+}
+
+bool ScanScheduler::isPaused() const
+{
+    return m_paused;
+}
+
+void ScanScheduler::setPaused(bool paused)
+{
+    if (m_paused == paused)
+        return;
+    m_paused = paused;
+    qCDebug(BLE_SCAN_SCHEDULER) << "Set paused:" << m_paused;
+    emit pausedChanged(m_paused);
+
+    if (!m_active)
+        return;
+    if (m_paused) {
+        m_idleTimer->stop();
+        if (m_scanning) {
+            m_interrupted = true;
+            emit stopRequested();
+        }
+    } else if (!m_scanning) {
+        // Devices may have shown up meanwhile.
+        startWindow();
+    }
+}
+
+int ScanScheduler::idleWindow() const
+{
+    return m_idleWindow;
+}
+
+qreal ScanScheduler::dutyCycle() const
+{
+    return qreal(m_scanWindow) / (m_scanWindow + m_idleWindow);
+}
+
+int ScanScheduler::windowCount() const
+{
+    return m_windowCount;
+}
+
+int ScanScheduler::lastNewDevices() const
+{
+    return m_lastNewDevices;
+}
+
+int ScanScheduler::lastSeenDevices() const
+{
+    return m_lastSeenDevices;
+}
+
+bool ScanScheduler::isActive() const
+{
+    return m_active;
+}
+
+bool ScanScheduler::isScanning() const
+{
+    return m_scanning;
+}
+
+void ScanScheduler::start()
+{
+    if (m_active)
+        return;
+    qCDebug(BLE_SCAN_SCHEDULER) << "Start scheduled discovery";
+    m_active = true;
+    m_idleWindow = m_minIdleWindow;
+    emit statisticsChanged();
+    startWindow();
+}
+
+void ScanScheduler::stop()
+{
+    if (!m_active)
+        return;
+    qCDebug(BLE_SCAN_SCHEDULER) << "Stop scheduled discovery";
+    m_active = false;
+    m_scanning = false;
+    m_idleTimer->stop();
+}
+
+void ScanScheduler::recordDevice(quint64 key, bool isNew)
+{
+    if (!m_scanning)
+        return;
+    m_windowDevices.insert(key);
+    if (isNew)
+        ++m_windowNewDevices;
+}
+
+void ScanScheduler::finishWindow()
+{
+    if (!m_scanning)
+        return;
+    m_scanning = false;
+
+    const auto duration = m_windowClock.elapsed();
+    m_lastNewDevices = m_windowNewDevices;
+    m_lastSeenDevices = m_windowDevices.count();
+    ++m_windowCount;
+
+    // A window cut short proves nothing about the population being
+    // stable, only new devices are taken into account then.
+    if (m_lastNewDevices > 0)
+        m_idleWindow = m_minIdleWindow;
+    else if (!m_interrupted)
+        m_idleWindow = qMin(qMax(m_idleWindow * 2, 1), qMax(m_minIdleWindow, m_maxIdleWindow));
+    m_interrupted = false;
+
+    qCDebug(BLE_SCAN_SCHEDULER) << "Scan window" << m_windowCount << "new:" << m_lastNewDevices
+                                << "seen:" << m_lastSeenDevices << "next idle window:"
+                                << m_idleWindow;
+    emit windowFinished(m_windowCount, m_lastNewDevices, m_lastSeenDevices, duration);
+    emit statisticsChanged();
+
+    if (m_active && !m_paused)
+        m_idleTimer->start(m_idleWindow);
+}
+
+void ScanScheduler::startWindow()
+{
+    if (!m_active || m_paused || m_scanning)
+        return;
+    m_scanning = true;
+    m_windowDevices.clear();
+    m_windowNewDevices = 0;
+    m_windowClock.start();
+    emit scanRequested();
+}
@@ -0,0 +1,109 @@
+#ifndef SCANSCHEDULER_H
+#define SCANSCHEDULER_H
+
+#include <QElapsedTimer>
+#include <QObject>
+#include <QSet>
+
+class QTimer;
+
+// Duty cycles the scan of the devices model: scan windows of a fixed
+// length alternate with idle windows, whose length adapts to the
+// population. A window without any new device doubles the next idle
+// window, up to the maximum, while new devices bring it back to the
+// minimum. No window is started while paused, e.g. while a device is
+// being connected, since the scan and the connection share the adapter.
+class ScanScheduler : public QObject
+{
+    Q_OBJECT
+
+    Q_PROPERTY(bool enabled READ isEnabled WRITE setEnabled NOTIFY enabledChanged)
+    Q_PROPERTY(int scanWindow READ scanWindow WRITE setScanWindow NOTIFY scanWindowChanged)
+    Q_PROPERTY(int minIdleWindow READ minIdleWindow
+               WRITE setMinIdleWindow NOTIFY minIdleWindowChanged)
+    Q_PROPERTY(int maxIdleWindow READ maxIdleWindow
+               WRITE setMaxIdleWindow NOTIFY maxIdleWindowChanged)
+    Q_PROPERTY(bool paused READ isPaused WRITE setPaused NOTIFY pausedChanged)
+
+    Q_PROPERTY(int idleWindow READ idleWindow NOTIFY statisticsChanged)
+    Q_PROPERTY(qreal dutyCycle READ dutyCycle NOTIFY statisticsChanged)
+    Q_PROPERTY(int windowCount READ windowCount NOTIFY statisticsChanged)
+    Q_PROPERTY(int lastNewDevices READ lastNewDevices NOTIFY statisticsChanged)
+    Q_PROPERTY(int lastSeenDevices READ lastSeenDevices NOTIFY statisticsChanged)
+
+public:
+    explicit ScanScheduler(QObject *parent = nullptr);
+
+    bool isEnabled() const;
+    void setEnabled(bool enabled);
+
+    // Milliseconds, as are the idle windows.
+    int scanWindow() const;
+    void setScanWindow(int scanWindow);
+
+    int minIdleWindow() const;
+    void setMinIdleWindow(int minIdleWindow);
+
+    int maxIdleWindow() const;
+    void setMaxIdleWindow(int maxIdleWindow);
+
+    bool isPaused() const;
+    void setPaused(bool paused);
+
+    // The next idle window.
+    int idleWindow() const;
+    // The share of the time spent scanning at the current idle window.
+    qreal dutyCycle() const;
+    int windowCount() const;
+    // Of the last scan window.
+    int lastNewDevices() const;
+    int lastSeenDevices() const;
+
+    // Between start() and stop().
+    bool isActive() const;
+    bool isScanning() const;
+
+    // Driven by the devices model.
+    void start();
+    void stop();
+    void recordDevice(quint64 key, bool isNew);
+    // The scan window is over, whether it finished or was canceled.
+    void finishWindow();
+
+signals:
+    void enabledChanged(bool enabled);
+    void scanWindowChanged(int scanWindow);
+    void minIdleWindowChanged(int minIdleWindow);
+    void maxIdleWindowChanged(int maxIdleWindow);
+    void pausedChanged(bool paused);
+    void statisticsChanged();
+
+    void scanRequested();
+    void stopRequested();
+
+    // Duration in milliseconds, shorter than the scan window when the
+    // window was cut by a pause.
+    void windowFinished(int window, int newDevices, int seenDevices, qint64 duration);
+
+private:
+    void startWindow();
+
+    QTimer *m_idleTimer = nullptr;
+    QElapsedTimer m_windowClock;
+    QSet<quint64> m_windowDevices;
+    int m_windowNewDevices = 0;
+    bool m_enabled = false;
+    bool m_paused = false;
+    bool m_active = false;
+    bool m_scanning = false;
+    bool m_interrupted = false;
+    int m_scanWindow = 5000;
+    int m_minIdleWindow = 5000;
+    int m_maxIdleWindow = 60000;
+    int m_idleWindow = 5000;
+    int m_windowCount = 0;
+    int m_lastNewDevices = 0;
+    int m_lastSeenDevices = 0;
+};
+
+#endif // SCANSCHEDULER_H
@@ -1,19 +1,43 @@
 #include "servicesmodel.h"
+#include "tracer.h"
 
-#include <QLowEnergyService>
-#include <QLowEnergyController>
 #include <QLoggingCategory>
 
+#include <algorithm>
+
 Q_DECLARE_LOGGING_CATEGORY(BLE_SERVICES_MODEL)
 
 enum {
     ServiceNameRole = Qt::UserRole + 1,
-    ServiceUuidRole
+    ServiceUuidRole,
+    ServiceDetailsDiscoveredRole,
+    ServiceDetailsDiscoveringRole
 };
 
 ServicesModel::ServicesModel(QObject *parent)
+    : ServicesModel(BleBackend::defaultBackend(), parent)
+{
+}
+
+ServicesModel::ServicesModel(BleBackend *backend, QObject *parent)
+    : ServicesModel(new ConnectionPool(backend), new GattCache(), parent)
+{
+    m_connectionPool->setParent(this);
+    m_gattCache->setParent(this);
+}
+
+ServicesModel::ServicesModel(ConnectionPool *connectionPool, GattCache *gattCache,
+                             QObject *parent)
     : QAbstractListModel(parent)
+    , m_connectionPool(connectionPool)
+    , m_connectionTuner(new ConnectionTuner(this))
+    , m_gattCache(gattCache)
+    , m_metrics(LatencyMetrics::defaultMetrics())
+    , m_insertionBatcher(new UpdateBatcher(this))
 {
+    m_insertionBatcher->setFlushHandler([this]() {
+        flushPendingServices();
+    });
 }
 
 bool ServicesModel::isRunning() const
@@ -50,30 +74,120 @@ QString ServicesModel::errorString() const
                         : tr("No controller object set");
 }
 
-void ServicesModel::update(const QString &deviceAddress)
+UpdateBatcher *ServicesModel::insertionBatcher() const
+{
+    return m_insertionBatcher;
+}
+
+ConnectionPool *ServicesModel::connectionPool() const
+{
+    return m_connectionPool;
+}
+
+ConnectionTuner *ServicesModel::connectionTuner() const
+{
+    return m_connectionTuner;
+}
+
+GattCache *ServicesModel::gattCache() const
+{
+    return m_gattCache;
+}
+
+LatencyMetrics *ServicesModel::metrics() const
+{
+    return m_metrics;
+}
+
+bool ServicesModel::prefetch() const
+{
+    return m_prefetch;
+}
+
+void ServicesModel::setPrefetch(bool prefetch)
+{
+    if (m_prefetch == prefetch)
+        return;
+    m_prefetch = prefetch;
+    qCDebug(BLE_SERVICES_MODEL) << "Set prefetch:" << m_prefetch;
+    if (!m_prefetch)
+        cancelPrefetch();
+    else if (m_controller && m_controller->state() == QLowEnergyController::DiscoveredState)
+        startPrefetch();
+    emit prefetchChanged(m_prefetch);
+}
+
+int ServicesModel::prefetchConcurrency() const
+{
+    return m_prefetchConcurrency;
+}
+
+void ServicesModel::setPrefetchConcurrency(int prefetchConcurrency)
+{
+    prefetchConcurrency = qMax(prefetchConcurrency, 1);
+    if (m_prefetchConcurrency == prefetchConcurrency)
+        return;
+    m_prefetchConcurrency = prefetchConcurrency;
+    qCDebug(BLE_SERVICES_MODEL) << "Set prefetch concurrency:" << m_prefetchConcurrency;
+    pumpPrefetch();
+    emit prefetchConcurrencyChanged(m_prefetchConcurrency);
+}
+
+QStringList ServicesModel::prefetchOrder() const
+{
+    return m_prefetchOrder;
+}
+
+void ServicesModel::setPrefetchOrder(const QStringList &prefetchOrder)
+{
+    if (m_prefetchOrder == prefetchOrder)
+        return;
+    m_prefetchOrder = prefetchOrder;
+    qCDebug(BLE_SERVICES_MODEL) << "Set prefetch order:" << m_prefetchOrder;
+    emit prefetchOrderChanged(m_prefetchOrder);
+}
+
+int ServicesModel::prefetchPending() const
+{
+    return m_prefetchQueue.count() + m_prefetching.count();
+}
+
+int ServicesModel::prefetchCompleted() const
+{
+    return m_prefetchCompleted;
+}
+
+void ServicesModel::update(const QString &deviceAddress, const QString &deviceModel)
 {
     if (m_running)
         return;
-    if (m_controller && (m_controller->remoteAddress()
-            == QBluetoothAddress(deviceAddress))) {
+    const QBluetoothAddress address(deviceAddress);
+    if (m_controller && (m_controller->remoteAddress() == address))
         return;
-    }
 
     qCDebug(BLE_SERVICES_MODEL) << "Start services discovery";
     setRunning(true);
 
     beginResetModel();
-    delete m_controller;
-    m_controller = new QLowEnergyController(QBluetoothAddress(deviceAddress),
-                                            this);
-    qDeleteAll(m_services);
+    if (m_controller) {
+        // The link stays in the pool, so that coming back to this
+        // device does not cost a reconnect and a rediscovery.
+        m_controller->disconnect(this);
+        m_connectionPool->release(m_controller->remoteAddress());
+    }
+    m_controller = m_connectionPool->acquire(address);
+    m_connectionTuner->setController(m_controller);
+    m_deviceModel = deviceModel;
+    cancelPrefetch();
+    m_insertionBatcher->cancel();
     m_services.clear();
+    m_pendingServices.clear();
     endResetModel();
 
     setConnected(false);
 
-    connect(m_controller, &QLowEnergyController::stateChanged,
-            [this](QLowEnergyController::ControllerState state) {
+    connect(m_controller, &PeripheralController::stateChanged,
+            this, [this](QLowEnergyController::ControllerState state) {
         switch (state) {
         case QLowEnergyController::ConnectingState:
         case QLowEnergyController::DiscoveringState:
@@ -81,63 +195,356 @@ void ServicesModel::update(const QString &deviceAddress)
             break;
         case QLowEnergyController::ConnectedState:
             setConnected(true);
-            m_controller->discoverServices();
+            discoverServices();
             break;
         case QLowEnergyController::UnconnectedState:
-            //setConnected(false);
+            // The services stay, the pool reconnects the link and the
+            // discovery attaches the new service objects to them.
+            setConnected(false);
+            setRunning(false);
             break;
         case QLowEnergyController::DiscoveredState:
+            if (m_metrics)
+                m_metrics->end(LatencyMetrics::ServiceDiscovery, m_controller->remoteAddress());
+            Tracer::end("discovery", "services", m_controller->remoteAddress().toUInt64());
+            m_insertionBatcher->flush();
+            removeUnconfirmedServices();
+            cacheServices();
             setRunning(false);
+            if (m_prefetch)
+                startPrefetch();
             break;
         default:
             break;
         }
     });
 
-    connect(m_controller, QOverload<QLowEnergyController::Error>::of(
-                &QLowEnergyController::error),
-            [this](QLowEnergyController::Error error) {
-        Q_UNUSED(error);
+    connect(m_controller, &PeripheralController::errorOccurred,
+            this, [this](QLowEnergyController::Error error) {
+        if (m_metrics)
+            m_metrics->fail(LatencyMetrics::ServiceDiscovery, m_controller->remoteAddress());
+        Tracer::end("discovery", "services", m_controller->remoteAddress().toUInt64());
         setRunning(false);
+        // Only the error which gives up is reported.
+        if (m_connectionPool->isReconnecting(m_controller->remoteAddress())) {
+            qCWarning(BLE_SERVICES_MODEL) << "Reconnect failed:" << error;
+            return;
+        }
         emit errorOccurred();
     });
 
-    connect(m_controller, &QLowEnergyController::serviceDiscovered,
-            [this](const QBluetoothUuid &serviceUuid) {
-        const bool containsService = service(serviceUuid.toString());
-        if (containsService) {
+    connect(m_controller, &PeripheralController::serviceDiscovered,
+            this, [this](const QBluetoothUuid &serviceUuid) {
+        const auto knownService = findService(serviceUuid);
+        const auto cachedService = qobject_cast<CachedGattService *>(knownService);
+        if (cachedService && !cachedService->source()) {
+            qCDebug(BLE_SERVICES_MODEL) << "Confirm cached service:" << serviceUuid;
+            cachedService->setSource(m_controller->createServiceObject(serviceUuid,
+                                                                       cachedService));
+            return;
+        }
+        if (knownService) {
             qCWarning(BLE_SERVICES_MODEL) << "Nothing to add, service already is in model:"
                                           << serviceUuid;
             return;
         }
 
-        const auto service = m_controller->createServiceObject(serviceUuid, this);
-        if (!service) {
+        const auto source = m_controller->createServiceObject(serviceUuid,
+                                                             m_controller);
+        if (!source) {
             qCWarning(BLE_SERVICES_MODEL) << "Unable to create service object:"
                                           << serviceUuid;
             return;
         }
 
+        // Wrapped, so that the service outlives the link: after a
+        // reconnect, the discovery attaches a new source to it instead.
+        GattCache::Service discovered;
+        discovered.uuid = serviceUuid;
+        const auto service = new CachedGattService(m_controller->remoteAddress(), discovered,
+                                                   m_controller);
+        service->setSource(source);
+
         qCDebug(BLE_SERVICES_MODEL) << "Add service:" << serviceUuid;
-        const auto rowsCount = m_services.count();
-        beginInsertRows(QModelIndex(), rowsCount, rowsCount);
-        m_services.append(service);
-        endInsertRows();
+        watchService(service);
+        m_pendingServices.append(service);
+        m_insertionBatcher->schedule();
     });
 
-    m_controller->connectToDevice();
+    // A pooled controller resumes from wherever it is, the pool itself
+    // takes care of queueing the connection of an unconnected one.
+    switch (m_controller->state()) {
+    case QLowEnergyController::DiscoveredState:
+        setConnected(true);
+        restoreServices();
+        setRunning(false);
+        if (m_prefetch)
+            startPrefetch();
+        break;
+    default:
+        // The services of a previous visit, wrapped so that they outlived
+        // the link, or else the cached layout, are shown until the
+        // discovery confirms them.
+        if (m_controller->findChild<CachedGattService *>(QString(), Qt::FindDirectChildrenOnly))
+            restoreServices();
+        else
+            populateFromCache();
+        if (m_controller->state() == QLowEnergyController::ConnectedState) {
+            setConnected(true);
+            discoverServices();
+        } else if (m_controller->state() == QLowEnergyController::DiscoveringState) {
+            setConnected(true);
+        }
+        break;
+    }
 }
 
 QObject *ServicesModel::service(const QString &serviceUuid) const
 {
-    const auto serviceEnd = m_services.cend();
-    const auto serviceIt = std::find_if(m_services.cbegin(), serviceEnd,
-                                        [serviceUuid](const QLowEnergyService *service)
-    {
-        return service->serviceUuid() == QUuid(serviceUuid);
+    return findService(QBluetoothUuid(serviceUuid));
+}
+
+GattService *ServicesModel::serviceAt(int row) const
+{
+    return m_services.value(row);
+}
+
+GattService *ServicesModel::findService(const QBluetoothUuid &serviceUuid) const
+{
+    const auto hasUuid = [serviceUuid](const GattService *service) {
+        return service->serviceUuid() == serviceUuid;
+    };
+    auto serviceIt = std::find_if(m_services.cbegin(), m_services.cend(), hasUuid);
+    if (serviceIt != m_services.cend())
+        return *serviceIt;
+    serviceIt = std::find_if(m_pendingServices.cbegin(), m_pendingServices.cend(), hasUuid);
+    if (serviceIt != m_pendingServices.cend())
+        return *serviceIt;
+    return nullptr;
+}
+
+void ServicesModel::discoverServices()
+{
+    // The service objects of a previous link are invalid once it has
+    // been reconnected, the wrapped ones get a new source.
+    const auto services = m_controller->findChildren<GattService *>(
+                QString(), Qt::FindDirectChildrenOnly);
+    for (const auto service : services) {
+        if (!m_services.contains(service) && !m_pendingServices.contains(service)) {
+            delete service;
+            continue;
+        }
+        if (const auto cachedService = qobject_cast<CachedGattService *>(service))
+            cachedService->setSource(nullptr);
+    }
+    if (m_metrics)
+        m_metrics->begin(LatencyMetrics::ServiceDiscovery, m_controller->remoteAddress());
+    if (Tracer::isEnabled()) {
+        Tracer::begin("discovery", "services", m_controller->remoteAddress().toUInt64(),
+                      m_controller->remoteAddress().toString());
+    }
+    m_controller->discoverServices();
+}
+
+void ServicesModel::populateFromCache()
+{
+    const auto address = m_controller->remoteAddress();
+    const auto layout = m_gattCache->lookup(address, m_deviceModel);
+    for (const auto &cached : layout) {
+        const auto service = new CachedGattService(address, cached, m_controller);
+        watchService(service);
+        m_pendingServices.append(service);
+    }
+    m_insertionBatcher->flush();
+}
+
+void ServicesModel::removeUnconfirmedServices()
+{
+    // Cached services which the discovery did not find anymore.
+    for (auto row = m_services.count() - 1; row >= 0; --row) {
+        const auto cachedService = qobject_cast<CachedGattService *>(m_services.at(row));
+        if (!cachedService || cachedService->source())
+            continue;
+        qCDebug(BLE_SERVICES_MODEL) << "Remove service:" << cachedService->serviceUuid();
+        beginRemoveRows(QModelIndex(), row, row);
+        m_services.remove(row);
+        endRemoveRows();
+        delete cachedService;
+    }
+}
+
+void ServicesModel::watchService(GattService *service)
+{
+    const auto deviceModel = m_deviceModel;
+    connect(service, &GattService::stateChanged,
+            this, [this, service, deviceModel](QLowEnergyService::ServiceState state) {
+        // Timed here, whoever started the discovery of the details.
+        if (m_metrics && state == QLowEnergyService::DiscoveringServices) {
+            m_metrics->begin(LatencyMetrics::DetailDiscovery, service->deviceAddress(),
+                             service->serviceUuid().toString());
+        }
+        // Keyed by the service, the details of several services may be
+        // discovered at once.
+        if (Tracer::isEnabled() && state == QLowEnergyService::DiscoveringServices) {
+            Tracer::begin("discovery", "discoverDetails", quintptr(service),
+                          service->serviceUuid().toString());
+        }
+        if (state == QLowEnergyService::ServiceDiscovered) {
+            Tracer::end("discovery", "discoverDetails", quintptr(service));
+            if (m_metrics) {
+                m_metrics->end(LatencyMetrics::DetailDiscovery, service->deviceAddress(),
+                               service->serviceUuid().toString());
+            }
+            cacheService(service, deviceModel);
+        }
+        serviceStateChanged(service);
+    });
+
+    connect(service, &GattService::errorOccurred,
+            this, [this, service]() {
+        if (m_metrics) {
+            m_metrics->fail(LatencyMetrics::DetailDiscovery, service->deviceAddress(),
+                            service->serviceUuid().toString());
+        }
+        Tracer::end("discovery", "discoverDetails", quintptr(service));
+        finishPrefetch(service);
+    });
+}
+
+void ServicesModel::serviceStateChanged(GattService *service)
+{
+    const auto row = m_services.indexOf(service);
+    if (row >= 0) {
+        const auto modelIndex = index(row, 0);
+        emit dataChanged(modelIndex, modelIndex);
+    }
+    if (service->state() != QLowEnergyService::DiscoveringServices)
+        finishPrefetch(service);
+}
+
+void ServicesModel::cacheService(GattService *service, const QString &deviceModel)
+{
+    GattCache::Service cached;
+    cached.uuid = service->serviceUuid();
+    cached.name = service->serviceName();
+    const auto characteristicUuids = service->characteristicUuids();
+    for (const auto &characteristicUuid : characteristicUuids)
+        cached.characteristics.append(service->characteristic(characteristicUuid));
+    m_gattCache->storeService(service->deviceAddress(), deviceModel, cached);
+}
+
+void ServicesModel::cacheServices()
+{
+    GattCache::Layout layout;
+    const auto serviceUuids = m_controller->services();
+    for (const auto &serviceUuid : serviceUuids) {
+        const auto service = findService(serviceUuid);
+        if (!service)
+            continue;
+        GattCache::Service cached;
+        cached.uuid = serviceUuid;
+        cached.name = service->serviceName();
+        layout.append(cached);
+    }
+    m_gattCache->storeServices(m_controller->remoteAddress(), m_deviceModel, layout);
+}
+
+void ServicesModel::restoreServices()
+{
+    // The service objects created during the discovery are children of
+    // the controller, in the discovery order. One per service, should an
+    // earlier visit have left another.
+    const auto services = m_controller->findChildren<GattService *>(
+                QString(), Qt::FindDirectChildrenOnly);
+    qCDebug(BLE_SERVICES_MODEL) << "Restore services:" << services.count();
+    m_pendingServices.clear();
+    for (const auto service : services) {
+        if (findService(service->serviceUuid()))
+            delete service;
+        else
+            m_pendingServices.append(service);
+    }
+    m_insertionBatcher->flush();
+}
+
+void ServicesModel::startPrefetch()
+{
+    cancelPrefetch();
+
+    // The services listed in the order first, by their rank, then the
+    // others in the discovery order.
+    QVector<QPair<int, GattService *>> rankedServices;
+    for (auto row = 0; row < m_services.count(); ++row) {
+        const auto service = m_services.at(row);
+        if (service->state() != QLowEnergyService::DiscoveryRequired)
+            continue;
+        const auto rank = m_prefetchOrder.indexOf(service->serviceUuid().toString());
+        rankedServices.append(qMakePair((rank >= 0) ? rank : m_prefetchOrder.count() + row,
+                                        service));
+    }
+    std::sort(rankedServices.begin(), rankedServices.end(),
+              [](const QPair<int, GattService *> &left, const QPair<int, GattService *> &right) {
+        return left.first < right.first;
     });
 
-    return (serviceIt != serviceEnd) ? *serviceIt : nullptr;
+    qCDebug(BLE_SERVICES_MODEL) << "Start prefetch:" << rankedServices.count();
+    for (const auto &rankedService : qAsConst(rankedServices))
+        m_prefetchQueue.append(rankedService.second);
+    pumpPrefetch();
+    emit prefetchProgressChanged();
+}
+
+void ServicesModel::cancelPrefetch()
+{
+    if (m_prefetchQueue.isEmpty() && m_prefetching.isEmpty() && m_prefetchCompleted == 0)
+        return;
+    // The discoveries in flight complete on their own.
+    m_prefetchQueue.clear();
+    m_prefetching.clear();
+    m_prefetchCompleted = 0;
+    emit prefetchProgressChanged();
+}
+
+void ServicesModel::pumpPrefetch()
+{
+    // The deleted services are done with.
+    m_prefetching.removeAll(nullptr);
+
+    // Several discoveries are kept in flight, so that the stack always
+    // has the next request queued when one completes.
+    while (m_prefetching.count() < m_prefetchConcurrency && !m_prefetchQueue.isEmpty()) {
+        const auto service = m_prefetchQueue.takeFirst();
+        // Skips the services deleted or opened meanwhile.
+        if (!service || service->state() != QLowEnergyService::DiscoveryRequired)
+            continue;
+        qCDebug(BLE_SERVICES_MODEL) << "Prefetch service:" << service->serviceUuid();
+        m_prefetching.append(service);
+        service->discoverDetails();
+    }
+}
+
+void ServicesModel::finishPrefetch(GattService *service)
+{
+    const auto prefetchingIndex = m_prefetching.indexOf(service);
+    if (prefetchingIndex < 0)
+        return;
+    m_prefetching.remove(prefetchingIndex);
+    ++m_prefetchCompleted;
+    pumpPrefetch();
+    emit prefetchProgressChanged();
+}
+
+void ServicesModel::flushPendingServices()
+{
+    if (m_pendingServices.isEmpty())
+        return;
+
+    const auto rowsCount = m_services.count();
+    beginInsertRows(QModelIndex(), rowsCount,
+                    rowsCount + m_pendingServices.count() - 1);
+    m_services.append(m_pendingServices);
+    m_pendingServices.clear();
+    endInsertRows();
 }
 
 int ServicesModel::rowCount(const QModelIndex &parent) const
@@ -160,6 +567,10 @@ QVariant ServicesModel::data(const QModelIndex &index, int role) const
         return service->serviceName();
     case ServiceUuidRole:
         return service->serviceUuid();
+    case ServiceDetailsDiscoveredRole:
+        return service->state() == QLowEnergyService::ServiceDiscovered;
+    case ServiceDetailsDiscoveringRole:
+        return service->state() == QLowEnergyService::DiscoveringServices;
     default:
         return QVariant();
     }
@@ -169,6 +580,8 @@ QHash<int, QByteArray> ServicesModel::roleNames() const
 {
     return {
         { ServiceNameRole, "name" },
-        { ServiceUuidRole, "uuid" }
+        { ServiceUuidRole, "uuid" },
+        { ServiceDetailsDiscoveredRole, "detailsDiscovered" },
+        { ServiceDetailsDiscoveringRole, "detailsDiscovering" }
     };
 }
@@ -1,11 +1,16 @@
 #ifndef SERVICESMODEL_H
 #define SERVICESMODEL_H
 
+#include "blebackend.h"
+#include "connectionpool.h"
+#include "connectiontuner.h"
+#include "gattcache.h"
+#include "latencymetrics.h"
+#include "updatebatcher.h"
+
 #include <QAbstractListModel>
 #include <QPointer>
-
-class QLowEnergyService;
-class QLowEnergyController;
+#include <QStringList>
 
 class ServicesModel : public QAbstractListModel
 {
@@ -14,34 +19,113 @@ class ServicesModel : public QAbstractListModel
     Q_PROPERTY(bool running READ isRunning NOTIFY runningChanged)
     Q_PROPERTY(bool connected READ isConnected NOTIFY connectedChanged)
     Q_PROPERTY(QString errorString READ errorString NOTIFY errorOccurred)
+    Q_PROPERTY(UpdateBatcher *insertionBatcher READ insertionBatcher CONSTANT)
+    Q_PROPERTY(ConnectionPool *connectionPool READ connectionPool CONSTANT)
+    Q_PROPERTY(ConnectionTuner *connectionTuner READ connectionTuner CONSTANT)
+    Q_PROPERTY(GattCache *gattCache READ gattCache CONSTANT)
+    Q_PROPERTY(LatencyMetrics *metrics READ metrics CONSTANT)
+
+    Q_PROPERTY(bool prefetch READ prefetch WRITE setPrefetch NOTIFY prefetchChanged)
+    Q_PROPERTY(int prefetchConcurrency READ prefetchConcurrency
+               WRITE setPrefetchConcurrency NOTIFY prefetchConcurrencyChanged)
+    Q_PROPERTY(QStringList prefetchOrder READ prefetchOrder
+               WRITE setPrefetchOrder NOTIFY prefetchOrderChanged)
+    Q_PROPERTY(int prefetchPending READ prefetchPending NOTIFY prefetchProgressChanged)
+    Q_PROPERTY(int prefetchCompleted READ prefetchCompleted NOTIFY prefetchProgressChanged)
 
 public:
     explicit ServicesModel(QObject *parent = nullptr);
+    explicit ServicesModel(BleBackend *backend, QObject *parent = nullptr);
+    // Shares the pool and the cache with other models, e.g. so that the
+    // connection attempts of all of them are bounded together. Neither
+    // is owned by the model then.
+    explicit ServicesModel(ConnectionPool *connectionPool, GattCache *gattCache,
+                           QObject *parent = nullptr);
 
     bool isRunning() const;
     bool isConnected() const;
     QString errorString() const;
+    UpdateBatcher *insertionBatcher() const;
+    ConnectionPool *connectionPool() const;
+    ConnectionTuner *connectionTuner() const;
+    GattCache *gattCache() const;
+    LatencyMetrics *metrics() const;
+
+    // Discovers the details of all the services once the services are
+    // discovered, so that the characteristics are resolved before they
+    // are asked for. The services listed in the order (by UUID) go
+    // first, the others follow in the discovery order.
+    bool prefetch() const;
+    void setPrefetch(bool prefetch);
+
+    int prefetchConcurrency() const;
+    void setPrefetchConcurrency(int prefetchConcurrency);
+
+    QStringList prefetchOrder() const;
+    void setPrefetchOrder(const QStringList &prefetchOrder);
 
-    Q_INVOKABLE void update(const QString &deviceAddress);
+    int prefetchPending() const;
+    int prefetchCompleted() const;
+
+    // The optional device model lets identical devices share their
+    // cached GATT layout, see GattCache::shareByDeviceModel.
+    Q_INVOKABLE void update(const QString &deviceAddress,
+                            const QString &deviceModel = QString());
     Q_INVOKABLE QObject *service(const QString &serviceUuid) const;
+    GattService *serviceAt(int row) const;
 
 signals:
     void runningChanged(bool running);
     void connectedChanged(bool connected);
     void errorOccurred();
 
+    void prefetchChanged(bool prefetch);
+    void prefetchConcurrencyChanged(int prefetchConcurrency);
+    void prefetchOrderChanged(const QStringList &prefetchOrder);
+    void prefetchProgressChanged();
+
 private:
     void setRunning(bool running);
     void setConnected(bool connected);
 
+    void discoverServices();
+    void restoreServices();
+    void populateFromCache();
+    void removeUnconfirmedServices();
+    void watchService(GattService *service);
+    void serviceStateChanged(GattService *service);
+    void cacheService(GattService *service, const QString &deviceModel);
+    void cacheServices();
+
+    void startPrefetch();
+    void cancelPrefetch();
+    void pumpPrefetch();
+    void finishPrefetch(GattService *service);
+    GattService *findService(const QBluetoothUuid &serviceUuid) const;
+    void flushPendingServices();
+
     int rowCount(const QModelIndex &parent) const final;
     QVariant data(const QModelIndex &index, int role) const final;
     QHash<int, QByteArray> roleNames() const final;
 
     bool m_running = false;
     bool m_connected = false;
-    QVector<QLowEnergyService *> m_services;
-    QPointer<QLowEnergyController> m_controller;
+    ConnectionPool *m_connectionPool = nullptr;
+    ConnectionTuner *m_connectionTuner = nullptr;
+    GattCache *m_gattCache = nullptr;
+    QPointer<LatencyMetrics> m_metrics;
+    QString m_deviceModel;
+    QVector<GattService *> m_services;
+    QVector<GattService *> m_pendingServices;
+    UpdateBatcher *m_insertionBatcher = nullptr;
+    QPointer<PeripheralController> m_controller;
+
+    bool m_prefetch = false;
+    int m_prefetchConcurrency = 2;
+    QStringList m_prefetchOrder;
+    QVector<QPointer<GattService>> m_prefetchQueue;
+    QVector<QPointer<GattService>> m_prefetching;
+    int m_prefetchCompleted = 0;
 };
 
 #endif // SERVICESMODEL_H
@@ -0,0 +1,849 @@
+#include "simulatedblebackend.h"
+#include "capturereader.h"
+
+#include <QLoggingCategory>
+#include <QTimer>
+#include <QtEndian>
+
+Q_DECLARE_LOGGING_CATEGORY(BLE_BACKEND)
+
+// Simulated devices use a contiguous range of random static addresses.
+static const quint64 DeviceAddressBase = Q_UINT64_C(0xC0DE00000000);
+
+// Base values of the UUIDs of the simulated attributes. The GATT
+// layout only depends on the attribute indexes, so that all the
+// simulated devices share the same model.
+static const quint32 ServiceUuidBase = 0x5e4d0000;
+static const quint32 CharacteristicUuidBase = 0x5e4e0000;
+
+enum {
+    // The company identifier reserved for tests by the Bluetooth SIG.
+    TestManufacturerId = 0xffff,
+    ScannerTickInterval = 10,
+    NotificationTickInterval = 5
+};
+
+// SplitMix64 finalizer, derives reproducible values from the seed.
+static quint64 scramble(quint64 value)
+{
+    value += Q_UINT64_C(0x9e3779b97f4a7c15);
+    value = (value ^ (value >> 30)) * Q_UINT64_C(0xbf58476d1ce4e5b9);
+    value = (value ^ (value >> 27)) * Q_UINT64_C(0x94d049bb133111eb);
+    return value ^ (value >> 31);
+}
+
+static QLowEnergyCharacteristic::PropertyTypes simulatedProperties(int characteristicIndex)
+{
+    switch (characteristicIndex % 4) {
+    case 0:
+        return QLowEnergyCharacteristic::Read | QLowEnergyCharacteristic::Notify;
+    case 1:
+        return QLowEnergyCharacteristic::Read | QLowEnergyCharacteristic::Write
+                | QLowEnergyCharacteristic::WriteNoResponse;
+    case 2:
+        return QLowEnergyCharacteristic::Read | QLowEnergyCharacteristic::Indicate;
+    default:
+        return QLowEnergyCharacteristic::Read;
+    }
+}
+
+static GattCharacteristicInfo makeCharacteristic(const QBluetoothUuid &uuid,
+                                                 const QString &name,
+                                                 QLowEnergyCharacteristic::PropertyTypes properties)
+{
+    GattCharacteristicInfo characteristic;
+    characteristic.uuid = uuid;
+    characteristic.name = name;
+    characteristic.properties = properties;
+    characteristic.value = QByteArray(sizeof(quint32), '\0');
+
+    if (properties & (QLowEnergyCharacteristic::Notify
+                      | QLowEnergyCharacteristic::Indicate)) {
+        GattDescriptorInfo configDescriptor;
+        configDescriptor.uuid = QBluetoothUuid(
+                    QBluetoothUuid::ClientCharacteristicConfiguration);
+        configDescriptor.name = QStringLiteral("Client Characteristic Configuration");
+        configDescriptor.value = QByteArray(sizeof(quint16), '\0');
+        characteristic.descriptors.append(configDescriptor);
+    }
+
+    GattDescriptorInfo descriptionDescriptor;
+    descriptionDescriptor.uuid = QBluetoothUuid(
+                QBluetoothUuid::CharacteristicUserDescription);
+    descriptionDescriptor.name = QStringLiteral("Characteristic User Description");
+    descriptionDescriptor.value = name.toUtf8();
+    characteristic.descriptors.append(descriptionDescriptor);
+
+    return characteristic;
+}
+
+// SimulatedDeviceScanner
+
+SimulatedDeviceScanner::SimulatedDeviceScanner(SimulatedBleBackend *backend,
+                                               QObject *parent)
+    : DeviceScanner(parent)
+    , m_backend(backend)
+    , m_tickTimer(new QTimer(this))
+    , m_timeoutTimer(new QTimer(this))
+{
+    m_tickTimer->setInterval(ScannerTickInterval);
+    connect(m_tickTimer, &QTimer::timeout, this, &SimulatedDeviceScanner::emitDue);
+
+    m_timeoutTimer->setSingleShot(true);
+    m_timeoutTimer->setInterval(40000);
+    connect(m_timeoutTimer, &QTimer::timeout, this, &SimulatedDeviceScanner::finish);
+}
+
+int SimulatedDeviceScanner::lowEnergyDiscoveryTimeout() const
+{
+    return m_timeoutTimer->interval();
+}
+
+void SimulatedDeviceScanner::setLowEnergyDiscoveryTimeout(int timeout)
+{
+    m_timeoutTimer->setInterval(timeout);
+}
+
+bool SimulatedDeviceScanner::isActive() const
+{
+    return m_tickTimer->isActive();
+}
+
+QString SimulatedDeviceScanner::errorString() const
+{
+    return m_backend ? QString() : tr("Simulated backend destroyed");
+}
+
+void SimulatedDeviceScanner::start()
+{
+    if (!m_backend) {
+        emit errorOccurred();
+        return;
+    }
+
+    m_clock.start();
+    m_emitted = 0;
+    m_tickTimer->start();
+    // As for Qt Bluetooth, a zero timeout scans until stopped.
+    if (m_timeoutTimer->interval() > 0)
+        m_timeoutTimer->start();
+}
+
+void SimulatedDeviceScanner::stop()
+{
+    if (!isActive())
+        return;
+    m_tickTimer->stop();
+    m_timeoutTimer->stop();
+    emit canceled();
+}
+
+void SimulatedDeviceScanner::advance(int advertisements)
+{
+    if (!m_backend)
+        return;
+
+    const auto deviceCount = m_backend->deviceCount();
+    if (deviceCount == 0)
+        return;
+    if (m_seenDevices.size() != deviceCount)
+        m_seenDevices.resize(deviceCount);
+
+    for (auto i = 0; i < advertisements; ++i) {
+        const auto device = m_backend->advertisement(m_sequence);
+        const auto deviceIndex = int(m_sequence % quint64(deviceCount));
+        ++m_sequence;
+
+        if (m_seenDevices.testBit(deviceIndex)) {
+            emit deviceUpdated(device, QBluetoothDeviceInfo::Field::RSSI
+                               | QBluetoothDeviceInfo::Field::ManufacturerData);
+        } else {
+            m_seenDevices.setBit(deviceIndex);
+            emit deviceDiscovered(device);
+        }
+    }
+}
+
+void SimulatedDeviceScanner::emitDue()
+{
+    if (!m_backend)
+        return;
+    const auto due = m_clock.elapsed() * m_backend->config().advertisementRate / 1000;
+    const auto advertisements = int(due - m_emitted);
+    m_emitted = due;
+    advance(advertisements);
+}
+
+void SimulatedDeviceScanner::finish()
+{
+    emitDue();
+    m_tickTimer->stop();
+    emit finished();
+}
+
+// SimulatedGattService
+
+SimulatedGattService::SimulatedGattService(SimulatedBleBackend *backend,
+                                           const QBluetoothAddress &deviceAddress,
+                                           const QBluetoothUuid &serviceUuid,
+                                           QObject *parent)
+    : GattService(parent)
+    , m_backend(backend)
+    , m_deviceAddress(deviceAddress)
+    , m_serviceUuid(serviceUuid)
+    , m_notificationTimer(new QTimer(this))
+{
+    m_notificationTimer->setInterval(NotificationTickInterval);
+    m_notificationTimer->setTimerType(Qt::PreciseTimer);
+    connect(m_notificationTimer, &QTimer::timeout,
+            this, &SimulatedGattService::emitDueNotifications);
+}
+
+QBluetoothAddress SimulatedGattService::deviceAddress() const
+{
+    return m_deviceAddress;
+}
+
+QBluetoothUuid SimulatedGattService::serviceUuid() const
+{
+    return m_serviceUuid;
+}
+
+QString SimulatedGattService::serviceName() const
+{
+    return tr("Simulated service %1").arg(m_serviceUuid.toString());
+}
+
+QLowEnergyService::ServiceState SimulatedGattService::state() const
+{
+    return m_state;
+}
+
+void SimulatedGattService::discoverDetails()
+{
+    if (!m_backend || m_state != QLowEnergyService::DiscoveryRequired)
+        return;
+
+    setState(QLowEnergyService::DiscoveringServices);
+    QTimer::singleShot(m_backend->config().discoveryLatency, this, [this]() {
+        if (!m_backend || m_state != QLowEnergyService::DiscoveringServices)
+            return;
+        m_characteristics = m_backend->characteristics(m_deviceAddress, m_serviceUuid);
+        m_characteristicRows.clear();
+        for (auto row = 0; row < m_characteristics.count(); ++row)
+            m_characteristicRows.insert(m_characteristics.at(row).uuid, row);
+        m_notificationCounters.fill(0, m_characteristics.count());
+        setState(QLowEnergyService::ServiceDiscovered);
+    });
+}
+
+QVector<QBluetoothUuid> SimulatedGattService::characteristicUuids() const
+{
+    QVector<QBluetoothUuid> characteristicUuids;
+    characteristicUuids.reserve(m_characteristics.count());
+    for (const auto &characteristic : m_characteristics)
+        characteristicUuids.append(characteristic.uuid);
+    return characteristicUuids;
+}
+
+GattCharacteristicInfo SimulatedGattService::characteristic(
+        const QBluetoothUuid &characteristicUuid) const
+{
+    const auto row = m_characteristicRows.value(characteristicUuid, -1);
+    return (row < 0) ? GattCharacteristicInfo() : m_characteristics.at(row);
+}
+
+QByteArray SimulatedGattService::characteristicValue(
+        const QBluetoothUuid &characteristicUuid) const
+{
+    const auto row = m_characteristicRows.value(characteristicUuid, -1);
+    return (row < 0) ? QByteArray() : m_characteristics.at(row).value;
+}
+
+QByteArray SimulatedGattService::descriptorValue(const QBluetoothUuid &characteristicUuid,
+                                                 const QBluetoothUuid &descriptorUuid) const
+{
+    const auto row = m_characteristicRows.value(characteristicUuid, -1);
+    if (row < 0)
+        return QByteArray();
+    for (const auto &descriptor : m_characteristics.at(row).descriptors) {
+        if (descriptor.uuid == descriptorUuid)
+            return descriptor.value;
+    }
+    return QByteArray();
+}
+
+void SimulatedGattService::readCharacteristic(const QBluetoothUuid &characteristicUuid)
+{
+    if (m_state == QLowEnergyService::InvalidService) {
+        emit errorOccurred(QLowEnergyService::OperationError);
+        return;
+    }
+    const auto row = m_characteristicRows.value(characteristicUuid, -1);
+    if (row < 0 || !(m_characteristics.at(row).properties & QLowEnergyCharacteristic::Read)) {
+        emit errorOccurred(QLowEnergyService::CharacteristicReadError);
+        return;
+    }
+
+    QTimer::singleShot(0, this, [this, row]() {
+        if (m_state == QLowEnergyService::InvalidService)
+            return;
+        const auto &characteristic = m_characteristics.at(row);
+        emit characteristicRead(characteristic.uuid, characteristic.value);
+    });
+}
+
+void SimulatedGattService::writeCharacteristic(const QBluetoothUuid &characteristicUuid,
+                                               const QByteArray &value,
+                                               QLowEnergyService::WriteMode mode)
+{
+    if (m_state == QLowEnergyService::InvalidService) {
+        emit errorOccurred(QLowEnergyService::OperationError);
+        return;
+    }
+    const auto row = m_characteristicRows.value(characteristicUuid, -1);
+    const auto writable = QLowEnergyCharacteristic::Write
+            | QLowEnergyCharacteristic::WriteNoResponse
+            | QLowEnergyCharacteristic::WriteSigned;
+    if (row < 0 || !(m_characteristics.at(row).properties & writable)) {
+        emit errorOccurred(QLowEnergyService::CharacteristicWriteError);
+        return;
+    }
+
+    m_characteristics[row].value = value;
+
+    // As for Qt Bluetooth, unacknowledged writes are not reported.
+    if (mode != QLowEnergyService::WriteWithResponse)
+        return;
+    QTimer::singleShot(0, this, [this, row, value]() {
+        if (m_state == QLowEnergyService::InvalidService)
+            return;
+        emit characteristicWritten(m_characteristics.at(row).uuid, value);
+    });
+}
+
+void SimulatedGattService::readDescriptor(const QBluetoothUuid &characteristicUuid,
+                                          const QBluetoothUuid &descriptorUuid)
+{
+    if (m_state == QLowEnergyService::InvalidService) {
+        emit errorOccurred(QLowEnergyService::OperationError);
+        return;
+    }
+    const auto row = m_characteristicRows.value(characteristicUuid, -1);
+    const auto descriptor = (row < 0) ? nullptr : findDescriptor(row, descriptorUuid);
+    if (!descriptor) {
+        emit errorOccurred(QLowEnergyService::DescriptorReadError);
+        return;
+    }
+
+    const auto value = descriptor->value;
+    QTimer::singleShot(0, this, [this, characteristicUuid, descriptorUuid, value]() {
+        if (m_state == QLowEnergyService::InvalidService)
+            return;
+        emit descriptorRead(characteristicUuid, descriptorUuid, value);
+    });
+}
+
+void SimulatedGattService::writeDescriptor(const QBluetoothUuid &characteristicUuid,
+                                           const QBluetoothUuid &descriptorUuid,
+                                           const QByteArray &value)
+{
+    if (m_state == QLowEnergyService::InvalidService) {
+        emit errorOccurred(QLowEnergyService::OperationError);
+        return;
+    }
+    const auto row = m_characteristicRows.value(characteristicUuid, -1);
+    const auto descriptor = (row < 0) ? nullptr : findDescriptor(row, descriptorUuid);
+    if (!descriptor) {
+        emit errorOccurred(QLowEnergyService::DescriptorWriteError);
+        return;
+    }
+
+    descriptor->value = value;
+    if (descriptorUuid == QBluetoothUuid(QBluetoothUuid::ClientCharacteristicConfiguration))
+        updateSubscription(row);
+
+    QTimer::singleShot(0, this, [this, characteristicUuid, descriptorUuid, value]() {
+        if (m_state == QLowEnergyService::InvalidService)
+            return;
+        emit descriptorWritten(characteristicUuid, descriptorUuid, value);
+    });
+}
+
+void SimulatedGattService::advanceNotifications(int notifications)
+{
+    if (m_subscribedRows.isEmpty())
+        return;
+    for (auto i = 0; i < notifications; ++i) {
+        m_nextSubscribedRow %= m_subscribedRows.count();
+        notify(m_subscribedRows.at(m_nextSubscribedRow++));
+    }
+}
+
+void SimulatedGattService::replayNotification(const QBluetoothUuid &characteristicUuid,
+                                              const QByteArray &value)
+{
+    const auto row = m_characteristicRows.value(characteristicUuid, -1);
+    if (row < 0)
+        return;
+    m_characteristics[row].value = value;
+    emit characteristicChanged(characteristicUuid, value);
+}
+
+void SimulatedGattService::invalidate()
+{
+    m_notificationTimer->stop();
+    m_subscribedRows.clear();
+    setState(QLowEnergyService::InvalidService);
+}
+
+void SimulatedGattService::setState(QLowEnergyService::ServiceState state)
+{
+    if (m_state == state)
+        return;
+    m_state = state;
+    emit stateChanged(m_state);
+}
+
+void SimulatedGattService::notify(int row)
+{
+    if (!m_backend)
+        return;
+    auto &characteristic = m_characteristics[row];
+    characteristic.value = m_backend->notificationValue(
+                m_backend->deviceIndex(m_deviceAddress), row,
+                ++m_notificationCounters[row]);
+    emit characteristicChanged(characteristic.uuid, characteristic.value);
+}
+
+void SimulatedGattService::emitDueNotifications()
+{
+    if (!m_backend || m_subscribedRows.isEmpty())
+        return;
+    const auto rate = qint64(m_backend->config().notificationRate) * m_subscribedRows.count();
+    const auto due = m_notificationClock.elapsed() * rate / 1000;
+    const auto notifications = int(due - m_notificationsEmitted);
+    m_notificationsEmitted = due;
+    advanceNotifications(notifications);
+}
+
+void SimulatedGattService::updateSubscription(int row)
+{
+    // The replay emits the recorded notifications on its own.
+    if (!m_backend || m_backend->isReplaying())
+        return;
+
+    const auto configuration = descriptorValue(
+                m_characteristics.at(row).uuid,
+                QBluetoothUuid(QBluetoothUuid::ClientCharacteristicConfiguration));
+    const auto subscribed = configuration.size() >= int(sizeof(quint16))
+            && qFromLittleEndian<quint16>(configuration.constData()) != 0;
+
+    m_subscribedRows.removeAll(row);
+    if (subscribed)
+        m_subscribedRows.append(row);
+
+    // Restart the accounting, the rate depends on the subscriptions.
+    m_notificationsEmitted = 0;
+    m_notificationClock.start();
+    if (m_subscribedRows.isEmpty())
+        m_notificationTimer->stop();
+    else if (!m_notificationTimer->isActive())
+        m_notificationTimer->start();
+}
+
+GattDescriptorInfo *SimulatedGattService::findDescriptor(int row,
+                                                         const QBluetoothUuid &descriptorUuid)
+{
+    auto &descriptors = m_characteristics[row].descriptors;
+    for (auto &descriptor : descriptors) {
+        if (descriptor.uuid == descriptorUuid)
+            return &descriptor;
+    }
+    return nullptr;
+}
+
+// SimulatedPeripheralController
+
+SimulatedPeripheralController::SimulatedPeripheralController(
+        SimulatedBleBackend *backend, const QBluetoothAddress &remoteAddress,
+        QObject *parent)
+    : PeripheralController(parent)
+    , m_backend(backend)
+    , m_remoteAddress(remoteAddress)
+{
+}
+
+QBluetoothAddress SimulatedPeripheralController::remoteAddress() const
+{
+    return m_remoteAddress;
+}
+
+QLowEnergyController::ControllerState SimulatedPeripheralController::state() const
+{
+    return m_state;
+}
+
+QLowEnergyController::Error SimulatedPeripheralController::error() const
+{
+    return m_error;
+}
+
+QString SimulatedPeripheralController::errorString() const
+{
+    switch (m_error) {
+    case QLowEnergyController::NoError:
+        return QString();
+    case QLowEnergyController::UnknownRemoteDeviceError:
+        return tr("Unknown simulated device");
+    default:
+        return tr("Simulated controller error");
+    }
+}
+
+void SimulatedPeripheralController::connectToDevice()
+{
+    if (!m_backend || m_state != QLowEnergyController::UnconnectedState)
+        return;
+
+    m_error = QLowEnergyController::NoError;
+    setState(QLowEnergyController::ConnectingState);
+    QTimer::singleShot(m_backend->config().connectLatency, this, [this]() {
+        if (m_state != QLowEnergyController::ConnectingState)
+            return;
+        if (!m_backend || m_backend->deviceIndex(m_remoteAddress) < 0) {
+            setState(QLowEnergyController::UnconnectedState);
+            setError(QLowEnergyController::UnknownRemoteDeviceError);
+            return;
+        }
+        setState(QLowEnergyController::ConnectedState);
+        setMtu(qMax(int(DefaultAttMtu), m_backend->config().mtu));
+    });
+}
+
+void SimulatedPeripheralController::disconnectFromDevice()
+{
+    if (m_state == QLowEnergyController::UnconnectedState)
+        return;
+    setState(QLowEnergyController::ClosingState);
+    closeLink();
+}
+
+void SimulatedPeripheralController::dropLink()
+{
+    if (m_state == QLowEnergyController::UnconnectedState)
+        return;
+    closeLink();
+}
+
+void SimulatedPeripheralController::discoverServices()
+{
+    if (!m_backend || m_state != QLowEnergyController::ConnectedState)
+        return;
+
+    setState(QLowEnergyController::DiscoveringState);
+    QTimer::singleShot(m_backend->config().discoveryLatency, this, [this]() {
+        if (!m_backend || m_state != QLowEnergyController::DiscoveringState)
+            return;
+        m_services = m_backend->serviceUuids(m_remoteAddress);
+        for (const auto &serviceUuid : qAsConst(m_services))
+            emit serviceDiscovered(serviceUuid);
+        setState(QLowEnergyController::DiscoveredState);
+        emit discoveryFinished();
+    });
+}
+
+QVector<QBluetoothUuid> SimulatedPeripheralController::services() const
+{
+    return m_services;
+}
+
+GattService *SimulatedPeripheralController::createServiceObject(
+        const QBluetoothUuid &serviceUuid, QObject *parent)
+{
+    if (!m_backend || !m_services.contains(serviceUuid))
+        return nullptr;
+    const auto service = new SimulatedGattService(m_backend, m_remoteAddress,
+                                                  serviceUuid, parent);
+    m_backend->attachService(service);
+    m_serviceObjects.removeAll(nullptr);
+    m_serviceObjects.append(service);
+    return service;
+}
+
+int SimulatedPeripheralController::mtu() const
+{
+    return m_mtu;
+}
+
+QLowEnergyConnectionParameters SimulatedPeripheralController::connectionParameters() const
+{
+    return m_connectionParameters;
+}
+
+void SimulatedPeripheralController::requestConnectionUpdate(
+        const QLowEnergyConnectionParameters &parameters)
+{
+    if (!m_backend || m_state == QLowEnergyController::UnconnectedState)
+        return;
+
+    QTimer::singleShot(m_backend->config().connectLatency, this, [this, parameters]() {
+        if (!m_backend || m_state == QLowEnergyController::UnconnectedState)
+            return;
+        // The shortest interval of the range which the peripheral
+        // accepts, or its own minimum when the range is below it.
+        const auto interval = qMax(parameters.minimumInterval(),
+                                   m_backend->config().minConnectionInterval);
+        m_connectionParameters.setIntervalRange(interval, interval);
+        m_connectionParameters.setLatency(parameters.latency());
+        m_connectionParameters.setSupervisionTimeout(parameters.supervisionTimeout());
+        emit connectionUpdated(m_connectionParameters);
+    });
+}
+
+void SimulatedPeripheralController::setState(QLowEnergyController::ControllerState state)
+{
+    if (m_state == state)
+        return;
+    m_state = state;
+    emit stateChanged(m_state);
+}
+
+void SimulatedPeripheralController::setError(QLowEnergyController::Error error)
+{
+    m_error = error;
+    emit errorOccurred(m_error);
+}
+
+void SimulatedPeripheralController::closeLink()
+{
+    // The service objects do not survive their link.
+    for (const auto &service : qAsConst(m_serviceObjects)) {
+        if (service)
+            service->invalidate();
+    }
+    m_serviceObjects.clear();
+    m_services.clear();
+    setState(QLowEnergyController::UnconnectedState);
+    setMtu(DefaultAttMtu);
+}
+
+void SimulatedPeripheralController::setMtu(int mtu)
+{
+    if (m_mtu == mtu)
+        return;
+    m_mtu = mtu;
+    emit mtuChanged(m_mtu);
+}
+
+// SimulatedBleBackend
+
+SimulatedBleBackend::SimulatedBleBackend(QObject *parent)
+    : BleBackend(parent)
+{
+}
+
+SimulationConfig SimulatedBleBackend::config() const
+{
+    return m_config;
+}
+
+void SimulatedBleBackend::setConfig(const SimulationConfig &config)
+{
+    m_config = config;
+    qCDebug(BLE_BACKEND) << "Set simulation: devices:" << m_config.deviceCount
+                         << "services:" << m_config.servicesPerDevice
+                         << "characteristics:" << m_config.characteristicsPerService
+                         << "seed:" << m_config.seed;
+}
+
+bool SimulatedBleBackend::loadReplay(const QString &fileName, qreal speed)
+{
+    delete m_replayReader;
+    m_replayReader = new CaptureReader(this);
+    if (!m_replayReader->open(fileName)) {
+        qCWarning(BLE_BACKEND) << "Unable to load replay:" << fileName
+                               << m_replayReader->errorString();
+        delete m_replayReader;
+        m_replayReader = nullptr;
+        return false;
+    }
+
+    m_replaySpeed = speed;
+    m_replayDevices.clear();
+    m_replayServices.clear();
+    m_replayCharacteristics.clear();
+
+    // Recover the GATT layout from the recorded traffic.
+    for (auto index = 0; index < m_replayReader->count(); ++index) {
+        const auto record = m_replayReader->record(index);
+        const auto address = record.address.toUInt64();
+        if (!m_replayServices.contains(address))
+            m_replayDevices.append(record.address);
+        auto &services = m_replayServices[address];
+        if (!services.contains(record.serviceUuid))
+            services.append(record.serviceUuid);
+        auto &characteristics = m_replayCharacteristics[qMakePair(address, record.serviceUuid)];
+        if (!characteristics.contains(record.characteristicUuid))
+            characteristics.append(record.characteristicUuid);
+    }
+
+    connect(m_replayReader, &CaptureReader::recordReplayed,
+            this, &SimulatedBleBackend::replayRecord);
+
+    qCDebug(BLE_BACKEND) << "Load replay:" << fileName
+                         << "devices:" << m_replayDevices.count();
+    return true;
+}
+
+bool SimulatedBleBackend::isReplaying() const
+{
+    return m_replayReader != nullptr;
+}
+
+DeviceScanner *SimulatedBleBackend::createDeviceScanner(QObject *parent)
+{
+    return new SimulatedDeviceScanner(this, parent);
+}
+
+PeripheralController *SimulatedBleBackend::createController(
+        const QBluetoothAddress &remoteAddress, QObject *parent)
+{
+    return new SimulatedPeripheralController(this, remoteAddress, parent);
+}
+
+int SimulatedBleBackend::deviceCount() const
+{
+    return m_replayReader ? m_replayDevices.count() : m_config.deviceCount;
+}
+
+int SimulatedBleBackend::deviceIndex(const QBluetoothAddress &address) const
+{
+    if (m_replayReader)
+        return m_replayDevices.indexOf(address);
+
+    const auto value = address.toUInt64();
+    if (value < DeviceAddressBase
+            || value >= DeviceAddressBase + quint64(m_config.deviceCount)) {
+        return -1;
+    }
+    return int(value - DeviceAddressBase);
+}
+
+QBluetoothDeviceInfo SimulatedBleBackend::advertisement(quint64 sequence) const
+{
+    const auto deviceIndex = int(sequence % quint64(deviceCount()));
+    const auto noise = scramble(m_config.seed ^ scramble(sequence));
+
+    const auto address = m_replayReader ? m_replayDevices.at(deviceIndex)
+                                        : QBluetoothAddress(DeviceAddressBase + deviceIndex);
+    const auto name = m_replayReader
+            ? QStringLiteral("Replay %1").arg(address.toString())
+            : QStringLiteral("Simulated %1").arg(deviceIndex, 5, 10, QLatin1Char('0'));
+
+    QBluetoothDeviceInfo device(address, name, 0);
+    device.setCoreConfigurations(QBluetoothDeviceInfo::LowEnergyCoreConfiguration);
+    device.setRssi(qint16(-40 - int(noise % 60)));
+
+    QByteArray manufacturerData(sizeof(quint32), Qt::Uninitialized);
+    qToLittleEndian(quint32(noise >> 32), manufacturerData.data());
+    device.setManufacturerData(TestManufacturerId, manufacturerData);
+
+    const auto serviceUuids = this->serviceUuids(address);
+    device.setServiceUuids(serviceUuids.toList(), QBluetoothDeviceInfo::DataComplete);
+    return device;
+}
+
+QVector<QBluetoothUuid> SimulatedBleBackend::serviceUuids(const QBluetoothAddress &address) const
+{
+    if (m_replayReader)
+        return m_replayServices.value(address.toUInt64());
+
+    QVector<QBluetoothUuid> serviceUuids;
+    if (deviceIndex(address) < 0)
+        return serviceUuids;
+    serviceUuids.reserve(m_config.servicesPerDevice);
+    for (auto serviceIndex = 0; serviceIndex < m_config.servicesPerDevice; ++serviceIndex)
+        serviceUuids.append(QBluetoothUuid(ServiceUuidBase + quint32(serviceIndex)));
+    return serviceUuids;
+}
+
+QVector<GattCharacteristicInfo> SimulatedBleBackend::characteristics(
+        const QBluetoothAddress &address, const QBluetoothUuid &serviceUuid) const
+{
+    QVector<GattCharacteristicInfo> characteristics;
+
+    if (m_replayReader) {
+        const auto characteristicUuids = m_replayCharacteristics.value(
+                    qMakePair(address.toUInt64(), serviceUuid));
+        for (const auto &characteristicUuid : characteristicUuids) {
+            characteristics.append(makeCharacteristic(
+                                       characteristicUuid, characteristicUuid.toString(),
+                                       QLowEnergyCharacteristic::Read
+                                       | QLowEnergyCharacteristic::Notify));
+        }
+        return characteristics;
+    }
+
+    const auto serviceIndex = int(serviceUuid.toUInt32() - ServiceUuidBase);
+    if (serviceIndex < 0 || serviceIndex >= m_config.servicesPerDevice)
+        return characteristics;
+
+    characteristics.reserve(m_config.characteristicsPerService);
+    for (auto index = 0; index < m_config.characteristicsPerService; ++index) {
+        // The service index gets fields of its own, so that the UUIDs
+        // are unique across the services whatever their sizes.
+        const auto uuid = QBluetoothUuid(QUuid(CharacteristicUuidBase + quint32(index),
+                                               quint16(serviceIndex),
+                                               quint16(serviceIndex >> 16),
+                                               0x80, 0x00, 0x00, 0x80,
+                                               0x5f, 0x9b, 0x34, 0xfb));
+        characteristics.append(makeCharacteristic(
+                                   uuid, tr("Simulated characteristic %1.%2")
+                                   .arg(serviceIndex).arg(index),
+                                   simulatedProperties(index)));
+    }
+    return characteristics;
+}
+
+QByteArray SimulatedBleBackend::notificationValue(int deviceIndex, int row,
+                                                  quint32 counter) const
+{
+    // The counter first, then a reproducible pseudo random sample.
+    const auto sample = scramble(m_config.seed ^ (quint64(deviceIndex) << 40)
+                                 ^ (quint64(row) << 32) ^ counter);
+    QByteArray value(2 * sizeof(quint32), Qt::Uninitialized);
+    qToLittleEndian(counter, value.data());
+    qToLittleEndian(quint32(sample), value.data() + sizeof(quint32));
+    return value;
+}
+
+void SimulatedBleBackend::attachService(SimulatedGattService *service)
+{
+    m_attachedServices.removeAll(nullptr);
+    m_attachedServices.append(service);
+
+    if (m_replayReader && !m_replayReader->isPlaying()
+            && m_replayReader->position() == 0) {
+        qCDebug(BLE_BACKEND) << "Start replay, speed:" << m_replaySpeed;
+        m_replayReader->play(m_replaySpeed);
+    }
+}
+
+void SimulatedBleBackend::replayRecord(int index)
+{
+    const auto record = m_replayReader->record(index);
+    if (record.type != CaptureFormat::CharacteristicChanged)
+        return;
+
+    for (const auto &service : qAsConst(m_attachedServices)) {
+        if (!service || service->deviceAddress() != record.address
+                || service->serviceUuid() != record.serviceUuid) {
+            continue;
+        }
+        // Detach the payload from the mapped file.
+        service->replayNotification(record.characteristicUuid,
+                                    QByteArray(record.payload.constData(),
+                                               record.payload.size()));
+    }
+}
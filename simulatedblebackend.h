@@ -0,0 +1,232 @@
+#ifndef SIMULATEDBLEBACKEND_H
+#define SIMULATEDBLEBACKEND_H
+
+#include "blebackend.h"
+
+#include <QBitArray>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QPointer>
+
+class CaptureReader;
+class SimulatedBleBackend;
+class QTimer;
+
+// Deterministic backend without any radio. It either synthesizes a
+// configurable population of devices, GATT trees and notification rates
+// from a seed, or replays the notifications of a recorded capture file.
+// Everything it generates only depends on the configuration, so that
+// the same configuration always produces the same session.
+
+struct SimulationConfig
+{
+    int deviceCount = 100;
+    int servicesPerDevice = 3;
+    int characteristicsPerService = 4;
+    // Advertisements per second, across all the devices.
+    int advertisementRate = 1000;
+    // Notifications per second, per subscribed characteristic.
+    int notificationRate = 10;
+    // Milliseconds.
+    int connectLatency = 50;
+    int discoveryLatency = 50;
+    // Exchanged once connected.
+    int mtu = 247;
+    // Milliseconds, the shortest connection interval the peripherals
+    // grant. The connection updates take the connect latency.
+    double minConnectionInterval = 15.0;
+    quint32 seed = 1;
+};
+
+class SimulatedDeviceScanner final : public DeviceScanner
+{
+    Q_OBJECT
+
+public:
+    explicit SimulatedDeviceScanner(SimulatedBleBackend *backend,
+                                    QObject *parent = nullptr);
+
+    int lowEnergyDiscoveryTimeout() const final;
+    void setLowEnergyDiscoveryTimeout(int timeout) final;
+
+    bool isActive() const final;
+    QString errorString() const final;
+
+    void start() final;
+    void stop() final;
+
+    // Synchronously emits the next advertisements, regardless of the
+    // scanner being started or not.
+    void advance(int advertisements);
+
+private:
+    void emitDue();
+    void finish();
+
+    QPointer<SimulatedBleBackend> m_backend;
+    QTimer *m_tickTimer = nullptr;
+    QTimer *m_timeoutTimer = nullptr;
+    QElapsedTimer m_clock;
+    qint64 m_emitted = 0;
+    quint64 m_sequence = 0;
+    QBitArray m_seenDevices;
+};
+
+class SimulatedGattService final : public GattService
+{
+    Q_OBJECT
+
+public:
+    explicit SimulatedGattService(SimulatedBleBackend *backend,
+                                  const QBluetoothAddress &deviceAddress,
+                                  const QBluetoothUuid &serviceUuid,
+                                  QObject *parent = nullptr);
+
+    QBluetoothAddress deviceAddress() const final;
+    QBluetoothUuid serviceUuid() const final;
+    QString serviceName() const final;
+
+    QLowEnergyService::ServiceState state() const final;
+    void discoverDetails() final;
+
+    QVector<QBluetoothUuid> characteristicUuids() const final;
+    GattCharacteristicInfo characteristic(
+            const QBluetoothUuid &characteristicUuid) const final;
+    QByteArray characteristicValue(
+            const QBluetoothUuid &characteristicUuid) const final;
+    QByteArray descriptorValue(const QBluetoothUuid &characteristicUuid,
+                               const QBluetoothUuid &descriptorUuid) const final;
+
+    void readCharacteristic(const QBluetoothUuid &characteristicUuid) final;
+    void writeCharacteristic(const QBluetoothUuid &characteristicUuid,
+                             const QByteArray &value,
+                             QLowEnergyService::WriteMode mode) final;
+    void readDescriptor(const QBluetoothUuid &characteristicUuid,
+                        const QBluetoothUuid &descriptorUuid) final;
+    void writeDescriptor(const QBluetoothUuid &characteristicUuid,
+                         const QBluetoothUuid &descriptorUuid,
+                         const QByteArray &value) final;
+
+    // Synchronously emits notifications, round robin over the
+    // subscribed characteristics.
+    void advanceNotifications(int notifications);
+    // Used by the replay, emits the recorded value as a notification.
+    void replayNotification(const QBluetoothUuid &characteristicUuid,
+                            const QByteArray &value);
+    // Used by the controller once its link is gone, as Qt Bluetooth
+    // does; the operations fail from then on.
+    void invalidate();
+
+private:
+    void setState(QLowEnergyService::ServiceState state);
+    void notify(int row);
+    void emitDueNotifications();
+    void updateSubscription(int row);
+    GattDescriptorInfo *findDescriptor(int row, const QBluetoothUuid &descriptorUuid);
+
+    QPointer<SimulatedBleBackend> m_backend;
+    QBluetoothAddress m_deviceAddress;
+    QBluetoothUuid m_serviceUuid;
+    QLowEnergyService::ServiceState m_state = QLowEnergyService::DiscoveryRequired;
+
+    QVector<GattCharacteristicInfo> m_characteristics;
+    QHash<QBluetoothUuid, int> m_characteristicRows;
+    QVector<int> m_subscribedRows;
+    QVector<quint32> m_notificationCounters;
+
+    QTimer *m_notificationTimer = nullptr;
+    QElapsedTimer m_notificationClock;
+    qint64 m_notificationsEmitted = 0;
+    int m_nextSubscribedRow = 0;
+};
+
+class SimulatedPeripheralController final : public PeripheralController
+{
+    Q_OBJECT
+
+public:
+    explicit SimulatedPeripheralController(SimulatedBleBackend *backend,
+                                           const QBluetoothAddress &remoteAddress,
+                                           QObject *parent = nullptr);
+
+    QBluetoothAddress remoteAddress() const final;
+    QLowEnergyController::ControllerState state() const final;
+    QLowEnergyController::Error error() const final;
+    QString errorString() const final;
+
+    void connectToDevice() final;
+    void disconnectFromDevice() final;
+
+    void discoverServices() final;
+    QVector<QBluetoothUuid> services() const final;
+    GattService *createServiceObject(const QBluetoothUuid &serviceUuid,
+                                     QObject *parent) final;
+
+    int mtu() const final;
+    QLowEnergyConnectionParameters connectionParameters() const final;
+    void requestConnectionUpdate(const QLowEnergyConnectionParameters &parameters) final;
+
+    // Loses the link as on a supervision timeout, unlike a disconnect
+    // which is asked for.
+    void dropLink();
+
+private:
+    void setState(QLowEnergyController::ControllerState state);
+    void setError(QLowEnergyController::Error error);
+    void setMtu(int mtu);
+    void closeLink();
+
+    QPointer<SimulatedBleBackend> m_backend;
+    QBluetoothAddress m_remoteAddress;
+    QLowEnergyController::ControllerState m_state = QLowEnergyController::UnconnectedState;
+    QLowEnergyController::Error m_error = QLowEnergyController::NoError;
+    QVector<QBluetoothUuid> m_services;
+    QVector<QPointer<SimulatedGattService>> m_serviceObjects;
+    int m_mtu = DefaultAttMtu;
+    QLowEnergyConnectionParameters m_connectionParameters;
+};
+
+class SimulatedBleBackend final : public BleBackend
+{
+    Q_OBJECT
+
+public:
+    explicit SimulatedBleBackend(QObject *parent = nullptr);
+
+    SimulationConfig config() const;
+    void setConfig(const SimulationConfig &config);
+
+    // Replaces the synthetic population by the devices and notifications
+    // of a capture file, which are replayed once connected.
+    bool loadReplay(const QString &fileName, qreal speed = 1.0);
+    bool isReplaying() const;
+
+    DeviceScanner *createDeviceScanner(QObject *parent) final;
+    PeripheralController *createController(const QBluetoothAddress &remoteAddress,
+                                           QObject *parent) final;
+
+    // Used by the simulated objects.
+    int deviceCount() const;
+    int deviceIndex(const QBluetoothAddress &address) const;
+    QBluetoothDeviceInfo advertisement(quint64 sequence) const;
+    QVector<QBluetoothUuid> serviceUuids(const QBluetoothAddress &address) const;
+    QVector<GattCharacteristicInfo> characteristics(const QBluetoothAddress &address,
+                                                    const QBluetoothUuid &serviceUuid) const;
+    QByteArray notificationValue(int deviceIndex, int row, quint32 counter) const;
+
+    void attachService(SimulatedGattService *service);
+
+private:
+    void replayRecord(int index);
+
+    SimulationConfig m_config;
+
+    CaptureReader *m_replayReader = nullptr;
+    qreal m_replaySpeed = 1.0;
+    QVector<QBluetoothAddress> m_replayDevices;
+    QHash<quint64, QVector<QBluetoothUuid>> m_replayServices;
+    QHash<QPair<quint64, QBluetoothUuid>, QVector<QBluetoothUuid>> m_replayCharacteristics;
+    QVector<QPointer<SimulatedGattService>> m_attachedServices;
+};
+
+#endif // SIMULATEDBLEBACKEND_H
@@ -0,0 +1,66 @@
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// Bounded queue between exactly one producer thread and exactly one
+// consumer thread, without any lock: each side only ever writes its own
+// index, and publishes it once the slot has been filled or emptied.
+//
+// The indices grow freely and are masked into the slots, the capacity
+// being a power of two. The slots are allocated up front, the values
+// are moved in and out of them.
+template <typename T>
+class SpscQueue
+{
+public:
+    explicit SpscQueue(int capacityBits = 12)
+        : m_slots(size_t(1) << capacityBits)
+        , m_mask((size_t(1) << capacityBits) - 1)
+    {
+    }
+
+    SpscQueue(const SpscQueue &) = delete;
+    SpscQueue &operator=(const SpscQueue &) = delete;
+
+    size_t capacity() const
+    {
+        return m_slots.size();
+    }
+
+    // Producer side. Fails when the queue is full, the value is then
+    // left untouched.
+    bool tryPush(T &&value)
+    {
+        const auto tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head.load(std::memory_order_acquire) == m_slots.size())
+            return false;
+        m_slots[tail & m_mask] = std::move(value);
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side.
+    bool tryPop(T &value)
+    {
+        const auto head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire))
+            return false;
+        value = std::move(m_slots[head & m_mask]);
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::vector<T> m_slots;
+    const size_t m_mask;
+    // On cache lines of their own, so that the producer and the
+    // consumer do not invalidate each other's.
+    alignas(64) std::atomic<size_t> m_head { 0 };
+    alignas(64) std::atomic<size_t> m_tail { 0 };
+};
+
+#endif // SPSCQUEUE_H
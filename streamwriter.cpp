@@ -0,0 +1,318 @@
+#include "streamwriter.h"
+
+#include <QFile>
+#include <QLoggingCategory>
+#include <QTimer>
+
+Q_DECLARE_LOGGING_CATEGORY(BLE_OPERATIONS)
+
+StreamWriter::StreamWriter(GattOperationQueue *operationQueue, QObject *parent)
+    : QObject(parent)
+    , m_operationQueue(operationQueue)
+    , m_progressBatcher(new UpdateBatcher(this))
+    , m_pacingTimer(new QTimer(this))
+{
+    m_pacingTimer->setSingleShot(true);
+    m_pacingTimer->setInterval(m_pacingInterval);
+    connect(m_pacingTimer, &QTimer::timeout, this, &StreamWriter::pump);
+
+    // The progress changes with every chunk, it is published once per
+    // frame at most.
+    m_progressBatcher->setFlushHandler([this]() {
+        emit progressChanged();
+    });
+
+    connect(m_operationQueue, &GattOperationQueue::jobFinished,
+            this, [this](int jobId, int succeeded, int failed) {
+        Q_UNUSED(succeeded);
+        // A write rejected by the stack right away finishes before its
+        // identifier is known.
+        if (m_submitting) {
+            m_submittedJobFinished = true;
+            m_submittedJobFailed = failed > 0;
+            return;
+        }
+        if (!m_pendingJobs.remove(jobId))
+            return;
+        jobFinished(failed == 0);
+    });
+}
+
+bool StreamWriter::isRunning() const
+{
+    return m_running;
+}
+
+bool StreamWriter::isAcknowledged() const
+{
+    return m_acknowledged;
+}
+
+void StreamWriter::setAcknowledged(bool acknowledged)
+{
+    if (m_acknowledged == acknowledged)
+        return;
+    m_acknowledged = acknowledged;
+    qCDebug(BLE_OPERATIONS) << "Set stream acknowledged:" << m_acknowledged;
+    emit acknowledgedChanged(m_acknowledged);
+}
+
+int StreamWriter::chunkSize() const
+{
+    return m_chunkSize;
+}
+
+void StreamWriter::setChunkSize(int chunkSize)
+{
+    chunkSize = qMax(chunkSize, 1);
+    if (m_chunkSize == chunkSize)
+        return;
+    m_chunkSize = chunkSize;
+    qCDebug(BLE_OPERATIONS) << "Set stream chunk size:" << m_chunkSize;
+    emit chunkSizeChanged(m_chunkSize);
+}
+
+int StreamWriter::windowSize() const
+{
+    return m_windowSize;
+}
+
+void StreamWriter::setWindowSize(int windowSize)
+{
+    windowSize = qMax(windowSize, 1);
+    if (m_windowSize == windowSize)
+        return;
+    m_windowSize = windowSize;
+    qCDebug(BLE_OPERATIONS) << "Set stream window size:" << m_windowSize;
+    emit windowSizeChanged(m_windowSize);
+}
+
+int StreamWriter::pacingInterval() const
+{
+    return m_pacingInterval;
+}
+
+void StreamWriter::setPacingInterval(int pacingInterval)
+{
+    pacingInterval = qMax(pacingInterval, 0);
+    if (m_pacingInterval == pacingInterval)
+        return;
+    m_pacingInterval = pacingInterval;
+    qCDebug(BLE_OPERATIONS) << "Set stream pacing interval:" << m_pacingInterval;
+    m_pacingTimer->setInterval(m_pacingInterval);
+    emit pacingIntervalChanged(m_pacingInterval);
+}
+
+qint64 StreamWriter::totalBytes() const
+{
+    return m_totalBytes;
+}
+
+qint64 StreamWriter::bytesWritten() const
+{
+    return m_bytesWritten;
+}
+
+int StreamWriter::chunkCount() const
+{
+    return m_chunkCount;
+}
+
+qreal StreamWriter::bytesPerSecond() const
+{
+    const auto elapsed = m_clock.isValid() ? m_clock.elapsed() : 0;
+    if (elapsed <= 0)
+        return 0;
+    return m_bytesWritten * 1000.0 / elapsed;
+}
+
+qint64 StreamWriter::eta() const
+{
+    const auto rate = bytesPerSecond();
+    if (m_totalBytes < 0 || rate <= 0)
+        return -1;
+    return qint64((m_totalBytes - m_bytesWritten) * 1000.0 / rate);
+}
+
+QString StreamWriter::errorString() const
+{
+    return m_errorString;
+}
+
+bool StreamWriter::start(const QBluetoothUuid &characteristicUuid, QIODevice *device)
+{
+    if (m_running)
+        return false;
+
+    const auto service = m_operationQueue->service();
+    if (!service || !device || !device->isReadable()) {
+        m_errorString = tr("Nothing to stream");
+        emit finished(false);
+        return false;
+    }
+
+    const auto properties = service->characteristic(characteristicUuid).properties;
+    if (!(properties & (QLowEnergyCharacteristic::Write
+                        | QLowEnergyCharacteristic::WriteNoResponse))) {
+        m_errorString = tr("Characteristic is not writable");
+        emit finished(false);
+        return false;
+    }
+    if (m_acknowledged && !(properties & QLowEnergyCharacteristic::Write)) {
+        m_errorString = tr("Characteristic does not support acknowledged writes");
+        emit finished(false);
+        return false;
+    }
+
+    m_characteristicUuid = characteristicUuid;
+    m_device = device;
+    m_withoutResponse = !m_acknowledged
+            && (properties & QLowEnergyCharacteristic::WriteNoResponse);
+    m_acknowledgedBarriers = properties & QLowEnergyCharacteristic::Write;
+    m_readChannelFinished = false;
+    connect(device, &QIODevice::readyRead, this, &StreamWriter::pump);
+    connect(device, &QIODevice::readChannelFinished, this, [this]() {
+        m_readChannelFinished = true;
+        pump();
+    });
+    m_errorString.clear();
+    m_pendingJobs.clear();
+    m_chunksSinceBarrier = 0;
+    m_totalBytes = device->isSequential() ? -1 : device->size() - device->pos();
+    m_bytesWritten = 0;
+    m_chunkCount = 0;
+    m_clock.start();
+
+    qCDebug(BLE_OPERATIONS) << "Start stream:" << characteristicUuid
+                            << "bytes:" << m_totalBytes
+                            << "without response:" << m_withoutResponse
+                            << "acknowledged barriers:" << m_acknowledgedBarriers;
+
+    m_running = true;
+    emit runningChanged(m_running);
+    emit progressChanged();
+    pump();
+    return true;
+}
+
+bool StreamWriter::start(const QBluetoothUuid &characteristicUuid, const QString &fileName)
+{
+    if (m_running)
+        return false;
+
+    const auto file = new QFile(fileName, this);
+    if (!file->open(QIODevice::ReadOnly)) {
+        m_errorString = file->errorString();
+        delete file;
+        emit finished(false);
+        return false;
+    }
+
+    delete m_ownedDevice;
+    m_ownedDevice = file;
+    return start(characteristicUuid, file);
+}
+
+void StreamWriter::cancel()
+{
+    if (!m_running)
+        return;
+    // The chunks already queued still go out.
+    finish(false, tr("Canceled"));
+}
+
+void StreamWriter::pump()
+{
+    // An acknowledged chunk closes the window of the unacknowledged ones,
+    // which are all sent at once; in the acknowledged mode the window is
+    // the number of chunks in flight.
+    const auto maxPendingJobs = m_withoutResponse ? 1 : m_windowSize;
+
+    while (m_running && m_pendingJobs.count() < maxPendingJobs
+           && !m_pacingTimer->isActive()) {
+        if (!m_device) {
+            finish(false, tr("Device closed"));
+            return;
+        }
+
+        const auto chunk = m_device->read(m_chunkSize);
+        if (chunk.isEmpty()) {
+            // Otherwise the device resumes the stream once it has more.
+            if (isEndOfInput() && m_pendingJobs.isEmpty())
+                finish(m_device->atEnd() || m_device->isSequential(),
+                       m_device->errorString());
+            return;
+        }
+
+        const auto windowClosed = m_withoutResponse
+                && ++m_chunksSinceBarrier >= m_windowSize;
+        // Without acknowledged writes the pacing timer closes the windows.
+        const auto barrier = !m_withoutResponse
+                || (m_acknowledgedBarriers && (windowClosed || m_device->atEnd()));
+        const auto mode = barrier ? QLowEnergyService::WriteWithResponse
+                                  : QLowEnergyService::WriteWithoutResponse;
+        if (barrier || windowClosed)
+            m_chunksSinceBarrier = 0;
+
+        m_submitting = true;
+        m_submittedJobFinished = false;
+        m_submittedJobFailed = false;
+        const auto jobId = m_operationQueue->writeCharacteristic(
+                    m_characteristicUuid, chunk, mode, GattOperationQueue::Background);
+        m_submitting = false;
+
+        m_bytesWritten += chunk.size();
+        ++m_chunkCount;
+        m_progressBatcher->schedule();
+
+        if (jobId < 0 || m_submittedJobFailed) {
+            finish(false, tr("Chunk %1 rejected").arg(m_chunkCount));
+            return;
+        }
+        if (barrier && !m_submittedJobFinished)
+            m_pendingJobs.insert(jobId);
+        else if (windowClosed && !barrier)
+            m_pacingTimer->start();
+    }
+}
+
+bool StreamWriter::isEndOfInput() const
+{
+    // Files, pipes included, block until there is data or the end; the
+    // other sequential devices have none for now until they finish.
+    if (!m_device->isSequential() || qobject_cast<QFileDevice *>(m_device.data()))
+        return true;
+    return m_readChannelFinished || !m_device->isOpen();
+}
+
+void StreamWriter::jobFinished(bool succeeded)
+{
+    if (!succeeded) {
+        finish(false, tr("Chunk %1 not acknowledged").arg(m_chunkCount));
+        return;
+    }
+    pump();
+}
+
+void StreamWriter::finish(bool succeeded, const QString &errorString)
+{
+    qCDebug(BLE_OPERATIONS) << "Finish stream:" << m_characteristicUuid
+                            << "succeeded:" << succeeded
+                            << "bytes:" << m_bytesWritten
+                            << "chunks:" << m_chunkCount
+                            << "bytes/s:" << bytesPerSecond();
+
+    m_running = false;
+    m_pendingJobs.clear();
+    m_pacingTimer->stop();
+    m_errorString = succeeded ? QString() : errorString;
+    if (m_device)
+        m_device->disconnect(this);
+    if (m_ownedDevice)
+        m_ownedDevice->deleteLater();
+    m_device.clear();
+
+    m_progressBatcher->flush();
+    emit runningChanged(m_running);
+    emit finished(succeeded);
+}
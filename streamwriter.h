@@ -0,0 +1,126 @@
+#ifndef STREAMWRITER_H
+#define STREAMWRITER_H
+
+#include "gattoperationqueue.h"
+#include "updatebatcher.h"
+
+#include <QBluetoothUuid>
+#include <QElapsedTimer>
+#include <QPointer>
+#include <QSet>
+
+class QIODevice;
+class QTimer;
+
+// Streams the content of a device into one characteristic, in chunks
+// of the ATT payload size, through the operation queue of its service.
+//
+// The chunks are written without response, and every windowSize-th one
+// with response instead: the stack acknowledges it only once all the
+// chunks before it went out, so waiting for it bounds what is buffered
+// in the stack. A characteristic which only supports unacknowledged
+// writes gets a window of chunks per pacing interval instead. With
+// acknowledged set (or when the characteristic does not support
+// unacknowledged writes) every chunk is written with response, keeping
+// windowSize of them in flight.
+//
+// Sequential devices, e.g. sockets, are read as their data comes, until
+// their read channel is finished.
+class StreamWriter : public QObject
+{
+    Q_OBJECT
+
+    Q_PROPERTY(bool running READ isRunning NOTIFY runningChanged)
+    Q_PROPERTY(bool acknowledged READ isAcknowledged
+               WRITE setAcknowledged NOTIFY acknowledgedChanged)
+    Q_PROPERTY(int chunkSize READ chunkSize WRITE setChunkSize NOTIFY chunkSizeChanged)
+    Q_PROPERTY(int windowSize READ windowSize WRITE setWindowSize NOTIFY windowSizeChanged)
+    Q_PROPERTY(int pacingInterval READ pacingInterval
+               WRITE setPacingInterval NOTIFY pacingIntervalChanged)
+
+    Q_PROPERTY(qint64 totalBytes READ totalBytes NOTIFY progressChanged)
+    Q_PROPERTY(qint64 bytesWritten READ bytesWritten NOTIFY progressChanged)
+    Q_PROPERTY(int chunkCount READ chunkCount NOTIFY progressChanged)
+    Q_PROPERTY(qreal bytesPerSecond READ bytesPerSecond NOTIFY progressChanged)
+    Q_PROPERTY(qint64 eta READ eta NOTIFY progressChanged)
+    Q_PROPERTY(QString errorString READ errorString NOTIFY finished)
+
+public:
+    // The ATT payload of the default MTU of 23 bytes.
+    enum { DefaultChunkSize = 20 };
+
+    explicit StreamWriter(GattOperationQueue *operationQueue, QObject *parent = nullptr);
+
+    bool isRunning() const;
+
+    bool isAcknowledged() const;
+    void setAcknowledged(bool acknowledged);
+
+    int chunkSize() const;
+    void setChunkSize(int chunkSize);
+
+    int windowSize() const;
+    void setWindowSize(int windowSize);
+
+    // Milliseconds between the windows, when they cannot be closed by
+    // an acknowledged chunk.
+    int pacingInterval() const;
+    void setPacingInterval(int pacingInterval);
+
+    // Unknown (-1) for sequential devices.
+    qint64 totalBytes() const;
+    qint64 bytesWritten() const;
+    int chunkCount() const;
+    qreal bytesPerSecond() const;
+    // Milliseconds left, -1 when unknown.
+    qint64 eta() const;
+    QString errorString() const;
+
+    // The device has to be open and to outlive the transfer.
+    bool start(const QBluetoothUuid &characteristicUuid, QIODevice *device);
+    bool start(const QBluetoothUuid &characteristicUuid, const QString &fileName);
+    Q_INVOKABLE void cancel();
+
+signals:
+    void runningChanged(bool running);
+    void acknowledgedChanged(bool acknowledged);
+    void chunkSizeChanged(int chunkSize);
+    void windowSizeChanged(int windowSize);
+    void pacingIntervalChanged(int pacingInterval);
+
+    void progressChanged();
+    void finished(bool succeeded);
+
+private:
+    void pump();
+    bool isEndOfInput() const;
+    void jobFinished(bool succeeded);
+    void finish(bool succeeded, const QString &errorString = QString());
+
+    GattOperationQueue *m_operationQueue = nullptr;
+    UpdateBatcher *m_progressBatcher = nullptr;
+    QTimer *m_pacingTimer = nullptr;
+    QPointer<QIODevice> m_device;
+    QPointer<QIODevice> m_ownedDevice;
+    QBluetoothUuid m_characteristicUuid;
+    QSet<int> m_pendingJobs;
+    QElapsedTimer m_clock;
+    QString m_errorString;
+    bool m_running = false;
+    bool m_acknowledged = false;
+    bool m_withoutResponse = true;
+    bool m_acknowledgedBarriers = true;
+    bool m_readChannelFinished = false;
+    bool m_submitting = false;
+    bool m_submittedJobFinished = false;
+    bool m_submittedJobFailed = false;
+    int m_chunkSize = DefaultChunkSize;
+    int m_windowSize = 8;
+    int m_pacingInterval = 30;
+    int m_chunksSinceBarrier = 0;
+    qint64 m_totalBytes = -1;
+    qint64 m_bytesWritten = 0;
+    int m_chunkCount = 0;
+};
+
+#endif // STREAMWRITER_H
@@ -0,0 +1,376 @@
+#include "simulatedblebackend.h"
+#include "connectiontuner.h"
+#include "gattcache.h"
+#include "gattoperationqueue.h"
+#include "servicesmodel.h"
+
+#include <QtTest>
+
+// The writable characteristic of the simulated services.
+enum { WritableCharacteristic = 1 };
+
+static SimulationConfig config()
+{
+    SimulationConfig config;
+    config.deviceCount = 1;
+    config.servicesPerDevice = 1;
+    config.characteristicsPerService = 4;
+    // Only the link events which the tests ask for.
+    config.advertisementRate = 0;
+    config.notificationRate = 0;
+    config.connectLatency = 0;
+    config.discoveryLatency = 0;
+    return config;
+}
+
+class LinkTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void writeWhileDiscovering();
+    void writeAcrossDrop();
+    void writeAcrossReconnect();
+    void revisitDroppedLink();
+    void tuneConnection_data();
+    void tuneConnection();
+    void clampConnectionInterval();
+    void writeChunkSizeFollowsMtu();
+
+private:
+    void setUpService(SimulatedBleBackend &backend, QObject &context);
+
+    PeripheralController *m_controller = nullptr;
+    GattCache::Service m_cached;
+    QBluetoothUuid m_characteristicUuid;
+};
+
+// Connects, discovers the service once and keeps its layout, as the
+// GATT cache does.
+void LinkTest::setUpService(SimulatedBleBackend &backend, QObject &context)
+{
+    m_controller = backend.createController(backend.advertisement(0).address(), &context);
+    m_controller->connectToDevice();
+    QVERIFY(QTest::qWaitFor([this]() {
+        return m_controller->state() == QLowEnergyController::ConnectedState;
+    }));
+    m_controller->discoverServices();
+    QVERIFY(QTest::qWaitFor([this]() {
+        return m_controller->state() == QLowEnergyController::DiscoveredState;
+    }));
+
+    const auto serviceUuid = m_controller->services().value(0);
+    const QScopedPointer<GattService> service(m_controller->createServiceObject(serviceUuid));
+    service->discoverDetails();
+    QVERIFY(QTest::qWaitFor([&service]() {
+        return service->state() == QLowEnergyService::ServiceDiscovered;
+    }));
+
+    m_cached.uuid = serviceUuid;
+    m_cached.name = service->serviceName();
+    m_cached.detailed = true;
+    m_cached.characteristics.clear();
+    for (const auto &characteristicUuid : service->characteristicUuids())
+        m_cached.characteristics.append(service->characteristic(characteristicUuid));
+    m_characteristicUuid = service->characteristicUuids().value(WritableCharacteristic);
+    QVERIFY(service->characteristic(m_characteristicUuid).properties
+            & QLowEnergyCharacteristic::Write);
+}
+
+// A write requested while the details are discovered is held until they
+// are known. The queue must neither retry it meanwhile, nor report it
+// failed, and the peer gets it exactly once.
+void LinkTest::writeWhileDiscovering()
+{
+    auto simulation = config();
+    SimulatedBleBackend backend;
+    backend.setConfig(simulation);
+    QObject context;
+    setUpService(backend, context);
+    if (QTest::currentTestFailed())
+        return;
+
+    simulation.discoveryLatency = 100;
+    backend.setConfig(simulation);
+    CachedGattService service(m_controller->remoteAddress(), m_cached);
+    service.setSource(m_controller->createServiceObject(m_cached.uuid));
+    service.discoverDetails();
+
+    GattOperationQueue queue;
+    queue.setService(&service);
+    // Expires several times over while the details are discovered.
+    queue.setTimeout(20);
+    queue.setMaxRetries(2);
+    QSignalSpy finished(&queue, &GattOperationQueue::jobFinished);
+    QSignalSpy written(&service, &GattService::characteristicWritten);
+
+    QVERIFY(queue.writeCharacteristic(m_characteristicUuid, QByteArray::fromHex("c0de"))
+            >= 0);
+    QVERIFY(service.isHoldingRequests());
+    QVERIFY(finished.wait(1000));
+    QCOMPARE(finished.count(), 1);
+    QCOMPARE(finished.at(0).at(1).toInt(), 1);
+    QCOMPARE(finished.at(0).at(2).toInt(), 0);
+
+    // Anything sent twice would be acknowledged by now.
+    QTest::qWait(4 * queue.timeout());
+    QCOMPARE(written.count(), 1);
+    QCOMPARE(service.characteristicValue(m_characteristicUuid), QByteArray::fromHex("c0de"));
+}
+
+// A held write fails once when the link drops before the details are
+// known, and is not sent.
+void LinkTest::writeAcrossDrop()
+{
+    auto simulation = config();
+    SimulatedBleBackend backend;
+    backend.setConfig(simulation);
+    QObject context;
+    setUpService(backend, context);
+    if (QTest::currentTestFailed())
+        return;
+
+    simulation.discoveryLatency = 100;
+    backend.setConfig(simulation);
+    CachedGattService service(m_controller->remoteAddress(), m_cached);
+    service.setSource(m_controller->createServiceObject(m_cached.uuid));
+    service.discoverDetails();
+
+    GattOperationQueue queue;
+    queue.setService(&service);
+    queue.setTimeout(20);
+    queue.setMaxRetries(2);
+    QSignalSpy finished(&queue, &GattOperationQueue::jobFinished);
+    QSignalSpy written(&service, &GattService::characteristicWritten);
+
+    QVERIFY(queue.writeCharacteristic(m_characteristicUuid, QByteArray::fromHex("c0de"))
+            >= 0);
+    QTest::qWait(2 * queue.timeout());
+    const auto controller = qobject_cast<SimulatedPeripheralController *>(m_controller);
+    QVERIFY(controller);
+    controller->dropLink();
+    QVERIFY(!service.isHoldingRequests());
+
+    QVERIFY(finished.count() == 1 || finished.wait(1000));
+    QCOMPARE(finished.count(), 1);
+    QCOMPARE(finished.at(0).at(1).toInt(), 0);
+    QCOMPARE(finished.at(0).at(2).toInt(), 1);
+    QTest::qWait(4 * queue.timeout());
+    QCOMPARE(written.count(), 0);
+}
+
+// A write requested while a reconnected link rediscovers the service is
+// held until the details are known. The queue must neither retry it
+// meanwhile, nor report it failed, and the peer gets it exactly once.
+void LinkTest::writeAcrossReconnect()
+{
+    auto simulation = config();
+    SimulatedBleBackend backend;
+    backend.setConfig(simulation);
+    const auto address = backend.advertisement(0).address();
+
+    ServicesModel servicesModel(&backend);
+    servicesModel.connectionPool()->setReconnectDelay(1);
+    servicesModel.update(address.toString());
+    QVERIFY(QTest::qWaitFor([&servicesModel]() {
+        return servicesModel.isConnected() && !servicesModel.isRunning()
+                && servicesModel.serviceAt(0);
+    }));
+
+    const auto service = qobject_cast<CachedGattService *>(servicesModel.serviceAt(0));
+    QVERIFY(service);
+    service->discoverDetails();
+    QVERIFY(QTest::qWaitFor([service]() {
+        return service->source()
+                && service->source()->state() == QLowEnergyService::ServiceDiscovered;
+    }));
+    const auto characteristicUuid = service->characteristicUuids().value(WritableCharacteristic);
+    QVERIFY(service->characteristic(characteristicUuid).properties
+            & QLowEnergyCharacteristic::Write);
+
+    GattOperationQueue queue;
+    queue.setService(service);
+    // Expires several times over while the details are rediscovered.
+    queue.setTimeout(20);
+    queue.setMaxRetries(2);
+    QSignalSpy finished(&queue, &GattOperationQueue::jobFinished);
+    QSignalSpy written(service, &GattService::characteristicWritten);
+
+    simulation.discoveryLatency = 100;
+    backend.setConfig(simulation);
+    const auto controller = qobject_cast<SimulatedPeripheralController *>(
+                servicesModel.connectionPool()->controller(address));
+    QVERIFY(controller);
+    controller->dropLink();
+    QVERIFY(!servicesModel.isConnected());
+    QVERIFY(QTest::qWaitFor([&servicesModel]() {
+        return servicesModel.isConnected();
+    }));
+    QVERIFY(service->state() == QLowEnergyService::ServiceDiscovered);
+
+    QVERIFY(queue.writeCharacteristic(characteristicUuid, QByteArray::fromHex("c0de"))
+            >= 0);
+    QVERIFY(finished.wait(1000));
+    QCOMPARE(finished.count(), 1);
+    QCOMPARE(finished.at(0).at(1).toInt(), 1);
+    QCOMPARE(finished.at(0).at(2).toInt(), 0);
+
+    // Anything sent twice would be acknowledged by now.
+    QTest::qWait(4 * queue.timeout());
+    QCOMPARE(written.count(), 1);
+    QCOMPARE(service->characteristicValue(characteristicUuid), QByteArray::fromHex("c0de"));
+}
+
+// Coming back to a pooled link which dropped while it was idle shows
+// the services of the previous visit once, and the discovery attaches
+// new sources to them rather than adding other ones.
+void LinkTest::revisitDroppedLink()
+{
+    auto simulation = config();
+    simulation.deviceCount = 2;
+    simulation.servicesPerDevice = 3;
+    SimulatedBleBackend backend;
+    backend.setConfig(simulation);
+    const auto address = backend.advertisement(0).address();
+    const auto otherAddress = backend.advertisement(1).address();
+
+    ServicesModel servicesModel(&backend);
+    const QAbstractItemModel &model = servicesModel;
+    const auto discovered = [&servicesModel, &model, &simulation]() {
+        return servicesModel.isConnected() && !servicesModel.isRunning()
+                && model.rowCount() == simulation.servicesPerDevice;
+    };
+    servicesModel.update(address.toString());
+    QVERIFY(QTest::qWaitFor(discovered));
+
+    // Released to the pool, where its link drops.
+    servicesModel.update(otherAddress.toString());
+    QVERIFY(QTest::qWaitFor(discovered));
+    const auto controller = qobject_cast<SimulatedPeripheralController *>(
+                servicesModel.connectionPool()->controller(address));
+    QVERIFY(controller);
+    controller->dropLink();
+
+    servicesModel.update(address.toString());
+    QCOMPARE(model.rowCount(), simulation.servicesPerDevice);
+    QVERIFY(QTest::qWaitFor(discovered));
+    QCOMPARE(model.rowCount(), simulation.servicesPerDevice);
+    QCOMPARE(controller->findChildren<CachedGattService *>(
+                 QString(), Qt::FindDirectChildrenOnly).count(),
+             simulation.servicesPerDevice);
+
+    // And once more, now that the link is up.
+    servicesModel.update(otherAddress.toString());
+    QVERIFY(QTest::qWaitFor(discovered));
+    servicesModel.update(address.toString());
+    QCOMPARE(model.rowCount(), simulation.servicesPerDevice);
+}
+
+void LinkTest::tuneConnection_data()
+{
+    QTest::addColumn<ConnectionTuner::Profile>("profile");
+    QTest::addColumn<qreal>("minimumInterval");
+    QTest::addColumn<qreal>("maximumInterval");
+    QTest::addColumn<int>("latency");
+    QTest::addColumn<int>("supervisionTimeout");
+
+    QTest::newRow("low latency") << ConnectionTuner::LowLatency << 7.5 << 15.0 << 0 << 2000;
+    QTest::newRow("high throughput") << ConnectionTuner::HighThroughput << 15.0 << 30.0 << 0 << 4000;
+    QTest::newRow("low power") << ConnectionTuner::LowPower << 100.0 << 125.0 << 4 << 6000;
+}
+
+// The profile set before connecting is requested once the link is up,
+// and the peripheral grants the shortest interval of its range.
+void LinkTest::tuneConnection()
+{
+    QFETCH(ConnectionTuner::Profile, profile);
+    QFETCH(qreal, minimumInterval);
+    QFETCH(qreal, maximumInterval);
+    QFETCH(int, latency);
+    QFETCH(int, supervisionTimeout);
+
+    const auto parameters = ConnectionTuner::parameters(profile);
+    QCOMPARE(parameters.minimumInterval(), minimumInterval);
+    QCOMPARE(parameters.maximumInterval(), maximumInterval);
+    QCOMPARE(parameters.latency(), latency);
+    QCOMPARE(parameters.supervisionTimeout(), supervisionTimeout);
+
+    auto simulation = config();
+    // Below the intervals of every profile.
+    simulation.minConnectionInterval = 7.5;
+    SimulatedBleBackend backend;
+    backend.setConfig(simulation);
+    QObject context;
+    const auto controller = backend.createController(backend.advertisement(0).address(),
+                                                     &context);
+
+    ConnectionTuner tuner;
+    tuner.setController(controller);
+    tuner.setProfile(profile);
+    QCOMPARE(tuner.profile(), profile);
+    QSignalSpy updated(&tuner, &ConnectionTuner::connectionUpdated);
+    controller->connectToDevice();
+    QVERIFY(updated.wait(1000));
+
+    QCOMPARE(tuner.connectionInterval(), minimumInterval);
+    QCOMPARE(tuner.latency(), latency);
+    QCOMPARE(tuner.supervisionTimeout(), supervisionTimeout);
+}
+
+// A peripheral which cannot go as fast as asked for grants its minimum.
+void LinkTest::clampConnectionInterval()
+{
+    const auto simulation = config();
+    QVERIFY(ConnectionTuner::parameters(ConnectionTuner::LowLatency).minimumInterval()
+            < simulation.minConnectionInterval);
+    SimulatedBleBackend backend;
+    backend.setConfig(simulation);
+    QObject context;
+    const auto controller = backend.createController(backend.advertisement(0).address(),
+                                                     &context);
+
+    ConnectionTuner tuner;
+    tuner.setController(controller);
+    tuner.setProfile(ConnectionTuner::LowLatency);
+    QSignalSpy updated(&tuner, &ConnectionTuner::connectionUpdated);
+    controller->connectToDevice();
+    QVERIFY(updated.wait(1000));
+
+    QCOMPARE(tuner.connectionInterval(), simulation.minConnectionInterval);
+    QCOMPARE(tuner.latency(), 0);
+    QCOMPARE(tuner.supervisionTimeout(), 2000);
+}
+
+// The chunks of the streams fill the ATT payload of the negotiated MTU,
+// and fall back to the default one with the link.
+void LinkTest::writeChunkSizeFollowsMtu()
+{
+    const auto simulation = config();
+    QVERIFY(simulation.mtu > DefaultAttMtu);
+    SimulatedBleBackend backend;
+    backend.setConfig(simulation);
+    QObject context;
+    const auto controller = qobject_cast<SimulatedPeripheralController *>(
+                backend.createController(backend.advertisement(0).address(), &context));
+    QVERIFY(controller);
+
+    ConnectionTuner tuner;
+    tuner.setController(controller);
+    QCOMPARE(tuner.mtu(), int(DefaultAttMtu));
+    QCOMPARE(tuner.writeChunkSize(), DefaultAttMtu - 3);
+
+    QSignalSpy mtuChanged(&tuner, &ConnectionTuner::mtuChanged);
+    controller->connectToDevice();
+    QVERIFY(mtuChanged.wait(1000));
+    QCOMPARE(mtuChanged.at(0).at(0).toInt(), simulation.mtu);
+    QCOMPARE(tuner.mtu(), simulation.mtu);
+    QCOMPARE(tuner.writeChunkSize(), simulation.mtu - 3);
+
+    controller->dropLink();
+    QCOMPARE(mtuChanged.count(), 2);
+    QCOMPARE(tuner.writeChunkSize(), DefaultAttMtu - 3);
+}
+
+QTEST_GUILESS_MAIN(LinkTest)
+
+#include "linktest.moc"
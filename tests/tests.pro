@@ -0,0 +1,18 @@
+# Behavioural tests of the link handling, driven by the simulated
+# backend so that they run without any Bluetooth adapter:
+#
+#   ./linktest
+
+QT += testlib
+QT -= gui
+CONFIG += c++11 testcase console
+CONFIG -= app_bundle
+
+TARGET = linktest
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+include(../scanner.pri)
+
+SOURCES += \
+    linktest.cpp
@@ -0,0 +1,794 @@
+#include "threadedblebackend.h"
+#include "updatebatcher.h"
+
+#include <QLoggingCategory>
+#include <QThread>
+
+Q_DECLARE_LOGGING_CATEGORY(BLE_BACKEND)
+
+using Event = ThreadedBleBackend::Event;
+
+// I/O thread, the service being discovered.
+static QVector<GattCharacteristicInfo> characteristicsOf(const GattService *service)
+{
+    const auto characteristicUuids = service->characteristicUuids();
+    QVector<GattCharacteristicInfo> characteristics;
+    characteristics.reserve(characteristicUuids.count());
+    for (const auto &characteristicUuid : characteristicUuids)
+        characteristics.append(service->characteristic(characteristicUuid));
+    return characteristics;
+}
+
+// ThreadedBleBackend
+
+ThreadedBleBackend::ThreadedBleBackend(BleBackend *backend, QObject *parent)
+    : BleBackend(parent)
+    , m_thread(new QThread(this))
+    , m_drainBatcher(new UpdateBatcher(this))
+    , m_ioContext(new QObject)
+    , m_backend(backend)
+{
+    m_drainBatcher->setFlushHandler([this]() {
+        drain();
+    });
+
+    m_thread->setObjectName(QStringLiteral("Bluetooth I/O"));
+    m_ioContext->moveToThread(m_thread);
+    m_backend->setParent(nullptr);
+    m_backend->moveToThread(m_thread);
+    connect(m_thread, &QThread::finished,
+            m_ioContext, &QObject::deleteLater);
+    m_thread->start();
+    qCDebug(BLE_BACKEND) << "Start I/O thread";
+}
+
+ThreadedBleBackend::~ThreadedBleBackend()
+{
+    m_drainBatcher->cancel();
+    // The proxies which outlive the backend are left without any real
+    // object, their requests are ignored.
+    invokeBlocking([this]() {
+        for (const auto &worker : qAsConst(m_workers))
+            delete worker.data();
+        m_workers.clear();
+        delete m_backend;
+    });
+    m_thread->quit();
+    m_thread->wait();
+    qCDebug(BLE_BACKEND) << "Stop I/O thread";
+}
+
+DeviceScanner *ThreadedBleBackend::createDeviceScanner(QObject *parent)
+{
+    const auto handle = m_nextHandle++;
+    auto timeout = 0;
+    invokeBlocking([this, handle, &timeout]() {
+        const auto scanner = m_backend->createDeviceScanner(m_ioContext);
+        timeout = scanner->lowEnergyDiscoveryTimeout();
+        watchScanner(handle, scanner);
+    });
+
+    const auto scanner = new ThreadedDeviceScanner(this, handle, parent);
+    scanner->m_timeout = timeout;
+    m_proxies.insert(handle, scanner);
+    return scanner;
+}
+
+PeripheralController *ThreadedBleBackend::createController(
+        const QBluetoothAddress &remoteAddress, QObject *parent)
+{
+    const auto handle = m_nextHandle++;
+    auto state = QLowEnergyController::UnconnectedState;
+    auto error = QLowEnergyController::NoError;
+    QString errorString;
+    QVector<QBluetoothUuid> services;
+    int mtu = DefaultAttMtu;
+    QLowEnergyConnectionParameters connectionParameters;
+    invokeBlocking([&]() {
+        const auto controller = m_backend->createController(remoteAddress, m_ioContext);
+        state = controller->state();
+        error = controller->error();
+        errorString = controller->errorString();
+        services = controller->services();
+        mtu = controller->mtu();
+        connectionParameters = controller->connectionParameters();
+        watchController(handle, controller);
+    });
+
+    const auto controller = new ThreadedPeripheralController(this, handle, remoteAddress, parent);
+    controller->m_state = state;
+    controller->m_error = error;
+    controller->m_errorString = errorString;
+    controller->m_services = services;
+    controller->m_mtu = mtu;
+    controller->m_connectionParameters = connectionParameters;
+    m_proxies.insert(handle, controller);
+    return controller;
+}
+
+ThreadedGattService *ThreadedBleBackend::createService(quint64 controllerHandle,
+                                                       const QBluetoothUuid &serviceUuid,
+                                                       QObject *parent)
+{
+    const auto handle = m_nextHandle++;
+    auto created = false;
+    QBluetoothAddress deviceAddress;
+    QString serviceName;
+    auto state = QLowEnergyService::InvalidService;
+    QVector<GattCharacteristicInfo> characteristics;
+    invokeBlocking([&]() {
+        const auto controller = worker<PeripheralController>(controllerHandle);
+        if (!controller)
+            return;
+        // Owned by the controller, so that they go along with it.
+        const auto service = controller->createServiceObject(serviceUuid, controller);
+        if (!service)
+            return;
+        created = true;
+        deviceAddress = service->deviceAddress();
+        serviceName = service->serviceName();
+        state = service->state();
+        if (state == QLowEnergyService::ServiceDiscovered)
+            characteristics = characteristicsOf(service);
+        watchService(handle, service);
+    });
+    if (!created)
+        return nullptr;
+
+    const auto service = new ThreadedGattService(this, handle, deviceAddress, serviceUuid, parent);
+    service->m_serviceName = serviceName;
+    service->m_state = state;
+    service->setCharacteristics(characteristics);
+    m_proxies.insert(handle, service);
+    return service;
+}
+
+void ThreadedBleBackend::release(quint64 handle)
+{
+    m_proxies.remove(handle);
+    invoke([this, handle]() {
+        delete m_workers.take(handle).data();
+    });
+}
+
+void ThreadedBleBackend::drain()
+{
+    // Cleared first, the events posted from now on wake it up again.
+    m_drainPending.store(false, std::memory_order_release);
+
+    // At most one queue worth per frame, so that a stream faster than the
+    // GUI thread can not starve it; the rest has woken it up again.
+    Event event;
+    for (size_t count = 0; count < m_events.capacity() && m_events.tryPop(event); ++count)
+        dispatch(event);
+
+    if (m_backlogged.load(std::memory_order_acquire)) {
+        invoke([this]() {
+            flushBacklog();
+        });
+    }
+}
+
+void ThreadedBleBackend::dispatch(const Event &event)
+{
+    // Released while the event was queued.
+    const auto proxy = m_proxies.value(event.handle);
+    if (!proxy)
+        return;
+
+    switch (event.type) {
+    case Event::DeviceDiscovered:
+    case Event::DeviceUpdated:
+    case Event::ScanFinished:
+    case Event::ScanCanceled:
+    case Event::ScanError:
+        static_cast<ThreadedDeviceScanner *>(proxy)->handleEvent(event);
+        break;
+    case Event::ControllerStateChanged:
+    case Event::ControllerError:
+    case Event::ServiceDiscovered:
+    case Event::DiscoveryFinished:
+    case Event::MtuChanged:
+    case Event::ConnectionUpdated:
+        static_cast<ThreadedPeripheralController *>(proxy)->handleEvent(event);
+        break;
+    case Event::ServiceStateChanged:
+    case Event::ServiceError:
+    case Event::CharacteristicChanged:
+    case Event::CharacteristicRead:
+    case Event::CharacteristicWritten:
+    case Event::DescriptorRead:
+    case Event::DescriptorWritten:
+        static_cast<ThreadedGattService *>(proxy)->handleEvent(event);
+        break;
+    }
+}
+
+void ThreadedBleBackend::watchScanner(quint64 handle, DeviceScanner *scanner)
+{
+    m_workers.insert(handle, scanner);
+
+    connect(scanner, &DeviceScanner::deviceDiscovered,
+            scanner, [this, handle](const QBluetoothDeviceInfo &device) {
+        Event event(Event::DeviceDiscovered, handle);
+        event.device = device;
+        post(std::move(event));
+    });
+    connect(scanner, &DeviceScanner::deviceUpdated,
+            scanner, [this, handle](const QBluetoothDeviceInfo &device,
+                                    QBluetoothDeviceInfo::Fields updatedFields) {
+        Event event(Event::DeviceUpdated, handle);
+        event.device = device;
+        event.code = int(updatedFields);
+        post(std::move(event));
+    });
+
+    // The scan may be over or go on after any of them, carry whether.
+    const auto postEnd = [this, handle, scanner](Event::Type type) {
+        Event event(type, handle);
+        event.code = scanner->isActive();
+        event.errorString = scanner->errorString();
+        post(std::move(event));
+    };
+    connect(scanner, &DeviceScanner::finished,
+            scanner, [postEnd]() {
+        postEnd(Event::ScanFinished);
+    });
+    connect(scanner, &DeviceScanner::canceled,
+            scanner, [postEnd]() {
+        postEnd(Event::ScanCanceled);
+    });
+    connect(scanner, &DeviceScanner::errorOccurred,
+            scanner, [postEnd]() {
+        postEnd(Event::ScanError);
+    });
+}
+
+void ThreadedBleBackend::watchController(quint64 handle, PeripheralController *controller)
+{
+    m_workers.insert(handle, controller);
+
+    connect(controller, &PeripheralController::stateChanged,
+            controller, [this, handle, controller](QLowEnergyController::ControllerState state) {
+        Event event(Event::ControllerStateChanged, handle);
+        event.code = state;
+        // The services are forgotten on disconnects.
+        event.services = controller->services();
+        post(std::move(event));
+    });
+    connect(controller, &PeripheralController::errorOccurred,
+            controller, [this, handle, controller](QLowEnergyController::Error error) {
+        Event event(Event::ControllerError, handle);
+        event.code = error;
+        event.errorString = controller->errorString();
+        post(std::move(event));
+    });
+    connect(controller, &PeripheralController::serviceDiscovered,
+            controller, [this, handle](const QBluetoothUuid &serviceUuid) {
+        Event event(Event::ServiceDiscovered, handle);
+        event.uuid = serviceUuid;
+        post(std::move(event));
+    });
+    connect(controller, &PeripheralController::discoveryFinished,
+            controller, [this, handle]() {
+        post(Event(Event::DiscoveryFinished, handle));
+    });
+    connect(controller, &PeripheralController::mtuChanged,
+            controller, [this, handle](int mtu) {
+        Event event(Event::MtuChanged, handle);
+        event.code = mtu;
+        post(std::move(event));
+    });
+    connect(controller, &PeripheralController::connectionUpdated,
+            controller, [this, handle](const QLowEnergyConnectionParameters &parameters) {
+        Event event(Event::ConnectionUpdated, handle);
+        event.parameters = parameters;
+        post(std::move(event));
+    });
+}
+
+void ThreadedBleBackend::watchService(quint64 handle, GattService *service)
+{
+    m_workers.insert(handle, service);
+
+    connect(service, &GattService::stateChanged,
+            service, [this, handle, service](QLowEnergyService::ServiceState state) {
+        Event event(Event::ServiceStateChanged, handle);
+        event.code = state;
+        if (state == QLowEnergyService::ServiceDiscovered)
+            event.characteristics = characteristicsOf(service);
+        post(std::move(event));
+    });
+    connect(service, &GattService::errorOccurred,
+            service, [this, handle](QLowEnergyService::ServiceError error) {
+        Event event(Event::ServiceError, handle);
+        event.code = error;
+        post(std::move(event));
+    });
+
+    const auto postValue = [this, handle](Event::Type type,
+                                          const QBluetoothUuid &characteristicUuid,
+                                          const QBluetoothUuid &descriptorUuid,
+                                          const QByteArray &value) {
+        Event event(type, handle);
+        event.uuid = characteristicUuid;
+        event.descriptorUuid = descriptorUuid;
+        event.value = value;
+        post(std::move(event));
+    };
+    connect(service, &GattService::characteristicChanged,
+            service, [postValue](const QBluetoothUuid &characteristicUuid,
+                                 const QByteArray &value) {
+        postValue(Event::CharacteristicChanged, characteristicUuid, QBluetoothUuid(), value);
+    });
+    connect(service, &GattService::characteristicRead,
+            service, [postValue](const QBluetoothUuid &characteristicUuid,
+                                 const QByteArray &value) {
+        postValue(Event::CharacteristicRead, characteristicUuid, QBluetoothUuid(), value);
+    });
+    connect(service, &GattService::characteristicWritten,
+            service, [postValue](const QBluetoothUuid &characteristicUuid,
+                                 const QByteArray &value) {
+        postValue(Event::CharacteristicWritten, characteristicUuid, QBluetoothUuid(), value);
+    });
+    connect(service, &GattService::descriptorRead,
+            service, [postValue](const QBluetoothUuid &characteristicUuid,
+                                 const QBluetoothUuid &descriptorUuid,
+                                 const QByteArray &value) {
+        postValue(Event::DescriptorRead, characteristicUuid, descriptorUuid, value);
+    });
+    connect(service, &GattService::descriptorWritten,
+            service, [postValue](const QBluetoothUuid &characteristicUuid,
+                                 const QBluetoothUuid &descriptorUuid,
+                                 const QByteArray &value) {
+        postValue(Event::DescriptorWritten, characteristicUuid, descriptorUuid, value);
+    });
+}
+
+void ThreadedBleBackend::post(Event &&event)
+{
+    // Behind the ones kept aside, to keep the order.
+    if (!m_backlog.isEmpty())
+        flushBacklog();
+    if (!m_backlog.isEmpty() || !m_events.tryPush(std::move(event))) {
+        m_backlog.enqueue(event);
+        m_backlogged.store(true, std::memory_order_release);
+    }
+    wake();
+}
+
+void ThreadedBleBackend::flushBacklog()
+{
+    while (!m_backlog.isEmpty() && m_events.tryPush(std::move(m_backlog.head())))
+        m_backlog.dequeue();
+    if (m_backlog.isEmpty())
+        m_backlogged.store(false, std::memory_order_release);
+    wake();
+}
+
+void ThreadedBleBackend::wake()
+{
+    // A single wake up per frame, however many events are posted.
+    if (m_drainPending.exchange(true, std::memory_order_acq_rel))
+        return;
+    QMetaObject::invokeMethod(this, [this]() {
+        m_drainBatcher->schedule();
+    }, Qt::QueuedConnection);
+}
+
+// ThreadedDeviceScanner
+
+ThreadedDeviceScanner::ThreadedDeviceScanner(ThreadedBleBackend *backend, quint64 handle,
+                                             QObject *parent)
+    : DeviceScanner(parent)
+    , m_backend(backend)
+    , m_handle(handle)
+{
+}
+
+ThreadedDeviceScanner::~ThreadedDeviceScanner()
+{
+    if (m_backend)
+        m_backend->release(m_handle);
+}
+
+int ThreadedDeviceScanner::lowEnergyDiscoveryTimeout() const
+{
+    return m_timeout;
+}
+
+void ThreadedDeviceScanner::setLowEnergyDiscoveryTimeout(int timeout)
+{
+    m_timeout = timeout;
+    if (!m_backend)
+        return;
+    m_backend->invokeWorker<DeviceScanner>(m_handle, [timeout](DeviceScanner *scanner) {
+        scanner->setLowEnergyDiscoveryTimeout(timeout);
+    });
+}
+
+bool ThreadedDeviceScanner::isActive() const
+{
+    return m_active;
+}
+
+QString ThreadedDeviceScanner::errorString() const
+{
+    return m_errorString;
+}
+
+void ThreadedDeviceScanner::start()
+{
+    if (!m_backend)
+        return;
+    m_active = true;
+    m_backend->invokeWorker<DeviceScanner>(m_handle, [](DeviceScanner *scanner) {
+        scanner->start();
+    });
+}
+
+void ThreadedDeviceScanner::stop()
+{
+    if (!m_backend)
+        return;
+    m_backend->invokeWorker<DeviceScanner>(m_handle, [](DeviceScanner *scanner) {
+        scanner->stop();
+    });
+}
+
+void ThreadedDeviceScanner::handleEvent(const ThreadedBleBackend::Event &event)
+{
+    switch (event.type) {
+    case Event::DeviceDiscovered:
+        emit deviceDiscovered(event.device);
+        break;
+    case Event::DeviceUpdated:
+        emit deviceUpdated(event.device, QBluetoothDeviceInfo::Fields(event.code));
+        break;
+    case Event::ScanFinished:
+        m_active = event.code;
+        emit finished();
+        break;
+    case Event::ScanCanceled:
+        m_active = event.code;
+        emit canceled();
+        break;
+    case Event::ScanError:
+        m_active = event.code;
+        m_errorString = event.errorString;
+        emit errorOccurred();
+        break;
+    default:
+        break;
+    }
+}
+
+// ThreadedGattService
+
+ThreadedGattService::ThreadedGattService(ThreadedBleBackend *backend, quint64 handle,
+                                         const QBluetoothAddress &deviceAddress,
+                                         const QBluetoothUuid &serviceUuid, QObject *parent)
+    : GattService(parent)
+    , m_backend(backend)
+    , m_handle(handle)
+    , m_deviceAddress(deviceAddress)
+    , m_serviceUuid(serviceUuid)
+{
+}
+
+ThreadedGattService::~ThreadedGattService()
+{
+    if (m_backend)
+        m_backend->release(m_handle);
+}
+
+QBluetoothAddress ThreadedGattService::deviceAddress() const
+{
+    return m_deviceAddress;
+}
+
+QBluetoothUuid ThreadedGattService::serviceUuid() const
+{
+    return m_serviceUuid;
+}
+
+QString ThreadedGattService::serviceName() const
+{
+    return m_serviceName;
+}
+
+QLowEnergyService::ServiceState ThreadedGattService::state() const
+{
+    return m_state;
+}
+
+void ThreadedGattService::discoverDetails()
+{
+    if (!m_backend)
+        return;
+    m_backend->invokeWorker<GattService>(m_handle, [](GattService *service) {
+        service->discoverDetails();
+    });
+}
+
+QVector<QBluetoothUuid> ThreadedGattService::characteristicUuids() const
+{
+    QVector<QBluetoothUuid> characteristicUuids;
+    characteristicUuids.reserve(m_characteristics.count());
+    for (const auto &characteristic : m_characteristics)
+        characteristicUuids.append(characteristic.uuid);
+    return characteristicUuids;
+}
+
+GattCharacteristicInfo ThreadedGattService::characteristic(
+        const QBluetoothUuid &characteristicUuid) const
+{
+    const auto rowIt = m_characteristicRows.constFind(characteristicUuid);
+    if (rowIt == m_characteristicRows.cend())
+        return GattCharacteristicInfo();
+    return m_characteristics.at(rowIt.value());
+}
+
+QByteArray ThreadedGattService::characteristicValue(
+        const QBluetoothUuid &characteristicUuid) const
+{
+    const auto rowIt = m_characteristicRows.constFind(characteristicUuid);
+    if (rowIt == m_characteristicRows.cend())
+        return QByteArray();
+    return m_characteristics.at(rowIt.value()).value;
+}
+
+QByteArray ThreadedGattService::descriptorValue(const QBluetoothUuid &characteristicUuid,
+                                                const QBluetoothUuid &descriptorUuid) const
+{
+    const auto rowIt = m_characteristicRows.constFind(characteristicUuid);
+    if (rowIt == m_characteristicRows.cend())
+        return QByteArray();
+    const auto &descriptors = m_characteristics.at(rowIt.value()).descriptors;
+    for (const auto &descriptor : descriptors) {
+        if (descriptor.uuid == descriptorUuid)
+            return descriptor.value;
+    }
+    return QByteArray();
+}
+
+void ThreadedGattService::readCharacteristic(const QBluetoothUuid &characteristicUuid)
+{
+    if (!m_backend)
+        return;
+    m_backend->invokeWorker<GattService>(m_handle, [characteristicUuid](GattService *service) {
+        service->readCharacteristic(characteristicUuid);
+    });
+}
+
+void ThreadedGattService::writeCharacteristic(const QBluetoothUuid &characteristicUuid,
+                                              const QByteArray &value,
+                                              QLowEnergyService::WriteMode mode)
+{
+    if (!m_backend)
+        return;
+    m_backend->invokeWorker<GattService>(m_handle, [characteristicUuid, value, mode](
+                                         GattService *service) {
+        service->writeCharacteristic(characteristicUuid, value, mode);
+    });
+}
+
+void ThreadedGattService::readDescriptor(const QBluetoothUuid &characteristicUuid,
+                                         const QBluetoothUuid &descriptorUuid)
+{
+    if (!m_backend)
+        return;
+    m_backend->invokeWorker<GattService>(m_handle, [characteristicUuid, descriptorUuid](
+                                         GattService *service) {
+        service->readDescriptor(characteristicUuid, descriptorUuid);
+    });
+}
+
+void ThreadedGattService::writeDescriptor(const QBluetoothUuid &characteristicUuid,
+                                          const QBluetoothUuid &descriptorUuid,
+                                          const QByteArray &value)
+{
+    if (!m_backend)
+        return;
+    m_backend->invokeWorker<GattService>(m_handle, [characteristicUuid, descriptorUuid, value](
+                                         GattService *service) {
+        service->writeDescriptor(characteristicUuid, descriptorUuid, value);
+    });
+}
+
+void ThreadedGattService::handleEvent(const ThreadedBleBackend::Event &event)
+{
+    switch (event.type) {
+    case Event::ServiceStateChanged:
+        m_state = QLowEnergyService::ServiceState(event.code);
+        if (m_state == QLowEnergyService::ServiceDiscovered)
+            setCharacteristics(event.characteristics);
+        emit stateChanged(m_state);
+        break;
+    case Event::ServiceError:
+        emit errorOccurred(QLowEnergyService::ServiceError(event.code));
+        break;
+    case Event::CharacteristicChanged:
+    case Event::CharacteristicRead:
+    case Event::CharacteristicWritten: {
+        const auto rowIt = m_characteristicRows.constFind(event.uuid);
+        if (rowIt != m_characteristicRows.cend())
+            m_characteristics[rowIt.value()].value = event.value;
+        if (event.type == Event::CharacteristicChanged)
+            emit characteristicChanged(event.uuid, event.value);
+        else if (event.type == Event::CharacteristicRead)
+            emit characteristicRead(event.uuid, event.value);
+        else
+            emit characteristicWritten(event.uuid, event.value);
+        break;
+    }
+    case Event::DescriptorRead:
+    case Event::DescriptorWritten:
+        if (const auto descriptor = findDescriptor(event.uuid, event.descriptorUuid))
+            descriptor->value = event.value;
+        if (event.type == Event::DescriptorRead)
+            emit descriptorRead(event.uuid, event.descriptorUuid, event.value);
+        else
+            emit descriptorWritten(event.uuid, event.descriptorUuid, event.value);
+        break;
+    default:
+        break;
+    }
+}
+
+void ThreadedGattService::setCharacteristics(
+        const QVector<GattCharacteristicInfo> &characteristics)
+{
+    m_characteristics = characteristics;
+    m_characteristicRows.clear();
+    m_characteristicRows.reserve(m_characteristics.count());
+    for (auto row = 0; row < m_characteristics.count(); ++row)
+        m_characteristicRows.insert(m_characteristics.at(row).uuid, row);
+}
+
+GattDescriptorInfo *ThreadedGattService::findDescriptor(
+        const QBluetoothUuid &characteristicUuid, const QBluetoothUuid &descriptorUuid)
+{
+    const auto rowIt = m_characteristicRows.constFind(characteristicUuid);
+    if (rowIt == m_characteristicRows.cend())
+        return nullptr;
+    auto &descriptors = m_characteristics[rowIt.value()].descriptors;
+    for (auto &descriptor : descriptors) {
+        if (descriptor.uuid == descriptorUuid)
+            return &descriptor;
+    }
+    return nullptr;
+}
+
+// ThreadedPeripheralController
+
+ThreadedPeripheralController::ThreadedPeripheralController(
+        ThreadedBleBackend *backend, quint64 handle,
+        const QBluetoothAddress &remoteAddress, QObject *parent)
+    : PeripheralController(parent)
+    , m_backend(backend)
+    , m_handle(handle)
+    , m_remoteAddress(remoteAddress)
+{
+}
+
+ThreadedPeripheralController::~ThreadedPeripheralController()
+{
+    if (m_backend)
+        m_backend->release(m_handle);
+}
+
+QBluetoothAddress ThreadedPeripheralController::remoteAddress() const
+{
+    return m_remoteAddress;
+}
+
+QLowEnergyController::ControllerState ThreadedPeripheralController::state() const
+{
+    return m_state;
+}
+
+QLowEnergyController::Error ThreadedPeripheralController::error() const
+{
+    return m_error;
+}
+
+QString ThreadedPeripheralController::errorString() const
+{
+    return m_errorString;
+}
+
+void ThreadedPeripheralController::connectToDevice()
+{
+    if (!m_backend)
+        return;
+    m_backend->invokeWorker<PeripheralController>(m_handle, [](PeripheralController *controller) {
+        controller->connectToDevice();
+    });
+}
+
+void ThreadedPeripheralController::disconnectFromDevice()
+{
+    if (!m_backend)
+        return;
+    m_backend->invokeWorker<PeripheralController>(m_handle, [](PeripheralController *controller) {
+        controller->disconnectFromDevice();
+    });
+}
+
+void ThreadedPeripheralController::discoverServices()
+{
+    if (!m_backend)
+        return;
+    m_backend->invokeWorker<PeripheralController>(m_handle, [](PeripheralController *controller) {
+        controller->discoverServices();
+    });
+}
+
+QVector<QBluetoothUuid> ThreadedPeripheralController::services() const
+{
+    return m_services;
+}
+
+GattService *ThreadedPeripheralController::createServiceObject(
+        const QBluetoothUuid &serviceUuid, QObject *parent)
+{
+    if (!m_backend)
+        return nullptr;
+    return m_backend->createService(m_handle, serviceUuid, parent);
+}
+
+int ThreadedPeripheralController::mtu() const
+{
+    return m_mtu;
+}
+
+QLowEnergyConnectionParameters ThreadedPeripheralController::connectionParameters() const
+{
+    return m_connectionParameters;
+}
+
+void ThreadedPeripheralController::requestConnectionUpdate(
+        const QLowEnergyConnectionParameters &parameters)
+{
+    if (!m_backend)
+        return;
+    m_backend->invokeWorker<PeripheralController>(m_handle,
+                                                  [parameters](PeripheralController *controller) {
+        controller->requestConnectionUpdate(parameters);
+    });
+}
+
+void ThreadedPeripheralController::handleEvent(const ThreadedBleBackend::Event &event)
+{
+    switch (event.type) {
+    case Event::ControllerStateChanged:
+        m_state = QLowEnergyController::ControllerState(event.code);
+        m_services = event.services;
+        emit stateChanged(m_state);
+        break;
+    case Event::ControllerError:
+        m_error = QLowEnergyController::Error(event.code);
+        m_errorString = event.errorString;
+        emit errorOccurred(m_error);
+        break;
+    case Event::ServiceDiscovered:
+        if (!m_services.contains(event.uuid))
+            m_services.append(event.uuid);
+        emit serviceDiscovered(event.uuid);
+        break;
+    case Event::DiscoveryFinished:
+        emit discoveryFinished();
+        break;
+    case Event::MtuChanged:
+        m_mtu = event.code;
+        emit mtuChanged(m_mtu);
+        break;
+    case Event::ConnectionUpdated:
+        m_connectionParameters = event.parameters;
+        emit connectionUpdated(m_connectionParameters);
+        break;
+    default:
+        break;
+    }
+}
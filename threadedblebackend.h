@@ -0,0 +1,286 @@
+#ifndef THREADEDBLEBACKEND_H
+#define THREADEDBLEBACKEND_H
+
+#include "blebackend.h"
+#include "spscqueue.h"
+
+#include <QHash>
+#include <QPointer>
+#include <QQueue>
+
+#include <atomic>
+
+class QThread;
+
+class UpdateBatcher;
+class ThreadedDeviceScanner;
+class ThreadedGattService;
+class ThreadedPeripheralController;
+
+// Runs another backend on a dedicated I/O thread, so that the Bluetooth
+// stack and the signals of high rate notifications do not compete with
+// the rendering of the GUI thread.
+//
+// The objects handed out are proxies living in the thread of the caller.
+// Their requests are queued to the I/O thread; the events of the real
+// objects come back through a lock-free single producer, single consumer
+// queue, which is drained once per frame by the GUI thread. The proxies
+// mirror the state of the real objects from these events, so that their
+// getters never wait for the I/O thread. Only creating the objects does,
+// to start from their actual state.
+//
+// When the queue is full the I/O thread keeps the events aside and
+// hands them over once the GUI thread caught up, none is ever dropped.
+class ThreadedBleBackend final : public BleBackend
+{
+    Q_OBJECT
+
+public:
+    // Handed over from the I/O thread to the GUI thread.
+    struct Event
+    {
+        enum Type {
+            DeviceDiscovered,
+            DeviceUpdated,
+            ScanFinished,
+            ScanCanceled,
+            ScanError,
+            ControllerStateChanged,
+            ControllerError,
+            ServiceDiscovered,
+            DiscoveryFinished,
+            ServiceStateChanged,
+            ServiceError,
+            CharacteristicChanged,
+            CharacteristicRead,
+            CharacteristicWritten,
+            DescriptorRead,
+            DescriptorWritten,
+            MtuChanged,
+            ConnectionUpdated
+        };
+
+        Event() = default;
+        Event(Type type, quint64 handle) : type(type), handle(handle) {}
+
+        Type type = ScanFinished;
+        // Of the proxy.
+        quint64 handle = 0;
+        // A state, an error, an MTU or the updated fields of a device.
+        int code = 0;
+        QBluetoothUuid uuid;
+        QBluetoothUuid descriptorUuid;
+        QByteArray value;
+        QString errorString;
+        QBluetoothDeviceInfo device;
+        // Along with the state of a controller.
+        QVector<QBluetoothUuid> services;
+        // Along with the discovered state of a service.
+        QVector<GattCharacteristicInfo> characteristics;
+        QLowEnergyConnectionParameters parameters;
+    };
+
+    // Takes the ownership of the backend, which is moved to the I/O
+    // thread.
+    explicit ThreadedBleBackend(BleBackend *backend, QObject *parent = nullptr);
+    ~ThreadedBleBackend() override;
+
+    DeviceScanner *createDeviceScanner(QObject *parent) final;
+    PeripheralController *createController(const QBluetoothAddress &remoteAddress,
+                                           QObject *parent) final;
+
+private:
+    friend class ThreadedDeviceScanner;
+    friend class ThreadedGattService;
+    friend class ThreadedPeripheralController;
+
+    template <typename Function>
+    void invoke(Function function)
+    {
+        QMetaObject::invokeMethod(m_ioContext, function, Qt::QueuedConnection);
+    }
+
+    template <typename Function>
+    void invokeBlocking(Function function)
+    {
+        QMetaObject::invokeMethod(m_ioContext, function, Qt::BlockingQueuedConnection);
+    }
+
+    template <typename T>
+    T *worker(quint64 handle) const
+    {
+        return qobject_cast<T *>(m_workers.value(handle).data());
+    }
+
+    // Calls the function with the real object of a proxy, if it is
+    // still alive once the call reaches the I/O thread.
+    template <typename T, typename Function>
+    void invokeWorker(quint64 handle, Function function)
+    {
+        invoke([this, handle, function]() {
+            if (const auto object = worker<T>(handle))
+                function(object);
+        });
+    }
+
+    // GUI thread.
+    ThreadedGattService *createService(quint64 controllerHandle,
+                                       const QBluetoothUuid &serviceUuid,
+                                       QObject *parent);
+    void release(quint64 handle);
+    void drain();
+    void dispatch(const Event &event);
+
+    // I/O thread.
+    void watchScanner(quint64 handle, DeviceScanner *scanner);
+    void watchController(quint64 handle, PeripheralController *controller);
+    void watchService(quint64 handle, GattService *service);
+    void post(Event &&event);
+    void flushBacklog();
+    void wake();
+
+    // GUI thread.
+    QThread *m_thread = nullptr;
+    QHash<quint64, QObject *> m_proxies;
+    quint64 m_nextHandle = 1;
+    UpdateBatcher *m_drainBatcher = nullptr;
+
+    // I/O thread.
+    QObject *m_ioContext = nullptr;
+    BleBackend *m_backend = nullptr;
+    QHash<quint64, QPointer<QObject>> m_workers;
+    QQueue<Event> m_backlog;
+
+    SpscQueue<Event> m_events;
+    std::atomic<bool> m_drainPending { false };
+    std::atomic<bool> m_backlogged { false };
+};
+
+class ThreadedDeviceScanner final : public DeviceScanner
+{
+    Q_OBJECT
+
+public:
+    ~ThreadedDeviceScanner() override;
+
+    int lowEnergyDiscoveryTimeout() const final;
+    void setLowEnergyDiscoveryTimeout(int timeout) final;
+
+    bool isActive() const final;
+    QString errorString() const final;
+
+    void start() final;
+    void stop() final;
+
+private:
+    friend class ThreadedBleBackend;
+
+    ThreadedDeviceScanner(ThreadedBleBackend *backend, quint64 handle, QObject *parent);
+
+    void handleEvent(const ThreadedBleBackend::Event &event);
+
+    QPointer<ThreadedBleBackend> m_backend;
+    quint64 m_handle = 0;
+    int m_timeout = 0;
+    bool m_active = false;
+    QString m_errorString;
+};
+
+class ThreadedGattService final : public GattService
+{
+    Q_OBJECT
+
+public:
+    ~ThreadedGattService() override;
+
+    QBluetoothAddress deviceAddress() const final;
+    QBluetoothUuid serviceUuid() const final;
+    QString serviceName() const final;
+
+    QLowEnergyService::ServiceState state() const final;
+    void discoverDetails() final;
+
+    QVector<QBluetoothUuid> characteristicUuids() const final;
+    GattCharacteristicInfo characteristic(
+            const QBluetoothUuid &characteristicUuid) const final;
+    QByteArray characteristicValue(
+            const QBluetoothUuid &characteristicUuid) const final;
+    QByteArray descriptorValue(const QBluetoothUuid &characteristicUuid,
+                               const QBluetoothUuid &descriptorUuid) const final;
+
+    void readCharacteristic(const QBluetoothUuid &characteristicUuid) final;
+    void writeCharacteristic(const QBluetoothUuid &characteristicUuid,
+                             const QByteArray &value,
+                             QLowEnergyService::WriteMode mode) final;
+    void readDescriptor(const QBluetoothUuid &characteristicUuid,
+                        const QBluetoothUuid &descriptorUuid) final;
+    void writeDescriptor(const QBluetoothUuid &characteristicUuid,
+                         const QBluetoothUuid &descriptorUuid,
+                         const QByteArray &value) final;
+
+private:
+    friend class ThreadedBleBackend;
+
+    ThreadedGattService(ThreadedBleBackend *backend, quint64 handle,
+                        const QBluetoothAddress &deviceAddress,
+                        const QBluetoothUuid &serviceUuid, QObject *parent);
+
+    void handleEvent(const ThreadedBleBackend::Event &event);
+    void setCharacteristics(const QVector<GattCharacteristicInfo> &characteristics);
+    GattDescriptorInfo *findDescriptor(const QBluetoothUuid &characteristicUuid,
+                                       const QBluetoothUuid &descriptorUuid);
+
+    QPointer<ThreadedBleBackend> m_backend;
+    quint64 m_handle = 0;
+    QBluetoothAddress m_deviceAddress;
+    QBluetoothUuid m_serviceUuid;
+    QString m_serviceName;
+    QLowEnergyService::ServiceState m_state = QLowEnergyService::InvalidService;
+    QVector<GattCharacteristicInfo> m_characteristics;
+    QHash<QBluetoothUuid, int> m_characteristicRows;
+};
+
+class ThreadedPeripheralController final : public PeripheralController
+{
+    Q_OBJECT
+
+public:
+    ~ThreadedPeripheralController() override;
+
+    QBluetoothAddress remoteAddress() const final;
+    QLowEnergyController::ControllerState state() const final;
+    QLowEnergyController::Error error() const final;
+    QString errorString() const final;
+
+    void connectToDevice() final;
+    void disconnectFromDevice() final;
+
+    void discoverServices() final;
+    QVector<QBluetoothUuid> services() const final;
+    GattService *createServiceObject(const QBluetoothUuid &serviceUuid,
+                                     QObject *parent) final;
+
+    int mtu() const final;
+    QLowEnergyConnectionParameters connectionParameters() const final;
+    void requestConnectionUpdate(const QLowEnergyConnectionParameters &parameters) final;
+
+private:
+    friend class ThreadedBleBackend;
+
+    ThreadedPeripheralController(ThreadedBleBackend *backend, quint64 handle,
+                                 const QBluetoothAddress &remoteAddress, QObject *parent);
+
+    void handleEvent(const ThreadedBleBackend::Event &event);
+
+    QPointer<ThreadedBleBackend> m_backend;
+    quint64 m_handle = 0;
+    QBluetoothAddress m_remoteAddress;
+    QLowEnergyController::ControllerState m_state = QLowEnergyController::UnconnectedState;
+    QLowEnergyController::Error m_error = QLowEnergyController::NoError;
+    QString m_errorString;
+    QVector<QBluetoothUuid> m_services;
+    int m_mtu = DefaultAttMtu;
+    QLowEnergyConnectionParameters m_connectionParameters;
+};
+
+#endif // THREADEDBLEBACKEND_H
@@ -0,0 +1,181 @@
+#include "tracer.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLoggingCategory>
+#include <QSaveFile>
+
+#include <chrono>
+#include <cstring>
+
+Q_DECLARE_LOGGING_CATEGORY(BLE_TRACE)
+
+// A power of two, the slots are indexed by masking the sequence.
+enum : quint64 {
+    EventCapacity = 1 << 16,
+    EventMask = EventCapacity - 1
+};
+
+enum { ArgumentSize = 48 };
+
+// A slot is stamped with an odd value while it is written and with an
+// even one, derived from the sequence of the event, once it is
+// complete, so that the reader skips the slots being overwritten. As in
+// any seqlock, the fences order the plain payload accesses against the
+// stamps: the odd stamp before the payload writes, the payload reads
+// before the second check of the stamp.
+struct TraceEvent
+{
+    std::atomic<quint64> stamp { 0 };
+    qint64 timestamp = 0;
+    quint64 id = 0;
+    const char *category = nullptr;
+    const char *name = nullptr;
+    char phase = 0;
+    char argument[ArgumentSize] = {};
+};
+
+std::atomic<bool> Tracer::s_enabled { false };
+
+// Allocated on the first start only, and kept since writers may still
+// be recording when the tracer is stopped.
+static std::atomic<TraceEvent *> s_events { nullptr };
+static std::atomic<quint64> s_nextEvent { 0 };
+static std::atomic<quint64> s_nextId { 1 };
+static std::atomic<qint64> s_origin { 0 };
+
+static qint64 monotonicNanoseconds()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Tracer::start()
+{
+    if (isEnabled())
+        return;
+    auto events = s_events.load(std::memory_order_acquire);
+    if (!events) {
+        events = new TraceEvent[EventCapacity];
+        s_events.store(events, std::memory_order_release);
+    }
+    s_nextEvent.store(0, std::memory_order_relaxed);
+    for (quint64 index = 0; index < EventCapacity; ++index)
+        events[index].stamp.store(0, std::memory_order_relaxed);
+    s_origin.store(monotonicNanoseconds(), std::memory_order_relaxed);
+    s_enabled.store(true, std::memory_order_release);
+    qCDebug(BLE_TRACE) << "Start tracing";
+}
+
+void Tracer::stop()
+{
+    s_enabled.store(false, std::memory_order_release);
+}
+
+quint64 Tracer::nextId()
+{
+    return s_nextId.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Tracer::record(char phase, const char *category, const char *name,
+                    quint64 id, const QString &argument)
+{
+    const auto events = s_events.load(std::memory_order_acquire);
+    const auto sequence = s_nextEvent.fetch_add(1, std::memory_order_relaxed);
+    auto &event = events[sequence & EventMask];
+
+    event.stamp.store(2 * sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    event.timestamp = monotonicNanoseconds() - s_origin.load(std::memory_order_relaxed);
+    event.id = id;
+    event.category = category;
+    event.name = name;
+    event.phase = phase;
+    const auto utf8 = argument.toUtf8();
+    const auto size = qMin(utf8.size(), int(ArgumentSize) - 1);
+    std::memcpy(event.argument, utf8.constData(), size_t(size));
+    event.argument[size] = 0;
+    event.stamp.store(2 * sequence + 2, std::memory_order_release);
+}
+
+bool Tracer::save(const QString &fileName)
+{
+    const auto ring = s_events.load(std::memory_order_acquire);
+    if (!ring)
+        return false;
+    const auto last = s_nextEvent.load(std::memory_order_acquire);
+    const auto first = (last > EventCapacity) ? last - EventCapacity : 0;
+
+    QJsonArray events;
+    events.append(QJsonObject {
+        { QStringLiteral("ph"), QStringLiteral("M") },
+        { QStringLiteral("name"), QStringLiteral("process_name") },
+        { QStringLiteral("pid"), 1 },
+        { QStringLiteral("args"), QJsonObject {
+              { QStringLiteral("name"), QCoreApplication::applicationName() } } }
+    });
+
+    auto skipped = 0;
+    for (auto sequence = first; sequence < last; ++sequence) {
+        const auto &slot = ring[sequence & EventMask];
+        const auto stamp = slot.stamp.load(std::memory_order_acquire);
+        if (stamp != 2 * sequence + 2) {
+            ++skipped;
+            continue;
+        }
+        const auto timestamp = slot.timestamp;
+        const auto id = slot.id;
+        const auto category = slot.category;
+        const auto name = slot.name;
+        const auto phase = slot.phase;
+        char argument[ArgumentSize];
+        std::memcpy(argument, slot.argument, sizeof(argument));
+        // Overwritten while copied.
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.stamp.load(std::memory_order_relaxed) != stamp) {
+            ++skipped;
+            continue;
+        }
+
+        QJsonObject event {
+            { QStringLiteral("ph"), QString(QLatin1Char(phase)) },
+            { QStringLiteral("cat"), QLatin1String(category) },
+            { QStringLiteral("name"), QLatin1String(name) },
+            { QStringLiteral("pid"), 1 },
+            { QStringLiteral("tid"), 1 },
+            // Microseconds.
+            { QStringLiteral("ts"), timestamp / 1000.0 }
+        };
+        if (phase == 'i')
+            event.insert(QStringLiteral("s"), QStringLiteral("p"));
+        else
+            event.insert(QStringLiteral("id"), QString::number(id, 16).prepend(QLatin1String("0x")));
+        if (argument[0]) {
+            event.insert(QStringLiteral("args"),
+                         QJsonObject { { QStringLiteral("detail"), QString::fromUtf8(argument) } });
+        }
+        events.append(event);
+    }
+
+    QDir().mkpath(QFileInfo(fileName).absolutePath());
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qCWarning(BLE_TRACE) << "Unable to save trace:" << fileName << file.errorString();
+        return false;
+    }
+    file.write(QJsonDocument(QJsonObject {
+        { QStringLiteral("traceEvents"), events },
+        { QStringLiteral("displayTimeUnit"), QStringLiteral("ms") }
+    }).toJson(QJsonDocument::Compact));
+    if (!file.commit()) {
+        qCWarning(BLE_TRACE) << "Unable to save trace:" << fileName << file.errorString();
+        return false;
+    }
+    qCDebug(BLE_TRACE) << "Saved trace events:" << events.count() - 1
+                       << "skipped:" << skipped;
+    return true;
+}
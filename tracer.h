@@ -0,0 +1,63 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <QString>
+
+#include <atomic>
+
+// Records the lifecycle of the Bluetooth operations as Chrome trace
+// events, which Perfetto and chrome://tracing load. Spans are async
+// events keyed by an identifier, so that concurrent spans, e.g. the
+// operations in flight, are laid out on separate tracks.
+//
+// The events go to a fixed size ring buffer, overwriting the oldest
+// ones; writers claim their slot with an atomic increment and never
+// block each other. When the tracer is stopped, every call costs a
+// relaxed atomic load; arguments which are expensive to format should
+// be built under isEnabled() only.
+class Tracer
+{
+public:
+    static bool isEnabled()
+    {
+        return s_enabled.load(std::memory_order_relaxed);
+    }
+
+    static void start();
+    static void stop();
+    // Writes the events recorded so far as a JSON trace.
+    static bool save(const QString &fileName);
+
+    // A new identifier for a span, unique for the process.
+    static quint64 nextId();
+
+    // The names and categories have to be string literals, they are
+    // kept by address.
+    static void begin(const char *category, const char *name, quint64 id,
+                      const QString &argument = QString())
+    {
+        if (isEnabled())
+            record('b', category, name, id, argument);
+    }
+
+    static void end(const char *category, const char *name, quint64 id)
+    {
+        if (isEnabled())
+            record('e', category, name, id, QString());
+    }
+
+    static void instant(const char *category, const char *name,
+                        const QString &argument = QString())
+    {
+        if (isEnabled())
+            record('i', category, name, 0, argument);
+    }
+
+private:
+    static void record(char phase, const char *category, const char *name,
+                       quint64 id, const QString &argument);
+
+    static std::atomic<bool> s_enabled;
+};
+
+#endif // TRACER_H
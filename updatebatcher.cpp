@@ -0,0 +1,80 @@
+#include "updatebatcher.h"
+
+#include <QTimer>
+
+// Roughly one frame of a 60 Hz display.
+enum { DefaultBatchInterval = 16 };
+
+UpdateBatcher::UpdateBatcher(QObject *parent)
+    : QObject(parent)
+    , m_timer(new QTimer(this))
+{
+    m_timer->setSingleShot(true);
+    m_timer->setInterval(DefaultBatchInterval);
+    connect(m_timer, &QTimer::timeout, this, &UpdateBatcher::flush);
+}
+
+void UpdateBatcher::setFlushHandler(const FlushHandler &handler)
+{
+    m_flushHandler = handler;
+}
+
+int UpdateBatcher::interval() const
+{
+    return m_timer->interval();
+}
+
+void UpdateBatcher::setInterval(int interval)
+{
+    if (m_timer->interval() == interval)
+        return;
+    m_timer->setInterval(interval);
+    emit intervalChanged(interval);
+}
+
+int UpdateBatcher::coalescedCount() const
+{
+    return m_coalescedCount;
+}
+
+bool UpdateBatcher::isPending() const
+{
+    return m_timer->isActive();
+}
+
+void UpdateBatcher::schedule()
+{
+    // A non-positive interval disables batching entirely.
+    if (m_timer->interval() <= 0) {
+        if (m_flushHandler)
+            m_flushHandler();
+        return;
+    }
+
+    if (m_timer->isActive()) {
+        // The change notification is deferred to the flush, otherwise
+        // a bound counter would defeat the purpose of the batching.
+        ++m_coalescedCount;
+        m_coalescedCountDirty = true;
+        return;
+    }
+
+    m_timer->start();
+}
+
+void UpdateBatcher::flush()
+{
+    m_timer->stop();
+    if (m_flushHandler)
+        m_flushHandler();
+
+    if (m_coalescedCountDirty) {
+        m_coalescedCountDirty = false;
+        emit coalescedCountChanged(m_coalescedCount);
+    }
+}
+
+void UpdateBatcher::cancel()
+{
+    m_timer->stop();
+}
@@ -0,0 +1,49 @@
+#ifndef UPDATEBATCHER_H
+#define UPDATEBATCHER_H
+
+#include <QObject>
+
+#include <functional>
+
+class QTimer;
+
+// Coalesces bursts of model updates into a single flush per interval
+// (one display frame by default), so that views re-layout once per
+// burst instead of once per signal.
+class UpdateBatcher : public QObject
+{
+    Q_OBJECT
+
+    Q_PROPERTY(int interval READ interval WRITE setInterval NOTIFY intervalChanged)
+    Q_PROPERTY(int coalescedCount READ coalescedCount NOTIFY coalescedCountChanged)
+
+public:
+    using FlushHandler = std::function<void()>;
+
+    explicit UpdateBatcher(QObject *parent = nullptr);
+
+    void setFlushHandler(const FlushHandler &handler);
+
+    int interval() const;
+    void setInterval(int interval);
+
+    int coalescedCount() const;
+    bool isPending() const;
+
+public slots:
+    void schedule();
+    void flush();
+    void cancel();
+
+signals:
+    void intervalChanged(int interval);
+    void coalescedCountChanged(int coalescedCount);
+
+private:
+    QTimer *m_timer = nullptr;
+    FlushHandler m_flushHandler;
+    int m_coalescedCount = 0;
+    bool m_coalescedCountDirty = false;
+};
+
+#endif // UPDATEBATCHER_H